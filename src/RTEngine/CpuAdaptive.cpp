@@ -0,0 +1,151 @@
+#include "stdafx.h"
+#include "CpuAdaptive.h"
+
+using namespace Cpu;
+
+AdaptiveRenderer::AdaptiveRenderer(ThreadPool& threadPool) :
+    m_threadPool(threadPool),
+    m_renderer(threadPool),
+    m_width(0),
+    m_height(0),
+    m_tileSize(0),
+    m_tilesX(0),
+    m_tilesY(0)
+{
+}
+
+void AdaptiveRenderer::Resize(UINT width, UINT height, UINT tileSize)
+{
+    m_width = width;
+    m_height = height;
+    m_tileSize = (std::max)(tileSize, 1u);
+    m_tilesX = (width + m_tileSize - 1) / m_tileSize;
+    m_tilesY = (height + m_tileSize - 1) / m_tileSize;
+
+    UINT pixelCount = width * height;
+    m_radianceSum.assign(pixelCount, Vec3(0.0f));
+    m_image.assign(pixelCount, Vec3(0.0f));
+    m_luminanceMean.assign(pixelCount, 0.0f);
+    m_luminanceM2.assign(pixelCount, 0.0f);
+    m_sampleCounts.assign(pixelCount, 0);
+    m_activeTiles.assign(m_tilesX * m_tilesY, 1);
+    m_activePixels.clear();
+    m_activePixels.reserve(pixelCount);
+    m_stats = AdaptiveStats();
+}
+
+void AdaptiveRenderer::Render(const Scene& scene, const BVH& bvh, const Camera& camera, const PathSettings& settings,
+    const AdaptiveSettings& adaptiveSettings, const LightTree* lightTree)
+{
+    Resize(camera.width, camera.height, adaptiveSettings.tileSize);
+    CollectActivePixels();
+
+    // Active pixels have all taken one sample per pass so far, the pass index doubles as their sample index.
+    PathSettings passSettings = settings;
+    while (!m_activePixels.empty())
+    {
+        passSettings.sampleIndex = settings.sampleIndex + m_stats.passes;
+        m_renderer.Render(scene, bvh, camera, passSettings, lightTree, &m_activePixels);
+        Accumulate();
+
+        const RayStats& rays = m_renderer.Stats().rays;
+        m_stats.rays += rays.rays[RayType::Radiance] + rays.rays[RayType::Shadow];
+        m_stats.samples += m_activePixels.size();
+        m_stats.activePixels.push_back(static_cast<UINT>(m_activePixels.size()));
+        m_stats.passes++;
+
+        UpdateTiles(adaptiveSettings);
+        CollectActivePixels();
+    }
+
+    for (UINT i = 0; i < m_width * m_height; i++)
+    {
+        m_image[i] = m_sampleCounts[i] ? m_radianceSum[i] * (1.0f / m_sampleCounts[i]) : Vec3(0.0f);
+    }
+}
+
+void AdaptiveRenderer::Accumulate()
+{
+    const std::vector<Vec3>& radiance = m_renderer.Radiance();
+    m_threadPool.ParallelFor(static_cast<UINT>(m_activePixels.size()), WavefrontRenderer::BatchSize, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT i = begin; i < end; i++)
+        {
+            UINT pixel = m_activePixels[i];
+            m_radianceSum[pixel] += radiance[pixel];
+
+            float luminance = Luminance(radiance[pixel]);
+            UINT count = ++m_sampleCounts[pixel];
+            float delta = luminance - m_luminanceMean[pixel];
+            m_luminanceMean[pixel] += delta / count;
+            m_luminanceM2[pixel] += delta * (luminance - m_luminanceMean[pixel]);
+        }
+    });
+}
+
+void AdaptiveRenderer::UpdateTiles(const AdaptiveSettings& adaptiveSettings)
+{
+    m_threadPool.ParallelFor(m_tilesX * m_tilesY, 16, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT tile = begin; tile < end; tile++)
+        {
+            if (!m_activeTiles[tile])
+            {
+                continue;
+            }
+
+            UINT x0 = (tile % m_tilesX) * m_tileSize;
+            UINT y0 = (tile / m_tilesX) * m_tileSize;
+            UINT x1 = (std::min)(x0 + m_tileSize, m_width);
+            UINT y1 = (std::min)(y0 + m_tileSize, m_height);
+
+            // All pixels of an active tile have the same sample count.
+            UINT count = m_sampleCounts[y0 * m_width + x0];
+            if (count < (std::max)(adaptiveSettings.minSamples, 2u))
+            {
+                continue;
+            }
+            if (count >= adaptiveSettings.maxSamples)
+            {
+                m_activeTiles[tile] = 0;
+                continue;
+            }
+
+            // Variance of the pixel means is the sample variance over the sample count.
+            double meanVariance = 0;
+            double mean = 0;
+            for (UINT y = y0; y < y1; y++)
+            {
+                for (UINT x = x0; x < x1; x++)
+                {
+                    UINT pixel = y * m_width + x;
+                    meanVariance += m_luminanceM2[pixel] / ((count - 1.0) * count);
+                    mean += m_luminanceMean[pixel];
+                }
+            }
+            double pixelCount = static_cast<double>((x1 - x0) * (y1 - y0));
+            double error = std::sqrt(meanVariance / pixelCount) / (mean / pixelCount + adaptiveSettings.errorFloor);
+            if (error < adaptiveSettings.errorThreshold)
+            {
+                m_activeTiles[tile] = 0;
+            }
+        }
+    });
+}
+
+void AdaptiveRenderer::CollectActivePixels()
+{
+    // Scanline order keeps the camera rays of a batch coherent.
+    m_activePixels.clear();
+    for (UINT y = 0; y < m_height; y++)
+    {
+        const UINT8* tileRow = &m_activeTiles[(y / m_tileSize) * m_tilesX];
+        for (UINT x = 0; x < m_width; x++)
+        {
+            if (tileRow[x / m_tileSize])
+            {
+                m_activePixels.push_back(y * m_width + x);
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef CPU_ADAPTIVE_H
+#define CPU_ADAPTIVE_H
+
+#include "CpuWavefront.h"
+
+namespace Cpu
+{
+    // Convergence criteria of the adaptive sampler.
+    // A tile's error is the RMS standard error of its pixel means, relative to the tile's mean luminance
+    // plus errorFloor so dark tiles aren't held to a relative error that needs unbounded samples.
+    struct AdaptiveSettings
+    {
+        float errorThreshold = 0.02f;
+        float errorFloor = 0.1f;
+        UINT minSamples = 4;        // Samples before the first error estimate, variance estimates from fewer are unreliable.
+        UINT maxSamples = 64;
+        UINT tileSize = 8;
+    };
+
+    struct AdaptiveStats
+    {
+        UINT passes = 0;
+        UINT64 samples = 0;
+        UINT64 rays = 0;            // Radiance and shadow rays.
+        std::vector<UINT> activePixels;     // Pixels traced per pass.
+    };
+
+    // Progressive renderer that spends samples where the image is noisy.
+    // Every pass traces one path per active pixel and folds it into a running mean and variance of the pixel's
+    // luminance. Pixels are retired per tile, pooling the variance of neighbouring pixels, once the tile's
+    // error estimate falls below the threshold. Background and flat regions stop after the minimum sample count.
+    class AdaptiveRenderer
+    {
+    public:
+        explicit AdaptiveRenderer(ThreadPool& threadPool);
+
+        // Renders passes until every tile converged or reached the maximum sample count.
+        void Render(const Scene& scene, const BVH& bvh, const Camera& camera, const PathSettings& settings,
+            const AdaptiveSettings& adaptiveSettings = AdaptiveSettings(), const LightTree* lightTree = nullptr);
+
+        // Mean radiance per pixel.
+        const std::vector<Vec3>& Image() const { return m_image; }
+        const std::vector<UINT>& SampleCounts() const { return m_sampleCounts; }
+        const AdaptiveStats& Stats() const { return m_stats; }
+
+    private:
+        void Resize(UINT width, UINT height, UINT tileSize);
+        void Accumulate();
+        void UpdateTiles(const AdaptiveSettings& adaptiveSettings);
+        void CollectActivePixels();
+
+        ThreadPool& m_threadPool;
+        WavefrontRenderer m_renderer;
+        UINT m_width;
+        UINT m_height;
+        UINT m_tileSize;
+        UINT m_tilesX;
+        UINT m_tilesY;
+
+        // Per pixel running sums, Welford mean and sum of squared deviations of the luminance.
+        std::vector<Vec3> m_radianceSum;
+        std::vector<Vec3> m_image;
+        std::vector<float> m_luminanceMean;
+        std::vector<float> m_luminanceM2;
+        std::vector<UINT> m_sampleCounts;
+
+        std::vector<UINT8> m_activeTiles;
+        std::vector<UINT> m_activePixels;
+        AdaptiveStats m_stats;
+    };
+}
+
+#endif // !CPU_ADAPTIVE_H
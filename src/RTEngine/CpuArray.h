@@ -0,0 +1,113 @@
+#ifndef CPU_ARRAY_H
+#define CPU_ARRAY_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace Cpu
+{
+    // Array that owns its elements like std::vector, or views elements it doesn't own, such as a section of a mapped
+    // scene cache, see View(). Reads go to the elements either way, through the same pointer.
+    // A view is read only: the first write through a non-const accessor copies the elements into the array, so
+    // writes never reach the viewed memory. Copies of a view view the same elements.
+    template <typename T>
+    class MappableArray
+    {
+    public:
+        MappableArray() : m_data(nullptr), m_size(0), m_view(false) {}
+        MappableArray(const MappableArray& other) : m_elements(other.m_elements), m_view(other.m_view) { Sync(other); }
+        MappableArray(MappableArray&& other) : m_elements(std::move(other.m_elements)), m_view(other.m_view) { Sync(other); other.clear(); }
+
+        MappableArray& operator=(const MappableArray& other)
+        {
+            if (this != &other)
+            {
+                m_elements = other.m_elements;
+                m_view = other.m_view;
+                Sync(other);
+            }
+            return *this;
+        }
+
+        MappableArray& operator=(MappableArray&& other)
+        {
+            if (this != &other)
+            {
+                m_elements = std::move(other.m_elements);
+                m_view = other.m_view;
+                Sync(other);
+                other.clear();
+            }
+            return *this;
+        }
+
+        // Views count elements at data, which must stay valid and unchanged while the array views them.
+        void View(const T* data, size_t count)
+        {
+            std::vector<T>().swap(m_elements);
+            m_data = data;
+            m_size = count;
+            m_view = true;
+        }
+        bool IsView() const { return m_view; }
+
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        const T* data() const { return m_data; }
+        const T& operator[](size_t i) const { return m_data[i]; }
+        const T& back() const { return m_data[m_size - 1]; }
+        const T* begin() const { return m_data; }
+        const T* end() const { return m_data + m_size; }
+
+        T& operator[](size_t i) { Own(); return m_elements[i]; }
+
+        void push_back(const T& value) { Own(); m_elements.push_back(value); Sync(); }
+        template <typename... Args>
+        void emplace_back(Args&&... args) { Own(); m_elements.emplace_back(std::forward<Args>(args)...); Sync(); }
+        void resize(size_t count) { Own(); m_elements.resize(count); Sync(); }
+        void resize(size_t count, const T& value) { Own(); m_elements.resize(count, value); Sync(); }
+        void reserve(size_t count) { Own(); m_elements.reserve(count); Sync(); }
+        void assign(size_t count, const T& value) { m_view = false; m_elements.assign(count, value); Sync(); }
+        void assign(const T* first, const T* last) { m_view = false; m_elements.assign(first, last); Sync(); }
+        void clear() { m_view = false; m_elements.clear(); Sync(); }
+
+    private:
+        // Copies the viewed elements into the array before a write.
+        void Own()
+        {
+            if (m_view)
+            {
+                m_elements.assign(m_data, m_data + m_size);
+                m_view = false;
+                Sync();
+            }
+        }
+
+        void Sync()
+        {
+            m_data = m_elements.data();
+            m_size = m_elements.size();
+        }
+
+        void Sync(const MappableArray& other)
+        {
+            if (m_view)
+            {
+                m_data = other.m_data;
+                m_size = other.m_size;
+            }
+            else
+            {
+                Sync();
+            }
+        }
+
+        std::vector<T> m_elements;
+        const T* m_data;        // The owned or the viewed elements.
+        size_t m_size;
+        bool m_view;
+    };
+}
+
+#endif // !CPU_ARRAY_H
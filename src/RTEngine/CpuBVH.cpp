@@ -0,0 +1,425 @@
+#include "stdafx.h"
+#include "CpuBVH.h"
+
+using namespace Cpu;
+
+namespace
+{
+    static const UINT SAHBinCount = 12;
+
+    // Slab test against <tMin, tMax>, returns the entry distance in tEntry.
+    inline bool IntersectNodeBounds(const BVHNode& node, const Vec3& origin, const Vec3& invDirection, float tMin, float tMax, float& tEntry)
+    {
+        float tx0 = (node.boundsMin.x - origin.x) * invDirection.x;
+        float tx1 = (node.boundsMax.x - origin.x) * invDirection.x;
+        float ty0 = (node.boundsMin.y - origin.y) * invDirection.y;
+        float ty1 = (node.boundsMax.y - origin.y) * invDirection.y;
+        float tz0 = (node.boundsMin.z - origin.z) * invDirection.z;
+        float tz1 = (node.boundsMax.z - origin.z) * invDirection.z;
+
+        float tNear = (std::max)((std::max)((std::min)(tx0, tx1), (std::min)(ty0, ty1)), (std::max)((std::min)(tz0, tz1), tMin));
+        float tFar = (std::min)((std::min)((std::max)(tx0, tx1), (std::max)(ty0, ty1)), (std::min)((std::max)(tz0, tz1), tMax));
+
+        tEntry = tNear;
+        return tNear <= tFar;
+    }
+
+    inline Vec3 SafeInverse(const Vec3& d)
+    {
+        auto inv = [](float v) { return std::fabs(v) > 1e-20f ? 1.0f / v : (v >= 0 ? FLT_MAX : -FLT_MAX); };
+        return Vec3(inv(d.x), inv(d.y), inv(d.z));
+    }
+
+    inline Aabb NodeBounds(const BVHNode& node)
+    {
+        Aabb bounds;
+        bounds.min = node.boundsMin;
+        bounds.max = node.boundsMax;
+        return bounds;
+    }
+}
+
+void BVH::Build(const Scene& scene)
+{
+    BuildWithBounds(scene, [&](UINT ref) { return scene.GetPrimitiveBounds(ref); });
+}
+
+void BVH::Build(const Scene& scene, float time)
+{
+    BuildWithBounds(scene, [&](UINT ref) { return scene.GetPrimitiveBounds(ref, time); });
+}
+
+void BVH::Build(const Scene& scene, const Aabb* primitiveBounds)
+{
+    UINT sphereCount = scene.SphereCount();
+    BuildWithBounds(scene, [&](UINT ref)
+    {
+        UINT index = GetPrimitiveIndex(ref);
+        return primitiveBounds[GetPrimitiveKind(ref) == PrimitiveKind::Sphere ? index : sphereCount + index];
+    });
+}
+
+void BVH::View(const BVHNode* nodes, size_t nodeCount, const UINT* primitiveRefs, size_t primitiveRefCount)
+{
+    m_nodes.View(nodes, nodeCount);
+    m_primitiveRefs.View(primitiveRefs, primitiveRefCount);
+}
+
+void BVH::Refit(const Scene& scene)
+{
+    ThrowIfFalse(m_primitiveRefs.size() == scene.PrimitiveCount(), L"The scene doesn't match the BVH.");
+
+    // Children are always stored after their parent, so a reverse sweep visits them first.
+    for (size_t i = m_nodes.size(); i-- > 0;)
+    {
+        BVHNode& node = m_nodes[i];
+        Aabb bounds;
+        if (node.IsLeaf())
+        {
+            for (UINT j = node.leftFirst; j < node.leftFirst + node.primitiveCount; j++)
+            {
+                bounds.Grow(scene.GetPrimitiveBounds(m_primitiveRefs[j]));
+            }
+        }
+        else
+        {
+            Aabb left = NodeBounds(m_nodes[node.leftFirst]);
+            Aabb right = NodeBounds(m_nodes[node.leftFirst + 1]);
+            bounds = left;
+            bounds.Grow(right);
+            node.flags = right.SurfaceArea() > left.SurfaceArea() ? BVHNodeFlags::OccluderSecond : BVHNodeFlags::None;
+        }
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+    }
+}
+
+template <typename GetBounds>
+void BVH::BuildWithBounds(const Scene& scene, GetBounds getBounds)
+{
+    m_nodes.clear();
+    std::vector<UINT> refs;
+    scene.GetPrimitiveRefs(refs);
+    m_primitiveRefs.assign(refs.data(), refs.data() + refs.size());
+
+    UINT primitiveCount = static_cast<UINT>(m_primitiveRefs.size());
+    if (primitiveCount == 0)
+    {
+        return;
+    }
+
+    std::vector<BuildPrimitive> buildPrimitives(primitiveCount);
+    for (UINT i = 0; i < primitiveCount; i++)
+    {
+        buildPrimitives[i].bounds = getBounds(m_primitiveRefs[i]);
+        buildPrimitives[i].centroid = buildPrimitives[i].bounds.Centroid();
+    }
+
+    // A binary tree with N leaves has at most 2N - 1 nodes.
+    m_nodes.reserve(2 * primitiveCount - 1);
+    m_nodes.push_back(BVHNode());
+    Subdivide(0, 0, primitiveCount, 0, buildPrimitives);
+}
+
+void BVH::Subdivide(UINT nodeIndex, UINT first, UINT count, UINT depth, std::vector<BuildPrimitive>& buildPrimitives)
+{
+    Aabb bounds, centroidBounds;
+    for (UINT i = first; i < first + count; i++)
+    {
+        bounds.Grow(buildPrimitives[i].bounds);
+        centroidBounds.Grow(buildPrimitives[i].centroid);
+    }
+    {
+        BVHNode& node = m_nodes[nodeIndex];
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+        node.leftFirst = first;
+        node.primitiveCount = static_cast<UINT16>(count);
+        node.splitAxis = 0;
+        node.flags = BVHNodeFlags::None;
+    }
+
+    // Traversal stacks are sized by MaxDepth, stop splitting before they could overflow.
+    if (count <= MaxLeafSize || (depth + 2 >= MaxDepth && count <= 0xFFFF))
+    {
+        return;
+    }
+
+    // Binned SAH over all three axes.
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    UINT bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float axisMin = centroidBounds.min[axis];
+        float axisMax = centroidBounds.max[axis];
+        if (axisMax <= axisMin) continue;
+
+        Aabb binBounds[SAHBinCount];
+        UINT binCounts[SAHBinCount] = {};
+        float scale = SAHBinCount / (axisMax - axisMin);
+        for (UINT i = first; i < first + count; i++)
+        {
+            UINT bin = (std::min)(SAHBinCount - 1, static_cast<UINT>((buildPrimitives[i].centroid[axis] - axisMin) * scale));
+            binCounts[bin]++;
+            binBounds[bin].Grow(buildPrimitives[i].bounds);
+        }
+
+        // Sweep from both sides to evaluate every split plane.
+        float leftArea[SAHBinCount - 1], rightArea[SAHBinCount - 1];
+        UINT leftCount[SAHBinCount - 1], rightCount[SAHBinCount - 1];
+        Aabb leftBox, rightBox;
+        UINT leftSum = 0, rightSum = 0;
+        for (UINT i = 0; i < SAHBinCount - 1; i++)
+        {
+            leftSum += binCounts[i];
+            leftCount[i] = leftSum;
+            leftBox.Grow(binBounds[i]);
+            leftArea[i] = leftBox.SurfaceArea();
+
+            rightSum += binCounts[SAHBinCount - 1 - i];
+            rightCount[SAHBinCount - 2 - i] = rightSum;
+            rightBox.Grow(binBounds[SAHBinCount - 1 - i]);
+            rightArea[SAHBinCount - 2 - i] = rightBox.SurfaceArea();
+        }
+        for (UINT i = 0; i < SAHBinCount - 1; i++)
+        {
+            if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i + 1;
+            }
+        }
+    }
+
+    // Leaf primitive counts are 16 bit, so oversized leaves are always split.
+    bool mustSplit = count > 0xFFFF;
+    float leafCost = count * bounds.SurfaceArea();
+    if (!mustSplit && (bestAxis < 0 || bestCost >= leafCost))
+    {
+        return;
+    }
+
+    // Partition primitives and their references in place.
+    UINT mid = first + count / 2;
+    if (bestAxis >= 0)
+    {
+        float axisMin = centroidBounds.min[bestAxis];
+        float scale = SAHBinCount / (centroidBounds.max[bestAxis] - axisMin);
+        UINT i = first;
+        UINT j = first + count;
+        while (i < j)
+        {
+            UINT bin = (std::min)(SAHBinCount - 1, static_cast<UINT>((buildPrimitives[i].centroid[bestAxis] - axisMin) * scale));
+            if (bin < bestSplit)
+            {
+                i++;
+            }
+            else
+            {
+                j--;
+                std::swap(buildPrimitives[i], buildPrimitives[j]);
+                std::swap(m_primitiveRefs[i], m_primitiveRefs[j]);
+            }
+        }
+        mid = i;
+    }
+
+    UINT leftIndex = static_cast<UINT>(m_nodes.size());
+    m_nodes.push_back(BVHNode());
+    m_nodes.push_back(BVHNode());
+    Subdivide(leftIndex, first, mid - first, depth + 1, buildPrimitives);
+    Subdivide(leftIndex + 1, mid, first + count - mid, depth + 1, buildPrimitives);
+
+    // A random shadow ray hits a convex volume with probability proportional to its surface area,
+    // so the larger child is visited first when only looking for any occluder.
+    BVHNode& node = m_nodes[nodeIndex];
+    node.leftFirst = leftIndex;
+    node.primitiveCount = 0;
+    node.splitAxis = static_cast<UINT8>(bestAxis < 0 ? 0 : bestAxis);
+    node.flags = NodeBounds(m_nodes[leftIndex + 1]).SurfaceArea() > NodeBounds(m_nodes[leftIndex]).SurfaceArea()
+        ? BVHNodeFlags::OccluderSecond : BVHNodeFlags::None;
+}
+
+template <bool AcceptFirstHit>
+bool BVH::Traverse(const Scene& scene, const Ray& ray, Hit& hit, RayStats* stats) const
+{
+    if (m_nodes.empty())
+    {
+        return false;
+    }
+
+    const RayType::Enum rayType = AcceptFirstHit ? RayType::Shadow : RayType::Radiance;
+    Vec3 invDirection = SafeInverse(ray.direction);
+    UINT nodeVisits = 0;
+    UINT primitiveTests = 0;
+    bool hitFound = false;
+
+    float tEntry;
+    UINT stack[MaxDepth];
+    UINT stackSize = 0;
+    const BVHNode* node = &m_nodes[0];
+    if (!IntersectNodeBounds(*node, ray.origin, invDirection, ray.tMin, hit.t, tEntry))
+    {
+        node = nullptr;
+    }
+
+    while (node)
+    {
+        nodeVisits++;
+        if (node->IsLeaf())
+        {
+            for (UINT i = 0; i < node->primitiveCount; i++)
+            {
+                primitiveTests++;
+                if (scene.IntersectPrimitive(m_primitiveRefs[node->leftFirst + i], ray, hit))
+                {
+                    hitFound = true;
+                    if (AcceptFirstHit) break;
+                }
+            }
+            if (AcceptFirstHit && hitFound) break;
+            node = stackSize ? &m_nodes[stack[--stackSize]] : nullptr;
+            continue;
+        }
+
+        // Visit the nearer child first and defer the other one.
+        const BVHNode* child0 = &m_nodes[node->leftFirst];
+        const BVHNode* child1 = child0 + 1;
+        float t0, t1;
+        bool hit0 = IntersectNodeBounds(*child0, ray.origin, invDirection, ray.tMin, hit.t, t0);
+        bool hit1 = IntersectNodeBounds(*child1, ray.origin, invDirection, ray.tMin, hit.t, t1);
+        if (hit0 && hit1)
+        {
+            if (t1 < t0)
+            {
+                std::swap(child0, child1);
+            }
+            stack[stackSize++] = static_cast<UINT>(child1 - m_nodes.data());
+            node = child0;
+        }
+        else if (hit0 || hit1)
+        {
+            node = hit0 ? child0 : child1;
+        }
+        else
+        {
+            node = stackSize ? &m_nodes[stack[--stackSize]] : nullptr;
+        }
+    }
+
+    if (stats)
+    {
+        stats->rays[rayType]++;
+        stats->nodeVisits[rayType] += nodeVisits;
+        stats->primitiveTests[rayType] += primitiveTests;
+    }
+    return hitFound;
+}
+
+bool BVH::Intersect(const Scene& scene, const Ray& ray, Hit& hit, RayStats* stats) const
+{
+    hit.t = ray.tMax;
+    return Traverse<false>(scene, ray, hit, stats);
+}
+
+bool BVH::IntersectAny(const Scene& scene, const Ray& ray, RayStats* stats) const
+{
+    Hit hit;
+    hit.t = ray.tMax;
+    return Traverse<true>(scene, ray, hit, stats);
+}
+
+bool BVH::Occluded(const Scene& scene, const Ray& ray, OcclusionCache* cache, RayStats* stats) const
+{
+    UINT nodeVisits = 0;
+    UINT primitiveTests = 0;
+    bool occluded = false;
+
+    if (stats)
+    {
+        stats->rays[RayType::Shadow]++;
+    }
+
+    // Coherent shadow rays are often blocked by the same primitive.
+    if (cache && cache->lastOccluder != InvalidPrimitive)
+    {
+        primitiveTests++;
+        if (scene.OccludedByPrimitive(cache->lastOccluder, ray))
+        {
+            if (stats)
+            {
+                stats->primitiveTests[RayType::Shadow] += primitiveTests;
+                stats->occlusionCacheHits++;
+            }
+            return true;
+        }
+    }
+
+    Vec3 invDirection = SafeInverse(ray.direction);
+    float tEntry;
+    UINT stack[MaxDepth];
+    UINT stackSize = 0;
+    const BVHNode* node = m_nodes.empty() ? nullptr : &m_nodes[0];
+    if (node && !IntersectNodeBounds(*node, ray.origin, invDirection, ray.tMin, ray.tMax, tEntry))
+    {
+        node = nullptr;
+    }
+
+    while (node && !occluded)
+    {
+        nodeVisits++;
+        if (node->IsLeaf())
+        {
+            for (UINT i = 0; i < node->primitiveCount; i++)
+            {
+                UINT ref = m_primitiveRefs[node->leftFirst + i];
+                primitiveTests++;
+                if (scene.OccludedByPrimitive(ref, ray))
+                {
+                    if (cache)
+                    {
+                        cache->lastOccluder = ref;
+                    }
+                    occluded = true;
+                    break;
+                }
+            }
+            node = stackSize ? &m_nodes[stack[--stackSize]] : nullptr;
+            continue;
+        }
+
+        // No distance ordering, descend into the likelier occluder first.
+        const BVHNode* child0 = &m_nodes[node->leftFirst];
+        const BVHNode* child1 = child0 + 1;
+        if (node->flags & BVHNodeFlags::OccluderSecond)
+        {
+            std::swap(child0, child1);
+        }
+        bool hit0 = IntersectNodeBounds(*child0, ray.origin, invDirection, ray.tMin, ray.tMax, tEntry);
+        bool hit1 = IntersectNodeBounds(*child1, ray.origin, invDirection, ray.tMin, ray.tMax, tEntry);
+        if (hit0 && hit1)
+        {
+            stack[stackSize++] = static_cast<UINT>(child1 - m_nodes.data());
+            node = child0;
+        }
+        else if (hit0 || hit1)
+        {
+            node = hit0 ? child0 : child1;
+        }
+        else
+        {
+            node = stackSize ? &m_nodes[stack[--stackSize]] : nullptr;
+        }
+    }
+
+    if (stats)
+    {
+        stats->nodeVisits[RayType::Shadow] += nodeVisits;
+        stats->primitiveTests[RayType::Shadow] += primitiveTests;
+    }
+    return occluded;
+}
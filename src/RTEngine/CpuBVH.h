@@ -0,0 +1,91 @@
+#ifndef CPU_BVH_H
+#define CPU_BVH_H
+
+#include "CpuScene.h"
+
+namespace Cpu
+{
+    namespace BVHNodeFlags {
+        enum Enum {
+            None = 0,
+            OccluderSecond = 1 << 0,    // Second child is the more likely occluder, test it first for shadow rays.
+        };
+    }
+
+    // 32 byte BVH node, two per cache line.
+    // Interior nodes: leftFirst is the index of the first of two adjacent children.
+    // Leaf nodes: leftFirst is the first entry in the primitive reference list.
+    struct BVHNode
+    {
+        Vec3 boundsMin;
+        UINT leftFirst;
+        Vec3 boundsMax;
+        UINT16 primitiveCount;
+        UINT8 splitAxis;
+        UINT8 flags;
+
+        bool IsLeaf() const { return primitiveCount > 0; }
+    };
+
+    // Binary bounding volume hierarchy over the scene primitives, built with binned SAH.
+    class BVH
+    {
+    public:
+        static const UINT MaxLeafSize = 4;
+        static const UINT MaxDepth = 64;
+
+        // Builds over the volumes the primitives sweep over the shutter interval, for rays of any time.
+        void Build(const Scene& scene);
+
+        // Builds over the primitives at a single time, only valid for rays of that time.
+        void Build(const Scene& scene, float time);
+
+        // Builds over precomputed swept bounds, one per primitive in the order Scene::GetPrimitiveRefs() lists them.
+        void Build(const Scene& scene, const Aabb* primitiveBounds);
+
+        // Updates the bounds of every node to the primitives' current swept volumes, keeping the hierarchy.
+        // Much faster than a build, but the tree only stays efficient while the primitives move little relative to each other.
+        // The scene must hold the primitives the hierarchy was built over.
+        void Refit(const Scene& scene);
+
+        // Replaces the hierarchy with a view of one built before over the same scene, see SceneCache. The arrays must
+        // outlive the view, a build or a refit replaces it with arrays of the BVH's own.
+        void View(const BVHNode* nodes, size_t nodeCount, const UINT* primitiveRefs, size_t primitiveRefCount);
+
+        // Closest hit traversal. Children are visited front to back.
+        bool Intersect(const Scene& scene, const Ray& ray, Hit& hit, RayStats* stats = nullptr) const;
+
+        // Occlusion only traversal for shadow rays.
+        // Children are visited in a fixed, build time order that favours the child with the larger
+        // surface area, the first primitive hit ends the search and the last occluder is cached.
+        bool Occluded(const Scene& scene, const Ray& ray, OcclusionCache* cache = nullptr, RayStats* stats = nullptr) const;
+
+        // First hit traversal using the closest hit machinery, which is what the GPU path does for
+        // shadow rays with RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH. Used as a benchmark baseline.
+        bool IntersectAny(const Scene& scene, const Ray& ray, RayStats* stats = nullptr) const;
+
+        UINT NodeCount() const { return static_cast<UINT>(m_nodes.size()); }
+        size_t SizeInBytes() const { return m_nodes.size() * sizeof(BVHNode) + m_primitiveRefs.size() * sizeof(UINT); }
+        const MappableArray<BVHNode>& Nodes() const { return m_nodes; }
+        const MappableArray<UINT>& PrimitiveRefs() const { return m_primitiveRefs; }
+
+    private:
+        struct BuildPrimitive
+        {
+            Aabb bounds;
+            Vec3 centroid;
+        };
+
+        template <typename GetBounds>
+        void BuildWithBounds(const Scene& scene, GetBounds getBounds);
+        void Subdivide(UINT nodeIndex, UINT first, UINT count, UINT depth, std::vector<BuildPrimitive>& buildPrimitives);
+
+        template <bool AcceptFirstHit>
+        bool Traverse(const Scene& scene, const Ray& ray, Hit& hit, RayStats* stats) const;
+
+        MappableArray<BVHNode> m_nodes;
+        MappableArray<UINT> m_primitiveRefs;
+    };
+}
+
+#endif // !CPU_BVH_H
@@ -0,0 +1,2673 @@
+#include "stdafx.h"
+#include "CpuBenchmark.h"
+#include "CpuAdaptive.h"
+#include "CpuDenoise.h"
+#include "CpuDistributed.h"
+#include "CpuImageWriter.h"
+#include "CpuLights.h"
+#include "CpuMetaballs.h"
+#include "CpuNoise.h"
+#include "CpuPreview.h"
+#include "CpuSceneCache.h"
+#include "CpuSceneFile.h"
+#include "CpuSceneGenerator.h"
+#include "CpuSequence.h"
+#include "CpuService.h"
+#include "CpuTexture.h"
+#include "CpuTonemap.h"
+#include "CpuWavefront.h"
+#include "PerformanceTimers.h"
+
+using namespace Cpu;
+using namespace std;
+
+namespace
+{
+    namespace BenchmarkTimers {
+        enum Enum {
+            BuildBVH = 0,
+            Wavefront,
+            Primary,
+            ShadowBaseline,
+            ShadowOcclusion,
+            PathTermination,
+            Kernel,         // Shared by the per-kernel measurements.
+            Count
+        };
+    }
+    static_assert(BenchmarkTimers::Count <= DX::CPUTimer::c_maxTimers, "Too many benchmark timers.");
+
+    // Offset to avoid self-intersection of rays leaving a surface.
+    static const float c_rayOffset = 1e-3f;
+
+    // Path termination benchmark: reference quality and convergence criteria.
+    static const UINT c_referencePasses = 64;
+    static const UINT c_maxConvergencePasses = 64;
+    static const float c_convergenceRMSE = 0.05f;
+
+    float RMSE(const vector<Vec3>& image, float imageScale, const vector<Vec3>& reference, float referenceScale)
+    {
+        double sum = 0;
+        for (size_t i = 0; i < image.size(); i++)
+        {
+            Vec3 d = image[i] * imageScale - reference[i] * referenceScale;
+            sum += Dot(d, d) / 3.0;
+        }
+        return static_cast<float>(sqrt(sum / (std::max)(size_t(1), image.size())));
+    }
+
+    // Noise benchmark sample count.
+    static const UINT c_noiseSamples = 1 << 20;
+
+    // Baseline: the value noise the shaders used before, hashing every lattice corner with sin().
+    float Rnd2(float x, float y)
+    {
+        float v = std::sin(x * 12.9898f + y * 78.233f) * 43758.5453f;
+        return v - std::floor(v);
+    }
+
+    float SinValueNoise(const Vec3& position, float scale)
+    {
+        Vec3 p = position * scale;
+        float u = p.x - std::floor(p.x);
+        float v = p.y - std::floor(p.y);
+        float w = p.z - std::floor(p.z);
+
+        // Hermitian smoothing
+        u = u * u * (3 - 2 * u);
+        v = v * v * (3 - 2 * v);
+        w = w * w * (3 - 2 * w);
+
+        int i = static_cast<int>(std::floor(p.x));
+        int j = static_cast<int>(std::floor(p.y));
+        int k = static_cast<int>(std::floor(p.z));
+
+        float accum = 0;
+        for (int di = 0; di < 2; di++)
+        {
+            for (int dj = 0; dj < 2; dj++)
+            {
+                for (int dk = 0; dk < 2; dk++)
+                {
+                    float seed = Rnd2(0, static_cast<float>(i + di)) * Rnd2(0, static_cast<float>(j + dj)) * Rnd2(0, static_cast<float>(k + dk));
+                    float c = Rnd2(0, seed);
+                    accum += (di * u + (1 - di) * (1 - u)) * (dj * v + (1 - dj) * (1 - v)) * (dk * w + (1 - dk) * (1 - w)) * c;
+                }
+            }
+        }
+        return accum;
+    }
+
+    // Texture benchmark: texture resolution and samples per access pattern.
+    static const UINT c_textureSize = 4096;
+    static const UINT c_textureSamples = 1 << 22;
+
+    // Metaball benchmark: animation frames over the MetaballDemo cycle and the view of the field.
+    static const UINT c_metaballFrames = 8;
+    static const float c_metaballCycleDuration = 12.0f;
+    static const float c_metaballFieldOfView = 45.0f;
+
+    // Largest angle between analytic and finite difference metaball normals. The finite difference step is 5.8e-6,
+    // and half an ulp of a coordinate between 1 and 2, 1.2e-7, is 2% of it, which turns each gradient component by
+    // up to about 1.2 degrees. The rest covers the rounding of the potentials themselves.
+    static const double c_metaballNormalToleranceDegrees = 3.0;
+
+    // Cosine between a ray and the normal below which the ray grazes the metaball isosurface, within 3 degrees of it.
+    static const float c_metaballGrazingCosine = 0.05f;
+
+    // Metaball scaling benchmark: metaball counts of the random fields and their metaballs per unit volume.
+    static const UINT c_metaballScalingCounts[] = { 64, 512, 4096 };
+    static const float c_metaballDensity = 8.0f;
+
+    // Random metaballs at c_metaballDensity in a cube centered at the origin, moving a little between the key frames.
+    MetaballField RandomMetaballField(UINT count)
+    {
+        float size = cbrt(count / c_metaballDensity);
+        vector<AnimatedMetaball> metaballs(count);
+        for (UINT i = 0; i < count; i++)
+        {
+            UINT seed = 7 * i;
+            AnimatedMetaball& metaball = metaballs[i];
+            metaball.center0 = (Vec3(HashToFloat(seed), HashToFloat(seed + 1), HashToFloat(seed + 2)) - Vec3(0.5f)) * size;
+            metaball.center1 = metaball.center0 + (Vec3(HashToFloat(seed + 3), HashToFloat(seed + 4), HashToFloat(seed + 5)) - Vec3(0.5f)) * 0.4f;
+            metaball.radius = 0.15f + 0.15f * HashToFloat(seed + 6);
+        }
+        return MetaballField(move(metaballs));
+    }
+
+    // Motion blur benchmark: time samples per pixel and how far the spheres rise over the shutter interval.
+    static const UINT c_motionBlurTimeSamples = 8;
+    static const float c_motionBlurTravel = 0.5f;
+
+    // Many light benchmark: light counts, the share of them that are sphere lights and emissive scene spheres,
+    // and the passes of the reference and of the measured images.
+    static const UINT c_manyLightCounts[] = { 256, 4096 };
+    static const UINT c_emissiveSphereStride = 8;
+    static const UINT c_manyLightReferencePasses = 64;
+    static const UINT c_manyLightPasses = 16;
+
+    // Area light benchmark: reference passes, the error each integrator has to reach and its pass budget.
+    static const UINT c_areaLightReferencePasses = 64;
+    static const float c_areaLightTargetRMSE = 0.05f;
+    static const UINT c_areaLightMaxPasses = 64;
+
+    // Adaptive sampling benchmark: reference passes and the pass budget of the uniform renders matching the adaptive error.
+    static const UINT c_adaptiveReferencePasses = 256;
+    static const UINT c_adaptiveMaxUniformPasses = 128;
+
+    // Denoiser benchmark: reference passes, the sample counts of the denoised renders and the timed repeats of the filter.
+    static const UINT c_denoiseReferencePasses = 256;
+    static const UINT c_denoiseSampleCounts[] = { 1, 2, 4, 8 };
+    static const UINT c_denoiseRepeats = 8;
+
+    // Preview benchmark: when the camera moves during a preview, as a fraction of the full frame time.
+    static const float c_previewCancelPoint = 0.5f;
+
+    // Random number benchmark: generated spheres and the thread counts the renders are compared across.
+    static const UINT c_randomSpheres = 1 << 20;
+    static const UINT c_randomThreadCounts[] = { 1, 2, 3 };
+    static const UINT c_randomSceneSeed = 1;
+
+    // Scene generation benchmark: sphere counts of the generated scenes.
+    static const UINT c_generatedSphereCounts[] = { 1 << 16, 1 << 20 };
+
+    // Scene file benchmark: spheres of the generated scene written out and loaded back.
+    static const UINT c_sceneFileSpheres = 1 << 20;
+
+    // Scene cache benchmark: spheres of the generated scene loaded from the scene file and from the scene cache.
+    static const UINT c_sceneCacheSpheres = 1 << 20;
+
+    // Image writer benchmark: tile size and tile buffers of the streamed images.
+    static const UINT c_imageTileSize = 64;
+    static const UINT c_imagePendingTiles = 16;
+
+    // Tone mapping benchmark: size of the frame the rendered image is repeated over, and its exposure in stops.
+    static const UINT c_tonemapWidth = 3840;
+    static const UINT c_tonemapHeight = 2160;
+    static const float c_tonemapExposure = 1.0f;
+
+    // Sequence benchmark: frames of the animation, spheres of the generated field added to the scene, and the height
+    // and period in seconds of the spheres' bobbing.
+    static const UINT c_sequenceFrames = 8;
+    static const UINT c_sequenceSpheres = 1 << 18;
+    static const float c_sequenceBobHeight = 0.1f;
+    static const float c_sequenceBobPeriod = 2.0f;
+
+    // Distributed rendering benchmark: tile size, tiles the failing worker renders before it drops its connection,
+    // and the delay per tile of the straggler.
+    static const UINT c_distributedTileSize = 32;
+    static const UINT c_distributedCrashTiles = 4;
+    static const UINT c_distributedStragglerDelayMS = 50;
+
+    // Render service benchmark: spheres of the generated field added to the scene, so loading it and building its BVH
+    // take a share of the first job, jobs on the cached scene, their samples per pixel, and the tile size of tiled jobs.
+    static const UINT c_serviceSpheres = 1 << 16;
+    static const UINT c_serviceWarmJobs = 8;
+    static const UINT c_serviceSamples = 2;
+    static const UINT c_serviceTileSize = 64;
+
+    // Camera ray benchmark: passes over the image per generator, and the strata of the jittered render.
+    static const UINT c_cameraRayPasses = 16;
+    static const UINT c_cameraRayStrata = 4;
+
+    // Baseline: records parsed line by line through string streams, as MetaballField::Load() does. Returns the records.
+    UINT ParseWithStreams(const string& text)
+    {
+        istringstream lines(text);
+        string line;
+        UINT records = 0;
+        vector<float> values;
+        while (getline(lines, line))
+        {
+            istringstream words(line.substr(0, line.find('#')));
+            string keyword;
+            if (!(words >> keyword))
+            {
+                continue;
+            }
+            values.clear();
+            float value;
+            while (words >> value)
+            {
+                values.push_back(value);
+            }
+            records++;
+        }
+        return records;
+    }
+
+    // Baseline: the scene generators' random numbers before, from the C runtime's shared generator.
+    double RandDouble()
+    {
+        return rand() / (RAND_MAX + 1.0);
+    }
+
+    // A random sphere as the scene generators place them: center, radius and albedo.
+    struct RandomSphere
+    {
+        Vec3 center;
+        float radius;
+        Vec3 albedo;
+    };
+
+    template <typename Random>
+    RandomSphere GenerateSphere(Random random)
+    {
+        RandomSphere sphere;
+        float x = static_cast<float>(random());
+        float y = static_cast<float>(random());
+        float z = static_cast<float>(random());
+        sphere.center = Vec3(x, y, z) * 100.0f;
+        sphere.radius = 0.1f + 0.2f * static_cast<float>(random());
+        float r = static_cast<float>(random());
+        float g = static_cast<float>(random());
+        float b = static_cast<float>(random());
+        sphere.albedo = Vec3(r, g, b);
+        return sphere;
+    }
+
+    // File of the given name in the temporary directory.
+    wstring TempFilePath(const wchar_t* name)
+    {
+        WCHAR tempPath[MAX_PATH];
+        ThrowIfFalse(GetTempPath(MAX_PATH, tempPath) > 0, L"Failed to get the temporary directory.");
+        return wstring(tempPath) + name;
+    }
+
+    // Pinhole camera looking from eye at target, in the form Camera::GenerateRay() unprojects.
+    Camera LookAtCamera(const Vec3& eye, const Vec3& target, float fieldOfView, UINT width, UINT height)
+    {
+        Vec3 forward = Normalize(target - eye);
+        Vec3 right = Normalize(Cross(Vec3(0, 1, 0), forward));
+        Vec3 up = Cross(forward, right);
+        float tanHalfFovY = tan(fieldOfView * 0.5f * 3.14159265f / 180.0f);
+        Vec3 screenX = right * (tanHalfFovY * width / height);
+        Vec3 screenY = up * tanHalfFovY;
+
+        Camera camera;
+        XMFLOAT4X4& m = camera.projectionToWorld;
+        m = XMFLOAT4X4();
+        m._11 = screenX.x; m._12 = screenX.y; m._13 = screenX.z;
+        m._21 = screenY.x; m._22 = screenY.y; m._23 = screenY.z;
+        m._41 = eye.x + forward.x; m._42 = eye.y + forward.y; m._43 = eye.z + forward.z; m._44 = 1;
+        camera.position = eye;
+        camera.width = width;
+        camera.height = height;
+        return camera;
+    }
+
+    MaterialConstantBuffer DiffuseMaterial(const Vec3& albedo)
+    {
+        MaterialConstantBuffer material = {};
+        material.albedo = XMFLOAT4(albedo.x, albedo.y, albedo.z, 1.0f);
+        material.diffuseCoef = 1.0f;
+        material.specularPower = 50.0f;
+        return material;
+    }
+
+    // Closed box lit by a quad light under the ceiling and a small emissive sphere on the floor,
+    // with two diffuse spheres. The camera sits inside, so no path escapes to the background.
+    Scene LitBoxScene()
+    {
+        Scene scene;
+        UINT white = scene.AddMaterial(DiffuseMaterial(Vec3(0.73f)));
+        UINT red = scene.AddMaterial(DiffuseMaterial(Vec3(0.65f, 0.05f, 0.05f)));
+        UINT green = scene.AddMaterial(DiffuseMaterial(Vec3(0.12f, 0.45f, 0.15f)));
+        UINT quadLight = scene.AddMaterial(DiffuseMaterial(Vec3(0.0f)));
+        UINT sphereLight = scene.AddMaterial(DiffuseMaterial(Vec3(0.0f)));
+        scene.SetMaterialEmission(quadLight, Vec3(15.0f));
+        scene.SetMaterialEmission(sphereLight, Vec3(20.0f, 12.0f, 4.0f));
+
+        scene.AddQuad(Vec3(-1, 0, -3), Vec3(0, 0, 4), Vec3(2, 0, 0), white);     // Floor.
+        scene.AddQuad(Vec3(-1, 2, -3), Vec3(2, 0, 0), Vec3(0, 0, 4), white);     // Ceiling.
+        scene.AddQuad(Vec3(-1, 0, 1), Vec3(2, 0, 0), Vec3(0, 2, 0), white);      // Back.
+        scene.AddQuad(Vec3(-1, 0, -3), Vec3(0, 2, 0), Vec3(2, 0, 0), white);     // Front, behind the camera.
+        scene.AddQuad(Vec3(-1, 0, -3), Vec3(0, 0, 4), Vec3(0, 2, 0), red);       // Left.
+        scene.AddQuad(Vec3(1, 0, -3), Vec3(0, 2, 0), Vec3(0, 0, 4), green);      // Right.
+        scene.AddQuad(Vec3(-0.25f, 1.99f, -0.25f), Vec3(0.5f, 0, 0), Vec3(0, 0, 0.5f), quadLight);
+        scene.AddSphere(Vec3(0.6f, 0.1f, 0.5f), 0.1f, sphereLight);
+        scene.AddSphere(Vec3(-0.4f, 0.4f, 0.3f), 0.4f, white);
+        scene.AddSphere(Vec3(0.35f, 0.3f, -0.4f), 0.3f, white);
+        scene.AddEmissivePrimitiveLights();
+        return scene;
+    }
+
+    Camera LitBoxCamera(UINT width, UINT height)
+    {
+        return LookAtCamera(Vec3(0.0f, 1.0f, -2.4f), Vec3(0.0f, 0.9f, 0.0f), 45.0f, width, height);
+    }
+
+    void PrintRayStats(const wchar_t* label, const RayStats& stats, RayType::Enum rayType, double elapsedMS)
+    {
+        double rays = static_cast<double>(stats.rays[rayType]);
+        double perRay = rays > 0 ? 1.0 / rays : 0.0;
+        double MRaysPerSecond = elapsedMS > 0 ? rays / (elapsedMS * 1000.0) : 0.0;
+
+        wstringstream text;
+        text << setprecision(2) << fixed
+            << L"    " << label << L": " << stats.rays[rayType] << L" rays"
+            << L"    " << elapsedMS << L"ms"
+            << L"    ~Million Rays/s: " << MRaysPerSecond
+            << L"    nodes/ray: " << stats.nodeVisits[rayType] * perRay
+            << L"    primitives/ray: " << stats.primitiveTests[rayType] * perRay
+            << L"\n";
+        OutputDebugStringW(text.str().c_str());
+    }
+}
+
+Benchmark::Benchmark(const Scene& scene, const Camera& camera, UINT maxPathBounces) :
+    m_scene(scene),
+    m_camera(camera),
+    m_maxPathBounces(maxPathBounces),
+    m_failedChecks(0)
+{
+}
+
+void Benchmark::Run()
+{
+    BuildBVH();
+    RunShadowRays();
+    RunWavefront();
+    RunPathTermination();
+    RunNoise();
+    RunTextures();
+    RunMetaballs();
+    RunMotionBlur();
+    RunManyLights();
+    RunAreaLights();
+    RunAdaptiveSampling();
+    RunDenoiser();
+    RunPreview();
+    RunRandom();
+    RunSceneGeneration();
+    RunSceneFile();
+    RunSceneCache();
+    RunImageWriter();
+    RunTonemap();
+    RunSequence();
+    RunDistributed();
+    RunRenderService();
+    RunCameraRays();
+
+    ThrowIfFalse(m_failedChecks == 0, L"CPU benchmark checks failed, see the debugger output.");
+}
+
+Scene Benchmark::SceneWithSphereField(UINT sphereCount)
+{
+    Scene scene = m_scene;
+    RandomSceneSettings settings;
+    settings.sphereCount = sphereCount;
+    SceneGenerator generator(m_threadPool);
+    generator.Generate(scene, settings);
+    return scene;
+}
+
+void Benchmark::Check(bool passed, const wchar_t* check)
+{
+    if (!passed)
+    {
+        m_failedChecks++;
+        wstringstream text;
+        text << L"CPU benchmark check failed: " << check << L"\n";
+        OutputDebugStringW(text.str().c_str());
+    }
+}
+
+void Benchmark::BuildBVH()
+{
+    DX::CPUTimer timer;
+    timer.Start(BenchmarkTimers::BuildBVH);
+    m_bvh.Build(m_scene);
+    timer.Stop(BenchmarkTimers::BuildBVH);
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU BVH: primitives: " << m_scene.PrimitiveCount()
+        << L"    nodes: " << m_bvh.NodeCount() << L" (" << m_bvh.SizeInBytes() / 1024.0 << L"KB)"
+        << L"    build: " << timer.GetElapsedMS(BenchmarkTimers::BuildBVH) << L"ms\n";
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunShadowRays()
+{
+    DX::CPUTimer timer;
+
+    // Primary rays, keep the shadow ray origin for every hit.
+    RayStats radianceStats;
+    vector<Vec3> shadowOrigins;
+    shadowOrigins.reserve(m_camera.width * m_camera.height);
+    timer.Start(BenchmarkTimers::Primary);
+    for (UINT y = 0; y < m_camera.height; y++)
+    {
+        for (UINT x = 0; x < m_camera.width; x++)
+        {
+            Ray ray = m_camera.GenerateRay(x, y);
+            Hit hit;
+            if (m_bvh.Intersect(m_scene, ray, hit, &radianceStats))
+            {
+                shadowOrigins.push_back(ray.origin + ray.direction * hit.t + hit.normal * c_rayOffset);
+            }
+        }
+    }
+    timer.Stop(BenchmarkTimers::Primary);
+
+    vector<Ray> shadowRays(shadowOrigins.size());
+    for (size_t i = 0; i < shadowOrigins.size(); i++)
+    {
+        Vec3 toLight = m_scene.light.position - shadowOrigins[i];
+        shadowRays[i].origin = shadowOrigins[i];
+        shadowRays[i].tMax = Length(toLight);
+        shadowRays[i].direction = toLight * (1.0f / shadowRays[i].tMax);
+    }
+
+    vector<bool> baselineResults(shadowRays.size());
+    RayStats baselineStats;
+    timer.Start(BenchmarkTimers::ShadowBaseline);
+    for (size_t i = 0; i < shadowRays.size(); i++)
+    {
+        baselineResults[i] = m_bvh.IntersectAny(m_scene, shadowRays[i], &baselineStats);
+    }
+    timer.Stop(BenchmarkTimers::ShadowBaseline);
+
+    UINT64 occludedCount = 0;
+    UINT64 mismatchCount = 0;
+    RayStats occlusionStats;
+    OcclusionCache cache;
+    timer.Start(BenchmarkTimers::ShadowOcclusion);
+    for (size_t i = 0; i < shadowRays.size(); i++)
+    {
+        bool occluded = m_bvh.Occluded(m_scene, shadowRays[i], &cache, &occlusionStats);
+        occludedCount += occluded ? 1 : 0;
+        mismatchCount += occluded != baselineResults[i] ? 1 : 0;
+    }
+    timer.Stop(BenchmarkTimers::ShadowOcclusion);
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU shadow ray benchmark: " << m_camera.width << L"x" << m_camera.height << L"\n";
+    OutputDebugStringW(text.str().c_str());
+
+    PrintRayStats(L"Radiance", radianceStats, RayType::Radiance, timer.GetElapsedMS(BenchmarkTimers::Primary));
+    PrintRayStats(L"Shadow (first hit)", baselineStats, RayType::Shadow, timer.GetElapsedMS(BenchmarkTimers::ShadowBaseline));
+    PrintRayStats(L"Shadow (occlusion)", occlusionStats, RayType::Shadow, timer.GetElapsedMS(BenchmarkTimers::ShadowOcclusion));
+
+    text.str(L"");
+    text << L"    occluded: " << occludedCount
+        << L"    occluder cache hits: " << occlusionStats.occlusionCacheHits
+        << L"    mismatches: " << mismatchCount << L"\n";
+    OutputDebugStringW(text.str().c_str());
+    Check(mismatchCount == 0, L"occlusion traversal against first hit traversal");
+}
+
+void Benchmark::RunWavefront()
+{
+    static const wchar_t* stageNames[WavefrontStage::Count] = { L"Generate", L"Extend", L"Sort", L"Shade", L"Shadow" };
+
+    WavefrontRenderer renderer(m_threadPool);
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+
+    DX::CPUTimer timer;
+    timer.Start(BenchmarkTimers::Wavefront);
+    renderer.Render(m_scene, m_bvh, m_camera, settings);
+    timer.Stop(BenchmarkTimers::Wavefront);
+
+    const WavefrontStats& stats = renderer.Stats();
+    double totalMS = timer.GetElapsedMS(BenchmarkTimers::Wavefront);
+    UINT64 totalRays = stats.rays.rays[RayType::Radiance] + stats.rays.rays[RayType::Shadow];
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU wavefront renderer: " << m_camera.width << L"x" << m_camera.height
+        << L"    threads: " << m_threadPool.ThreadCount()
+        << L"    materials: " << m_scene.materials.size()
+        << L" (" << m_scene.materials.size() * sizeof(MaterialConstantBuffer) / 1024.0 << L"KB)"
+        << L"    " << totalMS << L"ms"
+        << L"    ~Million Rays/s: " << (totalMS > 0 ? totalRays / (totalMS * 1000.0) : 0.0) << L"\n";
+    for (UINT stage = 0; stage < WavefrontStage::Count; stage++)
+    {
+        text << L"    " << stageNames[stage] << L": " << stats.stageMS[stage] << L"ms"
+            << L" (" << (totalMS > 0 ? 100.0 * stats.stageMS[stage] / totalMS : 0.0) << L"%)\n";
+    }
+
+    // Queue occupancy relative to the queue capacity of one entry per pixel.
+    double capacity = static_cast<double>(m_camera.width) * m_camera.height;
+    for (size_t bounce = 0; bounce < stats.activeRays.size(); bounce++)
+    {
+        text << L"    bounce " << bounce
+            << L": active rays: " << stats.activeRays[bounce] << L" (" << 100.0 * stats.activeRays[bounce] / capacity << L"%)"
+            << L"    shadow rays: " << stats.shadowRays[bounce] << L" (" << 100.0 * stats.shadowRays[bounce] / capacity << L"%)\n";
+    }
+    OutputDebugStringW(text.str().c_str());
+
+    PrintRayStats(L"Radiance", stats.rays, RayType::Radiance, stats.stageMS[WavefrontStage::Extend]);
+    PrintRayStats(L"Shadow", stats.rays, RayType::Shadow, stats.stageMS[WavefrontStage::Shadow]);
+}
+
+void Benchmark::RunPathTermination()
+{
+    // Diffuse interreflection in the closed box, where every path bounces until it is terminated.
+    Scene scene = LitBoxScene();
+    Camera camera = LitBoxCamera(m_camera.width, m_camera.height);
+    BVH bvh;
+    bvh.Build(scene);
+    WavefrontRenderer renderer(m_threadPool);
+    UINT pixelCount = camera.width * camera.height;
+
+    auto Accumulate = [&](vector<Vec3>& image, const PathSettings& settings)
+    {
+        renderer.Render(scene, bvh, camera, settings);
+        const vector<Vec3>& radiance = renderer.Radiance();
+        for (UINT i = 0; i < pixelCount; i++)
+        {
+            image[i] += radiance[i];
+        }
+        const RayStats& stats = renderer.Stats().rays;
+        return stats.rays[RayType::Radiance] + stats.rays[RayType::Shadow];
+    };
+
+    // Fixed depth reference, with sample indices disjoint from the measured passes.
+    PathSettings referenceSettings;
+    referenceSettings.integrator = Integrator::NextEvent;
+    referenceSettings.maxBounces = m_maxPathBounces;
+    referenceSettings.russianRoulette = false;
+    vector<Vec3> reference(pixelCount, Vec3(0.0f));
+    for (UINT pass = 0; pass < c_referencePasses; pass++)
+    {
+        referenceSettings.sampleIndex = c_maxConvergencePasses + pass;
+        Accumulate(reference, referenceSettings);
+    }
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU path termination, next event + MIS in a lit box: " << camera.width << L"x" << camera.height
+        << L"    max bounces: " << m_maxPathBounces
+        << L"    reference passes: " << c_referencePasses << L"\n";
+
+    static const wchar_t* modeNames[] = { L"Fixed depth", L"Russian roulette" };
+    for (UINT mode = 0; mode < 2; mode++)
+    {
+        PathSettings settings;
+        settings.integrator = Integrator::NextEvent;
+        settings.maxBounces = m_maxPathBounces;
+        settings.russianRoulette = mode == 1;
+
+        vector<Vec3> image(pixelCount, Vec3(0.0f));
+        UINT64 rays = 0;
+        UINT passes = 0;
+        float error = FLT_MAX;
+
+        DX::CPUTimer timer;
+        timer.Start(BenchmarkTimers::PathTermination);
+        while (passes < c_maxConvergencePasses && error >= c_convergenceRMSE)
+        {
+            settings.sampleIndex = passes++;
+            rays += Accumulate(image, settings);
+            error = RMSE(image, 1.0f / passes, reference, 1.0f / c_referencePasses);
+        }
+        timer.Stop(BenchmarkTimers::PathTermination);
+
+        double raysPerPixel = static_cast<double>(rays) / pixelCount;
+        text << L"    " << modeNames[mode] << L": passes: " << passes
+            << L"    RMSE: " << setprecision(4) << error << setprecision(2)
+            << L"    rays/pixel/pass: " << raysPerPixel / passes
+            << L"    rays/converged pixel: " << raysPerPixel
+            << L"    " << timer.GetElapsedMS(BenchmarkTimers::PathTermination) << L"ms\n";
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunNoise()
+{
+    // Sample points spread over a few hundred lattice cells, in structure of arrays layout.
+    vector<float> x(c_noiseSamples), y(c_noiseSamples), z(c_noiseSamples), result(c_noiseSamples);
+    for (UINT i = 0; i < c_noiseSamples; i++)
+    {
+        x[i] = 20 * HashToFloat(3 * i) - 10;
+        y[i] = 20 * HashToFloat(3 * i + 1) - 10;
+        z[i] = 20 * HashToFloat(3 * i + 2) - 10;
+    }
+
+    DX::CPUTimer timer;
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU noise: " << c_noiseSamples << L" samples    turbulence octaves: " << PERLIN_OCTAVES << L"\n";
+
+    // Runs the kernel over all samples and reports the cost per sample.
+    // The checksum keeps the results alive.
+    auto Measure = [&](const wchar_t* label, UINT octaves, const function<void()>& kernel)
+    {
+        timer.Start(BenchmarkTimers::Kernel);
+        kernel();
+        timer.Stop(BenchmarkTimers::Kernel);
+
+        double checksum = 0;
+        for (float r : result)
+        {
+            checksum += r;
+        }
+        double ns = timer.GetElapsedMS(BenchmarkTimers::Kernel) * 1e6 / c_noiseSamples;
+        text << L"    " << label << L": " << ns << L"ns/sample    " << ns / octaves << L"ns/octave"
+            << L"    mean: " << setprecision(4) << checksum / c_noiseSamples << setprecision(2) << L"\n";
+    };
+
+    Measure(L"Value noise (sin hash)", 1, [&]
+    {
+        for (UINT i = 0; i < c_noiseSamples; i++)
+        {
+            result[i] = SinValueNoise(Vec3(x[i], y[i], z[i]), 1);
+        }
+    });
+    Measure(L"Gradient noise", 1, [&]
+    {
+        for (UINT i = 0; i < c_noiseSamples; i++)
+        {
+            result[i] = PerlinNoise(Vec3(x[i], y[i], z[i]));
+        }
+    });
+    Measure(L"Turbulence", PERLIN_OCTAVES, [&]
+    {
+        for (UINT i = 0; i < c_noiseSamples; i++)
+        {
+            result[i] = Turbulence(Vec3(x[i], y[i], z[i]));
+        }
+    });
+    vector<float> scalarTurbulence = result;
+    Measure(L"Turbulence (SoA SSE)", PERLIN_OCTAVES, [&]
+    {
+        Turbulence(x.data(), y.data(), z.data(), result.data(), c_noiseSamples);
+    });
+
+    float maxError = 0;
+    for (UINT i = 0; i < c_noiseSamples; i++)
+    {
+        maxError = (std::max)(maxError, std::fabs(result[i] - scalarTurbulence[i]));
+    }
+    text << L"    SoA vs scalar max difference: " << scientific << maxError << L"\n";
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunTextures()
+{
+    vector<UINT> texels(c_textureSize * c_textureSize);
+    for (UINT i = 0; i < texels.size(); i++)
+    {
+        texels[i] = HashUint(i) | 0xff000000;
+    }
+
+    DX::CPUTimer timer;
+    timer.Start(BenchmarkTimers::Kernel);
+    Texture linear(c_textureSize, c_textureSize, texels.data(), TextureLayout::Linear);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double linearBuildMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    timer.Start(BenchmarkTimers::Kernel);
+    Texture tiled(c_textureSize, c_textureSize, texels.data(), TextureLayout::Tiled);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double tiledBuildMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    texels.clear();
+    texels.shrink_to_fit();
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU textures: " << c_textureSize << L"x" << c_textureSize << L"    mips: " << linear.MipCount()
+        << L"    linear: " << linear.SizeInBytes() / (1024.0 * 1024.0) << L"MB, build " << linearBuildMS << L"ms"
+        << L"    tiled: " << tiled.SizeInBytes() / (1024.0 * 1024.0) << L"MB, build " << tiledBuildMS << L"ms\n";
+
+    // Runs the pattern for count samples on both layouts and reports the texel fetch rates.
+    // The checksums keep the results alive and must match between the layouts.
+    typedef function<float(const Texture&, UINT)> Pattern;
+    auto Compare = [&](const wchar_t* label, UINT count, UINT texelsPerSample, const Pattern& pattern)
+    {
+        double rates[TextureLayout::Count];
+        double checksums[TextureLayout::Count];
+        const Texture* textures[TextureLayout::Count] = { &linear, &tiled };
+        for (UINT layout = 0; layout < TextureLayout::Count; layout++)
+        {
+            double checksum = 0;
+            timer.Start(BenchmarkTimers::Kernel);
+            for (UINT i = 0; i < count; i++)
+            {
+                checksum += pattern(*textures[layout], i);
+            }
+            timer.Stop(BenchmarkTimers::Kernel);
+            rates[layout] = static_cast<double>(count) * texelsPerSample / (timer.GetElapsedMS(BenchmarkTimers::Kernel) * 1000.0);
+            checksums[layout] = checksum;
+        }
+        text << L"    " << label
+            << L": linear " << rates[TextureLayout::Linear] << L" Mtexels/s"
+            << L"    tiled " << rates[TextureLayout::Tiled] << L" Mtexels/s"
+            << L"    speedup: " << rates[TextureLayout::Tiled] / rates[TextureLayout::Linear] << L"x\n";
+        Check(checksums[TextureLayout::Linear] == checksums[TextureLayout::Tiled], (wstring(label) + L": tiled texture against linear").c_str());
+    };
+
+    const UINT size = c_textureSize;
+    const UINT texelCount = size * size;
+    const float texel = 1.0f / size;
+
+    // Raw texel fetches over the whole top level, sweeping down the columns as rays do across
+    // a texture seen rotated by 90 degrees.
+    Compare(L"Column sweep, point", texelCount, 1, [&](const Texture& texture, UINT i)
+    {
+        return static_cast<float>(texture.Fetch(0, i / size, i % size) & 0xff);
+    });
+
+    // Raw 2x1 texel footprints along diagonals, a texture rotated by 45 degrees.
+    Compare(L"Diagonal sweep, point", texelCount, 2, [&](const Texture& texture, UINT i)
+    {
+        UINT x = (i / size + i % size) & (size - 1);
+        UINT y = (i % size - i / size) & (size - 1);
+        return static_cast<float>((texture.Fetch(0, x, y) & 0xff) + (texture.Fetch(0, x, (y + 1) & (size - 1)) & 0xff));
+    });
+
+    // Filtered samples of a texture rotated against the screen, one texel per sample.
+    const UINT gridSize = static_cast<UINT>(sqrt(static_cast<double>(c_textureSamples)));
+    const float cosAngle = cos(1.1f);
+    const float sinAngle = sin(1.1f);
+    Compare(L"Rotated scanlines, bilinear", c_textureSamples, 4, [&](const Texture& texture, UINT i)
+    {
+        float x = static_cast<float>(i % gridSize);
+        float y = static_cast<float>(i / gridSize);
+        Vec3 color = texture.SampleBilinear(0, (x * cosAngle - y * sinAngle) * texel, (x * sinAngle + y * cosAngle) * texel);
+        return color.x + color.y + color.z;
+    });
+
+    // Minified texture, 3 texels per sample, filtered from the mip levels selected by the footprint.
+    Compare(L"Rotated scanlines, trilinear", c_textureSamples, 8, [&](const Texture& texture, UINT i)
+    {
+        float x = 3.0f * (i % gridSize);
+        float y = 3.0f * (i / gridSize);
+        Vec3 color = texture.Sample((x * cosAngle - y * sinAngle) * texel, (x * sinAngle + y * cosAngle) * texel, 3.0f * texel);
+        return color.x + color.y + color.z;
+    });
+
+    // Incoherent secondary rays: no locality for any layout.
+    Compare(L"Random, bilinear", c_textureSamples, 4, [&](const Texture& texture, UINT i)
+    {
+        Vec3 color = texture.SampleBilinear(0, HashToFloat(2 * i), HashToFloat(2 * i + 1));
+        return color.x + color.y + color.z;
+    });
+
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunMetaballs()
+{
+    // The field in its local space, framed by a camera at the image resolution.
+    const UINT width = m_camera.width;
+    const UINT height = m_camera.height;
+    const UINT pixelCount = width * height;
+    float tanHalfFov = tan(c_metaballFieldOfView * 0.5f * 3.14159265f / 180.0f);
+    Vec3 eye, forward, right, up;
+    auto LookAt = [&](const Vec3& position, const Vec3& target)
+    {
+        eye = position;
+        forward = Normalize(target - eye);
+        right = Normalize(Cross(Vec3(0, 1, 0), forward));
+        up = Cross(forward, right);
+    };
+    LookAt(Vec3(0.0f, 0.5f, -2.4f), Vec3(0.0f));
+
+    auto GenerateRay = [&](UINT pixel)
+    {
+        float screenX = ((pixel % width + 0.5f) / width * 2.0f - 1.0f) * tanHalfFov * width / height;
+        float screenY = -((pixel / width + 0.5f) / height * 2.0f - 1.0f) * tanHalfFov;
+        Ray ray;
+        ray.origin = eye;
+        ray.direction = Normalize(forward + right * screenX + up * screenY);
+        return ray;
+    };
+
+    // Intersection variants: the previous uniform march with finite difference normals,
+    // then sphere tracing with finite difference and with analytic normals.
+    struct Variant
+    {
+        const wchar_t* name;
+        MetaballMarch::Enum march;
+        MetaballNormals::Enum normals;
+        vector<float> hitT;
+        vector<Vec3> hitNormal;
+        MetaballStats stats;
+        double elapsedMS;
+
+        Variant(const wchar_t* _name, MetaballMarch::Enum _march, MetaballNormals::Enum _normals) :
+            name(_name),
+            march(_march),
+            normals(_normals),
+            elapsedMS(0)
+        {
+        }
+    };
+    Variant variants[] =
+    {
+        { L"Uniform march, finite differences", MetaballMarch::Uniform, MetaballNormals::FiniteDifferences },
+        { L"Sphere tracing, finite differences", MetaballMarch::SphereTrace, MetaballNormals::FiniteDifferences },
+        { L"Sphere tracing, analytic", MetaballMarch::SphereTrace, MetaballNormals::Analytic },
+    };
+
+    // Intersects a pixel's ray with every animation frame of a field, returns the time spent intersecting.
+    // The grid rebuilds are timed separately.
+    DX::CPUTimer timer;
+    vector<MetaballStats> threadStats;
+    auto TraceFrames = [&](MetaballField& field, MetaballMarch::Enum march, MetaballNormals::Enum normals, MetaballCulling::Enum culling,
+        float* hitT, Vec3* hitNormal, MetaballStats& stats, double& buildMS)
+    {
+        double elapsedMS = 0;
+        buildMS = 0;
+        for (UINT frame = 0; frame < c_metaballFrames; frame++)
+        {
+            timer.Start(BenchmarkTimers::Kernel);
+            field.InitializeAnimated(frame * c_metaballCycleDuration / c_metaballFrames, c_metaballCycleDuration, culling);
+            timer.Stop(BenchmarkTimers::Kernel);
+            buildMS += timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+            threadStats.assign(m_threadPool.ThreadCount(), MetaballStats());
+            float* frameHitT = hitT ? hitT + frame * pixelCount : nullptr;
+            Vec3* frameHitNormal = hitNormal ? hitNormal + frame * pixelCount : nullptr;
+
+            timer.Start(BenchmarkTimers::Kernel);
+            m_threadPool.ParallelFor(pixelCount, WavefrontRenderer::BatchSize, [&](UINT begin, UINT end, UINT threadIndex)
+            {
+                for (UINT i = begin; i < end; i++)
+                {
+                    float t;
+                    Vec3 normal;
+                    if (field.Intersect(GenerateRay(i), march, normals, t, normal, &threadStats[threadIndex]) && frameHitT)
+                    {
+                        frameHitT[i] = t;
+                        frameHitNormal[i] = normal;
+                    }
+                }
+            });
+            timer.Stop(BenchmarkTimers::Kernel);
+            elapsedMS += timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+            for (auto& s : threadStats)
+            {
+                stats.Merge(s);
+            }
+        }
+        return elapsedMS;
+    };
+
+    MetaballField field;
+    for (Variant& variant : variants)
+    {
+        variant.hitT.assign(pixelCount * c_metaballFrames, -1.0f);
+        variant.hitNormal.resize(pixelCount * c_metaballFrames);
+        double buildMS;
+        variant.elapsedMS = TraceFrames(field, variant.march, variant.normals, MetaballCulling::None, variant.hitT.data(), variant.hitNormal.data(), variant.stats, buildMS);
+    }
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU metaballs: " << field.Count() << L" metaballs    " << width << L"x" << height << L"    frames: " << c_metaballFrames << L"\n";
+
+    for (const Variant& variant : variants)
+    {
+        const MetaballStats& s = variant.stats;
+        double perRay = s.rays ? 1.0 / s.rays : 0.0;
+        double perHit = s.hits ? 1.0 / s.hits : 0.0;
+        text << L"    " << variant.name << L": hits: " << s.hits
+            << L"    steps/ray: " << s.steps * perRay
+            << L"    potentials/ray: " << s.potentialEvaluations * perRay
+            << L"    potentials/hit: " << s.potentialEvaluations * perHit
+            << L" (normal: " << s.normalEvaluations * perHit << L")"
+            << L"    " << variant.elapsedMS << L"ms"
+            << L"    ~Million Hits/s: " << (variant.elapsedMS > 0 ? s.hits / (variant.elapsedMS * 1000.0) : 0.0)
+            << L"\n";
+    }
+
+    // Uniform marching overshoots the surface by up to a step, sphere tracing by a bisected step.
+    // Either can step over a thin grazing part of the surface the other one finds.
+    UINT mismatches = 0;
+    UINT commonHits = 0;
+    double sumDifference = 0;
+    float maxDifference = 0;
+    const vector<float>& uniform = variants[0].hitT;
+    const vector<float>& sphereTraced = variants[1].hitT;
+    for (size_t i = 0; i < uniform.size(); i++)
+    {
+        if ((uniform[i] < 0) != (sphereTraced[i] < 0))
+        {
+            mismatches++;
+        }
+        else if (uniform[i] >= 0)
+        {
+            float difference = fabs(uniform[i] - sphereTraced[i]);
+            maxDifference = (std::max)(maxDifference, difference);
+            sumDifference += difference;
+            commonHits++;
+        }
+    }
+    // A uniform step is 1 / METABALL_MAX_STEPS of the segment through the field, at most the field's diagonal.
+    float stepBound = Length(field.Bounds().Extent()) / METABALL_MAX_STEPS;
+    text << L"    hit mismatches: " << mismatches << setprecision(4)
+        << L"    hit distance difference: mean " << (commonHits ? sumDifference / commonHits : 0.0) << L" max " << maxDifference
+        << L" (uniform step up to " << stepBound << L")\n";
+    Check(maxDifference <= stepBound, L"sphere traced metaball hits against uniform march, within a step");
+
+    // Analytic normals against the finite difference normals of the same hits.
+    double sumAngle = 0;
+    double maxAngle = 0;
+    UINT normalCount = 0;
+    for (size_t i = 0; i < sphereTraced.size(); i++)
+    {
+        if (sphereTraced[i] >= 0)
+        {
+            float cosAngle = Dot(variants[1].hitNormal[i], variants[2].hitNormal[i]);
+            double angle = acos((std::min)(1.0f, (std::max)(-1.0f, cosAngle))) * 180.0 / 3.14159265;
+            sumAngle += angle;
+            maxAngle = (std::max)(maxAngle, angle);
+            normalCount++;
+        }
+    }
+    text << L"    analytic vs finite difference normals: mean " << (normalCount ? sumAngle / normalCount : 0.0) << L" deg    max " << maxAngle << L" deg\n";
+    Check(maxAngle < c_metaballNormalToleranceDegrees, L"analytic metaball normals against finite differences");
+
+    // Scaling with the metaball count: random fields of the same metaball density in growing volumes,
+    // the -metaballs file and the scene file's metaballs, each framed like the MetaballDemo field and intersected
+    // with and without the grid.
+    vector<pair<wstring, MetaballField>> fields;
+    for (UINT count : c_metaballScalingCounts)
+    {
+        fields.emplace_back(L"random " + to_wstring(count), RandomMetaballField(count));
+    }
+    if (!m_metaballFile.empty())
+    {
+        fields.emplace_back(m_metaballFile, MetaballField::Load(m_metaballFile));
+    }
+    if (!m_sceneMetaballs.empty())
+    {
+        fields.emplace_back(L"scene file", MetaballField(m_sceneMetaballs));
+    }
+
+    text << L"  Metaball count scaling, sphere tracing, analytic normals:\n";
+    const MetaballCulling::Enum cullings[] = { MetaballCulling::Grid, MetaballCulling::None };
+    vector<float> cullingHitT[_countof(cullings)];
+    vector<Vec3> cullingHitNormal[_countof(cullings)];
+    for (auto& namedField : fields)
+    {
+        MetaballField& scaledField = namedField.second;
+        const Aabb& bounds = scaledField.Bounds();
+        LookAt(bounds.Centroid() + Vec3(0.0f, 0.5f, -2.4f) * (0.5f * MaxComponent(bounds.Extent())), bounds.Centroid());
+
+        for (UINT c = 0; c < _countof(cullings); c++)
+        {
+            MetaballCulling::Enum culling = cullings[c];
+            cullingHitT[c].assign(pixelCount * c_metaballFrames, -1.0f);
+            cullingHitNormal[c].resize(pixelCount * c_metaballFrames);
+            MetaballStats s;
+            double buildMS;
+            double elapsedMS = TraceFrames(scaledField, MetaballMarch::SphereTrace, MetaballNormals::Analytic, culling,
+                cullingHitT[c].data(), cullingHitNormal[c].data(), s, buildMS);
+            double perRay = s.rays ? 1.0 / s.rays : 0.0;
+            text << L"    " << namedField.first << (culling == MetaballCulling::Grid ? L", grid" : L", no culling")
+                << L": metaballs: " << scaledField.Count()
+                << L"    cells: " << scaledField.CellCount()
+                << L"    max metaballs/cell: " << scaledField.MaxCellMetaballs()
+                << L"    hits: " << s.hits
+                << L"    cells/ray: " << s.cells * perRay
+                << L"    steps/ray: " << s.steps * perRay
+                << L"    potentials/ray: " << s.potentialEvaluations * perRay
+                << L"    " << elapsedMS << L"ms (grid builds: " << buildMS << L"ms)"
+                << L"\n";
+        }
+
+        // The grid marches the cells' shorter segments in finer steps than the whole field, so it may find hits the
+        // whole field's march steps over, but it should miss none of them, save where the ray grazes the isosurface
+        // and the field peaks within the sampling error of the threshold.
+        float cullingStepBound = Length(scaledField.Bounds().Extent()) / METABALL_MAX_STEPS;
+        UINT gridMisses = 0;
+        UINT fieldMisses = 0;
+        UINT grazingMisses = 0;
+        for (size_t i = 0; i < cullingHitT[0].size(); i++)
+        {
+            float gridT = cullingHitT[0][i];
+            float fieldT = cullingHitT[1][i];
+            if (fieldT >= 0 && (gridT < 0 || gridT > fieldT + cullingStepBound))
+            {
+                float cosine = fabs(Dot(cullingHitNormal[1][i], GenerateRay(static_cast<UINT>(i % pixelCount)).direction));
+                (cosine < c_metaballGrazingCosine ? grazingMisses : gridMisses)++;
+            }
+            else if (gridT >= 0 && (fieldT < 0 || fieldT > gridT + cullingStepBound))
+            {
+                fieldMisses++;
+            }
+        }
+        text << L"      grid against no culling: hits the grid misses: " << gridMisses << L" (grazing: " << grazingMisses << L")"
+            << L"    hits the whole field misses: " << fieldMisses << L"\n";
+        Check(gridMisses == 0, (namedField.first + L": metaball grid hits against the whole field").c_str());
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunMotionBlur()
+{
+    // Every sphere rises by a random fraction of c_motionBlurTravel over the shutter, like the bouncing spheres of RTTNW.
+    Scene scene = m_scene;
+    for (UINT i = 0; i < scene.SphereCount(); i++)
+    {
+        scene.sphereMotionY[i] += c_motionBlurTravel * HashToFloat(i);
+    }
+
+    UINT pixelCount = m_camera.width * m_camera.height;
+    vector<float> closestT(pixelCount * c_motionBlurTimeSamples);
+    DX::CPUTimer timer;
+
+    // Traces every pixel at the center of each time sample interval through the BVH getBVH(sample) returns.
+    // With compare set, the closest hits are checked against the ones of the previous call.
+    auto TraceTimeSamples = [&](const wchar_t* label, double& buildMS, bool compare, auto getBVH)
+    {
+        RayStats stats;
+        UINT64 hitCount = 0;
+        UINT64 mismatchCount = 0;
+        double traceMS = 0;
+        buildMS = 0;
+        for (UINT sample = 0; sample < c_motionBlurTimeSamples; sample++)
+        {
+            timer.Start(BenchmarkTimers::BuildBVH);
+            const BVH& bvh = getBVH(sample);
+            timer.Stop(BenchmarkTimers::BuildBVH);
+            buildMS += timer.GetElapsedMS(BenchmarkTimers::BuildBVH);
+
+            float time = (sample + 0.5f) / c_motionBlurTimeSamples;
+            timer.Start(BenchmarkTimers::Primary);
+            for (UINT i = 0; i < pixelCount; i++)
+            {
+                Ray ray = m_camera.GenerateRay(i % m_camera.width, i / m_camera.width);
+                ray.time = time;
+                Hit hit;
+                bool isHit = bvh.Intersect(scene, ray, hit, &stats);
+                hitCount += isHit ? 1 : 0;
+
+                float& t = closestT[sample * pixelCount + i];
+                float hitT = isHit ? hit.t : -1.0f;
+                mismatchCount += compare && t != hitT ? 1 : 0;
+                t = hitT;
+            }
+            timer.Stop(BenchmarkTimers::Primary);
+            traceMS += timer.GetElapsedMS(BenchmarkTimers::Primary);
+        }
+
+        wstringstream text;
+        text << setprecision(2) << fixed
+            << L"  " << label << L": build: " << buildMS << L"ms    trace: " << traceMS << L"ms    total: " << buildMS + traceMS << L"ms"
+            << L"    hits: " << hitCount;
+        if (compare)
+        {
+            text << L"    mismatches: " << mismatchCount;
+            Check(mismatchCount == 0, L"swept bounds BVH against BVH rebuilt per time sample");
+        }
+        text << L"\n";
+        OutputDebugStringW(text.str().c_str());
+        PrintRayStats(L"Radiance", stats, RayType::Radiance, traceMS);
+    };
+
+    wstringstream text;
+    text << L"CPU motion blur benchmark: " << m_camera.width << L"x" << m_camera.height
+        << L"    moving spheres: " << scene.SphereCount()
+        << L"    time samples: " << c_motionBlurTimeSamples << L"\n";
+    OutputDebugStringW(text.str().c_str());
+
+    // One build over the swept volumes serves rays of any time.
+    BVH sweptBVH;
+    double sweptBuildMS;
+    TraceTimeSamples(L"Swept bounds, one build", sweptBuildMS, false, [&](UINT sample) -> const BVH&
+    {
+        if (sample == 0)
+        {
+            sweptBVH.Build(scene);
+        }
+        return sweptBVH;
+    });
+
+    // Baseline: a build at every time sample, the closest hits have to match the swept BVH.
+    BVH instantBVH;
+    double instantBuildMS;
+    TraceTimeSamples(L"Rebuild per time sample", instantBuildMS, true, [&](UINT sample) -> const BVH&
+    {
+        instantBVH.Build(scene, (sample + 0.5f) / c_motionBlurTimeSamples);
+        return instantBVH;
+    });
+}
+
+void Benchmark::RunManyLights()
+{
+    UINT pixelCount = m_camera.width * m_camera.height;
+    WavefrontRenderer renderer(m_threadPool);
+    DX::CPUTimer timer;
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU many lights: " << m_camera.width << L"x" << m_camera.height
+        << L"    reference passes: " << c_manyLightReferencePasses << L"\n";
+
+    for (UINT lightCount : c_manyLightCounts)
+    {
+        // Every c_emissiveSphereStride-th sphere glows, the remaining lights are point and sphere lights in a
+        // layer above the spheres. Intensities are scaled so the total lighting doesn't depend on the count.
+        Scene scene = m_scene;
+        Aabb sphereBounds;
+        for (UINT i = 0; i < scene.SphereCount(); i++)
+        {
+            sphereBounds.Grow(scene.GetPrimitiveBounds(MakePrimitiveRef(PrimitiveKind::Sphere, i)));
+        }
+        float size = MaxComponent(sphereBounds.Extent());
+        Aabb lightBounds;
+        lightBounds.Grow(Vec3(sphereBounds.min.x, sphereBounds.max.y + 0.5f, sphereBounds.min.z));
+        lightBounds.Grow(Vec3(sphereBounds.max.x, sphereBounds.max.y + 0.5f + 0.25f * size, sphereBounds.max.z));
+        Vec3 extent = lightBounds.Extent();
+
+        UINT emissiveSphereCount = 0;
+        for (UINT i = 0; i < scene.SphereCount() && emissiveSphereCount < lightCount / 2; i += c_emissiveSphereStride, emissiveSphereCount++)
+        {
+            MaterialConstantBuffer material = scene.materials[scene.sphereMaterial[i]];
+            scene.sphereMaterial[i] = scene.AddMaterial(material);
+            scene.SetMaterialEmission(scene.sphereMaterial[i], Vec3(HashToFloat(3 * i), HashToFloat(3 * i + 1), HashToFloat(3 * i + 2)) * 2.0f + Vec3(0.5f));
+        }
+        scene.AddEmissivePrimitiveLights();
+
+        for (UINT i = scene.LightCount(); i < lightCount; i++)
+        {
+            UINT seed = 8 * i;
+            Vec3 position = lightBounds.min + Vec3(HashToFloat(seed), HashToFloat(seed + 1), HashToFloat(seed + 2)) * extent;
+            Vec3 intensity = (Vec3(HashToFloat(seed + 3), HashToFloat(seed + 4), HashToFloat(seed + 5)) + Vec3(0.5f)) * (0.25f * size * size / lightCount);
+            if (i % 2)
+            {
+                scene.AddPointLight(position, intensity);
+            }
+            else
+            {
+                float radius = size * (0.005f + 0.01f * HashToFloat(seed + 6));
+                scene.AddSphereLight(position, radius, intensity * (1.0f / (3.14159265f * radius * radius)));
+            }
+        }
+
+        BVH bvh;
+        bvh.Build(scene);
+        LightTree lightTree;
+        timer.Start(BenchmarkTimers::Kernel);
+        lightTree.Build(scene);
+        timer.Stop(BenchmarkTimers::Kernel);
+
+        auto Accumulate = [&](vector<Vec3>& image, const PathSettings& settings, const LightTree* tree)
+        {
+            renderer.Render(scene, bvh, m_camera, settings, tree);
+            const vector<Vec3>& radiance = renderer.Radiance();
+            for (UINT i = 0; i < pixelCount; i++)
+            {
+                image[i] += radiance[i];
+            }
+            return renderer.Stats().rays.rays[RayType::Shadow];
+        };
+
+        // Both strategies are unbiased, so the reference uses the light tree with sample indices disjoint from the measured passes.
+        PathSettings settings;
+        settings.maxBounces = m_maxPathBounces;
+        settings.russianRoulette = false;
+        vector<Vec3> reference(pixelCount, Vec3(0.0f));
+        for (UINT pass = 0; pass < c_manyLightReferencePasses; pass++)
+        {
+            settings.sampleIndex = c_manyLightPasses + pass;
+            Accumulate(reference, settings, &lightTree);
+        }
+
+        text << L"  lights: " << scene.LightCount()
+            << L"    light tree: " << lightTree.NodeCount() << L" nodes (" << lightTree.SizeInBytes() / 1024.0 << L"KB)"
+            << L"    build: " << timer.GetElapsedMS(BenchmarkTimers::Kernel) << L"ms\n";
+
+        static const wchar_t* strategyNames[] = { L"Uniform", L"Light tree" };
+        for (UINT strategy = 0; strategy < 2; strategy++)
+        {
+            const LightTree* tree = strategy == 1 ? &lightTree : nullptr;
+            vector<Vec3> image(pixelCount, Vec3(0.0f));
+            UINT64 shadowRays = 0;
+            double elapsedMS = 0;
+
+            text << L"    " << strategyNames[strategy] << L":";
+            for (UINT pass = 1; pass <= c_manyLightPasses; pass++)
+            {
+                settings.sampleIndex = pass - 1;
+                timer.Start(BenchmarkTimers::Wavefront);
+                shadowRays += Accumulate(image, settings, tree);
+                timer.Stop(BenchmarkTimers::Wavefront);
+                elapsedMS += timer.GetElapsedMS(BenchmarkTimers::Wavefront);
+
+                // Noise against time at power of two pass counts.
+                if ((pass & (pass - 1)) == 0)
+                {
+                    text << L"    " << pass << L" passes: " << elapsedMS << L"ms RMSE "
+                        << setprecision(4) << RMSE(image, 1.0f / pass, reference, 1.0f / c_manyLightReferencePasses) << setprecision(2);
+                }
+            }
+            text << L"    shadow rays/pixel/pass: " << static_cast<double>(shadowRays) / (pixelCount * c_manyLightPasses) << L"\n";
+        }
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunAreaLights()
+{
+    Scene scene = LitBoxScene();
+    Camera camera = LitBoxCamera(m_camera.width, m_camera.height);
+    UINT pixelCount = camera.width * camera.height;
+
+    BVH bvh;
+    bvh.Build(scene);
+    LightTree lightTree;
+    lightTree.Build(scene);
+    WavefrontRenderer renderer(m_threadPool);
+
+    auto Accumulate = [&](vector<Vec3>& image, const PathSettings& settings)
+    {
+        renderer.Render(scene, bvh, camera, settings, &lightTree);
+        const vector<Vec3>& radiance = renderer.Radiance();
+        for (UINT i = 0; i < pixelCount; i++)
+        {
+            image[i] += radiance[i];
+        }
+        const RayStats& stats = renderer.Stats().rays;
+        return stats.rays[RayType::Radiance] + stats.rays[RayType::Shadow];
+    };
+
+    // Both integrators converge to the same image, the reference uses the faster one with disjoint sample indices.
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    settings.integrator = Integrator::NextEvent;
+    vector<Vec3> reference(pixelCount, Vec3(0.0f));
+    for (UINT pass = 0; pass < c_areaLightReferencePasses; pass++)
+    {
+        settings.sampleIndex = c_areaLightMaxPasses + pass;
+        Accumulate(reference, settings);
+    }
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU area lights: " << camera.width << L"x" << camera.height
+        << L"    lights: " << scene.LightCount()
+        << L"    max bounces: " << m_maxPathBounces
+        << L"    reference passes: " << c_areaLightReferencePasses
+        << L"    target RMSE: " << c_areaLightTargetRMSE << L"\n";
+
+    static const wchar_t* integratorNames[] = { L"BSDF sampling", L"Next event + MIS" };
+    static const Integrator::Enum integrators[] = { Integrator::BSDFSampling, Integrator::NextEvent };
+    for (UINT mode = 0; mode < 2; mode++)
+    {
+        settings.integrator = integrators[mode];
+        vector<Vec3> image(pixelCount, Vec3(0.0f));
+        UINT64 rays = 0;
+        UINT passes = 0;
+        float error = FLT_MAX;
+
+        DX::CPUTimer timer;
+        timer.Start(BenchmarkTimers::Kernel);
+        while (passes < c_areaLightMaxPasses && error >= c_areaLightTargetRMSE)
+        {
+            settings.sampleIndex = passes++;
+            rays += Accumulate(image, settings);
+            error = RMSE(image, 1.0f / passes, reference, 1.0f / c_areaLightReferencePasses);
+        }
+        timer.Stop(BenchmarkTimers::Kernel);
+
+        double elapsedMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+        text << L"    " << integratorNames[mode] << (error < c_areaLightTargetRMSE ? L": converged after " : L": not converged after ")
+            << passes << L" passes"
+            << L"    RMSE: " << setprecision(4) << error << setprecision(2)
+            << L"    rays/pixel/pass: " << static_cast<double>(rays) / pixelCount / passes
+            << L"    " << elapsedMS << L"ms";
+        if (error >= c_areaLightTargetRMSE)
+        {
+            // The error falls with the square root of the pass count.
+            double scale = (error / c_areaLightTargetRMSE) * (error / c_areaLightTargetRMSE);
+            text << L"    estimated to converge after ~" << static_cast<UINT>(passes * scale) << L" passes, ~" << elapsedMS * scale << L"ms";
+        }
+        text << L"\n";
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunAdaptiveSampling()
+{
+    // Sky lit diffuse paths: noisy where surfaces see little of the sky, noiseless in the background.
+    UINT pixelCount = m_camera.width * m_camera.height;
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    settings.integrator = Integrator::BSDFSampling;
+
+    WavefrontRenderer renderer(m_threadPool);
+    auto Accumulate = [&](vector<Vec3>& image)
+    {
+        renderer.Render(m_scene, m_bvh, m_camera, settings);
+        const vector<Vec3>& radiance = renderer.Radiance();
+        for (UINT i = 0; i < pixelCount; i++)
+        {
+            image[i] += radiance[i];
+        }
+        const RayStats& stats = renderer.Stats().rays;
+        return stats.rays[RayType::Radiance] + stats.rays[RayType::Shadow];
+    };
+
+    // Reference with sample indices disjoint from the measured renders.
+    vector<Vec3> reference(pixelCount, Vec3(0.0f));
+    for (UINT pass = 0; pass < c_adaptiveReferencePasses; pass++)
+    {
+        settings.sampleIndex = c_adaptiveReferencePasses + pass;
+        Accumulate(reference);
+    }
+
+    AdaptiveSettings adaptiveSettings;
+    AdaptiveRenderer adaptiveRenderer(m_threadPool);
+    DX::CPUTimer timer;
+    settings.sampleIndex = 0;
+    timer.Start(BenchmarkTimers::Kernel);
+    adaptiveRenderer.Render(m_scene, m_bvh, m_camera, settings, adaptiveSettings);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double adaptiveMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    const AdaptiveStats& adaptiveStats = adaptiveRenderer.Stats();
+    float adaptiveError = RMSE(adaptiveRenderer.Image(), 1.0f, reference, 1.0f / c_adaptiveReferencePasses);
+
+    // Uniform passes until the image is as close to the reference as the adaptive one.
+    vector<Vec3> image(pixelCount, Vec3(0.0f));
+    UINT64 uniformRays = 0;
+    UINT passes = 0;
+    float error = FLT_MAX;
+    timer.Start(BenchmarkTimers::Kernel);
+    while (passes < c_adaptiveMaxUniformPasses && error > adaptiveError)
+    {
+        settings.sampleIndex = passes++;
+        uniformRays += Accumulate(image);
+        error = RMSE(image, 1.0f / passes, reference, 1.0f / c_adaptiveReferencePasses);
+    }
+    timer.Stop(BenchmarkTimers::Kernel);
+    double uniformMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU adaptive sampling: " << m_camera.width << L"x" << m_camera.height
+        << L"    max bounces: " << m_maxPathBounces
+        << L"    reference passes: " << c_adaptiveReferencePasses
+        << L"    threshold: " << adaptiveSettings.errorThreshold
+        << L"    tile: " << adaptiveSettings.tileSize << L"x" << adaptiveSettings.tileSize << L"\n"
+        << L"    Adaptive: passes: " << adaptiveStats.passes
+        << L"    RMSE: " << setprecision(4) << adaptiveError << setprecision(2)
+        << L"    samples/pixel: " << static_cast<double>(adaptiveStats.samples) / pixelCount
+        << L"    rays/pixel: " << static_cast<double>(adaptiveStats.rays) / pixelCount
+        << L"    " << adaptiveMS << L"ms\n"
+        << L"    Uniform: passes: " << passes
+        << L"    RMSE: " << setprecision(4) << error << setprecision(2)
+        << L"    rays/pixel: " << static_cast<double>(uniformRays) / pixelCount
+        << L"    " << uniformMS << L"ms";
+    if (error > adaptiveError)
+    {
+        // The error falls with the square root of the pass count.
+        double scale = (error / adaptiveError) * (error / adaptiveError);
+        uniformRays = static_cast<UINT64>(uniformRays * scale);
+        text << L"    estimated to match after ~" << static_cast<UINT>(passes * scale) << L" passes";
+    }
+    text << L"\n    Rays saved: " << 100.0 * (1.0 - static_cast<double>(adaptiveStats.rays) / uniformRays) << L"%\n";
+
+    // Samples per pixel distribution in power of two buckets: up to minSamples, then (n/2, n].
+    vector<UINT> buckets;
+    for (UINT count : adaptiveRenderer.SampleCounts())
+    {
+        UINT bucket = 0;
+        for (UINT limit = adaptiveSettings.minSamples; limit < count; limit *= 2)
+        {
+            bucket++;
+        }
+        if (bucket >= buckets.size())
+        {
+            buckets.resize(bucket + 1, 0);
+        }
+        buckets[bucket]++;
+    }
+    text << L"    Samples/pixel:";
+    for (UINT bucket = 0, limit = adaptiveSettings.minSamples; bucket < buckets.size(); bucket++, limit *= 2)
+    {
+        text << L"    <=" << limit << L": " << 100.0 * buckets[bucket] / pixelCount << L"%";
+    }
+    text << L"\n";
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunDenoiser()
+{
+    // Sky lit diffuse paths, as in RunAdaptiveSampling().
+    UINT pixelCount = m_camera.width * m_camera.height;
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    settings.integrator = Integrator::BSDFSampling;
+
+    WavefrontRenderer renderer(m_threadPool);
+    auto Accumulate = [&](vector<Vec3>& image)
+    {
+        renderer.Render(m_scene, m_bvh, m_camera, settings);
+        const vector<Vec3>& radiance = renderer.Radiance();
+        for (UINT i = 0; i < pixelCount; i++)
+        {
+            image[i] += radiance[i];
+        }
+    };
+
+    // Reference with sample indices disjoint from the measured renders.
+    vector<Vec3> reference(pixelCount, Vec3(0.0f));
+    for (UINT pass = 0; pass < c_denoiseReferencePasses; pass++)
+    {
+        settings.sampleIndex = c_denoiseReferencePasses + pass;
+        Accumulate(reference);
+    }
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU denoiser: " << m_camera.width << L"x" << m_camera.height
+        << L"    max bounces: " << m_maxPathBounces
+        << L"    reference passes: " << c_denoiseReferencePasses << L"\n";
+
+    Denoiser denoiser(m_threadPool);
+    DX::CPUTimer timer;
+    for (UINT samples : c_denoiseSampleCounts)
+    {
+        vector<Vec3> image(pixelCount, Vec3(0.0f));
+        timer.Start(BenchmarkTimers::Kernel);
+        for (UINT pass = 0; pass < samples; pass++)
+        {
+            settings.sampleIndex = pass;
+            Accumulate(image);
+        }
+        for (Vec3& color : image)
+        {
+            color *= 1.0f / samples;
+        }
+        timer.Stop(BenchmarkTimers::Kernel);
+        double renderMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+        // The first hits, and so the guides, are the same in every pass.
+        DenoiseSettings denoiseSettings;
+        denoiseSettings.samples = samples;
+        timer.Start(BenchmarkTimers::Kernel);
+        for (UINT repeat = 0; repeat < c_denoiseRepeats; repeat++)
+        {
+            denoiser.Denoise(m_camera.width, m_camera.height, image, renderer.Albedo(), renderer.Normals(), renderer.Depths(), denoiseSettings);
+        }
+        timer.Stop(BenchmarkTimers::Kernel);
+        double denoiseMS = timer.GetElapsedMS(BenchmarkTimers::Kernel) / c_denoiseRepeats;
+
+        float noisyError = RMSE(image, 1.0f, reference, 1.0f / c_denoiseReferencePasses);
+        float denoisedError = RMSE(denoiser.Output(), 1.0f, reference, 1.0f / c_denoiseReferencePasses);
+
+        // The error of the undenoised image falls with the square root of the pass count.
+        double equivalentPasses = samples * (noisyError / denoisedError) * (noisyError / denoisedError);
+        double renderMSPerPass = renderMS / samples;
+        text << L"    " << samples << L" spp: RMSE: " << setprecision(4) << noisyError
+            << L" -> " << denoisedError << setprecision(2)
+            << L"    render: " << renderMS << L"ms"
+            << L"    denoise: " << denoiseMS << L"ms (" << denoiseMS * 1e6 / pixelCount << L"ms/megapixel)"
+            << L"    matches ~" << equivalentPasses << L" spp, ~" << equivalentPasses * renderMSPerPass << L"ms"
+            << L"    time: " << 100.0 * (renderMS + denoiseMS) / (equivalentPasses * renderMSPerPass) << L"%\n";
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunPreview()
+{
+    UINT pixelCount = m_camera.width * m_camera.height;
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+
+    // Baseline: the full frame in one render call, after a warm up call.
+    WavefrontRenderer renderer(m_threadPool);
+    renderer.Render(m_scene, m_bvh, m_camera, settings);
+    DX::CPUTimer timer;
+    timer.Start(BenchmarkTimers::Wavefront);
+    renderer.Render(m_scene, m_bvh, m_camera, settings);
+    timer.Stop(BenchmarkTimers::Wavefront);
+    double frameMS = timer.GetElapsedMS(BenchmarkTimers::Wavefront);
+
+    PreviewSettings previewSettings;
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU preview: " << m_camera.width << L"x" << m_camera.height
+        << L"    tile: " << previewSettings.tileSize << L"x" << previewSettings.tileSize
+        << L"    coarsest block: " << previewSettings.coarsestBlock << L"x" << previewSettings.coarsestBlock
+        << L"    full frame: " << frameMS << L"ms\n";
+
+    // Every pixel is traced once with the frame's random numbers, so the final preview matches the frame.
+    static const wchar_t* orderNames[] = { L"Scanline", L"Hilbert", L"Spiral" };
+    // The first render allocates the queues, it is a warm up call too.
+    PreviewRenderer preview(m_threadPool);
+    preview.Render(m_scene, m_bvh, m_camera, settings, previewSettings);
+    for (UINT order = 0; order < TileOrder::Count; order++)
+    {
+        previewSettings.order = static_cast<TileOrder::Enum>(order);
+        preview.Render(m_scene, m_bvh, m_camera, settings, previewSettings);
+
+        UINT mismatches = 0;
+        for (UINT i = 0; i < pixelCount; i++)
+        {
+            Vec3 difference = preview.Image()[i] - renderer.Radiance()[i];
+            mismatches += difference.x != 0 || difference.y != 0 || difference.z != 0 ? 1 : 0;
+        }
+        const PreviewStats& stats = preview.Stats();
+        text << L"    " << orderNames[order] << L": first image: " << stats.firstImageMS << L"ms"
+            << L"    center tile: " << stats.centerTileMS << L"ms"
+            << L"    final: " << stats.totalMS << L"ms"
+            << L"    batches: " << stats.batches
+            << L"    mismatches: " << mismatches << L"\n";
+        Check(mismatches == 0, L"preview against full frame");
+    }
+
+    // A camera move halfway through a preview: cancel it from another thread and measure how long
+    // it takes to stop, and to get the first image of the restarted preview.
+    previewSettings.order = TileOrder::Spiral;
+    std::atomic<bool> cancel(false);
+    bool completed = true;
+    std::thread previewThread([&]()
+    {
+        completed = preview.Render(m_scene, m_bvh, m_camera, settings, previewSettings, &cancel);
+    });
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(frameMS * c_previewCancelPoint * 1000.0)));
+    timer.Start(BenchmarkTimers::Wavefront);
+    cancel = true;
+    previewThread.join();
+    timer.Stop(BenchmarkTimers::Wavefront);
+    double cancelMS = timer.GetElapsedMS(BenchmarkTimers::Wavefront);
+    PreviewStats cancelledStats = preview.Stats();
+
+    cancel = false;
+    preview.Render(m_scene, m_bvh, m_camera, settings, previewSettings, &cancel);
+    text << L"    Camera move after " << frameMS * c_previewCancelPoint << L"ms: "
+        << (completed ? L"preview already complete" : L"cancelled")
+        << L" in " << cancelMS << L"ms    levels done: " << cancelledStats.levels
+        << L"    batches: " << cancelledStats.batches
+        << L"    first image after the move: " << cancelMS + preview.Stats().firstImageMS << L"ms\n";
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunRandom()
+{
+    wstringstream text;
+    text << setprecision(2) << fixed << L"CPU random numbers: " << c_randomSpheres << L" spheres\n";
+
+    // Scene generation: one shared generator in sequence, against a stream per sphere, in sequence and in parallel.
+    DX::CPUTimer timer;
+    vector<RandomSphere> spheres(c_randomSpheres);
+    srand(c_randomSceneSeed);
+    timer.Start(BenchmarkTimers::Kernel);
+    for (UINT i = 0; i < c_randomSpheres; i++)
+    {
+        spheres[i] = GenerateSphere(RandDouble);
+    }
+    timer.Stop(BenchmarkTimers::Kernel);
+    double randMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+    auto GenerateSpheres = [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT i = begin; i < end; i++)
+        {
+            RandomStream random(c_randomSceneSeed, i);
+            spheres[i] = GenerateSphere([&random]() { return random.NextDouble(); });
+        }
+    };
+    timer.Start(BenchmarkTimers::Kernel);
+    GenerateSpheres(0, c_randomSpheres, 0);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double streamMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    vector<RandomSphere> serialSpheres = spheres;
+
+    timer.Start(BenchmarkTimers::Kernel);
+    m_threadPool.ParallelFor(c_randomSpheres, WavefrontRenderer::BatchSize, GenerateSpheres);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double parallelMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    UINT sphereMismatches = 0;
+    for (UINT i = 0; i < c_randomSpheres; i++)
+    {
+        sphereMismatches += memcmp(&spheres[i], &serialSpheres[i], sizeof(RandomSphere)) == 0 ? 0 : 1;
+    }
+
+    text << L"    rand(): " << randMS << L"ms"
+        << L"    stream per sphere: " << streamMS << L"ms"
+        << L"    parallel, " << m_threadPool.ThreadCount() << L" threads: " << parallelMS << L"ms"
+        << L"    mismatches: " << sphereMismatches << L"\n";
+    Check(sphereMismatches == 0, L"random spheres in parallel against in sequence");
+
+    // Paths draw from a stream per pixel, sample and vertex, so renders match for any thread count.
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    settings.integrator = Integrator::BSDFSampling;
+    vector<Vec3> reference;
+    for (UINT threadCount : c_randomThreadCounts)
+    {
+        ThreadPool threadPool(threadCount);
+        WavefrontRenderer renderer(threadPool);
+        renderer.Render(m_scene, m_bvh, m_camera, settings);
+        if (reference.empty())
+        {
+            reference = renderer.Radiance();
+            continue;
+        }
+
+        UINT mismatches = 0;
+        for (size_t i = 0; i < reference.size(); i++)
+        {
+            Vec3 difference = renderer.Radiance()[i] - reference[i];
+            mismatches += difference.x != 0 || difference.y != 0 || difference.z != 0 ? 1 : 0;
+        }
+        text << L"    Render with " << threadCount << L" threads against " << c_randomThreadCounts[0] << L": pixel mismatches: " << mismatches << L"\n";
+        Check(mismatches == 0, L"render across thread counts");
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunSceneGeneration()
+{
+    wstringstream text;
+    text << setprecision(2) << fixed << L"CPU scene generation:\n";
+
+    DX::CPUTimer timer;
+    ThreadPool serialThreadPool(1);
+    for (UINT sphereCount : c_generatedSphereCounts)
+    {
+        RandomSceneSettings settings;
+        settings.sphereCount = sphereCount;
+
+        // Once on a single thread and once on the pool, the scenes have to match.
+        Scene serialScene;
+        SceneGenerator serialGenerator(serialThreadPool);
+        timer.Start(BenchmarkTimers::Kernel);
+        serialGenerator.Generate(serialScene, settings);
+        timer.Stop(BenchmarkTimers::Kernel);
+        double serialMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+        Scene scene;
+        SceneGenerator generator(m_threadPool);
+        timer.Start(BenchmarkTimers::Kernel);
+        generator.Generate(scene, settings);
+        timer.Stop(BenchmarkTimers::Kernel);
+        double parallelMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+        UINT sphereCountGenerated = scene.SphereCount();
+        UINT mismatches = serialScene.SphereCount() == sphereCountGenerated ? 0 : sphereCountGenerated;
+        for (UINT i = 0; i < sphereCountGenerated && mismatches == 0; i++)
+        {
+            bool same = scene.sphereCenterX[i] == serialScene.sphereCenterX[i] && scene.sphereCenterZ[i] == serialScene.sphereCenterZ[i] &&
+                scene.sphereRadius[i] == serialScene.sphereRadius[i] &&
+                memcmp(&scene.materials[scene.sphereMaterial[i]], &serialScene.materials[serialScene.sphereMaterial[i]], sizeof(MaterialConstantBuffer)) == 0;
+            mismatches += same ? 0 : 1;
+        }
+
+        // Independent overlap check: spheres sorted into cells of the largest diameter, each tested against the 3x3 cells around it.
+        float cellSize = 2.0f * settings.maxRadius;
+        const RandomSceneStats& stats = generator.Stats();
+        UINT gridSize = static_cast<UINT>(ceil(stats.extent / cellSize)) + 1;
+        auto CellOf = [&](UINT i, int dx, int dz)
+        {
+            int x = static_cast<int>((scene.sphereCenterX[i] + 0.5f * stats.extent) / cellSize) + dx;
+            int z = static_cast<int>((scene.sphereCenterZ[i] + 0.5f * stats.extent) / cellSize) + dz;
+            return static_cast<UINT64>(z + 1) * (gridSize + 2) + (x + 1);
+        };
+        vector<pair<UINT64, UINT>> cells(sphereCountGenerated);
+        for (UINT i = 0; i < sphereCountGenerated; i++)
+        {
+            cells[i] = make_pair(CellOf(i, 0, 0), i);
+        }
+        sort(cells.begin(), cells.end());
+
+        UINT overlaps = 0;
+        for (UINT i = 0; i < sphereCountGenerated; i++)
+        {
+            for (int dz = -1; dz <= 1; dz++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    UINT64 cell = CellOf(i, dx, dz);
+                    auto it = lower_bound(cells.begin(), cells.end(), make_pair(cell, 0u));
+                    for (; it != cells.end() && it->first == cell; ++it)
+                    {
+                        UINT j = it->second;
+                        Vec3 d = Vec3(scene.sphereCenterX[j], scene.sphereCenterY[j], scene.sphereCenterZ[j]) -
+                            Vec3(scene.sphereCenterX[i], scene.sphereCenterY[i], scene.sphereCenterZ[i]);
+                        float radii = scene.sphereRadius[i] + scene.sphereRadius[j];
+                        overlaps += j > i && Dot(d, d) < radii * radii * 0.9999f ? 1 : 0;
+                    }
+                }
+            }
+        }
+
+        BVH bvh;
+        timer.Start(BenchmarkTimers::BuildBVH);
+        bvh.Build(scene);
+        timer.Stop(BenchmarkTimers::BuildBVH);
+
+        double megabytes = (sphereCountGenerated * (8 * sizeof(float)) + scene.materials.size() * (sizeof(MaterialConstantBuffer) + sizeof(UINT) + sizeof(Vec3))) / (1024.0 * 1024.0);
+        text << L"    " << sphereCountGenerated << L" of " << sphereCount << L" spheres"
+            << L"    grid: " << stats.gridSize << L"x" << stats.gridSize << L" cells of " << stats.cellSize
+            << L"    candidates/sphere: " << static_cast<double>(stats.candidates) / (std::max)(1u, sphereCountGenerated)
+            << L"    overlap tests/candidate: " << static_cast<double>(stats.overlapTests) / (std::max)(UINT64(1), stats.candidates) << L"\n"
+            << L"        serial: " << serialMS << L"ms"
+            << L"    parallel, " << m_threadPool.ThreadCount() << L" threads: " << parallelMS << L"ms"
+            << L" (" << sphereCountGenerated / (std::max)(parallelMS, 1e-3) / 1000.0 << L" Mspheres/s)"
+            << L"    scene: " << megabytes << L"MB, " << stats.materials << L" materials"
+            << L"    mismatches: " << mismatches
+            << L"    overlaps: " << overlaps
+            << L"    BVH build: " << timer.GetElapsedMS(BenchmarkTimers::BuildBVH) << L"ms\n";
+        Check(mismatches == 0, L"generated scene on the pool against on a single thread");
+        Check(overlaps == 0, L"generated spheres don't overlap");
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunSceneFile()
+{
+    // The benchmark scene and a generated sphere field, written out, loaded back and compared.
+    Scene scene = SceneWithSphereField(c_sceneFileSpheres);
+
+    DX::CPUTimer timer;
+    string file;
+    timer.Start(BenchmarkTimers::Kernel);
+    SceneFileLoader::Write(scene, file);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double writeMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    double megabytes = file.size() / (1024.0 * 1024.0);
+
+    timer.Start(BenchmarkTimers::Kernel);
+    UINT streamRecords = ParseWithStreams(file);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double streamMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+    ThreadPool serialThreadPool(1);
+    SceneFileLoader serialLoader(serialThreadPool);
+    SceneDescription serialDescription;
+    timer.Start(BenchmarkTimers::Kernel);
+    serialLoader.Parse(file, serialDescription);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double serialMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+    // Parsed twice, the second parse reuses the description's arrays like reloading a scene does.
+    SceneFileLoader loader(m_threadPool);
+    SceneDescription description;
+    loader.Parse(file, description);
+    timer.Start(BenchmarkTimers::Kernel);
+    loader.Parse(file, description);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double parallelMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+    Scene loaded;
+    timer.Start(BenchmarkTimers::Kernel);
+    loader.AddToScene(description, loaded);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double addMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+    UINT records = static_cast<UINT>(description.lights.size() + description.materials.size() + description.spheres.size() +
+        description.vertices.size() + description.triangles.size() + description.manyLights.size());
+    UINT mismatches = loaded.SphereCount() == scene.SphereCount() && loaded.TriangleCount() == scene.TriangleCount() &&
+        loaded.materials.size() == scene.materials.size() && loaded.lights.size() == scene.lights.size() ? 0 : 1;
+    for (UINT i = 0; i < scene.SphereCount() && mismatches == 0; i++)
+    {
+        mismatches += loaded.sphereCenterX[i] == scene.sphereCenterX[i] && loaded.sphereCenterY[i] == scene.sphereCenterY[i] &&
+            loaded.sphereCenterZ[i] == scene.sphereCenterZ[i] && loaded.sphereRadius[i] == scene.sphereRadius[i] &&
+            loaded.sphereMaterial[i] == scene.sphereMaterial[i] ? 0 : 1;
+    }
+    for (size_t i = 0; i < scene.materials.size() && mismatches == 0; i++)
+    {
+        mismatches += memcmp(&loaded.materials[i], &scene.materials[i], sizeof(MaterialConstantBuffer)) == 0 ? 0 : 1;
+    }
+    UINT serialMismatches = serialDescription.spheres.size() == description.spheres.size() &&
+        memcmp(serialDescription.spheres.data(), description.spheres.data(), description.spheres.size() * sizeof(SceneFileSphere)) == 0 ? 0 : 1;
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU scene file: " << records << L" records (" << streamRecords << L" by the baseline)    " << megabytes << L"MB"
+        << L"    write: " << writeMS << L"ms\n"
+        << L"    string streams: " << streamMS << L"ms (" << megabytes * 1000.0 / (std::max)(streamMS, 1e-3) << L"MB/s)"
+        << L"    chunked, 1 thread: " << serialMS << L"ms (" << megabytes * 1000.0 / (std::max)(serialMS, 1e-3) << L"MB/s)"
+        << L"    chunked, " << m_threadPool.ThreadCount() << L" threads: " << parallelMS << L"ms (" << megabytes * 1000.0 / (std::max)(parallelMS, 1e-3) << L"MB/s)"
+        << L"    add to scene: " << addMS << L"ms\n"
+        << L"    round trip mismatches: " << mismatches << L"    thread count mismatches: " << serialMismatches << L"\n";
+    OutputDebugStringW(text.str().c_str());
+    Check(records == streamRecords, L"scene file records against string stream parsing");
+    Check(mismatches == 0, L"scene file round trip");
+    Check(serialMismatches == 0, L"scene file parsed on the pool against on a single thread");
+}
+
+void Benchmark::RunSceneCache()
+{
+    // The benchmark scene and a generated sphere field, written as a scene file and as a scene cache with its BVH.
+    Scene scene = SceneWithSphereField(c_sceneCacheSpheres);
+    BVH bvh;
+    bvh.Build(scene);
+
+    wstring textPath = TempFilePath(L"RTEngineSceneCache.txt");
+    wstring cachePath = TempFilePath(L"RTEngineSceneCache.bin");
+
+    double textMegabytes = SceneFileLoader::Save(textPath, scene) / (1024.0 * 1024.0);
+
+    DX::CPUTimer timer;
+    timer.Start(BenchmarkTimers::Kernel);
+    SceneCache::Write(cachePath, scene, &bvh);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double writeMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+    // Time to the first ray: from the file on disk to the camera's center ray hit. The files were just written,
+    // so both are read from the file cache and the times are those of parsing and building, not of the disk.
+    // The cached scene and BVH view the mapping, the first ray faults in the pages it touches.
+    Ray ray = m_camera.GenerateRay(m_camera.width / 2, m_camera.height / 2);
+    auto Measure = [&](double* stageMS, const function<void()>& stage)
+    {
+        timer.Start(BenchmarkTimers::Kernel);
+        stage();
+        timer.Stop(BenchmarkTimers::Kernel);
+        *stageMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    };
+
+    Scene textScene;
+    BVH textBVH;
+    Hit textHit;
+    double textMS[4];
+    SceneFileLoader loader(m_threadPool);
+    SceneDescription description;
+    Measure(&textMS[0], [&] { loader.Load(textPath, description); });
+    Measure(&textMS[1], [&] { loader.AddToScene(description, textScene); });
+    Measure(&textMS[2], [&] { textBVH.Build(textScene); });
+    Measure(&textMS[3], [&] { textBVH.Intersect(textScene, ray, textHit); });
+
+    Scene cachedScene;
+    BVH cachedBVH;
+    Hit cachedHit;
+    double cachedMS[4];
+    SceneCache cache;
+    Measure(&cachedMS[0], [&] { cache.Open(cachePath); });
+    Measure(&cachedMS[1], [&] { cache.ReadScene(cachedScene); });
+    Measure(&cachedMS[2], [&] { cache.ReadBVH(cachedBVH); });
+    Measure(&cachedMS[3], [&] { cachedBVH.Intersect(cachedScene, ray, cachedHit); });
+    double cacheMegabytes = cache.SizeInBytes() / (1024.0 * 1024.0);
+
+    // Without the cached BVH, built from the mapped primitive bounds.
+    Scene boundsScene;
+    BVH boundsBVH;
+    Hit boundsHit;
+    double boundsMS[4];
+    SceneCache boundsCache;
+    Measure(&boundsMS[0], [&] { boundsCache.Open(cachePath); });
+    Measure(&boundsMS[1], [&] { boundsCache.ReadScene(boundsScene); });
+    Measure(&boundsMS[2], [&] { boundsCache.BuildBVH(boundsScene, boundsBVH); });
+    Measure(&boundsMS[3], [&] { boundsBVH.Intersect(boundsScene, ray, boundsHit); });
+    UINT copies = cachedScene.sphereCenterX.IsView() && cachedScene.triangleV0.IsView() && cachedScene.materials.IsView() &&
+        cachedBVH.Nodes().IsView() && cachedBVH.PrimitiveRefs().IsView() && boundsScene.sphereRadius.IsView() ? 0 : 1;
+
+    // The cached scene and both BVHs must match the originals bit for bit. Triangles of the text path are rebuilt
+    // from their vertices, so only its hit primitive is compared.
+    auto Same = [](const void* a, const void* b, size_t size) { return size == 0 || memcmp(a, b, size) == 0; };
+    UINT mismatches = cachedScene.SphereCount() == scene.SphereCount() && cachedScene.TriangleCount() == scene.TriangleCount() &&
+        cachedScene.materials.size() == scene.materials.size() && cachedScene.lights.size() == scene.lights.size() &&
+        cachedBVH.NodeCount() == bvh.NodeCount() && boundsBVH.NodeCount() == bvh.NodeCount() ? 0 : 1;
+    if (mismatches == 0)
+    {
+        mismatches += Same(cachedScene.sphereCenterX.data(), scene.sphereCenterX.data(), scene.SphereCount() * sizeof(float)) &&
+            Same(cachedScene.sphereCenterY.data(), scene.sphereCenterY.data(), scene.SphereCount() * sizeof(float)) &&
+            Same(cachedScene.sphereCenterZ.data(), scene.sphereCenterZ.data(), scene.SphereCount() * sizeof(float)) &&
+            Same(cachedScene.sphereRadius.data(), scene.sphereRadius.data(), scene.SphereCount() * sizeof(float)) &&
+            Same(cachedScene.sphereMaterial.data(), scene.sphereMaterial.data(), scene.SphereCount() * sizeof(UINT)) &&
+            Same(cachedScene.triangleV0.data(), scene.triangleV0.data(), scene.TriangleCount() * sizeof(Vec3)) &&
+            Same(cachedScene.materials.data(), scene.materials.data(), scene.materials.size() * sizeof(MaterialConstantBuffer)) ? 0 : 1;
+        mismatches += Same(cachedBVH.Nodes().data(), bvh.Nodes().data(), bvh.NodeCount() * sizeof(BVHNode)) &&
+            Same(boundsBVH.Nodes().data(), bvh.Nodes().data(), bvh.NodeCount() * sizeof(BVHNode)) &&
+            Same(boundsBVH.PrimitiveRefs().data(), bvh.PrimitiveRefs().data(), bvh.PrimitiveRefs().size() * sizeof(UINT)) ? 0 : 1;
+    }
+    UINT hitMismatches = (cachedHit.primitive == textHit.primitive ? 0 : 1) + (boundsHit.primitive == textHit.primitive ? 0 : 1) +
+        (cachedHit.t == boundsHit.t ? 0 : 1);
+    cache.Close();
+    boundsCache.Close();
+    DeleteFile(textPath.c_str());
+    DeleteFile(cachePath.c_str());
+
+    // Caches also arrive over the network, reading one with an index out of range has to throw.
+    vector<BYTE> bytes;
+    SceneCache::Serialize(scene, &bvh, bytes);
+    const SceneCacheHeader& header = *reinterpret_cast<const SceneCacheHeader*>(bytes.data());
+    UINT firstLeaf = 0;
+    while (!bvh.Nodes()[firstLeaf].IsLeaf())
+    {
+        firstLeaf++;
+    }
+    struct Corruption
+    {
+        SceneCacheSection::Enum section;
+        size_t offset;
+        UINT value;
+    };
+    const Corruption corruptions[] =
+    {
+        { SceneCacheSection::SphereMaterial, 0, static_cast<UINT>(scene.materials.size()) },
+        { SceneCacheSection::BVHNodes, offsetof(BVHNode, leftFirst), bvh.NodeCount() - 1 },            // Second child past the end.
+        { SceneCacheSection::BVHNodes, offsetof(BVHNode, leftFirst), 0 },                              // The root is its own child.
+        { SceneCacheSection::BVHNodes, firstLeaf * sizeof(BVHNode) + offsetof(BVHNode, leftFirst), static_cast<UINT>(bvh.PrimitiveRefs().size()) },
+        { SceneCacheSection::BVHPrimitiveRefs, 0, MakePrimitiveRef(PrimitiveKind::Sphere, scene.SphereCount()) },
+    };
+    vector<BYTE> corruptedBytes(bytes.size() + SceneCache::SectionAlignment);
+    BYTE* corrupted = corruptedBytes.data() + (SceneCache::SectionAlignment - reinterpret_cast<uintptr_t>(corruptedBytes.data()) % SceneCache::SectionAlignment);
+    UINT corruptionsAccepted = 0;
+    for (const Corruption& corruption : corruptions)
+    {
+        memcpy(corrupted, bytes.data(), bytes.size());
+        memcpy(corrupted + header.sections[corruption.section].offset + corruption.offset, &corruption.value, sizeof(UINT));
+        try
+        {
+            SceneCache corruptedCache;
+            corruptedCache.Open(corrupted, bytes.size());
+            Scene corruptedScene;
+            BVH corruptedBVH;
+            corruptedCache.ReadScene(corruptedScene);
+            corruptedCache.ReadBVH(corruptedBVH);
+            corruptionsAccepted++;
+        }
+        catch (...)
+        {
+        }
+    }
+
+    auto PrintPath = [](wstringstream& text, const wchar_t* label, const double* stageMS, const wchar_t* const* stages)
+    {
+        text << L"    " << label << L": " << stageMS[0] + stageMS[1] + stageMS[2] + stageMS[3] << L"ms (";
+        for (UINT i = 0; i < 4; i++)
+        {
+            text << (i > 0 ? L", " : L"") << stages[i] << L" " << stageMS[i] << L"ms";
+        }
+        text << L")\n";
+    };
+    const wchar_t* textStages[] = { L"load", L"add to scene", L"BVH build", L"first ray" };
+    const wchar_t* cachedStages[] = { L"map", L"view and check scene", L"view and check BVH", L"first ray" };
+    const wchar_t* boundsStages[] = { L"map", L"view and check scene", L"BVH build from mapped bounds", L"first ray" };
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU scene cache: " << scene.SphereCount() << L" spheres    " << scene.TriangleCount() << L" triangles"
+        << L"    scene file: " << textMegabytes << L"MB    cache: " << cacheMegabytes << L"MB, written in " << writeMS << L"ms\n"
+        << L"    time to first ray:\n";
+    PrintPath(text, L"scene file", textMS, textStages);
+    PrintPath(text, L"scene cache", cachedMS, cachedStages);
+    PrintPath(text, L"scene cache without BVH", boundsMS, boundsStages);
+    text << L"    mismatches: " << mismatches << L"    copied arrays: " << copies << L"    first hit mismatches: " << hitMismatches
+        << L"    corrupted caches accepted: " << corruptionsAccepted << L" of " << _countof(corruptions) << L"\n";
+    OutputDebugStringW(text.str().c_str());
+    Check(mismatches == 0, L"scene cache round trip");
+    Check(copies == 0, L"scene cache read in place");
+    Check(hitMismatches == 0, L"first hit from scene cache against scene file");
+    Check(corruptionsAccepted == 0, L"corrupted scene caches rejected");
+}
+
+void Benchmark::RunImageWriter()
+{
+    struct ImageOutput
+    {
+        const wchar_t* label;
+        const wchar_t* file;
+        ImageFormat::Enum format;
+        ImagePixelType::Enum pixelType;
+        bool guides;
+    };
+    const ImageOutput outputs[] =
+    {
+        { L"PFM float", L"RTEngineImage.pfm", ImageFormat::PFM, ImagePixelType::Float, false },
+        { L"EXR half", L"RTEngineImage.exr", ImageFormat::EXR, ImagePixelType::Half, false },
+        { L"EXR half with guides", L"RTEngineImage.exr", ImageFormat::EXR, ImagePixelType::Half, true },
+        { L"EXR float with guides", L"RTEngineImage.exr", ImageFormat::EXR, ImagePixelType::Float, true },
+    };
+
+    UINT width = m_camera.width;
+    UINT height = m_camera.height;
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    WavefrontRenderer renderer(m_threadPool);
+    DX::CPUTimer timer;
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU image writer: " << width << L"x" << height << L"    tiles: " << c_imageTileSize << L"x" << c_imageTileSize
+        << L"    tile buffers: " << c_imagePendingTiles << L"\n";
+
+    UINT pfmMismatches = 0;
+    for (const ImageOutput& output : outputs)
+    {
+        wstring path = TempFilePath(output.file);
+        vector<ImageLayer> layers = RenderImageLayers(output.guides);
+        ImageWriterSettings writerSettings;
+        writerSettings.pixelType = output.pixelType;
+
+        // Baseline: the frame rendered in one go, then copied into an image of the file format and written out.
+        writerSettings.tileSize = (std::max)(width, height);
+        writerSettings.maxPendingTiles = 1;
+        ImageWriter frameWriter;
+        timer.Start(BenchmarkTimers::Kernel);
+        frameWriter.Open(path, output.format, width, height, layers, writerSettings);
+        RenderImage(renderer, m_scene, m_bvh, m_camera, settings, frameWriter);
+        frameWriter.Close();
+        timer.Stop(BenchmarkTimers::Kernel);
+        double frameMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+        ImageWriterStats frameStats = frameWriter.Stats();
+
+        byte* frameFile = nullptr;
+        UINT frameFileSize = 0;
+        if (output.format == ImageFormat::PFM)
+        {
+            ThrowIfFailed(ReadDataFromFile(path.c_str(), &frameFile, &frameFileSize));
+        }
+
+        writerSettings.tileSize = c_imageTileSize;
+        writerSettings.maxPendingTiles = c_imagePendingTiles;
+        ImageWriter writer;
+        timer.Start(BenchmarkTimers::Kernel);
+        writer.Open(path, output.format, width, height, layers, writerSettings);
+        RenderImage(renderer, m_scene, m_bvh, m_camera, settings, writer);
+        writer.Close();
+        timer.Stop(BenchmarkTimers::Kernel);
+        double streamedMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+        const ImageWriterStats& stats = writer.Stats();
+
+        // Rendered a band at a time, the streamed PFM must match the one of the frame rendered in one go byte for byte.
+        if (output.format == ImageFormat::PFM)
+        {
+            byte* file = nullptr;
+            UINT fileSize = 0;
+            ThrowIfFailed(ReadDataFromFile(path.c_str(), &file, &fileSize));
+            pfmMismatches += fileSize == frameFileSize && memcmp(file, frameFile, fileSize) == 0 ? 0 : 1;
+            free(file);
+            free(frameFile);
+        }
+        DeleteFile(path.c_str());
+
+        text << L"    " << output.label << L": " << stats.bytes / (1024.0 * 1024.0) << L"MB"
+            << L"    whole frame: " << frameMS << L"ms, " << frameStats.bufferBytes / (1024.0 * 1024.0) << L"MB buffered"
+            << L"    streamed: " << streamedMS << L"ms, " << stats.bufferBytes / (1024.0 * 1024.0) << L"MB buffered, "
+            << L"peak pending tiles: " << stats.peakPendingTiles << L", waits: " << stats.waits << L", I/O thread busy " << stats.ioMS << L"ms\n";
+    }
+    text << L"    streamed PFM mismatches: " << pfmMismatches << L"\n";
+    OutputDebugStringW(text.str().c_str());
+    Check(pfmMismatches == 0, L"streamed PFM against whole frame PFM");
+}
+
+void Benchmark::RunTonemap()
+{
+    // The rendered frame repeated over a 4K frame, exposed so that the highlights reach the shoulder of the curves.
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    WavefrontRenderer renderer(m_threadPool);
+    renderer.Render(m_scene, m_bvh, m_camera, settings);
+    const vector<Vec3>& radiance = renderer.Radiance();
+    size_t pixelCount = static_cast<size_t>(c_tonemapWidth) * c_tonemapHeight;
+    vector<Vec3> frame(pixelCount);
+    for (UINT y = 0; y < c_tonemapHeight; y++)
+    {
+        for (UINT x = 0; x < c_tonemapWidth; x++)
+        {
+            frame[static_cast<size_t>(y) * c_tonemapWidth + x] = radiance[(y % m_camera.height) * m_camera.width + x % m_camera.width];
+        }
+    }
+
+    typedef void (*TonemapRowFunction)(const float*, UINT, UINT, UINT, const OutputTransform&, BYTE*);
+    auto TonemapRows = [&](TonemapRowFunction tonemapRow, const OutputTransform& transform, UINT begin, UINT end, vector<BYTE>& image)
+    {
+        for (UINT y = begin; y < end; y++)
+        {
+            size_t pixel = static_cast<size_t>(y) * c_tonemapWidth;
+            tonemapRow(&frame[pixel].x, c_tonemapWidth, 0, y, transform, &image[3 * pixel]);
+        }
+    };
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU tone mapping: " << c_tonemapWidth << L"x" << c_tonemapHeight
+        << L"    exposure: " << c_tonemapExposure << L"    sRGB, 8x8 ordered dither    threads: " << m_threadPool.ThreadCount() << L"\n";
+
+    static const wchar_t* curveNames[ToneCurve::Count] = { L"Clamp", L"Reinhard", L"ACES" };
+    vector<BYTE> reference(3 * pixelCount);
+    vector<BYTE> image(3 * pixelCount);
+    DX::CPUTimer timer;
+    for (UINT curve = 0; curve < ToneCurve::Count; curve++)
+    {
+        OutputTransform transform;
+        transform.exposure = c_tonemapExposure;
+        transform.toneCurve = static_cast<ToneCurve::Enum>(curve);
+
+        timer.Start(BenchmarkTimers::Kernel);
+        TonemapRows(TonemapRowReference, transform, 0, c_tonemapHeight, reference);
+        timer.Stop(BenchmarkTimers::Kernel);
+        double referenceMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+        timer.Start(BenchmarkTimers::Kernel);
+        TonemapRows(TonemapRow, transform, 0, c_tonemapHeight, image);
+        timer.Stop(BenchmarkTimers::Kernel);
+        double singleThreadMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+        timer.Start(BenchmarkTimers::Kernel);
+        m_threadPool.ParallelFor(c_tonemapHeight, 16, [&](UINT begin, UINT end, UINT)
+        {
+            TonemapRows(TonemapRow, transform, begin, end, image);
+        });
+        timer.Stop(BenchmarkTimers::Kernel);
+        double poolMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+
+        // The sRGB approximation may round a value the other way than the exact curve.
+        size_t mismatches = 0;
+        int maxDifference = 0;
+        for (size_t i = 0; i < image.size(); i++)
+        {
+            int difference = abs(static_cast<int>(image[i]) - static_cast<int>(reference[i]));
+            mismatches += difference != 0 ? 1 : 0;
+            maxDifference = (std::max)(maxDifference, difference);
+        }
+
+        text << L"    " << curveNames[curve] << L": scalar: " << referenceMS << L"ms (" << referenceMS * 1e6 / pixelCount << L"ns/pixel)"
+            << L"    SSE: " << singleThreadMS << L"ms (" << singleThreadMS * 1e6 / pixelCount << L"ns/pixel)"
+            << L"    SSE on the pool: " << poolMS << L"ms"
+            << L"    speedup: " << referenceMS / singleThreadMS << L"x"
+            << L"    bytes off the exact curve: " << setprecision(4) << 100.0 * mismatches / image.size() << setprecision(2)
+            << L"%, by up to " << maxDifference << L"\n";
+        // Within 0.01 of a quantization step of the exact curve, so a byte may round the other way but by one at most.
+        Check(maxDifference <= 1, (wstring(curveNames[curve]) + L": SSE tone mapping against the scalar reference").c_str());
+    }
+
+    // The frame streamed to a PPM, tone mapped as the writer encodes each band, and to a PFM for comparison.
+    // The PPM has to hold exactly the bytes of the frame tone mapped in one go.
+    OutputTransform transform;
+    transform.exposure = c_tonemapExposure;
+    TonemapRows(TonemapRow, transform, 0, c_tonemapHeight, image);
+
+    struct ImageOutput
+    {
+        const wchar_t* label;
+        const wchar_t* file;
+        ImageFormat::Enum format;
+    };
+    const ImageOutput outputs[] =
+    {
+        { L"PFM", L"RTEngineImage.pfm", ImageFormat::PFM },
+        { L"PPM", L"RTEngineImage.ppm", ImageFormat::PPM },
+    };
+    for (const ImageOutput& output : outputs)
+    {
+        wstring path = TempFilePath(output.file);
+        ImageWriterSettings writerSettings;
+        writerSettings.tileSize = c_imageTileSize;
+        writerSettings.maxPendingTiles = c_imagePendingTiles;
+        writerSettings.outputTransform = transform;
+
+        ImageWriter writer;
+        timer.Start(BenchmarkTimers::Kernel);
+        writer.Open(path, output.format, c_tonemapWidth, c_tonemapHeight, RenderImageLayers(false), writerSettings);
+        for (UINT tileY = 0; tileY < writer.TilesY(); tileY++)
+        {
+            const float* layerPixels[] = { &frame[static_cast<size_t>(tileY) * writer.TileHeight() * c_tonemapWidth].x };
+            writer.WriteTile(0, tileY, layerPixels, c_tonemapWidth);
+        }
+        writer.Close();
+        timer.Stop(BenchmarkTimers::Kernel);
+        double writeMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+        const ImageWriterStats& stats = writer.Stats();
+
+        text << L"    streamed " << output.label << L": " << writeMS << L"ms, " << stats.bytes / (1024.0 * 1024.0) << L"MB"
+            << L", I/O thread busy " << stats.ioMS << L"ms";
+        if (output.format == ImageFormat::PPM)
+        {
+            byte* file = nullptr;
+            UINT fileSize = 0;
+            ThrowIfFailed(ReadDataFromFile(path.c_str(), &file, &fileSize));
+            bool matches = fileSize >= image.size() && memcmp(file + fileSize - image.size(), image.data(), image.size()) == 0;
+            free(file);
+            text << L", matches the tone mapped frame: " << (matches ? L"yes" : L"no");
+            Check(matches, L"streamed PPM against the frame tone mapped in one go");
+        }
+        text << L"\n";
+        DeleteFile(path.c_str());
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunSequence()
+{
+    struct SequenceMode
+    {
+        const wchar_t* label;
+        bool refit;
+        bool pipelined;
+    };
+    const SequenceMode modes[] =
+    {
+        { L"One at a time, BVH rebuilt", false, false },
+        { L"One at a time, BVH refit", true, false },
+        { L"Pipelined, BVH refit", true, true },
+    };
+
+    // The benchmark scene and a generated sphere field, large enough for the BVH to take a share of the frame time.
+    // Every sphere bobs up and down, each with its own phase.
+    Scene scene = SceneWithSphereField(c_sequenceSpheres);
+    vector<float> centerY(scene.sphereCenterY.begin(), scene.sphereCenterY.end());
+    auto update = [&](float time, Scene& frameScene, Camera&)
+    {
+        for (UINT i = 0; i < frameScene.SphereCount(); i++)
+        {
+            float phase = 2.0f * 3.14159265f * (time / c_sequenceBobPeriod + i * 0.1f);
+            frameScene.sphereCenterY[i] = centerY[i] + c_sequenceBobHeight * std::sin(phase);
+        }
+    };
+
+    wstring path = TempFilePath(L"RTEngineSequence.pfm");
+    SequenceSettings settings;
+    settings.frameCount = c_sequenceFrames;
+    settings.pathSettings.maxBounces = m_maxPathBounces;
+    settings.writerSettings.tileSize = c_imageTileSize;
+    settings.writerSettings.maxPendingTiles = c_imagePendingTiles;
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU sequence: " << m_camera.width << L"x" << m_camera.height << L"    frames: " << c_sequenceFrames
+        << L"    frame time: " << settings.frameTime * 1000 << L"ms    spheres: " << scene.SphereCount() << L"\n";
+
+    // Every mode has to render the frames of the first one, byte for byte.
+    vector<vector<BYTE>> firstFrames(c_sequenceFrames);
+    SequenceRenderer renderer(m_threadPool);
+    double baselineMS = 0;
+    for (const SequenceMode& mode : modes)
+    {
+        bool first = &mode == &modes[0];
+        settings.refit = mode.refit;
+        settings.pipelined = mode.pipelined;
+        renderer.Render(scene, m_camera, update, path, settings);
+
+        UINT mismatches = 0;
+        for (UINT frame = 0; frame < c_sequenceFrames; frame++)
+        {
+            wstring framePath = SequenceRenderer::FramePath(path, frame);
+            byte* file = nullptr;
+            UINT fileSize = 0;
+            ThrowIfFailed(ReadDataFromFile(framePath.c_str(), &file, &fileSize));
+            if (first)
+            {
+                firstFrames[frame].assign(file, file + fileSize);
+            }
+            else
+            {
+                mismatches += fileSize == firstFrames[frame].size() && memcmp(file, firstFrames[frame].data(), fileSize) == 0 ? 0 : 1;
+            }
+            free(file);
+            DeleteFile(framePath.c_str());
+        }
+
+        SequenceFrameStats sum;
+        double maxFrameMS = 0;
+        for (const SequenceFrameStats& stats : renderer.FrameStats())
+        {
+            sum.updateMS += stats.updateMS;
+            sum.bvhMS += stats.bvhMS;
+            sum.renderMS += stats.renderMS;
+            maxFrameMS = (std::max)(maxFrameMS, stats.frameMS);
+        }
+        baselineMS = first ? renderer.TotalMS() : baselineMS;
+        text << L"    " << mode.label << L": " << renderer.TotalMS() << L"ms, " << c_sequenceFrames * 1000.0 / renderer.TotalMS() << L" frames/s"
+            << L"    per frame: update " << sum.updateMS / c_sequenceFrames << L"ms, BVH " << sum.bvhMS / c_sequenceFrames
+            << L"ms, render " << sum.renderMS / c_sequenceFrames << L"ms, slowest frame " << maxFrameMS << L"ms"
+            << L"    speedup: " << baselineMS / renderer.TotalMS() << L"x";
+        if (!first)
+        {
+            text << L"    frames that differ: " << mismatches;
+            Check(mismatches == 0, L"sequence frames across modes");
+        }
+        text << L"\n";
+    }
+
+    // Frame by frame timings of the pipelined run, frame 0 builds the BVH.
+    for (UINT frame = 0; frame < c_sequenceFrames; frame++)
+    {
+        const SequenceFrameStats& stats = renderer.FrameStats()[frame];
+        text << L"        frame " << frame << L": " << stats.frameMS << L"ms    update: " << stats.updateMS << L"ms    BVH: " << stats.bvhMS
+            << L"ms    render: " << stats.renderMS << L"ms\n";
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunDistributed()
+{
+    struct DistributedRun
+    {
+        const wchar_t* label;
+        UINT workers;
+        bool faults;            // The second worker drops its connection after a few tiles and the third is a straggler.
+    };
+    const DistributedRun runs[] =
+    {
+        { L"1 worker", 1, false },
+        { L"2 workers", 2, false },
+        { L"4 workers", 4, false },
+        { L"3 workers, one lost and one straggling", 3, true },
+    };
+
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    DistributedSettings distributedSettings;
+    distributedSettings.tileSize = c_distributedTileSize;
+
+    // The local render every distributed one has to match, byte for byte. The first render allocates the queues.
+    DX::CPUTimer timer;
+    WavefrontRenderer renderer(m_threadPool);
+    renderer.Render(m_scene, m_bvh, m_camera, settings);
+    timer.Start(BenchmarkTimers::Kernel);
+    renderer.Render(m_scene, m_bvh, m_camera, settings);
+    timer.Stop(BenchmarkTimers::Kernel);
+    double localMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    const vector<Vec3>& reference = renderer.Radiance();
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU distributed rendering: " << m_camera.width << L"x" << m_camera.height << L"    tile: " << c_distributedTileSize
+        << L"    local render: " << localMS << L"ms\n";
+
+    // Workers run on threads of this process with thread pools of their own, over loopback connections, which exercises
+    // the same protocol as worker processes on other machines.
+    double singleWorkerMS = 0;
+    for (const DistributedRun& run : runs)
+    {
+        UINT threadsPerWorker = (std::max)(1u, m_threadPool.ThreadCount() / run.workers);
+        vector<thread> workerThreads;
+        vector<Vec3> image;
+        DistributedStats firstFrame;
+        DistributedStats secondFrame;
+        {
+            TileCoordinator coordinator;
+            coordinator.Listen(0);
+            coordinator.SetScene(m_scene, m_bvh);
+            for (UINT i = 0; i < run.workers; i++)
+            {
+                TileWorkerSettings workerSettings;
+                if (run.faults)
+                {
+                    workerSettings.maxTiles = i == 1 ? c_distributedCrashTiles : UINT_MAX;
+                    workerSettings.delayMS = i == 2 ? c_distributedStragglerDelayMS : 0;
+                }
+                UINT16 port = coordinator.Port();
+                workerThreads.emplace_back([=]()
+                {
+                    // A worker that fails is a lost worker to the coordinator, which renders its tiles elsewhere.
+                    try
+                    {
+                        ThreadPool threadPool(threadsPerWorker);
+                        TileWorker worker(threadPool);
+                        worker.Run("127.0.0.1", port, workerSettings);
+                    }
+                    catch (...)
+                    {
+                    }
+                });
+            }
+            ThrowIfFalse(coordinator.WaitForWorkers(run.workers, distributedSettings.timeoutMS), L"Distributed render workers failed to connect.");
+
+            // The first frame sends the scene to the workers, the second one only tiles.
+            coordinator.Render(m_camera, settings, image, distributedSettings);
+            firstFrame = coordinator.Stats();
+            if (!run.faults)
+            {
+                coordinator.Render(m_camera, settings, image, distributedSettings);
+            }
+            secondFrame = coordinator.Stats();
+        }
+        for (thread& workerThread : workerThreads)
+        {
+            workerThread.join();
+        }
+
+        UINT mismatches = 0;
+        for (size_t i = 0; i < image.size(); i++)
+        {
+            mismatches += memcmp(&image[i], &reference[i], sizeof(Vec3)) == 0 ? 0 : 1;
+        }
+        singleWorkerMS = run.workers == 1 ? secondFrame.renderMS : singleWorkerMS;
+        text << L"    " << run.label << L", " << threadsPerWorker << L" threads each: first frame " << firstFrame.renderMS
+            << L"ms, scene sent " << firstFrame.sceneBytes / (1024.0 * 1024.0) << L"MB";
+        if (!run.faults)
+        {
+            text << L"    frame: " << secondFrame.renderMS << L"ms    vs local: " << localMS / secondFrame.renderMS
+                << L"x    vs 1 worker: " << singleWorkerMS / secondFrame.renderMS << L"x";
+        }
+        text << L"    workers used: " << secondFrame.workers << L"    lost: " << secondFrame.lostWorkers
+            << L"    tiles reissued: " << secondFrame.reissuedTiles << L", stolen: " << secondFrame.stolenTiles
+            << L", duplicates dropped: " << secondFrame.duplicateResults << L"    pixels that differ: " << mismatches << L"\n";
+        Check(mismatches == 0, L"distributed render against local render");
+    }
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunRenderService()
+{
+    // The benchmark scene and a generated sphere field as a scene file and as a scene cache without a BVH.
+    Scene scene = SceneWithSphereField(c_serviceSpheres);
+    wstring filePath = TempFilePath(L"RTEngineService.txt");
+    wstring cachePath = TempFilePath(L"RTEngineService.cache");
+    SceneFileLoader::Save(filePath, scene);
+    SceneCache::Write(cachePath, scene);
+
+    // A single cached scene, so jobs alternating between the two files evict each other.
+    RenderServiceSettings serviceSettings;
+    serviceSettings.maxScenes = 1;
+    RenderService service(m_threadPool, serviceSettings);
+    service.Listen(0);
+    thread serviceThread([&]() { service.Run(); });
+
+    RenderClient client;
+    client.Connect(service.Port());
+    RenderJob job;
+    job.camera = m_camera;
+    job.samplesPerPixel = c_serviceSamples;
+    job.maxBounces = m_maxPathBounces;
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU render service: " << m_camera.width << L"x" << m_camera.height << L"    samples per pixel: " << c_serviceSamples
+        << L"    spheres: " << scene.SphereCount() << L"\n";
+
+    // Latency as the client sees it, from sending the job to the last pixel.
+    DX::CPUTimer timer;
+    vector<Vec3> image;
+    RenderJobStats stats;
+    auto Submit = [&](const wstring& id, const RenderTileCallback& onTile)
+    {
+        timer.Start(BenchmarkTimers::Kernel);
+        client.Render(job, id, image, stats, onTile);
+        timer.Stop(BenchmarkTimers::Kernel);
+        return timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    };
+    auto Report = [&](const wchar_t* label, double latencyMS)
+    {
+        text << L"    " << label << L": " << latencyMS << L"ms    " << (stats.cached ? L"cached" : L"loaded")
+            << L"    load: " << stats.loadMS << L"ms    BVH: " << stats.bvhMS << L"ms    render: " << stats.renderMS << L"ms\n";
+    };
+
+    Report(L"First job, scene file", Submit(filePath, RenderTileCallback()));
+    vector<Vec3> wholeImage = image;
+
+    double warmMS = 0;
+    double warmRenderMS = 0;
+    double fastestMS = DBL_MAX;
+    for (UINT i = 0; i < c_serviceWarmJobs; i++)
+    {
+        double latencyMS = Submit(filePath, RenderTileCallback());
+        warmMS += latencyMS;
+        warmRenderMS += stats.renderMS;
+        fastestMS = (std::min)(fastestMS, latencyMS);
+    }
+    Report(L"Last job on the cached scene", timer.GetElapsedMS(BenchmarkTimers::Kernel));
+
+    // The same passes rendered in this process on the service's scene, the trace time a job can't go below.
+    RenderJobStats sceneStats;
+    shared_ptr<const ServiceScene> serviceScene = service.FindScene(filePath, sceneStats);
+    WavefrontRenderer renderer(m_threadPool);
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    vector<Vec3> localImage(image.size());
+    renderer.Render(serviceScene->scene, serviceScene->bvh, m_camera, settings);
+    timer.Start(BenchmarkTimers::Kernel);
+    for (UINT sample = 0; sample < c_serviceSamples; sample++)
+    {
+        settings.sampleIndex = sample;
+        renderer.Render(serviceScene->scene, serviceScene->bvh, m_camera, settings);
+        for (size_t i = 0; i < localImage.size(); i++)
+        {
+            localImage[i] += renderer.Radiance()[i];
+        }
+    }
+    for (Vec3& pixel : localImage)
+    {
+        pixel *= 1.0f / c_serviceSamples;
+    }
+    timer.Stop(BenchmarkTimers::Kernel);
+    double localMS = timer.GetElapsedMS(BenchmarkTimers::Kernel);
+    text << L"    " << c_serviceWarmJobs << L" jobs on the cached scene: " << warmMS / c_serviceWarmJobs << L"ms on average, fastest "
+        << fastestMS << L"ms, render " << warmRenderMS / c_serviceWarmJobs << L"ms    local render: " << localMS
+        << L"ms    overhead: " << warmMS / c_serviceWarmJobs - localMS << L"ms\n";
+
+    // Tiles of the same job as they finish.
+    DX::CPUTimer firstTileTimer;
+    UINT tiles = 0;
+    job.tileSize = c_serviceTileSize;
+    firstTileTimer.Start();
+    double tiledMS = Submit(filePath, [&](UINT, UINT, UINT, UINT, const Vec3*)
+    {
+        if (tiles++ == 0)
+        {
+            firstTileTimer.Stop();
+        }
+        return true;
+    });
+    job.tileSize = 0;
+    vector<Vec3> tiledImage = image;
+    text << L"    Tiled job, " << c_serviceTileSize << L"x" << c_serviceTileSize << L": " << tiledMS << L"ms    " << tiles
+        << L" tiles, first after " << firstTileTimer.GetElapsedMS() << L"ms\n";
+
+    // The scene cache evicts the scene file, which is loaded again.
+    Report(L"Scene cache, evicting the scene file", Submit(cachePath, RenderTileCallback()));
+    Report(L"Scene file again", Submit(filePath, RenderTileCallback()));
+
+    UINT mismatches[3] = {};
+    for (size_t i = 0; i < wholeImage.size(); i++)
+    {
+        mismatches[0] += memcmp(&wholeImage[i], &localImage[i], sizeof(Vec3)) == 0 ? 0 : 1;
+        mismatches[1] += memcmp(&tiledImage[i], &localImage[i], sizeof(Vec3)) == 0 ? 0 : 1;
+        mismatches[2] += memcmp(&image[i], &localImage[i], sizeof(Vec3)) == 0 ? 0 : 1;
+    }
+    text << L"    pixels that differ from the local render: whole image " << mismatches[0] << L", tiled " << mismatches[1]
+        << L", reloaded " << mismatches[2] << L"    scenes cached: " << service.CachedSceneCount() << L"\n";
+    Check(mismatches[0] == 0 && mismatches[1] == 0 && mismatches[2] == 0, L"render service jobs against local render");
+
+    client.StopService();
+    serviceThread.join();
+    DeleteFile(filePath.c_str());
+    DeleteFile(cachePath.c_str());
+    OutputDebugStringW(text.str().c_str());
+}
+
+void Benchmark::RunCameraRays()
+{
+    UINT width = m_camera.width;
+    UINT height = m_camera.height;
+    UINT count = width * height;
+    vector<float> directionsX(count), directionsY(count), directionsZ(count);
+    vector<float> referenceX(count), referenceY(count), referenceZ(count);
+    DX::CPUTimer timer;
+
+    // Generates the image's directions c_cameraRayPasses times, returns the time of a pass.
+    auto Time = [&](const function<void(UINT y)>& generateRow)
+    {
+        timer.Start(BenchmarkTimers::Kernel);
+        for (UINT pass = 0; pass < c_cameraRayPasses; pass++)
+        {
+            m_threadPool.ParallelFor(height, 1, [&](UINT begin, UINT end, UINT)
+            {
+                for (UINT y = begin; y < end; y++)
+                {
+                    generateRow(y);
+                }
+            });
+        }
+        timer.Stop(BenchmarkTimers::Kernel);
+        return timer.GetElapsedMS(BenchmarkTimers::Kernel) / c_cameraRayPasses;
+    };
+
+    // Unprojecting each pixel with the camera's matrix.
+    double matrixMS = Time([&](UINT y)
+    {
+        for (UINT x = 0; x < width; x++)
+        {
+            Vec3 direction = m_camera.GenerateRay(x, y).direction;
+            referenceX[y * width + x] = direction.x;
+            referenceY[y * width + x] = direction.y;
+            referenceZ[y * width + x] = direction.z;
+        }
+    });
+
+    // The per-frame basis one ray at a time, and rows of rays with SSE.
+    CameraRayBasis basis(m_camera);
+    double basisMS = Time([&](UINT y)
+    {
+        for (UINT x = 0; x < width; x++)
+        {
+            Vec3 direction = basis.GenerateRay(x, y).direction;
+            directionsX[y * width + x] = direction.x;
+            directionsY[y * width + x] = direction.y;
+            directionsZ[y * width + x] = direction.z;
+        }
+    });
+    vector<float> scalarX = directionsX;
+    vector<float> scalarY = directionsY;
+    vector<float> scalarZ = directionsZ;
+    double simdMS = Time([&](UINT y)
+    {
+        basis.GenerateDirections(0, y, width, nullptr, nullptr, &directionsX[y * width], &directionsY[y * width], &directionsZ[y * width]);
+    });
+
+    UINT mismatches = 0;
+    float maxAngle = 0.0f;
+    for (UINT i = 0; i < count; i++)
+    {
+        mismatches += directionsX[i] != scalarX[i] || directionsY[i] != scalarY[i] || directionsZ[i] != scalarZ[i] ? 1 : 0;
+        // The arc cosine can't resolve angles this small, the cross product can.
+        Vec3 direction(directionsX[i], directionsY[i], directionsZ[i]);
+        Vec3 reference(referenceX[i], referenceY[i], referenceZ[i]);
+        maxAngle = (std::max)(maxAngle, std::atan2(Length(Cross(direction, reference)), Dot(direction, reference)));
+    }
+
+    wstringstream text;
+    text << setprecision(2) << fixed
+        << L"CPU camera rays: " << width << L"x" << height << L"\n";
+    auto Report = [&](const wchar_t* label, double passMS)
+    {
+        text << L"    " << label << L": " << passMS << L"ms    " << count / (1000.0 * passMS) << L" Mrays/s    "
+            << matrixMS / passMS << L"x\n";
+    };
+    Report(L"Matrix unprojection per pixel", matrixMS);
+    Report(L"Ray basis per pixel", basisMS);
+    Report(L"Ray basis, SSE rows", simdMS);
+    text << setprecision(3) << scientific
+        << L"    largest angle to the matrix rays: " << maxAngle << L" radians    SSE rays that differ from the scalar basis: "
+        << mismatches << L"\n" << setprecision(2) << fixed;
+    Check(mismatches == 0, L"SSE camera rays against scalar ray basis");
+
+    // Generation against tracing in a render, at pixel centers and jittered in strata.
+    WavefrontRenderer renderer(m_threadPool);
+    PathSettings settings;
+    settings.maxBounces = m_maxPathBounces;
+    renderer.Render(m_scene, m_bvh, m_camera, settings);
+    for (UINT strata : { 0u, c_cameraRayStrata })
+    {
+        settings.jitterStrata = strata;
+        renderer.Render(m_scene, m_bvh, m_camera, settings);
+        const WavefrontStats& stats = renderer.Stats();
+        double generateMS = stats.stageMS[WavefrontStage::Generate];
+        double traceMS = 0;
+        for (UINT stage = WavefrontStage::Extend; stage < WavefrontStage::Count; stage++)
+        {
+            traceMS += stats.stageMS[stage];
+        }
+        text << L"    Render, " << (strata ? to_wstring(strata) + L"x" + to_wstring(strata) + L" jittered strata" : wstring(L"pixel centers"))
+            << L": generate " << generateMS << L"ms, other stages " << traceMS << L"ms    generate share: "
+            << 100.0 * generateMS / (generateMS + traceMS) << L"%\n";
+    }
+
+    OutputDebugStringW(text.str().c_str());
+}
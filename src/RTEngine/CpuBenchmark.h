@@ -0,0 +1,143 @@
+#ifndef CPU_BENCHMARK_H
+#define CPU_BENCHMARK_H
+
+#include "CpuBVH.h"
+#include "CpuCamera.h"
+#include "CpuMetaballs.h"
+#include "CpuThreadPool.h"
+
+namespace Cpu
+{
+    // Offline measurements of the CPU backend, enabled with the -cpuBenchmark command line argument.
+    // Results are written to the debugger output.
+    class Benchmark
+    {
+    public:
+        Benchmark(const Scene& scene, const Camera& camera, UINT maxPathBounces = MAX_PATH_BOUNCES);
+
+        // Builds the BVH and runs all benchmarks. Benchmarks check their results against a reference, Run() throws
+        // once all of them ran if a check failed, see FailedChecks().
+        void Run();
+
+        // Traces one primary ray per pixel and a shadow ray from every hit towards the light,
+        // once with the first hit closest hit traversal and once with the occlusion only traversal.
+        void RunShadowRays();
+
+        // Renders the frame with the wavefront renderer and reports per stage timings and queue occupancy.
+        void RunWavefront();
+
+        // Accumulates passes with fixed depth and with Russian roulette path termination until the image
+        // converges to a fixed depth reference, and reports the rays spent per converged pixel.
+        void RunPathTermination();
+
+        // Times the sin() hashed value noise the shaders used before against the table driven
+        // gradient noise, scalar and in structure of arrays layout with SSE.
+        void RunNoise();
+
+        // Compares texel fetch throughput of a high resolution texture in linear and tiled layout,
+        // for rotated scanline, mip filtered and random access patterns.
+        void RunTextures();
+
+        // Intersects the animated MetaballDemo field with uniform ray marching and with sphere tracing,
+        // and reports the potential evaluations and hit rates of both. Then intersects growing random
+        // fields and the metaball file, if set, with and without the field's culling grid.
+        void RunMetaballs();
+
+        // Gives every sphere a linear motion and traces primary rays at several times of the shutter interval,
+        // once through a single BVH over the swept bounds and once through a BVH rebuilt at every time sample.
+        void RunMotionBlur();
+
+        // Lights the scene with thousands of point, sphere and emissive sphere lights and accumulates passes that
+        // sample one light per hit, picked uniformly and by the light tree, reporting the noise against render time.
+        void RunManyLights();
+
+        // Renders a box lit by a quad and a sphere area light with BSDF sampling only and with next event estimation
+        // and multiple importance sampling, and reports the time each takes to reach a target error.
+        void RunAreaLights();
+
+        // Renders sky lit diffuse paths with per tile adaptive sampling, then with uniform passes until they match its
+        // error, and reports the rays each spends and the distribution of the adaptive samples per pixel.
+        void RunAdaptiveSampling();
+
+        // Denoises sky lit diffuse renders of a few samples per pixel, and reports the filter time per megapixel and
+        // how many samples per pixel, and how much render time, the renders without the filter need for the same error.
+        void RunDenoiser();
+
+        // Renders coarse to fine previews with tiles in scanline, Hilbert and spiral order and reports the time to
+        // the first image, to the finished center tile and to the final image. Then cancels a preview halfway, as a
+        // camera move does, and reports the time until it stops and until the restarted preview's first image.
+        void RunPreview();
+
+        // Generates random spheres from the C runtime's rand() and from a random stream per sphere, in sequence and in
+        // parallel, and renders the frame with several thread counts to check the results don't depend on them.
+        void RunRandom();
+
+        // Generates random sphere fields of growing size on a single thread and on the pool, checks the scenes match and
+        // that no spheres overlap, and reports the generation time and the time to build the BVH over the scene.
+        void RunSceneGeneration();
+
+        // Writes the scene with a generated sphere field to the scene file format, loads it back and compares, and reports
+        // the parse throughput of the chunked loader on a single thread and on the pool against string stream parsing.
+        void RunSceneFile();
+
+        // Writes the scene with a generated sphere field as a scene file and as a scene cache, and reports the time from
+        // each file to the camera's first ray hit: parsing and building the BVH against mapping the cache and reading
+        // its BVH, or building one from the cache's primitive bounds.
+        void RunSceneCache();
+
+        // Renders the frame to PFM and EXR files, in one go and then copied into the file, and a band at a time streamed
+        // to the file as tiles by the image writer's I/O thread, and reports the time and the memory each holds.
+        void RunImageWriter();
+
+        // Tone maps the rendered frame, repeated over a 4K frame, with each tone curve through the scalar reference and
+        // the SSE output transform, and reports the time per frame and pixel and how far the SSE bytes are off. Then
+        // streams the frame to a PPM, tone mapped as the writer encodes it, against streaming the floats to a PFM.
+        void RunTonemap();
+
+        // Renders a short animation of bobbing spheres to files with the sequence renderer, one frame at a time with a BVH
+        // rebuilt and with one refit every frame, then pipelined with the next frame's update and refit overlapping the
+        // current frame's render, and reports the throughput and the per frame timings. All modes must render the same frames.
+        void RunSequence();
+
+        // Renders the frame with the tile coordinator on 1, 2 and 4 workers over loopback connections, and with a worker
+        // that drops its connection and a straggler, and reports the frame times, the scene transfer and the tiles sent
+        // again or twice. The image must match a local render pixel for pixel.
+        void RunDistributed();
+
+        // Sends render jobs to a render service over a loopback connection: the first job on a scene file, which loads it
+        // and builds its BVH, then jobs on the cached scene against rendering them in this process, a tiled job, and jobs
+        // that evict the scene from the cache. Reports each job's latency and where its time went.
+        void RunRenderService();
+
+        // Generates the image's camera rays by unprojecting every pixel with the camera's matrix, with the per-frame
+        // ray basis one ray at a time, and with the basis a row of rays at a time with SSE, then compares the time the
+        // wavefront renderer spends generating camera rays with tracing them, at pixel centers and jittered in strata.
+        void RunCameraRays();
+
+        // Metaball file for RunMetaballs(), see MetaballField::Load().
+        void SetMetaballFile(const std::wstring& path) { m_metaballFile = path; }
+        // Metaballs of a scene file, added to RunMetaballs() like the metaball file.
+        void SetSceneMetaballs(const std::vector<AnimatedMetaball>& metaballs) { m_sceneMetaballs = metaballs; }
+
+        // Checks that failed in the benchmarks run so far, each is reported to the debugger output.
+        UINT FailedChecks() const { return m_failedChecks; }
+
+    private:
+        void BuildBVH();
+        // The benchmark scene with a generated sphere field of sphereCount spheres added.
+        Scene SceneWithSphereField(UINT sphereCount);
+        // Counts a failed check, the benchmark goes on reporting its measurements.
+        void Check(bool passed, const wchar_t* check);
+
+        const Scene& m_scene;
+        const Camera& m_camera;
+        UINT m_maxPathBounces;
+        std::wstring m_metaballFile;
+        std::vector<AnimatedMetaball> m_sceneMetaballs;
+        BVH m_bvh;
+        ThreadPool m_threadPool;
+        UINT m_failedChecks;
+    };
+}
+
+#endif // !CPU_BENCHMARK_H
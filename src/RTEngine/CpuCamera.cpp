@@ -0,0 +1,75 @@
+#include "stdafx.h"
+#include "CpuCamera.h"
+#include <emmintrin.h>
+
+using namespace Cpu;
+
+CameraRayBasis::CameraRayBasis(const Camera& camera) :
+    origin(camera.position)
+{
+    // Each row of the matrix unprojected relative to the camera position: the direction through screen point (sx, sy)
+    // is sx * screenX + sy * screenY + screenOrigin, divided by the homogeneous w of the point.
+    const XMFLOAT4X4& m = camera.projectionToWorld;
+    Vec3 p = camera.position;
+    Vec3 screenX = Vec3(m._11, m._12, m._13) - p * m._14;
+    Vec3 screenY = Vec3(m._21, m._22, m._23) - p * m._24;
+    Vec3 screenOrigin = Vec3(m._41, m._42, m._43) - p * m._44;
+
+    // The divide scales the direction, only its sign matters before normalizing, taken at the image center.
+    if (m._44 < 0.0f)
+    {
+        screenX = -screenX;
+        screenY = -screenY;
+        screenOrigin = -screenOrigin;
+    }
+
+    // Pixel coordinates map to screenX = px / width * 2 - 1 and screenY = 1 - py / height * 2.
+    right = screenX * (2.0f / camera.width);
+    down = screenY * (-2.0f / camera.height);
+    corner = screenOrigin - screenX + screenY;
+}
+
+void CameraRayBasis::GenerateDirections(UINT x, UINT y, UINT count, const float* offsetsX, const float* offsetsY,
+    float* directionsX, float* directionsY, float* directionsZ) const
+{
+    // The row's part of the direction is the same for all its pixels.
+    float rowY = static_cast<float>(y);
+    __m128 cornerX = _mm_set1_ps(corner.x);
+    __m128 cornerY = _mm_set1_ps(corner.y);
+    __m128 cornerZ = _mm_set1_ps(corner.z);
+    __m128 rightX = _mm_set1_ps(right.x);
+    __m128 rightY = _mm_set1_ps(right.y);
+    __m128 rightZ = _mm_set1_ps(right.z);
+    __m128 downX = _mm_set1_ps(down.x);
+    __m128 downY = _mm_set1_ps(down.y);
+    __m128 downZ = _mm_set1_ps(down.z);
+    __m128 center = _mm_set1_ps(0.5f);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+
+    UINT i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 px = _mm_add_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x + i)), lanes), offsetsX ? _mm_loadu_ps(offsetsX + i) : center);
+        __m128 py = _mm_add_ps(_mm_set1_ps(rowY), offsetsY ? _mm_loadu_ps(offsetsY + i) : center);
+
+        __m128 dx = _mm_add_ps(_mm_add_ps(cornerX, _mm_mul_ps(rightX, px)), _mm_mul_ps(downX, py));
+        __m128 dy = _mm_add_ps(_mm_add_ps(cornerY, _mm_mul_ps(rightY, px)), _mm_mul_ps(downY, py));
+        __m128 dz = _mm_add_ps(_mm_add_ps(cornerZ, _mm_mul_ps(rightZ, px)), _mm_mul_ps(downZ, py));
+
+        // A full precision square root and divide, like Normalize(), so the lanes match the scalar rays.
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+        _mm_storeu_ps(directionsX + i, _mm_mul_ps(dx, invLength));
+        _mm_storeu_ps(directionsY + i, _mm_mul_ps(dy, invLength));
+        _mm_storeu_ps(directionsZ + i, _mm_mul_ps(dz, invLength));
+    }
+
+    for (; i < count; i++)
+    {
+        Vec3 direction = GenerateRay(x + i, y, offsetsX ? offsetsX[i] : 0.5f, offsetsY ? offsetsY[i] : 0.5f).direction;
+        directionsX[i] = direction.x;
+        directionsY[i] = direction.y;
+        directionsZ[i] = direction.z;
+    }
+}
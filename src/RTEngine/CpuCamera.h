@@ -0,0 +1,100 @@
+#ifndef CPU_CAMERA_H
+#define CPU_CAMERA_H
+
+#include "CpuRay.h"
+
+namespace Cpu
+{
+    // CPU port of GenerateCameraRay() in RaytracingShaderHelper.hlsli.
+    struct Camera
+    {
+        XMFLOAT4X4 projectionToWorld;
+        Vec3 position;
+        UINT width = 0;
+        UINT height = 0;
+
+        void Set(const XMMATRIX& _projectionToWorld, const XMVECTOR& _position, UINT _width, UINT _height)
+        {
+            XMStoreFloat4x4(&projectionToWorld, _projectionToWorld);
+            XMFLOAT3 p;
+            XMStoreFloat3(&p, _position);
+            position = Vec3(p);
+            width = _width;
+            height = _height;
+        }
+
+        // Generate a ray in world space for a camera pixel corresponding to an index from the dispatched 2D grid.
+        Ray GenerateRay(UINT x, UINT y, float offsetX = 0.5f, float offsetY = 0.5f) const
+        {
+            float screenX = (x + offsetX) / width * 2.0f - 1.0f;
+            float screenY = -((y + offsetY) / height * 2.0f - 1.0f);
+
+            // Unproject the pixel coordinate into a world positon.
+            const XMFLOAT4X4& m = projectionToWorld;
+            float wx = screenX * m._11 + screenY * m._21 + m._41;
+            float wy = screenX * m._12 + screenY * m._22 + m._42;
+            float wz = screenX * m._13 + screenY * m._23 + m._43;
+            float ww = screenX * m._14 + screenY * m._24 + m._44;
+
+            Ray ray;
+            ray.origin = position;
+            ray.direction = Normalize(Vec3(wx, wy, wz) * (1.0f / ww) - position);
+            return ray;
+        }
+
+        // Angle between the rays of two adjacent pixels at the image center, the spread of the ray cones
+        // used to select texture mip levels.
+        float PixelSpreadAngle() const
+        {
+            Vec3 center = GenerateRay(width / 2, height / 2).direction;
+            Vec3 neighbour = GenerateRay(width / 2 + 1, height / 2).direction;
+            return std::acos((std::min)(1.0f, Dot(center, neighbour)));
+        }
+    };
+
+    // The camera's unprojection set up once per frame for generating primary rays in batches.
+    // Unprojecting a screen point and subtracting the camera position is linear in the pixel coordinates, apart from
+    // the homogeneous divide, which only scales the direction, so the direction through pixel coordinates (px, py) is
+    // corner + px * right + py * down before it's normalized: two multiply-adds per component instead of a matrix
+    // transform and a divide. Assumes the image is in front of the camera, the divide doesn't change sign across it.
+    struct CameraRayBasis
+    {
+        Vec3 origin;
+        Vec3 corner;    // Direction through the top left corner of the image, not normalized.
+        Vec3 right;     // Change of the direction per pixel to the right,
+        Vec3 down;      // and per pixel down.
+
+        explicit CameraRayBasis(const Camera& camera);
+
+        // Ray through a pixel at a subpixel offset, matches Camera::GenerateRay() up to rounding.
+        Ray GenerateRay(UINT x, UINT y, float offsetX = 0.5f, float offsetY = 0.5f) const
+        {
+            float px = static_cast<float>(x) + offsetX;
+            float py = static_cast<float>(y) + offsetY;
+
+            Ray ray;
+            ray.origin = origin;
+            ray.direction = Normalize(corner + right * px + down * py);
+            return ray;
+        }
+
+        // Directions of count consecutive pixels of row y starting at column x, four at a time with SSE, written to
+        // structure of arrays outputs. Without subpixel offsets the rays go through the pixel centers.
+        // Each direction is bit for bit the one GenerateRay() returns.
+        void GenerateDirections(UINT x, UINT y, UINT count, const float* offsetsX, const float* offsetsY,
+            float* directionsX, float* directionsY, float* directionsZ) const;
+    };
+
+    // Subpixel offset of a sample pass in an n x n grid of strata of the pixel: pass sampleIndex falls in stratum
+    // sampleIndex mod n^2, in raster order, jittered within it by u and v in [0, 1). Every n^2 passes sample each
+    // stratum once.
+    inline void StratifiedOffset(UINT sampleIndex, UINT strata, float u, float v, float& offsetX, float& offsetY)
+    {
+        UINT stratum = sampleIndex % (strata * strata);
+        float scale = 1.0f / strata;
+        offsetX = (stratum % strata + u) * scale;
+        offsetY = (stratum / strata + v) * scale;
+    }
+}
+
+#endif // !CPU_CAMERA_H
@@ -0,0 +1,222 @@
+#include "stdafx.h"
+#include "CpuDenoise.h"
+#include <emmintrin.h>
+
+using namespace Cpu;
+
+namespace
+{
+    // B3 spline, 1/16 (1 4 6 4 1).
+    static const float c_kernel[5] = { 1.0f / 16, 4.0f / 16, 6.0f / 16, 4.0f / 16, 1.0f / 16 };
+
+    inline __m128 Floor4(__m128 v)
+    {
+        // Truncation rounds towards zero, correct the negative non-integers.
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+        return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmplt_ps(v, truncated), _mm_set1_ps(1.0f)));
+    }
+
+    // Apron pixels around the image have an albedo no surface has, which gives them no weight.
+    static const float c_apronAlbedo = 1e18f;
+
+    // exp(x) for x <= 0 to about 1e-4 relative error: 2^(x/ln(2)) split into a power of two built in the
+    // exponent bits and a polynomial of the fraction. Inputs below -40, and NaNs, return 0: those weights
+    // vanish next to the center tap's, and cutting them keeps the sums out of denormals.
+    inline __m128 ExpNegative4(__m128 x)
+    {
+        __m128 cutoff = _mm_set1_ps(-40.0f);
+        __m128 t = _mm_mul_ps(_mm_max_ps(x, cutoff), _mm_set1_ps(1.44269504f));
+        __m128 integer = Floor4(t);
+        __m128 f = _mm_sub_ps(t, integer);
+        __m128 p = _mm_set1_ps(0.00133336f);
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.00961813f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.0555041f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.240227f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.693147f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+        __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(integer), _mm_set1_epi32(127)), 23);
+        return _mm_and_ps(_mm_mul_ps(p, _mm_castsi128_ps(exponent)), _mm_cmpge_ps(x, cutoff));
+    }
+
+    inline __m128 SquaredDistance4(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+    {
+        __m128 dx = _mm_sub_ps(ax, bx);
+        __m128 dy = _mm_sub_ps(ay, by);
+        __m128 dz = _mm_sub_ps(az, bz);
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    }
+}
+
+Denoiser::Denoiser(ThreadPool& threadPool) :
+    m_threadPool(threadPool),
+    m_width(0),
+    m_height(0),
+    m_stride(0),
+    m_apron(0),
+    m_tilesX(0),
+    m_tilesY(0)
+{
+}
+
+void Denoiser::Resize(UINT width, UINT height, UINT apron)
+{
+    if (width == m_width && height == m_height && apron == m_apron)
+    {
+        return;
+    }
+
+    // The apron is as wide as the last iteration's reach, so every tap loads from the planes directly.
+    // The last group of 4 pixels of a row spills into the apron to the right, which is widened to fit its taps.
+    m_width = width;
+    m_height = height;
+    m_apron = apron;
+    m_stride = ((width + 3) & ~3u) + 2 * apron;
+    m_tilesX = (width + TileSize - 1) / TileSize;
+    m_tilesY = (height + TileSize - 1) / TileSize;
+
+    size_t size = static_cast<size_t>(m_stride) * (height + 2 * apron);
+    for (Plane3& color : m_color)
+    {
+        color.Assign(size, 0.0f);
+    }
+    m_albedo.Assign(size, c_apronAlbedo);
+    m_normals.Assign(size, 0.0f);
+    m_depths.assign(size, FLT_MAX);
+    m_output.resize(width * height);
+}
+
+void Denoiser::Denoise(UINT width, UINT height, const std::vector<Vec3>& color, const std::vector<Vec3>& albedo,
+    const std::vector<Vec3>& normals, const std::vector<float>& depths, const DenoiseSettings& settings)
+{
+    UINT apron = settings.iterations > 0 ? 2u << (settings.iterations - 1) : 0;
+    Resize(width, height, (apron + 3) & ~3u);
+
+    // Transpose into planes.
+    m_threadPool.ParallelFor(height, 1, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT y = begin; y < end; y++)
+        {
+            for (UINT x = 0; x < width; x++)
+            {
+                UINT i = y * width + x;
+                UINT j = PlaneIndex(x, y);
+                m_color[0].x[j] = color[i].x;
+                m_color[0].y[j] = color[i].y;
+                m_color[0].z[j] = color[i].z;
+                m_albedo.x[j] = albedo[i].x;
+                m_albedo.y[j] = albedo[i].y;
+                m_albedo.z[j] = albedo[i].z;
+                m_normals.x[j] = normals[i].x;
+                m_normals.y[j] = normals[i].y;
+                m_normals.z[j] = normals[i].z;
+                m_depths[j] = depths[i];
+            }
+        }
+    });
+
+    UINT current = 0;
+    float colorSigma = settings.colorSigma / std::sqrt(static_cast<float>((std::max)(settings.samples, 1u)));
+    for (UINT iteration = 0; iteration < settings.iterations; iteration++)
+    {
+        const Plane3& input = m_color[current];
+        Plane3& output = m_color[1 - current];
+        UINT step = 1u << iteration;
+        m_threadPool.ParallelFor(m_tilesX * m_tilesY, 1, [&](UINT begin, UINT end, UINT)
+        {
+            for (UINT tile = begin; tile < end; tile++)
+            {
+                FilterTile(tile, step, colorSigma, settings, input, output);
+            }
+        });
+        current = 1 - current;
+        colorSigma *= 0.5f;
+    }
+
+    const Plane3& result = m_color[current];
+    m_threadPool.ParallelFor(height, 1, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT y = begin; y < end; y++)
+        {
+            for (UINT x = 0; x < width; x++)
+            {
+                UINT j = PlaneIndex(x, y);
+                m_output[y * width + x] = Vec3(result.x[j], result.y[j], result.z[j]);
+            }
+        }
+    });
+}
+
+void Denoiser::FilterTile(UINT tile, UINT step, float colorSigma, const DenoiseSettings& settings, const Plane3& input, Plane3& output) const
+{
+    UINT x0 = (tile % m_tilesX) * TileSize;
+    UINT y0 = (tile / m_tilesX) * TileSize;
+    UINT x1 = (std::min)(x0 + TileSize, m_width);
+    UINT y1 = (std::min)(y0 + TileSize, m_height);
+
+    __m128 colorScale = _mm_set1_ps(-1.0f / (colorSigma * colorSigma));
+    __m128 albedoScale = _mm_set1_ps(-1.0f / (settings.albedoSigma * settings.albedoSigma));
+    __m128 normalScale = _mm_set1_ps(-1.0f / (settings.normalSigma * settings.normalSigma));
+    __m128 one = _mm_set1_ps(1.0f);
+
+    for (UINT y = y0; y < y1; y++)
+    {
+        for (UINT x = x0; x < x1; x += 4)
+        {
+            UINT center = PlaneIndex(x, y);
+            __m128 cr = _mm_loadu_ps(&input.x[center]);
+            __m128 cg = _mm_loadu_ps(&input.y[center]);
+            __m128 cb = _mm_loadu_ps(&input.z[center]);
+            __m128 ar = _mm_loadu_ps(&m_albedo.x[center]);
+            __m128 ag = _mm_loadu_ps(&m_albedo.y[center]);
+            __m128 ab = _mm_loadu_ps(&m_albedo.z[center]);
+            __m128 nx = _mm_loadu_ps(&m_normals.x[center]);
+            __m128 ny = _mm_loadu_ps(&m_normals.y[center]);
+            __m128 nz = _mm_loadu_ps(&m_normals.z[center]);
+            __m128 d = _mm_loadu_ps(&m_depths[center]);
+
+            // 1 / (sigma * depth), 0 for the background's FLT_MAX depth, which weighs by the other guides only.
+            __m128 depthScale = _mm_div_ps(one, _mm_mul_ps(d, _mm_set1_ps(settings.depthSigma)));
+
+            __m128 sumR = _mm_setzero_ps();
+            __m128 sumG = _mm_setzero_ps();
+            __m128 sumB = _mm_setzero_ps();
+            __m128 sumWeight = _mm_setzero_ps();
+            for (int dy = -2; dy <= 2; dy++)
+            {
+                for (int dx = -2; dx <= 2; dx++)
+                {
+                    __m128 kernel = _mm_set1_ps(c_kernel[dy + 2] * c_kernel[dx + 2]);
+                    UINT tap = center + (dy * static_cast<int>(m_stride) + dx) * static_cast<int>(step);
+                    __m128 qr = _mm_loadu_ps(&input.x[tap]);
+                    __m128 qg = _mm_loadu_ps(&input.y[tap]);
+                    __m128 qb = _mm_loadu_ps(&input.z[tap]);
+                    __m128 qar = _mm_loadu_ps(&m_albedo.x[tap]);
+                    __m128 qag = _mm_loadu_ps(&m_albedo.y[tap]);
+                    __m128 qab = _mm_loadu_ps(&m_albedo.z[tap]);
+                    __m128 qnx = _mm_loadu_ps(&m_normals.x[tap]);
+                    __m128 qny = _mm_loadu_ps(&m_normals.y[tap]);
+                    __m128 qnz = _mm_loadu_ps(&m_normals.z[tap]);
+                    __m128 qd = _mm_loadu_ps(&m_depths[tap]);
+
+                    __m128 depthDifference = _mm_mul_ps(_mm_sub_ps(qd, d), depthScale);
+                    __m128 exponent = _mm_mul_ps(SquaredDistance4(qr, qg, qb, cr, cg, cb), colorScale);
+                    exponent = _mm_add_ps(exponent, _mm_mul_ps(SquaredDistance4(qar, qag, qab, ar, ag, ab), albedoScale));
+                    exponent = _mm_add_ps(exponent, _mm_mul_ps(SquaredDistance4(qnx, qny, qnz, nx, ny, nz), normalScale));
+                    exponent = _mm_sub_ps(exponent, _mm_mul_ps(depthDifference, depthDifference));
+                    __m128 weight = _mm_mul_ps(kernel, ExpNegative4(exponent));
+
+                    sumR = _mm_add_ps(sumR, _mm_mul_ps(weight, qr));
+                    sumG = _mm_add_ps(sumG, _mm_mul_ps(weight, qg));
+                    sumB = _mm_add_ps(sumB, _mm_mul_ps(weight, qb));
+                    sumWeight = _mm_add_ps(sumWeight, weight);
+                }
+            }
+
+            // The center tap always has weight, apron lanes may not.
+            __m128 invWeight = _mm_div_ps(one, _mm_max_ps(sumWeight, _mm_set1_ps(1e-20f)));
+            _mm_storeu_ps(&output.x[center], _mm_mul_ps(sumR, invWeight));
+            _mm_storeu_ps(&output.y[center], _mm_mul_ps(sumG, invWeight));
+            _mm_storeu_ps(&output.z[center], _mm_mul_ps(sumB, invWeight));
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef CPU_DENOISE_H
+#define CPU_DENOISE_H
+
+#include "CpuMath.h"
+#include "CpuThreadPool.h"
+
+namespace Cpu
+{
+    // Edge stopping parameters of the denoiser. A neighbour's weight falls off with the squared differences
+    // of its color, albedo and normal over the squared sigmas, and of its distance relative to the center's.
+    // The color sigma is for a single sample per pixel and shrinks with the noise, by the square root of the samples,
+    // then halves with every iteration, as the filtered colors get closer.
+    struct DenoiseSettings
+    {
+        UINT iterations = 5;
+        UINT samples = 1;           // Samples per pixel of the color.
+        float colorSigma = 2.0f;
+        float albedoSigma = 0.1f;
+        float normalSigma = 0.3f;
+        float depthSigma = 0.05f;
+    };
+
+    // Edge avoiding a-trous wavelet filter.
+    // Each iteration convolves the image with a 5x5 B3 spline kernel whose taps are spread twice as far apart as in the
+    // previous one, so five iterations cover 61x61 pixels at 25 taps per pixel each. Taps across edges of the first
+    // hit guides, or across large color differences, get little weight.
+    // The planes are kept in structure of arrays layout and filtered four pixels at a time with SSE, in tiles.
+    class Denoiser
+    {
+    public:
+        static const UINT TileSize = 32;
+
+        explicit Denoiser(ThreadPool& threadPool);
+
+        // Filters color, which may be a mean over several passes. Depths of FLT_MAX mark the background.
+        void Denoise(UINT width, UINT height, const std::vector<Vec3>& color, const std::vector<Vec3>& albedo,
+            const std::vector<Vec3>& normals, const std::vector<float>& depths, const DenoiseSettings& settings = DenoiseSettings());
+
+        const std::vector<Vec3>& Output() const { return m_output; }
+
+    private:
+        struct Plane3
+        {
+            std::vector<float> x, y, z;
+
+            void Assign(size_t size, float value) { x.assign(size, value); y.assign(size, value); z.assign(size, value); }
+        };
+
+        void Resize(UINT width, UINT height, UINT apron);
+        UINT PlaneIndex(UINT x, UINT y) const { return (y + m_apron) * m_stride + x + m_apron; }
+        void FilterTile(UINT tile, UINT step, float colorSigma, const DenoiseSettings& settings, const Plane3& input, Plane3& output) const;
+
+        ThreadPool& m_threadPool;
+        UINT m_width;
+        UINT m_height;
+        UINT m_stride;          // Row pitch of the planes, including the apron on both sides.
+        UINT m_apron;           // Border around the image in the planes, in pixels.
+        UINT m_tilesX;
+        UINT m_tilesY;
+
+        Plane3 m_color[2];
+        Plane3 m_albedo;
+        Plane3 m_normals;
+        std::vector<float> m_depths;
+        std::vector<Vec3> m_output;
+    };
+}
+
+#endif // !CPU_DENOISE_H
@@ -0,0 +1,608 @@
+#include "stdafx.h"
+#include "CpuDistributed.h"
+#include "CpuSceneCache.h"
+
+using namespace Cpu;
+
+namespace
+{
+    namespace DistributedMessage {
+        enum Enum {
+            Hello = 1,      // Worker to coordinator, HelloMessage, once after connecting.
+            Scene,          // The bytes of a scene cache with the BVH.
+            Textures,       // The scene's textures, see SerializeTextures(), right after the scene.
+            Job,            // JobMessage, the camera and settings of the tiles that follow.
+            Tile,           // TileMessage.
+            TileResult,     // Worker to coordinator, TileResultMessage followed by the tile's radiance in rows.
+            Exit
+        };
+    }
+
+    static const UINT c_helloMagic = 0x52544457;      // "WDTR"
+    static const UINT c_protocolVersion = 1;
+
+    // Largest messages accepted, guards against allocating whatever a corrupt header asks for.
+    static const UINT64 c_maxSceneBytes = 1ull << 36;
+    static const UINT64 c_maxResultBytes = 1ull << 28;
+
+    struct HelloMessage
+    {
+        UINT magic;
+        UINT version;
+        UINT cameraSize;
+        UINT settingsSize;
+    };
+
+    struct JobMessage
+    {
+        UINT frame;
+        Camera camera;
+        PathSettings settings;
+    };
+
+    struct TileMessage
+    {
+        UINT frame;
+        UINT tile;
+        UINT x, y, width, height;
+    };
+
+    struct TileResultMessage
+    {
+        UINT frame;
+        UINT tile;
+        UINT width;
+        UINT height;
+    };
+
+    struct TextureHeader
+    {
+        UINT width;
+        UINT height;
+        UINT layout;
+    };
+
+    // Scene caches don't hold textures, they follow the scene as the texture count, the material count and the
+    // materials' texture indices, then each texture's size, layout and top level texels. Workers build the mips again.
+    void SerializeTextures(const Scene& scene, std::vector<BYTE>& bytes)
+    {
+        auto Append = [&](const void* data, size_t size)
+        {
+            bytes.insert(bytes.end(), static_cast<const BYTE*>(data), static_cast<const BYTE*>(data) + size);
+        };
+        UINT counts[2] = { static_cast<UINT>(scene.textures.size()), static_cast<UINT>(scene.materialTextures.size()) };
+        bytes.clear();
+        Append(counts, sizeof(counts));
+        Append(scene.materialTextures.data(), scene.materialTextures.size() * sizeof(UINT));
+        std::vector<UINT> texels;
+        for (const Texture& texture : scene.textures)
+        {
+            TextureHeader header = { texture.Width(), texture.Height(), texture.Layout() };
+            texels.resize(static_cast<size_t>(header.width) * header.height);
+            for (UINT y = 0; y < header.height; y++)
+            {
+                for (UINT x = 0; x < header.width; x++)
+                {
+                    texels[static_cast<size_t>(y) * header.width + x] = texture.Fetch(0, x, y);
+                }
+            }
+            Append(&header, sizeof(header));
+            Append(texels.data(), texels.size() * sizeof(UINT));
+        }
+    }
+
+    void ReadTextures(const std::vector<BYTE>& bytes, Scene& scene)
+    {
+        size_t offset = 0;
+        auto Read = [&](size_t size)
+        {
+            ThrowIfFalse(offset + size <= bytes.size(), L"Invalid distributed render textures.");
+            const BYTE* data = bytes.data() + offset;
+            offset += size;
+            return data;
+        };
+        UINT counts[2];
+        memcpy(counts, Read(sizeof(counts)), sizeof(counts));
+        ThrowIfFalse(counts[1] == scene.materials.size(), L"The textures don't match the scene.");
+        memcpy(scene.materialTextures.data(), Read(counts[1] * sizeof(UINT)), counts[1] * sizeof(UINT));
+        scene.textures.clear();
+        for (UINT i = 0; i < counts[0]; i++)
+        {
+            TextureHeader header;
+            memcpy(&header, Read(sizeof(header)), sizeof(header));
+            ThrowIfFalse(header.layout < TextureLayout::Count, L"Invalid distributed render textures.");
+            size_t texelCount = static_cast<size_t>(header.width) * header.height;
+            std::vector<UINT> texels(texelCount);
+            memcpy(texels.data(), Read(texelCount * sizeof(UINT)), texelCount * sizeof(UINT));
+            scene.AddTexture(Texture(header.width, header.height, texels.data(), static_cast<TextureLayout::Enum>(header.layout)));
+        }
+        for (UINT texture : scene.materialTextures)
+        {
+            ThrowIfFalse(texture == InvalidTexture || texture < counts[0], L"Invalid distributed render textures.");
+        }
+    }
+
+    HelloMessage Hello()
+    {
+        HelloMessage hello = {};
+        hello.magic = c_helloMagic;
+        hello.version = c_protocolVersion;
+        hello.cameraSize = sizeof(Camera);
+        hello.settingsSize = sizeof(PathSettings);
+        return hello;
+    }
+}
+
+TileCoordinator::TileCoordinator() :
+    m_port(0),
+    m_sceneVersion(0),
+    m_frame(0),
+    m_rendering(false),
+    m_doneTiles(0),
+    m_issueCount(0),
+    m_image(nullptr),
+    m_imageWidth(0),
+    m_changed(false),
+    m_exit(false)
+{
+}
+
+TileCoordinator::~TileCoordinator()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+
+    // The accept thread is woken with a connection of its own, it sees the exit flag and leaves.
+    if (m_acceptThread.joinable())
+    {
+        try
+        {
+            Socket::Connect("127.0.0.1", m_port);
+        }
+        catch (...)
+        {
+            m_listener.Shutdown();
+        }
+        m_acceptThread.join();
+    }
+
+    // The accept thread is gone, nothing adds workers anymore. Sending to lost workers just fails.
+    for (auto& worker : m_workers)
+    {
+        WriteMessage(worker->socket, DistributedMessage::Exit, nullptr, 0);
+        worker->socket.Shutdown();
+        worker->reader.join();
+    }
+}
+
+void TileCoordinator::Listen(UINT16 port)
+{
+    ThrowIfFalse(!m_listener.IsValid(), L"The coordinator is listening already.");
+    m_listener = Socket::Listen(port);
+    m_port = m_listener.Port();
+    m_acceptThread = std::thread(&TileCoordinator::AcceptThreadMain, this);
+}
+
+bool TileCoordinator::WaitForWorkers(UINT count, UINT timeoutMS)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_condition.wait_for(lock, std::chrono::milliseconds(timeoutMS), [&]()
+    {
+        UINT ready = 0;
+        for (auto& worker : m_workers)
+        {
+            ready += worker->ready && !worker->lost;
+        }
+        return ready >= count;
+    });
+}
+
+void TileCoordinator::SetScene(const Scene& scene, const BVH& bvh)
+{
+    std::vector<BYTE> bytes;
+    std::vector<BYTE> textureBytes;
+    SceneCache::Serialize(scene, &bvh, bytes);
+    SerializeTextures(scene, textureBytes);
+
+    // Only the dispatcher, Render(), reads the scene bytes, it's never running now.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sceneBytes.swap(bytes);
+    m_textureBytes.swap(textureBytes);
+    m_sceneVersion++;
+}
+
+void TileCoordinator::Render(const Camera& camera, const PathSettings& settings, std::vector<Vec3>& image, const DistributedSettings& distributedSettings)
+{
+    ThrowIfFalse(m_sceneVersion > 0, L"The coordinator has no scene to render.");
+    ThrowIfFalse(distributedSettings.tileSize > 0 && distributedSettings.tilesInFlight > 0, L"Invalid distributed settings.");
+
+    DX::CPUTimer timer;
+    timer.Start();
+    image.assign(static_cast<size_t>(camera.width) * camera.height, Vec3());
+
+    JobMessage job = {};
+    job.camera = camera;
+    job.settings = settings;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        job.frame = ++m_frame;
+        m_rendering = true;
+        m_tiles.clear();
+        m_pendingTiles.clear();
+        for (UINT y = 0; y < camera.height; y += distributedSettings.tileSize)
+        {
+            for (UINT x = 0; x < camera.width; x += distributedSettings.tileSize)
+            {
+                Tile tile = {};
+                tile.x = x;
+                tile.y = y;
+                tile.width = (std::min)(distributedSettings.tileSize, camera.width - x);
+                tile.height = (std::min)(distributedSettings.tileSize, camera.height - y);
+                m_pendingTiles.push_back(static_cast<UINT>(m_tiles.size()));
+                m_tiles.push_back(tile);
+            }
+        }
+        m_doneTiles = 0;
+        m_image = image.data();
+        m_imageWidth = camera.width;
+        m_changed = true;
+        m_stats = DistributedStats();
+        m_stats.tiles = static_cast<UINT>(m_tiles.size());
+        for (auto& worker : m_workers)
+        {
+            worker->tilesRendered = 0;
+        }
+    }
+
+    // The render thread is the only one that sends to workers. Whenever workers connect, return tiles or are lost it
+    // tops up the tiles in flight of every worker, deciding under the lock and sending outside of it.
+    struct Send
+    {
+        Worker* worker;
+        bool scene;
+        bool job;
+        std::vector<TileMessage> tiles;
+    };
+    std::vector<Send> sends;
+    UINT lastDoneTiles = 0;
+    DX::CPUTimer progressTimer;
+    progressTimer.Start();
+    bool timedOut = false;
+    for (;;)
+    {
+        sends.clear();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait_for(lock, std::chrono::milliseconds(100), [&]() { return m_changed; });
+            if (m_doneTiles == m_tiles.size())
+            {
+                break;
+            }
+            progressTimer.Stop();
+            if (m_doneTiles != lastDoneTiles)
+            {
+                lastDoneTiles = m_doneTiles;
+                progressTimer.Start();
+            }
+            else if (progressTimer.GetElapsedMS() > distributedSettings.timeoutMS)
+            {
+                timedOut = true;
+                break;
+            }
+            m_changed = false;
+
+            for (auto& worker : m_workers)
+            {
+                if (!worker->ready || worker->lost)
+                {
+                    continue;
+                }
+                Send send;
+                send.worker = worker.get();
+                send.scene = worker->sceneVersion != m_sceneVersion;
+                send.job = worker->jobFrame != m_frame;
+                UINT tile;
+                while (worker->tiles.size() < distributedSettings.tilesInFlight && NextTile(*worker, distributedSettings, tile))
+                {
+                    const Tile& t = m_tiles[tile];
+                    TileMessage message = { m_frame, tile, t.x, t.y, t.width, t.height };
+                    send.tiles.push_back(message);
+                }
+                if (!send.tiles.empty())
+                {
+                    m_stats.sceneBytes += send.scene ? m_sceneBytes.size() + m_textureBytes.size() : 0;
+                    sends.push_back(std::move(send));
+                }
+            }
+        }
+
+        for (Send& send : sends)
+        {
+            Worker& worker = *send.worker;
+            bool sent = true;
+            if (send.scene)
+            {
+                sent = WriteMessage(worker.socket, DistributedMessage::Scene, m_sceneBytes.data(), m_sceneBytes.size()) &&
+                    WriteMessage(worker.socket, DistributedMessage::Textures, m_textureBytes.data(), m_textureBytes.size());
+                worker.sceneVersion = m_sceneVersion;
+            }
+            if (sent && send.job)
+            {
+                sent = WriteMessage(worker.socket, DistributedMessage::Job, &job, sizeof(job));
+                worker.jobFrame = job.frame;
+            }
+            for (size_t i = 0; sent && i < send.tiles.size(); i++)
+            {
+                sent = WriteMessage(worker.socket, DistributedMessage::Tile, &send.tiles[i], sizeof(TileMessage));
+            }
+            if (!sent)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                LoseWorker(worker);
+            }
+        }
+    }
+
+    // Results that arrive from now on are late copies or of a frame that was given up, readers drop them.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_rendering = false;
+        m_image = nullptr;
+        for (auto& worker : m_workers)
+        {
+            m_stats.workers += worker->tilesRendered > 0;
+        }
+    }
+    timer.Stop();
+    m_stats.renderMS = timer.GetElapsedMS();
+    ThrowIfFalse(!timedOut, L"The distributed render timed out, no worker returned a tile.");
+}
+
+bool TileCoordinator::NextTile(Worker& worker, const DistributedSettings& settings, UINT& tile)
+{
+    // Tiles of lost workers are queued at the front, the tiles before them may be done already by copies sent to
+    // other workers.
+    bool stolen = false;
+    tile = UINT_MAX;
+    while (!m_pendingTiles.empty() && tile == UINT_MAX)
+    {
+        if (!m_tiles[m_pendingTiles.front()].done)
+        {
+            tile = m_pendingTiles.front();
+        }
+        m_pendingTiles.pop_front();
+    }
+
+    // Out of tiles, an idle worker gets a copy of the tile that has been in flight longest.
+    if (tile == UINT_MAX && worker.tiles.empty())
+    {
+        for (UINT i = 0; i < m_tiles.size(); i++)
+        {
+            const Tile& candidate = m_tiles[i];
+            if (!candidate.done && candidate.copies > 0 && candidate.copies < settings.maxTileCopies &&
+                (tile == UINT_MAX || candidate.issue < m_tiles[tile].issue))
+            {
+                tile = i;
+            }
+        }
+        stolen = tile != UINT_MAX;
+    }
+    if (tile == UINT_MAX)
+    {
+        return false;
+    }
+
+    Tile& t = m_tiles[tile];
+    if (t.copies++ == 0)
+    {
+        t.issue = m_issueCount++;
+    }
+    m_stats.stolenTiles += stolen;
+    WorkerTile workerTile = { m_frame, tile };
+    worker.tiles.push_back(workerTile);
+    return true;
+}
+
+void TileCoordinator::LoseWorker(Worker& worker)
+{
+    if (worker.lost)
+    {
+        return;
+    }
+    worker.lost = true;
+    worker.socket.Shutdown();
+    for (const WorkerTile& workerTile : worker.tiles)
+    {
+        if (m_rendering && workerTile.frame == m_frame)
+        {
+            Tile& tile = m_tiles[workerTile.tile];
+            if (--tile.copies == 0 && !tile.done)
+            {
+                m_pendingTiles.push_front(workerTile.tile);
+                m_stats.reissuedTiles++;
+            }
+        }
+    }
+    worker.tiles.clear();
+    m_stats.lostWorkers += !m_exit;
+    m_changed = true;
+}
+
+void TileCoordinator::AcceptThreadMain()
+{
+    for (;;)
+    {
+        Socket connection = m_listener.Accept();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_exit || !connection.IsValid())
+        {
+            return;
+        }
+        m_workers.emplace_back(new Worker());
+        Worker* worker = m_workers.back().get();
+        worker->socket = std::move(connection);
+        worker->reader = std::thread(&TileCoordinator::ReaderThreadMain, this, worker);
+    }
+}
+
+void TileCoordinator::ReaderThreadMain(Worker* worker)
+{
+    UINT type = 0;
+    std::vector<BYTE> payload;
+    HelloMessage expected = Hello();
+    bool connected = ReadMessage(worker->socket, type, payload, sizeof(HelloMessage)) && type == DistributedMessage::Hello &&
+        payload.size() == sizeof(HelloMessage) && memcmp(payload.data(), &expected, sizeof(HelloMessage)) == 0;
+    if (connected)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        worker->ready = true;
+        m_changed = true;
+        m_condition.notify_all();
+    }
+
+    while (connected && ReadMessage(worker->socket, type, payload, c_maxResultBytes))
+    {
+        TileResultMessage result;
+        if (type != DistributedMessage::TileResult || payload.size() < sizeof(result))
+        {
+            break;
+        }
+        memcpy(&result, payload.data(), sizeof(result));
+        const BYTE* pixels = payload.data() + sizeof(result);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto workerTile = std::find_if(worker->tiles.begin(), worker->tiles.end(), [&](const WorkerTile& t)
+        {
+            return t.frame == result.frame && t.tile == result.tile;
+        });
+        if (workerTile == worker->tiles.end())
+        {
+            break;
+        }
+        worker->tiles.erase(workerTile);
+
+        if (m_rendering && result.frame == m_frame)
+        {
+            Tile& tile = m_tiles[result.tile];
+            if (result.width != tile.width || result.height != tile.height ||
+                payload.size() != sizeof(result) + static_cast<size_t>(tile.width) * tile.height * sizeof(Vec3))
+            {
+                break;
+            }
+            tile.copies--;
+            if (!tile.done)
+            {
+                for (UINT y = 0; y < tile.height; y++)
+                {
+                    memcpy(&m_image[static_cast<size_t>(tile.y + y) * m_imageWidth + tile.x], pixels + y * tile.width * sizeof(Vec3), tile.width * sizeof(Vec3));
+                }
+                tile.done = true;
+                m_doneTiles++;
+                worker->tilesRendered++;
+            }
+            else
+            {
+                m_stats.duplicateResults++;
+            }
+        }
+        m_changed = true;
+        m_condition.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    LoseWorker(*worker);
+    m_condition.notify_all();
+}
+
+TileWorker::TileWorker(ThreadPool& threadPool) :
+    m_renderer(threadPool)
+{
+}
+
+UINT TileWorker::Run(const std::string& host, UINT16 port, const TileWorkerSettings& settings)
+{
+    Socket socket = Socket::Connect(host, port);
+    HelloMessage hello = Hello();
+    ThrowIfFalse(WriteMessage(socket, DistributedMessage::Hello, &hello, sizeof(hello)), L"Failed to reach the coordinator.");
+
+    UINT type = 0;
+    std::vector<BYTE> payload;
+    bool hasScene = false;
+    JobMessage job = {};
+    UINT tiles = 0;
+    while (ReadMessage(socket, type, payload, c_maxSceneBytes))
+    {
+        switch (type)
+        {
+        case DistributedMessage::Scene:
+        {
+            // Scene cache sections are aligned to SceneCache::SectionAlignment from the start of the bytes.
+            // The scene and BVH view the bytes, the previous ones are replaced before anything reads them.
+            m_sceneBytes.resize(payload.size() + SceneCache::SectionAlignment);
+            BYTE* bytes = m_sceneBytes.data() + (SceneCache::SectionAlignment - reinterpret_cast<uintptr_t>(m_sceneBytes.data()) % SceneCache::SectionAlignment);
+            memcpy(bytes, payload.data(), payload.size());
+            SceneCache cache;
+            cache.Open(bytes, payload.size());
+            ThrowIfFalse(cache.HasBVH(), L"The coordinator sent a scene without a BVH.");
+            cache.ReadScene(m_scene);
+            cache.ReadBVH(m_bvh);
+            hasScene = false;
+            break;
+        }
+        case DistributedMessage::Textures:
+            ReadTextures(payload, m_scene);
+            hasScene = true;
+            break;
+        case DistributedMessage::Job:
+            ThrowIfFalse(payload.size() == sizeof(job), L"Invalid distributed render job.");
+            memcpy(&job, payload.data(), sizeof(job));
+            break;
+        case DistributedMessage::Tile:
+        {
+            TileMessage tile;
+            ThrowIfFalse(payload.size() == sizeof(tile), L"Invalid distributed render tile.");
+            memcpy(&tile, payload.data(), sizeof(tile));
+            ThrowIfFalse(hasScene && tile.frame == job.frame && tile.x + tile.width <= job.camera.width && tile.y + tile.height <= job.camera.height,
+                L"The coordinator sent a tile without its scene, textures or job.");
+            if (tiles == settings.maxTiles)
+            {
+                return tiles;
+            }
+            if (settings.delayMS > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(settings.delayMS));
+            }
+
+            m_pixels.resize(static_cast<size_t>(tile.width) * tile.height);
+            for (UINT y = 0; y < tile.height; y++)
+            {
+                for (UINT x = 0; x < tile.width; x++)
+                {
+                    m_pixels[y * tile.width + x] = (tile.y + y) * job.camera.width + tile.x + x;
+                }
+            }
+            m_renderer.Render(m_scene, m_bvh, job.camera, job.settings, nullptr, &m_pixels);
+            m_tilePixels.resize(m_pixels.size());
+            for (size_t i = 0; i < m_pixels.size(); i++)
+            {
+                m_tilePixels[i] = m_renderer.Radiance()[m_pixels[i]];
+            }
+
+            TileResultMessage result = { tile.frame, tile.tile, tile.width, tile.height };
+            if (!WriteMessage(socket, DistributedMessage::TileResult, &result, sizeof(result), m_tilePixels.data(), m_tilePixels.size() * sizeof(Vec3)))
+            {
+                return tiles;
+            }
+            tiles++;
+            break;
+        }
+        case DistributedMessage::Exit:
+            return tiles;
+        default:
+            ThrowIfFalse(false, L"Invalid distributed render message.");
+        }
+    }
+    return tiles;
+}
@@ -0,0 +1,145 @@
+#ifndef CPU_DISTRIBUTED_H
+#define CPU_DISTRIBUTED_H
+
+#include <deque>
+#include "CpuSocket.h"
+#include "CpuWavefront.h"
+
+namespace Cpu
+{
+    struct DistributedSettings
+    {
+        UINT tileSize = 32;
+        UINT tilesInFlight = 2;     // Tiles a worker is sent ahead of its results, so it has the next one when it finishes a tile.
+        UINT maxTileCopies = 2;     // Idle workers get copies of tiles still in flight, up to this many copies of a tile in all.
+        UINT timeoutMS = 60000;     // Render() throws if no tile finishes for this long.
+    };
+
+    struct DistributedStats
+    {
+        UINT tiles = 0;
+        UINT workers = 0;           // Workers whose results were used.
+        UINT lostWorkers = 0;       // Connections lost during the frame.
+        UINT reissuedTiles = 0;     // Tiles sent again because the workers that had them were lost.
+        UINT stolenTiles = 0;       // Copies of tiles in flight sent to idle workers.
+        UINT duplicateResults = 0;  // Results of tiles that were done already, discarded.
+        UINT64 sceneBytes = 0;      // Scenes sent to workers during the frame.
+        double renderMS = 0;
+    };
+
+    struct TileWorkerSettings
+    {
+        UINT maxTiles = UINT_MAX;   // Drops the connection when sent a tile after this many, to test lost workers.
+        UINT delayMS = 0;           // Waits before each tile, to test stragglers.
+    };
+
+    // Renders frames on workers in other processes or on other machines, see TileWorker.
+    // The frame is split into tiles that are handed out to the connected workers a few at a time, so each worker has
+    // its next tile queued while it renders one. Workers get the scene and its BVH once per connection, as the bytes of
+    // a scene cache followed by the textures, and render their tiles with the same renderer and settings as a local render, so the image is the
+    // same as rendered locally whichever worker rendered which tile. Workers can connect at any time, the tiles of a
+    // lost worker are sent again, and once the tiles run out idle workers get copies of the tiles that have been in
+    // flight longest, so a slow worker doesn't hold up the frame: the first result of a tile is used.
+    // Structures are sent as they are in memory, workers have to be the same build as the coordinator.
+    class TileCoordinator
+    {
+    public:
+        TileCoordinator();
+        // Tells the workers to exit and closes their connections.
+        ~TileCoordinator();
+
+        TileCoordinator(const TileCoordinator&) = delete;
+        TileCoordinator& operator=(const TileCoordinator&) = delete;
+
+        // Accepts workers on the port from now on, on a free port if it's 0, see Port().
+        void Listen(UINT16 port);
+        UINT16 Port() const { return m_port; }
+        // Waits until count workers are connected and ready, false if they aren't within the timeout.
+        bool WaitForWorkers(UINT count, UINT timeoutMS);
+
+        // The scene of the frames rendered from now on, sent to each worker before its next tile.
+        void SetScene(const Scene& scene, const BVH& bvh);
+        // Renders the radiance of the camera's pixels, as WavefrontRenderer::Render() would without a light tree.
+        void Render(const Camera& camera, const PathSettings& settings, std::vector<Vec3>& image,
+            const DistributedSettings& distributedSettings = DistributedSettings());
+
+        const DistributedStats& Stats() const { return m_stats; }
+
+    private:
+        struct WorkerTile
+        {
+            UINT frame;
+            UINT tile;
+        };
+
+        struct Worker
+        {
+            Socket socket;
+            std::thread reader;
+            std::vector<WorkerTile> tiles;  // Sent and not returned yet, of this frame or earlier ones.
+            UINT sceneVersion = 0;          // Of the scene the worker has, 0 before it got one.
+            UINT jobFrame = 0;              // Frame of the camera and settings the worker has.
+            UINT tilesRendered = 0;         // This frame's tiles whose results were used.
+            bool ready = false;             // Sent a matching hello.
+            bool lost = false;
+        };
+
+        struct Tile
+        {
+            UINT x, y, width, height;
+            UINT copies;                    // In flight on workers.
+            UINT64 issue;                   // Order in which tiles went from no copies in flight to one.
+            bool done;
+        };
+
+        void AcceptThreadMain();
+        void ReaderThreadMain(Worker* worker);
+        // These are called with the mutex held.
+        bool NextTile(Worker& worker, const DistributedSettings& settings, UINT& tile);
+        void LoseWorker(Worker& worker);
+
+        Socket m_listener;
+        UINT16 m_port;
+        std::thread m_acceptThread;
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::vector<BYTE> m_sceneBytes;
+        std::vector<BYTE> m_textureBytes;
+        UINT m_sceneVersion;
+
+        // The frame being rendered.
+        UINT m_frame;
+        bool m_rendering;
+        std::vector<Tile> m_tiles;
+        std::deque<UINT> m_pendingTiles;
+        UINT m_doneTiles;
+        UINT64 m_issueCount;
+        Vec3* m_image;
+        UINT m_imageWidth;
+        bool m_changed;                     // Workers connected, returned tiles or were lost since the dispatcher last looked.
+        bool m_exit;
+        DistributedStats m_stats;
+    };
+
+    // Renders tiles for a TileCoordinator, in a process of its own or on another machine.
+    class TileWorker
+    {
+    public:
+        explicit TileWorker(ThreadPool& threadPool);
+
+        // Connects to the coordinator and renders the tiles it sends until it says to exit or the connection is closed.
+        // Returns the number of tiles rendered.
+        UINT Run(const std::string& host, UINT16 port, const TileWorkerSettings& settings = TileWorkerSettings());
+
+    private:
+        WavefrontRenderer m_renderer;
+        std::vector<BYTE> m_sceneBytes;     // The coordinator's scene cache, m_scene and m_bvh view its sections.
+        Scene m_scene;
+        BVH m_bvh;
+        std::vector<UINT> m_pixels;
+        std::vector<Vec3> m_tilePixels;
+    };
+}
+
+#endif // !CPU_DISTRIBUTED_H
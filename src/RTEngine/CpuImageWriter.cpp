@@ -0,0 +1,523 @@
+#include "stdafx.h"
+#include "CpuImageWriter.h"
+
+using namespace Cpu;
+
+namespace
+{
+    // OpenEXR magic number and version 2 with the single part tiled flag.
+    static const int c_exrMagic = 20000630;
+    static const int c_exrTiledVersion = 2 | 0x200;
+    static const int c_exrHalf = 1;
+    static const int c_exrFloat = 2;
+    static const UINT c_exrTileHeaderSize = 5 * sizeof(int);    // Tile coordinates, level coordinates and data size.
+
+    void AppendBytes(std::vector<BYTE>& bytes, const void* data, size_t size)
+    {
+        const BYTE* begin = static_cast<const BYTE*>(data);
+        bytes.insert(bytes.end(), begin, begin + size);
+    }
+
+    template <typename T>
+    void Append(std::vector<BYTE>& bytes, T value)
+    {
+        AppendBytes(bytes, &value, sizeof(T));
+    }
+
+    void AppendString(std::vector<BYTE>& bytes, const std::string& text)
+    {
+        AppendBytes(bytes, text.c_str(), text.size() + 1);
+    }
+
+    void AppendAttribute(std::vector<BYTE>& bytes, const char* name, const char* type, int size)
+    {
+        AppendString(bytes, name);
+        AppendString(bytes, type);
+        Append(bytes, size);
+    }
+
+    // Rounds to the nearest half, ties to even. Overflows to infinity, underflows through the denormals to zero.
+    UINT16 FloatToHalf(float value)
+    {
+        UINT bits;
+        memcpy(&bits, &value, sizeof(bits));
+        UINT sign = (bits >> 16) & 0x8000;
+        UINT exponent = (bits >> 23) & 0xFF;
+        UINT mantissa = bits & 0x7FFFFF;
+        if (exponent == 0xFF)
+        {
+            return static_cast<UINT16>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+        }
+
+        int halfExponent = static_cast<int>(exponent) - 127 + 15;
+        if (halfExponent >= 31)
+        {
+            return static_cast<UINT16>(sign | 0x7C00);
+        }
+        UINT shift = 13;
+        UINT half = 0;
+        if (halfExponent <= 0)
+        {
+            if (halfExponent < -10)
+            {
+                return static_cast<UINT16>(sign);
+            }
+            mantissa |= 0x800000;
+            shift = 14 - halfExponent;
+        }
+        else
+        {
+            half = static_cast<UINT>(halfExponent) << 10;
+        }
+        half |= mantissa >> shift;
+
+        // A carry out of the mantissa correctly moves to the next exponent, or to infinity.
+        UINT rest = mantissa & ((1u << shift) - 1);
+        UINT halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+        {
+            half++;
+        }
+        return static_cast<UINT16>(sign | half);
+    }
+}
+
+ImageWriter::ImageWriter() :
+    m_file(INVALID_HANDLE_VALUE),
+    m_format(ImageFormat::EXR),
+    m_pixelType(ImagePixelType::Half),
+    m_width(0),
+    m_height(0),
+    m_tileWidth(0),
+    m_tileHeight(0),
+    m_tilesX(0),
+    m_tilesY(0),
+    m_maxPendingTiles(0),
+    m_headerSize(0),
+    m_fileEnd(0),
+    m_exit(false),
+    m_failed(false)
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+    StopIOThread();
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+    }
+}
+
+void ImageWriter::Open(const std::wstring& path, ImageFormat::Enum format, UINT width, UINT height, const std::vector<ImageLayer>& layers,
+    const ImageWriterSettings& settings)
+{
+    ThrowIfFalse(m_file == INVALID_HANDLE_VALUE, L"The image writer is already open.");
+    ThrowIfFalse(width > 0 && height > 0 && settings.tileSize > 0 && settings.maxPendingTiles > 0 && !layers.empty(), L"Invalid image writer settings.");
+    ThrowIfFalse(format != ImageFormat::PFM || (layers.size() == 1 && (layers[0].channels.size() == 1 || layers[0].channels.size() == 3)),
+        L"PFM images hold a single layer of 1 or 3 channels.");
+    ThrowIfFalse(format != ImageFormat::PPM || (layers.size() == 1 && layers[0].channels.size() == 3), L"PPM images hold a single layer of 3 channels.");
+
+    m_format = format;
+    m_pixelType = format == ImageFormat::PFM ? ImagePixelType::Float : settings.pixelType;
+    m_outputTransform = settings.outputTransform;
+    m_width = width;
+    m_height = height;
+    m_tileWidth = format == ImageFormat::EXR ? (std::min)(settings.tileSize, width) : width;
+    m_tileHeight = (std::min)(settings.tileSize, height);
+    m_tilesX = (width + m_tileWidth - 1) / m_tileWidth;
+    m_tilesY = (height + m_tileHeight - 1) / m_tileHeight;
+    m_maxPendingTiles = settings.maxPendingTiles;
+    m_layers = layers;
+
+    m_channels.clear();
+    for (UINT layer = 0; layer < layers.size(); layer++)
+    {
+        const std::string& channels = layers[layer].channels;
+        ThrowIfFalse(!channels.empty(), L"Image layers need at least one channel.");
+        for (UINT component = 0; component < channels.size(); component++)
+        {
+            Channel channel;
+            channel.name = layers[layer].name.empty() ? channels.substr(component, 1) : layers[layer].name + "." + channels[component];
+            channel.layer = layer;
+            channel.component = component;
+            channel.stride = static_cast<UINT>(channels.size());
+            m_channels.push_back(channel);
+        }
+    }
+    if (format == ImageFormat::EXR)
+    {
+        std::stable_sort(m_channels.begin(), m_channels.end(), [](const Channel& a, const Channel& b) { return a.name < b.name; });
+        for (size_t i = 1; i < m_channels.size(); i++)
+        {
+            ThrowIfFalse(m_channels[i - 1].name != m_channels[i].name, L"Image channel names must be unique.");
+        }
+    }
+
+    UINT tileCount = m_tilesX * m_tilesY;
+    m_tileQueued.assign(tileCount, 0);
+    m_tileOffsets.assign(tileCount, 0);
+
+    // Tile buffers are allocated on first use. The array is never resized while the I/O thread runs.
+    m_buffers.clear();
+    m_buffers.resize(m_maxPendingTiles);
+    m_bufferSizes.assign(m_maxPendingTiles, 0);
+    m_freeBuffers.resize(m_maxPendingTiles);
+    for (UINT i = 0; i < m_maxPendingTiles; i++)
+    {
+        m_freeBuffers[i] = m_maxPendingTiles - 1 - i;
+    }
+    m_queue.clear();
+    m_exit = false;
+    m_failed = false;
+    m_stats = ImageWriterStats();
+
+    m_file = CreateFile2(path.c_str(), GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr);
+    ThrowIfFalse(m_file != INVALID_HANDLE_VALUE, L"Failed to create the image file.");
+    WriteHeader();
+
+    m_ioThread = std::thread(&ImageWriter::IOThreadMain, this);
+}
+
+void ImageWriter::WriteHeader()
+{
+    std::vector<BYTE> header;
+    if (m_format == ImageFormat::PFM)
+    {
+        // Rows go from the bottom up, a negative scale marks little endian floats.
+        char text[64];
+        int length = snprintf(text, sizeof(text), "%s\n%u %u\n-1.0\n", m_channels.size() == 3 ? "PF" : "Pf", m_width, m_height);
+        AppendBytes(header, text, length);
+        m_headerSize = header.size();
+        m_fileEnd = m_headerSize + static_cast<UINT64>(m_width) * m_height * m_channels.size() * sizeof(float);
+    }
+    else if (m_format == ImageFormat::PPM)
+    {
+        // Rows go from the top down, a byte per channel.
+        char text[64];
+        int length = snprintf(text, sizeof(text), "P6\n%u %u\n255\n", m_width, m_height);
+        AppendBytes(header, text, length);
+        m_headerSize = header.size();
+        m_fileEnd = m_headerSize + static_cast<UINT64>(m_width) * m_height * 3;
+    }
+    else
+    {
+        Append(header, c_exrMagic);
+        Append(header, c_exrTiledVersion);
+
+        int channelListSize = 1;
+        for (const Channel& channel : m_channels)
+        {
+            channelListSize += static_cast<int>(channel.name.size()) + 1 + 4 * sizeof(int);
+        }
+        AppendAttribute(header, "channels", "chlist", channelListSize);
+        for (const Channel& channel : m_channels)
+        {
+            AppendString(header, channel.name);
+            Append(header, m_pixelType == ImagePixelType::Half ? c_exrHalf : c_exrFloat);
+            Append(header, 0);          // Not perceptually linear, and 3 reserved bytes.
+            Append(header, 1);          // No subsampling in x and y.
+            Append(header, 1);
+        }
+        Append(header, static_cast<BYTE>(0));
+
+        AppendAttribute(header, "compression", "compression", 1);
+        Append(header, static_cast<BYTE>(0));
+        int window[4] = { 0, 0, static_cast<int>(m_width) - 1, static_cast<int>(m_height) - 1 };
+        AppendAttribute(header, "dataWindow", "box2i", sizeof(window));
+        AppendBytes(header, window, sizeof(window));
+        AppendAttribute(header, "displayWindow", "box2i", sizeof(window));
+        AppendBytes(header, window, sizeof(window));
+        AppendAttribute(header, "lineOrder", "lineOrder", 1);
+        Append(header, static_cast<BYTE>(2));   // Random order, tiles are appended as they finish.
+        AppendAttribute(header, "pixelAspectRatio", "float", sizeof(float));
+        Append(header, 1.0f);
+        AppendAttribute(header, "screenWindowCenter", "v2f", 2 * sizeof(float));
+        Append(header, 0.0f);
+        Append(header, 0.0f);
+        AppendAttribute(header, "screenWindowWidth", "float", sizeof(float));
+        Append(header, 1.0f);
+        AppendAttribute(header, "tiles", "tiledesc", 2 * sizeof(UINT) + 1);
+        Append(header, m_tileWidth);
+        Append(header, m_tileHeight);
+        Append(header, static_cast<BYTE>(0));   // A single level.
+        Append(header, static_cast<BYTE>(0));   // End of the header.
+
+        // The tile offset table is written by Close(), once all tiles are in place.
+        m_headerSize = header.size();
+        header.resize(header.size() + m_tileOffsets.size() * sizeof(UINT64), 0);
+        m_fileEnd = header.size();
+    }
+    ThrowIfFalse(WriteAt(0, header.data(), header.size()), L"Failed to write the image header.");
+}
+
+void ImageWriter::WriteTile(UINT tileX, UINT tileY, const float* const* layerPixels, UINT rowPitch)
+{
+    ThrowIfFalse(tileX < m_tilesX && tileY < m_tilesY, L"Tile outside of the image.");
+    UINT tile = tileY * m_tilesX + tileX;
+    UINT buffer;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ThrowIfFalse(m_tileQueued[tile] == 0, L"Tile written twice.");
+        m_tileQueued[tile] = 1;
+        if (m_freeBuffers.empty())
+        {
+            m_stats.waits++;
+            m_freeCondition.wait(lock, [&] { return !m_freeBuffers.empty(); });
+        }
+        buffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+    }
+
+    // The buffer is this thread's until it is queued.
+    size_t size = EncodeTile(tileX, tileY, layerPixels, rowPitch, m_buffers[buffer]);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bufferSizes[buffer] = size;
+        m_queue.push_back({ tile, buffer });
+        m_stats.peakPendingTiles = (std::max)(m_stats.peakPendingTiles, m_maxPendingTiles - static_cast<UINT>(m_freeBuffers.size()));
+    }
+    m_queueCondition.notify_one();
+}
+
+size_t ImageWriter::EncodeTile(UINT tileX, UINT tileY, const float* const* layerPixels, UINT rowPitch, std::vector<BYTE>& bytes) const
+{
+    UINT x0 = tileX * m_tileWidth;
+    UINT y0 = tileY * m_tileHeight;
+    UINT width = (std::min)(m_tileWidth, m_width - x0);
+    UINT height = (std::min)(m_tileHeight, m_height - y0);
+    size_t sampleSize = m_format == ImageFormat::PPM ? sizeof(BYTE) : m_pixelType == ImagePixelType::Half ? sizeof(UINT16) : sizeof(float);
+    size_t dataSize = static_cast<size_t>(width) * height * m_channels.size() * sampleSize;
+    size_t headerSize = m_format == ImageFormat::EXR ? c_exrTileHeaderSize : 0;
+    if (bytes.size() < headerSize + dataSize)
+    {
+        bytes.resize(static_cast<size_t>(m_tileWidth) * m_tileHeight * m_channels.size() * sampleSize + headerSize);
+    }
+
+    BYTE* out = bytes.data();
+    if (m_format == ImageFormat::PFM)
+    {
+        // A band of whole rows of a single layer, the rows are stored bottom up.
+        size_t rowSize = static_cast<size_t>(width) * m_channels.size() * sizeof(float);
+        for (UINT row = 0; row < height; row++)
+        {
+            memcpy(out + row * rowSize, layerPixels[0] + static_cast<size_t>(height - 1 - row) * rowPitch * m_channels.size(), rowSize);
+        }
+        return dataSize;
+    }
+    if (m_format == ImageFormat::PPM)
+    {
+        // A band of whole rows of the RGB layer, tone mapped on the way into the file's bytes.
+        for (UINT row = 0; row < height; row++)
+        {
+            TonemapRow(layerPixels[0] + static_cast<size_t>(row) * rowPitch * 3, width, x0, y0 + row, m_outputTransform, out + static_cast<size_t>(row) * width * 3);
+        }
+        return dataSize;
+    }
+
+    int header[5] = { static_cast<int>(tileX), static_cast<int>(tileY), 0, 0, static_cast<int>(dataSize) };
+    memcpy(out, header, sizeof(header));
+    out += sizeof(header);
+
+    // Each row of the tile holds every channel's samples of the row in turn.
+    for (UINT row = 0; row < height; row++)
+    {
+        for (const Channel& channel : m_channels)
+        {
+            const float* source = layerPixels[channel.layer] + static_cast<size_t>(row) * rowPitch * channel.stride + channel.component;
+            if (m_pixelType == ImagePixelType::Half)
+            {
+                for (UINT x = 0; x < width; x++, out += sizeof(UINT16))
+                {
+                    UINT16 half = FloatToHalf(source[x * channel.stride]);
+                    memcpy(out, &half, sizeof(half));
+                }
+            }
+            else
+            {
+                for (UINT x = 0; x < width; x++, out += sizeof(float))
+                {
+                    memcpy(out, &source[x * channel.stride], sizeof(float));
+                }
+            }
+        }
+    }
+    return headerSize + dataSize;
+}
+
+void ImageWriter::IOThreadMain()
+{
+    for (;;)
+    {
+        PendingTile pending;
+        size_t size;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_queueCondition.wait(lock, [&] { return !m_queue.empty() || m_exit; });
+            if (m_queue.empty())
+            {
+                return;
+            }
+            pending = m_queue.front();
+            m_queue.pop_front();
+            size = m_bufferSizes[pending.buffer];
+        }
+
+        // EXR tiles go to the end of the file, PFM bands to their rows, which are stored bottom up, and PPM bands to theirs.
+        UINT64 offset = m_fileEnd;
+        if (m_format == ImageFormat::PFM)
+        {
+            UINT y0 = pending.tile * m_tileHeight;
+            UINT height = (std::min)(m_tileHeight, m_height - y0);
+            offset = m_headerSize + static_cast<UINT64>(m_height - y0 - height) * m_width * m_channels.size() * sizeof(float);
+        }
+        else if (m_format == ImageFormat::PPM)
+        {
+            offset = m_headerSize + static_cast<UINT64>(pending.tile) * m_tileHeight * m_width * 3;
+        }
+        m_ioTimer.Start();
+        bool written = WriteAt(offset, m_buffers[pending.buffer].data(), size);
+        m_ioTimer.Stop();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stats.ioMS += m_ioTimer.GetElapsedMS();
+            if (written)
+            {
+                m_stats.tiles++;
+                m_tileOffsets[pending.tile] = offset;
+                if (m_format == ImageFormat::EXR)
+                {
+                    m_fileEnd += size;
+                }
+            }
+            m_failed |= !written;
+            m_freeBuffers.push_back(pending.buffer);
+        }
+        m_freeCondition.notify_one();
+    }
+}
+
+bool ImageWriter::WriteAt(UINT64 offset, const void* data, size_t size)
+{
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(offset);
+    if (!SetFilePointerEx(m_file, position, nullptr, FILE_BEGIN))
+    {
+        return false;
+    }
+
+    // WriteFile() takes 32 bit sizes.
+    const BYTE* bytes = static_cast<const BYTE*>(data);
+    while (size > 0)
+    {
+        DWORD chunk = static_cast<DWORD>((std::min)(size, static_cast<size_t>(1) << 30));
+        DWORD written = 0;
+        if (!WriteFile(m_file, bytes, chunk, &written, nullptr) || written != chunk)
+        {
+            return false;
+        }
+        bytes += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+void ImageWriter::StopIOThread()
+{
+    if (m_ioThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_exit = true;
+        }
+        m_queueCondition.notify_one();
+        m_ioThread.join();
+    }
+}
+
+void ImageWriter::Close()
+{
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+    StopIOThread();
+
+    bool complete = !m_failed && m_stats.tiles == m_tileOffsets.size();
+    if (complete && m_format == ImageFormat::EXR)
+    {
+        complete = WriteAt(m_headerSize, m_tileOffsets.data(), m_tileOffsets.size() * sizeof(UINT64));
+    }
+    CloseHandle(m_file);
+    m_file = INVALID_HANDLE_VALUE;
+
+    m_stats.bytes = m_fileEnd;
+    for (const std::vector<BYTE>& buffer : m_buffers)
+    {
+        m_stats.bufferBytes += buffer.capacity();
+    }
+    m_buffers = std::vector<std::vector<BYTE>>();
+    ThrowIfFalse(complete, L"Failed to write the image.");
+}
+
+ImageFormat::Enum Cpu::ImageFormatFromPath(const std::wstring& path)
+{
+    size_t extension = path.find_last_of(L'.');
+    const wchar_t* extensionText = extension != std::wstring::npos ? path.c_str() + extension : L"";
+    if (_wcsicmp(extensionText, L".pfm") == 0)
+    {
+        return ImageFormat::PFM;
+    }
+    if (_wcsicmp(extensionText, L".ppm") == 0)
+    {
+        return ImageFormat::PPM;
+    }
+    return ImageFormat::EXR;
+}
+
+std::vector<ImageLayer> Cpu::RenderImageLayers(bool guides)
+{
+    std::vector<ImageLayer> layers = { { "", "RGB" } };
+    if (guides)
+    {
+        layers.push_back({ "albedo", "RGB" });
+        layers.push_back({ "normal", "XYZ" });
+        layers.push_back({ "depth", "Z" });
+    }
+    return layers;
+}
+
+void Cpu::RenderImage(WavefrontRenderer& renderer, const Scene& scene, const BVH& bvh, const Camera& camera, const PathSettings& settings,
+    ImageWriter& writer)
+{
+    ThrowIfFalse(writer.LayerCount() == 1 || writer.LayerCount() == 4, L"The image writer's layers don't match RenderImageLayers().");
+
+    std::vector<UINT> pixels;
+    for (UINT tileY = 0; tileY < writer.TilesY(); tileY++)
+    {
+        UINT y0 = tileY * writer.TileHeight();
+        UINT y1 = (std::min)(y0 + writer.TileHeight(), camera.height);
+        pixels.resize(static_cast<size_t>(y1 - y0) * camera.width);
+        for (UINT i = 0; i < pixels.size(); i++)
+        {
+            pixels[i] = y0 * camera.width + i;
+        }
+        renderer.Render(scene, bvh, camera, settings, nullptr, &pixels);
+
+        size_t firstPixel = static_cast<size_t>(y0) * camera.width;
+        for (UINT tileX = 0; tileX < writer.TilesX(); tileX++)
+        {
+            size_t pixel = firstPixel + tileX * writer.TileWidth();
+            const float* layerPixels[4] =
+            {
+                &renderer.Radiance()[pixel].x,
+                &renderer.Albedo()[pixel].x,
+                &renderer.Normals()[pixel].x,
+                &renderer.Depths()[pixel]
+            };
+            writer.WriteTile(tileX, tileY, layerPixels, camera.width);
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef CPU_IMAGE_WRITER_H
+#define CPU_IMAGE_WRITER_H
+
+#include <deque>
+#include "CpuTonemap.h"
+#include "CpuWavefront.h"
+
+namespace Cpu
+{
+    namespace ImageFormat {
+        enum Enum {
+            PFM = 0,        // Portable float map, 32 bit float, one layer of 1 or 3 channels.
+            EXR,            // Tiled OpenEXR, uncompressed, any number of layers.
+            PPM,            // Binary portable pixmap, 8 bit display values of a single RGB layer, see OutputTransform.
+            Count
+        };
+    }
+
+    namespace ImagePixelType {
+        enum Enum {
+            Half = 0,       // EXR only, PFM is always float and PPM 8 bit.
+            Float,
+            Count
+        };
+    }
+
+    // A layer of the image, named channels of a float per pixel each, interleaved in the pixels passed to the writer.
+    // Channel names are the layer's name and the channel's letter, "albedo.R", or just the letter in the unnamed layer.
+    struct ImageLayer
+    {
+        std::string name;
+        std::string channels;       // A letter per channel, "RGB", "XYZ" or "Z".
+    };
+
+    struct ImageWriterSettings
+    {
+        ImagePixelType::Enum pixelType = ImagePixelType::Half;
+        UINT tileSize = 64;         // EXR tiles are square, PFM and PPM tiles are bands of full rows as tall, see TileWidth().
+        UINT maxPendingTiles = 32;  // Tiles encoded but not written yet, WriteTile() waits while this many are pending.
+        OutputTransform outputTransform;    // PPM only, applied to each tile as it is encoded.
+    };
+
+    struct ImageWriterStats
+    {
+        UINT tiles = 0;
+        UINT64 bytes = 0;           // File size.
+        UINT peakPendingTiles = 0;
+        UINT64 bufferBytes = 0;     // Memory of the tile buffers, all that the writer holds besides the offset table.
+        UINT waits = 0;             // WriteTile() calls that waited for a free tile buffer.
+        double ioMS = 0;            // Spent on the I/O thread writing tiles.
+    };
+
+    // Streaming HDR image writer.
+    // The image is written tile by tile as tiles finish, in any order: every tile is encoded into the file format by the
+    // thread that hands it over, into one of a bounded set of tile buffers, and a background I/O thread writes the
+    // encoded tiles to the file. Only those buffers are ever held in memory, never a copy of the whole image.
+    // EXR tiles are appended as they arrive and found through the file's tile offset table, PFM and PPM tiles are bands
+    // of rows that are written at their place in the file. PPM tiles are tone mapped and quantized while they are
+    // encoded, so the 8 bit image never needs a float copy of the frame either.
+    class ImageWriter
+    {
+    public:
+        ImageWriter();
+        ~ImageWriter();
+
+        ImageWriter(const ImageWriter&) = delete;
+        ImageWriter& operator=(const ImageWriter&) = delete;
+
+        // Creates the file and writes its header.
+        void Open(const std::wstring& path, ImageFormat::Enum format, UINT width, UINT height, const std::vector<ImageLayer>& layers,
+            const ImageWriterSettings& settings = ImageWriterSettings());
+        // Encodes and queues a tile, safe to call from several threads. layerPixels holds a pointer per layer to the
+        // tile's top left pixel, rows are rowPitch pixels apart.
+        void WriteTile(UINT tileX, UINT tileY, const float* const* layerPixels, UINT rowPitch);
+        // Waits for the pending tiles and completes the file, throws if a tile is missing or a write failed.
+        void Close();
+
+        UINT TileWidth() const { return m_tileWidth; }
+        UINT TileHeight() const { return m_tileHeight; }
+        UINT TilesX() const { return m_tilesX; }
+        UINT TilesY() const { return m_tilesY; }
+        UINT LayerCount() const { return static_cast<UINT>(m_layers.size()); }
+        const ImageWriterStats& Stats() const { return m_stats; }
+
+    private:
+        struct Channel
+        {
+            std::string name;
+            UINT layer;
+            UINT component;
+            UINT stride;            // Channels of the layer.
+        };
+
+        struct PendingTile
+        {
+            UINT tile;
+            UINT buffer;
+        };
+
+        void WriteHeader();
+        size_t EncodeTile(UINT tileX, UINT tileY, const float* const* layerPixels, UINT rowPitch, std::vector<BYTE>& bytes) const;
+        void IOThreadMain();
+        bool WriteAt(UINT64 offset, const void* data, size_t size);
+        void StopIOThread();
+
+        HANDLE m_file;
+        DX::CPUTimer m_ioTimer;
+        ImageFormat::Enum m_format;
+        ImagePixelType::Enum m_pixelType;
+        OutputTransform m_outputTransform;
+        UINT m_width;
+        UINT m_height;
+        UINT m_tileWidth;
+        UINT m_tileHeight;
+        UINT m_tilesX;
+        UINT m_tilesY;
+        UINT m_maxPendingTiles;
+        std::vector<ImageLayer> m_layers;
+        std::vector<Channel> m_channels;    // In file order, sorted by name for EXR.
+        UINT64 m_headerSize;                // Up to the pixels of PFM and PPM, up to the tile offset table of EXR.
+        UINT64 m_fileEnd;
+
+        std::thread m_ioThread;
+        std::mutex m_mutex;
+        std::condition_variable m_queueCondition;
+        std::condition_variable m_freeCondition;
+        std::vector<std::vector<BYTE>> m_buffers;
+        std::vector<size_t> m_bufferSizes;
+        std::vector<UINT> m_freeBuffers;
+        std::deque<PendingTile> m_queue;
+        std::vector<UINT8> m_tileQueued;
+        std::vector<UINT64> m_tileOffsets;
+        bool m_exit;
+        bool m_failed;
+        ImageWriterStats m_stats;
+    };
+
+    // PFM for a path ending in .pfm, PPM for .ppm and EXR for anything else.
+    ImageFormat::Enum ImageFormatFromPath(const std::wstring& path);
+
+    // Layers RenderImage() writes: the radiance, and with guides the albedo, normal and distance of the first hits.
+    std::vector<ImageLayer> RenderImageLayers(bool guides);
+
+    // Renders the frame a band of tiles at a time and hands each finished band to the writer, opened with the camera's
+    // size and RenderImageLayers(), so the writer's I/O overlaps the rendering of the next band.
+    void RenderImage(WavefrontRenderer& renderer, const Scene& scene, const BVH& bvh, const Camera& camera, const PathSettings& settings,
+        ImageWriter& writer);
+}
+
+#endif // !CPU_IMAGE_WRITER_H
@@ -0,0 +1,315 @@
+#include "stdafx.h"
+#include "CpuLights.h"
+
+using namespace Cpu;
+
+namespace
+{
+    static const float Pi = 3.14159265f;
+
+    // Samples a direction uniformly in the cone the sphere subtends from position and returns the nearest point
+    // of the sphere along it. The irradiance is the radiance times the cone's solid angle.
+    bool SampleSphere(const Vec3& center, float radius, const Vec3& radiance, const Vec3& position, float u1, float u2, LightSample& sample)
+    {
+        Vec3 toCenter = center - position;
+        float distanceSquared = LengthSquared(toCenter);
+        float radiusSquared = radius * radius;
+        if (distanceSquared <= radiusSquared)
+        {
+            return false;
+        }
+
+        // 1 - cos(thetaMax) in a form that doesn't cancel out for small and distant spheres.
+        float sinThetaMaxSquared = radiusSquared / distanceSquared;
+        float cosThetaMax = std::sqrt((std::max)(0.0f, 1.0f - sinThetaMaxSquared));
+        float oneMinusCosThetaMax = sinThetaMaxSquared / (1.0f + cosThetaMax);
+
+        float oneMinusCosTheta = u1 * oneMinusCosThetaMax;
+        float cosTheta = 1.0f - oneMinusCosTheta;
+        float sinThetaSquared = oneMinusCosTheta * (2.0f - oneMinusCosTheta);
+        float sinTheta = std::sqrt(sinThetaSquared);
+        float phi = 2.0f * Pi * u2;
+
+        float distance = std::sqrt(distanceSquared);
+        Vec3 w = toCenter * (1.0f / distance);
+        Vec3 t = Normalize(Cross(std::fabs(w.x) > 0.9f ? Vec3(0, 1, 0) : Vec3(1, 0, 0), w));
+        Vec3 b = Cross(w, t);
+        Vec3 direction = (t * std::cos(phi) + b * std::sin(phi)) * sinTheta + w * cosTheta;
+
+        float hitT = distance * cosTheta - std::sqrt((std::max)(0.0f, radiusSquared - distanceSquared * sinThetaSquared));
+        sample.position = position + direction * hitT;
+        sample.irradiance = radiance * (2.0f * Pi * oneMinusCosThetaMax);
+        sample.pdf = 1.0f / (2.0f * Pi * oneMinusCosThetaMax);
+        return true;
+    }
+
+    float SpherePdf(const Vec3& center, float radius, const Vec3& position)
+    {
+        float distanceSquared = LengthSquared(center - position);
+        float radiusSquared = radius * radius;
+        if (distanceSquared <= radiusSquared)
+        {
+            return 0.0f;
+        }
+        float sinThetaMaxSquared = radiusSquared / distanceSquared;
+        float cosThetaMax = std::sqrt((std::max)(0.0f, 1.0f - sinThetaMaxSquared));
+        return 1.0f / (2.0f * Pi * sinThetaMaxSquared / (1.0f + cosThetaMax));
+    }
+
+    float TrianglePdf(const Vec3& e1, const Vec3& e2, const Vec3& position, const Vec3& lightPosition)
+    {
+        Vec3 toLight = lightPosition - position;
+        float distanceSquared = LengthSquared(toLight);
+        Vec3 normal = Cross(e1, e2);
+        float cosLightTimesDoubleArea = -Dot(normal, toLight) / std::sqrt(distanceSquared);
+        return cosLightTimesDoubleArea > 0 ? 2.0f * distanceSquared / cosLightTimesDoubleArea : 0.0f;
+    }
+
+    // Samples a point uniformly over the triangle's area. The triangle emits from the side Cross(e1, e2) faces.
+    bool SampleTriangle(const Vec3& v0, const Vec3& e1, const Vec3& e2, const Vec3& radiance, const Vec3& position, float u1, float u2, LightSample& sample)
+    {
+        float su = std::sqrt(u1);
+        sample.position = v0 + e1 * (su * (1.0f - u2)) + e2 * (su * u2);
+
+        Vec3 toLight = sample.position - position;
+        float distanceSquared = LengthSquared(toLight);
+        Vec3 normal = Cross(e1, e2);
+        float doubleArea = Length(normal);
+        if (distanceSquared <= 0 || doubleArea <= 0)
+        {
+            return false;
+        }
+
+        float cosLight = -Dot(normal, toLight) / (doubleArea * std::sqrt(distanceSquared));
+        if (cosLight <= 0)
+        {
+            return false;
+        }
+        sample.irradiance = radiance * (0.5f * doubleArea * cosLight / distanceSquared);
+        sample.pdf = distanceSquared / (0.5f * doubleArea * cosLight);
+        return true;
+    }
+}
+
+bool Cpu::SampleLight(const Scene& scene, const Light& light, const Vec3& position, float time, float u1, float u2, LightSample& sample)
+{
+    switch (light.type)
+    {
+    case LightType::Point:
+    {
+        float distanceSquared = LengthSquared(light.position - position);
+        if (distanceSquared <= 0)
+        {
+            return false;
+        }
+        sample.position = light.position;
+        sample.irradiance = light.emission * (1.0f / distanceSquared);
+        sample.pdf = 0;
+        return true;
+    }
+    case LightType::Sphere:
+    {
+        bool sampled = SampleSphere(light.position, light.radius, light.emission, position, u1, u2, sample);
+        sample.pdf = 0;
+        return sampled;
+    }
+    case LightType::Primitive:
+    {
+        UINT index = GetPrimitiveIndex(light.primitive);
+        if (GetPrimitiveKind(light.primitive) == PrimitiveKind::Sphere)
+        {
+            return SampleSphere(scene.GetSphereCenter(index, time), scene.sphereRadius[index], light.emission, position, u1, u2, sample);
+        }
+        return SampleTriangle(scene.triangleV0[index], scene.triangleE1[index], scene.triangleE2[index], light.emission, position, u1, u2, sample);
+    }
+    default:
+        return false;
+    }
+}
+
+float Cpu::LightPdf(const Scene& scene, const Light& light, const Vec3& position, float time, const Vec3& lightPosition)
+{
+    if (light.type != LightType::Primitive)
+    {
+        return 0.0f;
+    }
+
+    UINT index = GetPrimitiveIndex(light.primitive);
+    if (GetPrimitiveKind(light.primitive) == PrimitiveKind::Sphere)
+    {
+        return SpherePdf(scene.GetSphereCenter(index, time), scene.sphereRadius[index], position);
+    }
+    return TrianglePdf(scene.triangleE1[index], scene.triangleE2[index], position, lightPosition);
+}
+
+void LightTree::Build(const Scene& scene)
+{
+    m_nodes.clear();
+    m_parents.clear();
+    m_lightLeaves.assign(scene.LightCount(), 0);
+    UINT lightCount = scene.LightCount();
+    if (lightCount == 0)
+    {
+        return;
+    }
+
+    // Power, up to a constant factor: what the light delivers to a point at unit distance.
+    std::vector<BuildLight> buildLights(lightCount);
+    for (UINT i = 0; i < lightCount; i++)
+    {
+        const Light& light = scene.lights[i];
+        float area = 1.0f;
+        switch (light.type)
+        {
+        case LightType::Sphere:
+            area = Pi * light.radius * light.radius;
+            break;
+        case LightType::Primitive:
+        {
+            UINT index = GetPrimitiveIndex(light.primitive);
+            if (GetPrimitiveKind(light.primitive) == PrimitiveKind::Sphere)
+            {
+                area = Pi * scene.sphereRadius[index] * scene.sphereRadius[index];
+            }
+            else
+            {
+                area = 0.5f * Length(Cross(scene.triangleE1[index], scene.triangleE2[index]));
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+        BuildLight& buildLight = buildLights[i];
+        buildLight.bounds = scene.GetLightBounds(i);
+        buildLight.centroid = buildLight.bounds.Centroid();
+        buildLight.power = Luminance(light.emission) * area;
+        buildLight.index = i;
+    }
+
+    m_nodes.reserve(2 * lightCount - 1);
+    m_parents.reserve(2 * lightCount - 1);
+    m_nodes.emplace_back();
+    m_parents.push_back(0);
+    Subdivide(0, 0, lightCount, buildLights);
+}
+
+// Median split along the longest axis of the light centroids, down to one light per leaf.
+void LightTree::Subdivide(UINT nodeIndex, UINT first, UINT count, std::vector<BuildLight>& buildLights)
+{
+    Aabb bounds;
+    Aabb centroidBounds;
+    float power = 0;
+    for (UINT i = first; i < first + count; i++)
+    {
+        bounds.Grow(buildLights[i].bounds);
+        centroidBounds.Grow(buildLights[i].centroid);
+        power += buildLights[i].power;
+    }
+
+    LightNode& node = m_nodes[nodeIndex];
+    node.boundsMin = bounds.min;
+    node.boundsMax = bounds.max;
+    node.power = power;
+    if (count == 1)
+    {
+        node.leftFirst = buildLights[first].index | LightNode::LeafFlag;
+        m_lightLeaves[buildLights[first].index] = nodeIndex;
+        return;
+    }
+
+    Vec3 extent = centroidBounds.Extent();
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    UINT middle = first + count / 2;
+    std::nth_element(buildLights.begin() + first, buildLights.begin() + middle, buildLights.begin() + first + count,
+        [axis](const BuildLight& a, const BuildLight& b) { return a.centroid[axis] < b.centroid[axis]; });
+
+    UINT leftIndex = static_cast<UINT>(m_nodes.size());
+    node.leftFirst = leftIndex;
+    m_nodes.emplace_back();
+    m_nodes.emplace_back();
+    m_parents.push_back(nodeIndex);
+    m_parents.push_back(nodeIndex);
+    Subdivide(leftIndex, first, middle - first, buildLights);
+    Subdivide(leftIndex + 1, middle, first + count - middle, buildLights);
+}
+
+float LightTree::Importance(const LightNode& node, const Vec3& position, const Vec3& normal) const
+{
+    // Lights entirely below the surface don't light it, test the corner furthest along the normal.
+    Vec3 corner(
+        normal.x > 0 ? node.boundsMax.x : node.boundsMin.x,
+        normal.y > 0 ? node.boundsMax.y : node.boundsMin.y,
+        normal.z > 0 ? node.boundsMax.z : node.boundsMin.z);
+    if (Dot(corner - position, normal) <= 0)
+    {
+        return 0.0f;
+    }
+
+    // Distance to the bounds center, clamped to the bounds radius so nearby and enclosing nodes don't blow up.
+    Vec3 extent = node.boundsMax - node.boundsMin;
+    float distanceSquared = LengthSquared((node.boundsMin + node.boundsMax) * 0.5f - position);
+    float radiusSquared = 0.25f * LengthSquared(extent);
+    return node.power / (std::max)((std::max)(distanceSquared, radiusSquared), 1e-6f);
+}
+
+UINT LightTree::Select(const Vec3& position, const Vec3& normal, float u, float& pdf) const
+{
+    if (m_nodes.empty())
+    {
+        return InvalidLight;
+    }
+
+    // Each decision rescales u to <0, 1) so one random number serves the whole descent.
+    pdf = 1.0f;
+    UINT nodeIndex = 0;
+    while (!m_nodes[nodeIndex].IsLeaf())
+    {
+        UINT left = m_nodes[nodeIndex].leftFirst;
+        float leftImportance = Importance(m_nodes[left], position, normal);
+        float rightImportance = Importance(m_nodes[left + 1], position, normal);
+        float total = leftImportance + rightImportance;
+        if (total <= 0)
+        {
+            return InvalidLight;
+        }
+
+        float leftProbability = leftImportance / total;
+        if (u < leftProbability)
+        {
+            u = u / leftProbability;
+            pdf *= leftProbability;
+            nodeIndex = left;
+        }
+        else
+        {
+            u = (u - leftProbability) / (1.0f - leftProbability);
+            pdf *= 1.0f - leftProbability;
+            nodeIndex = left + 1;
+        }
+        u = (std::min)(u, 0.99999994f);
+    }
+    return m_nodes[nodeIndex].leftFirst & ~LightNode::LeafFlag;
+}
+
+float LightTree::Pdf(const Vec3& position, const Vec3& normal, UINT lightIndex) const
+{
+    // Product of the child probabilities Select() takes on the way down to the light's leaf.
+    float pdf = 1.0f;
+    UINT nodeIndex = m_lightLeaves[lightIndex];
+    while (nodeIndex != 0)
+    {
+        UINT left = m_nodes[m_parents[nodeIndex]].leftFirst;
+        float leftImportance = Importance(m_nodes[left], position, normal);
+        float rightImportance = Importance(m_nodes[left + 1], position, normal);
+        float total = leftImportance + rightImportance;
+        if (total <= 0)
+        {
+            return 0.0f;
+        }
+        pdf *= (nodeIndex == left ? leftImportance : rightImportance) / total;
+        nodeIndex = m_parents[nodeIndex];
+    }
+    return pdf;
+}
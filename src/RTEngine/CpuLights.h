@@ -0,0 +1,90 @@
+#ifndef CPU_LIGHTS_H
+#define CPU_LIGHTS_H
+
+#include "CpuScene.h"
+
+namespace Cpu
+{
+    // Point on a light a shading point is lit from and the irradiance it receives from there,
+    // at normal incidence and already divided by the probability of sampling the point.
+    // pdf is the solid angle density of the sampled direction for emissive primitives, which paths can also
+    // hit, and 0 for point and sphere lights, which only light sampling finds.
+    struct LightSample
+    {
+        Vec3 position;
+        Vec3 irradiance;
+        float pdf;
+    };
+
+    // Samples a point on a light as seen from position at a shutter time.
+    // Returns false if the light can't reach the position.
+    bool SampleLight(const Scene& scene, const Light& light, const Vec3& position, float time, float u1, float u2, LightSample& sample);
+
+    // Solid angle density with which SampleLight() picks lightPosition, a point of an emissive primitive, from position.
+    float LightPdf(const Scene& scene, const Light& light, const Vec3& position, float time, const Vec3& lightPosition);
+
+    // Picks one of lightCount lights with equal probability.
+    inline UINT SelectLightUniform(UINT lightCount, float u, float& pdf)
+    {
+        if (lightCount == 0)
+        {
+            return InvalidLight;
+        }
+        pdf = 1.0f / lightCount;
+        return (std::min)(static_cast<UINT>(u * lightCount), lightCount - 1);
+    }
+
+    // 32 byte light tree node.
+    // Interior nodes: leftFirst is the index of the first of two adjacent children.
+    // Leaf nodes hold a single light, leftFirst is its index with LeafFlag set.
+    struct LightNode
+    {
+        static const UINT LeafFlag = 1u << 31;
+
+        Vec3 boundsMin;
+        UINT leftFirst;
+        Vec3 boundsMax;
+        float power;        // Luminance of the summed emission, scaled by the emitting area.
+
+        bool IsLeaf() const { return (leftFirst & LeafFlag) != 0; }
+    };
+
+    // Binary bounding volume hierarchy over the scene lights.
+    // Selection walks from the root to a single light, at every node it picks a child in proportion to an
+    // estimate of the child's contribution to the shading point: its power over the squared distance, and
+    // nothing for lights that are all below the surface. The cost of a selection grows with the log of the
+    // light count, and the estimate concentrates the samples on the lights that matter.
+    class LightTree
+    {
+    public:
+        void Build(const Scene& scene);
+
+        // Selects a light for a shading point and returns its index and selection probability,
+        // or InvalidLight if no light can contribute.
+        UINT Select(const Vec3& position, const Vec3& normal, float u, float& pdf) const;
+
+        // Probability that Select() picks the light for the shading point.
+        float Pdf(const Vec3& position, const Vec3& normal, UINT lightIndex) const;
+
+        UINT NodeCount() const { return static_cast<UINT>(m_nodes.size()); }
+        size_t SizeInBytes() const { return m_nodes.size() * sizeof(LightNode); }
+
+    private:
+        struct BuildLight
+        {
+            Aabb bounds;
+            Vec3 centroid;
+            float power;
+            UINT index;
+        };
+
+        void Subdivide(UINT nodeIndex, UINT first, UINT count, std::vector<BuildLight>& buildLights);
+        float Importance(const LightNode& node, const Vec3& position, const Vec3& normal) const;
+
+        std::vector<LightNode> m_nodes;
+        std::vector<UINT> m_parents;        // Parent node per node, for Pdf().
+        std::vector<UINT> m_lightLeaves;    // Leaf node per light.
+    };
+}
+
+#endif // !CPU_LIGHTS_H
@@ -0,0 +1,79 @@
+#ifndef CPU_MATH_H
+#define CPU_MATH_H
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+// Small scalar vector library used by the CPU raytracing backend.
+// DirectXMath types are used at the engine boundary, these are used in the hot loops.
+namespace Cpu
+{
+    struct Vec3
+    {
+        float x, y, z;
+
+        Vec3() : x(0), y(0), z(0) {}
+        Vec3(float v) : x(v), y(v), z(v) {}
+        Vec3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+        Vec3(const XMFLOAT3& v) : x(v.x), y(v.y), z(v.z) {}
+
+        float operator[](int axis) const { return (&x)[axis]; }
+        float& operator[](int axis) { return (&x)[axis]; }
+    };
+
+    inline Vec3 operator+(const Vec3& a, const Vec3& b) { return Vec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+    inline Vec3 operator-(const Vec3& a, const Vec3& b) { return Vec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+    inline Vec3 operator*(const Vec3& a, const Vec3& b) { return Vec3(a.x * b.x, a.y * b.y, a.z * b.z); }
+    inline Vec3 operator*(const Vec3& a, float s) { return Vec3(a.x * s, a.y * s, a.z * s); }
+    inline Vec3 operator*(float s, const Vec3& a) { return Vec3(a.x * s, a.y * s, a.z * s); }
+    inline Vec3 operator/(const Vec3& a, const Vec3& b) { return Vec3(a.x / b.x, a.y / b.y, a.z / b.z); }
+    inline Vec3 operator-(const Vec3& a) { return Vec3(-a.x, -a.y, -a.z); }
+    inline Vec3& operator+=(Vec3& a, const Vec3& b) { a.x += b.x; a.y += b.y; a.z += b.z; return a; }
+    inline Vec3& operator*=(Vec3& a, const Vec3& b) { a.x *= b.x; a.y *= b.y; a.z *= b.z; return a; }
+    inline Vec3& operator*=(Vec3& a, float s) { a.x *= s; a.y *= s; a.z *= s; return a; }
+
+    inline float Dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline Vec3 Cross(const Vec3& a, const Vec3& b)
+    {
+        return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    }
+    inline float LengthSquared(const Vec3& a) { return Dot(a, a); }
+    inline float Length(const Vec3& a) { return std::sqrt(Dot(a, a)); }
+    inline Vec3 Normalize(const Vec3& a) { return a * (1.0f / Length(a)); }
+    inline Vec3 Min(const Vec3& a, const Vec3& b) { return Vec3(a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z); }
+    inline Vec3 Max(const Vec3& a, const Vec3& b) { return Vec3(a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z); }
+    inline float MaxComponent(const Vec3& a) { return a.x > a.y ? (a.x > a.z ? a.x : a.z) : (a.y > a.z ? a.y : a.z); }
+    inline float Lerp(float a, float b, float t) { return a + (b - a) * t; }
+    inline Vec3 Lerp(const Vec3& a, const Vec3& b, float t) { return a + (b - a) * t; }
+
+    // reflect() takes incident ray and surface normal, returns reflection vector
+    inline Vec3 Reflect(const Vec3& incident, const Vec3& normal)
+    {
+        return incident - normal * (2.0f * Dot(incident, normal));
+    }
+
+    inline float Saturate(float v) { return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v); }
+    inline float Luminance(const Vec3& color) { return Dot(color, Vec3(0.2126f, 0.7152f, 0.0722f)); }
+
+    // Axis aligned bounding box.
+    struct Aabb
+    {
+        Vec3 min = Vec3(FLT_MAX);
+        Vec3 max = Vec3(-FLT_MAX);
+
+        void Grow(const Vec3& p) { min = Min(min, p); max = Max(max, p); }
+        void Grow(const Aabb& b) { min = Min(min, b.min); max = Max(max, b.max); }
+        bool IsEmpty() const { return min.x > max.x; }
+        Vec3 Centroid() const { return (min + max) * 0.5f; }
+        Vec3 Extent() const { return max - min; }
+        float SurfaceArea() const
+        {
+            if (IsEmpty()) return 0.0f;
+            Vec3 e = Extent();
+            return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+    };
+}
+
+#endif // !CPU_MATH_H
@@ -0,0 +1,414 @@
+#include "stdafx.h"
+#include "CpuMetaballs.h"
+#include "MetaballKeyFrames.h"
+
+using namespace Cpu;
+
+namespace
+{
+    // Cells listing up to this many metaballs keep the per metaball distances of the march on the stack.
+    static const UINT c_stackMetaballs = 64;
+
+    // Quintic field function of a single metaball, see CalculateMetaballPotential().
+    // Stores the distance of position from the center, or -1 outside of the metaball.
+    inline float MetaballPotential(const Vec3& position, const Metaball& blob, float& distance)
+    {
+        float distanceSquared = LengthSquared(position - blob.center);
+        if (distanceSquared > blob.radius * blob.radius)
+        {
+            distance = -1;
+            return 0;
+        }
+
+        distance = std::sqrt(distanceSquared);
+        float x = 1 - distance / blob.radius;
+        return x * x * x * (x * (x * 6 - 15) + 10);
+    }
+
+    // See CalculateAnimationInterpolant().
+    float AnimationInterpolant(float elapsedTime, float cycleDuration)
+    {
+        float t = std::fmod(elapsedTime, cycleDuration) / cycleDuration;
+        t = t <= 0.5f ? 2 * t : 1 - 2 * (t - 0.5f);
+        return t * t * (3 - 2 * t);
+    }
+
+    // Entry and exit of a ray through a solid sphere, see RaySolidSphereIntersectionTest().
+    bool IntersectSolidSphere(const Ray& ray, const Vec3& center, float radius, float& tEnter, float& tExit)
+    {
+        Vec3 L = ray.origin - center;
+        float a = Dot(ray.direction, ray.direction);
+        float halfB = Dot(ray.direction, L);
+        float c = Dot(L, L) - radius * radius;
+        float discr = halfB * halfB - a * c;
+        if (discr < 0) return false;
+
+        float sqrtDiscr = std::sqrt(discr);
+        tEnter = (std::max)((-halfB - sqrtDiscr) / a, ray.tMin);
+        tExit = (std::min)((-halfB + sqrtDiscr) / a, ray.tMax);
+        return true;
+    }
+}
+
+MetaballField::MetaballField()
+{
+    for (UINT j = 0; j < N_METABALLS; j++)
+    {
+        AnimatedMetaball metaball;
+        metaball.center0 = Vec3(c_metaballKeyFrame0[j]);
+        metaball.center1 = Vec3(c_metaballKeyFrame1[j]);
+        metaball.radius = c_metaballRadii[j];
+        m_keyFrames.push_back(metaball);
+    }
+    InitializeAnimated(0, 1);
+}
+
+MetaballField::MetaballField(std::vector<AnimatedMetaball> metaballs) :
+    m_keyFrames(std::move(metaballs))
+{
+    ThrowIfFalse(!m_keyFrames.empty(), L"Empty metaball field.");
+    for (const AnimatedMetaball& metaball : m_keyFrames)
+    {
+        ThrowIfFalse(metaball.radius > 0, L"Metaball radii must be positive.");
+    }
+    InitializeAnimated(0, 1);
+}
+
+MetaballField MetaballField::Load(const std::wstring& path)
+{
+    byte* data = nullptr;
+    UINT size = 0;
+    ThrowIfFailed(ReadDataFromFile(path.c_str(), &data, &size));
+    std::string text(reinterpret_cast<const char*>(data), size);
+    free(data);
+
+    std::vector<AnimatedMetaball> metaballs;
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        std::istringstream values(line.substr(0, line.find('#')));
+        float v[8];
+        UINT count = 0;
+        while (count < 8 && values >> v[count])
+        {
+            count++;
+        }
+        if (count == 0 && values.eof())
+        {
+            continue;
+        }
+        ThrowIfFalse((count == 4 || count == 7) && values.eof(), L"Invalid metaball, expected \"x0 y0 z0 x1 y1 z1 radius\" or \"x y z radius\".");
+
+        AnimatedMetaball metaball;
+        metaball.center0 = Vec3(v[0], v[1], v[2]);
+        metaball.center1 = count == 7 ? Vec3(v[3], v[4], v[5]) : metaball.center0;
+        metaball.radius = v[count - 1];
+        metaballs.push_back(metaball);
+    }
+    return MetaballField(std::move(metaballs));
+}
+
+void MetaballField::InitializeAnimated(float elapsedTime, float cycleDuration, MetaballCulling::Enum culling)
+{
+    float tAnimate = AnimationInterpolant(elapsedTime, cycleDuration);
+    m_blobs.resize(m_keyFrames.size());
+    for (size_t j = 0; j < m_keyFrames.size(); j++)
+    {
+        m_blobs[j].center = Lerp(m_keyFrames[j].center0, m_keyFrames[j].center1, tAnimate);
+        m_blobs[j].radius = m_keyFrames[j].radius;
+    }
+    BuildGrid(culling);
+}
+
+// Buckets the metaballs into cubic cells, about c_cellsPerMetaball per metaball, with a counting pass
+// and a filling pass over the cells the bounding box of each metaball covers.
+void MetaballField::BuildGrid(MetaballCulling::Enum culling)
+{
+    m_bounds = Aabb();
+    for (const Metaball& blob : m_blobs)
+    {
+        m_bounds.Grow(blob.center - Vec3(blob.radius));
+        m_bounds.Grow(blob.center + Vec3(blob.radius));
+    }
+
+    Vec3 extent = m_bounds.Extent();
+    float cellSize = std::cbrt(extent.x * extent.y * extent.z / (c_cellsPerMetaball * m_blobs.size()));
+    for (int axis = 0; axis < 3; axis++)
+    {
+        m_resolution[axis] = culling == MetaballCulling::Grid
+            ? (std::max)(1, (std::min)(static_cast<int>(std::ceil(extent[axis] / cellSize)), static_cast<int>(c_maxResolution)))
+            : 1;
+        m_cellSize[axis] = extent[axis] / m_resolution[axis];
+    }
+
+    auto ForEachOverlappedCell = [&](const Metaball& blob, auto&& function)
+    {
+        int first[3], last[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            first[axis] = (std::max)(0, static_cast<int>((blob.center[axis] - blob.radius - m_bounds.min[axis]) / m_cellSize[axis]));
+            last[axis] = (std::min)(m_resolution[axis] - 1, static_cast<int>((blob.center[axis] + blob.radius - m_bounds.min[axis]) / m_cellSize[axis]));
+        }
+
+        int cell[3];
+        for (cell[2] = first[2]; cell[2] <= last[2]; cell[2]++)
+        {
+            for (cell[1] = first[1]; cell[1] <= last[1]; cell[1]++)
+            {
+                for (cell[0] = first[0]; cell[0] <= last[0]; cell[0]++)
+                {
+                    // Distance from the center to the closest point of the cell.
+                    float distanceSquared = 0;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        float cellMin = m_bounds.min[axis] + cell[axis] * m_cellSize[axis];
+                        float d = (std::max)((std::max)(cellMin - blob.center[axis], blob.center[axis] - cellMin - m_cellSize[axis]), 0.0f);
+                        distanceSquared += d * d;
+                    }
+                    if (distanceSquared <= blob.radius * blob.radius)
+                    {
+                        function(CellIndex(cell));
+                    }
+                }
+            }
+        }
+    };
+
+    UINT cellCount = CellCount();
+    m_cellStart.assign(cellCount + 1, 0);
+    for (const Metaball& blob : m_blobs)
+    {
+        ForEachOverlappedCell(blob, [&](UINT cellIndex) { m_cellStart[cellIndex + 1]++; });
+    }
+    m_maxCellMetaballs = 0;
+    for (UINT i = 0; i < cellCount; i++)
+    {
+        m_maxCellMetaballs = (std::max)(m_maxCellMetaballs, m_cellStart[i + 1]);
+        m_cellStart[i + 1] += m_cellStart[i];
+    }
+
+    m_cellMetaballs.resize(m_cellStart[cellCount]);
+    std::vector<UINT> cursor(m_cellStart.begin(), m_cellStart.end() - 1);
+    for (UINT j = 0; j < m_blobs.size(); j++)
+    {
+        ForEachOverlappedCell(m_blobs[j], [&](UINT cellIndex) { m_cellMetaballs[cursor[cellIndex]++] = j; });
+    }
+}
+
+float MetaballField::Potential(const Vec3& position, const UINT* metaballs, UINT count, float* distances, MetaballStats* stats) const
+{
+    float sumFieldPotential = 0;
+    for (UINT j = 0; j < count; j++)
+    {
+        sumFieldPotential += MetaballPotential(position, m_blobs[metaballs[j]], distances[j]);
+    }
+    if (stats) stats->potentialEvaluations += count;
+    return sumFieldPotential;
+}
+
+// Gradient of the field from the distances a Potential() evaluation at position stored,
+// without evaluating the field again. See CalculateMetaballPotential().
+Vec3 MetaballField::Gradient(const Vec3& position, const UINT* metaballs, UINT count, const float* distances) const
+{
+    Vec3 gradient(0.0f);
+    for (UINT j = 0; j < count; j++)
+    {
+        if (distances[j] > 0)
+        {
+            const Metaball& blob = m_blobs[metaballs[j]];
+            float x = 1 - distances[j] / blob.radius;
+            float xx = x * (1 - x);
+            gradient += (position - blob.center) * (-30 * xx * xx / (blob.radius * distances[j]));
+        }
+    }
+    return gradient;
+}
+
+// Central differences, as the shaders used before the analytic gradient.
+Vec3 MetaballField::FiniteDifferenceNormal(const Vec3& position, const UINT* metaballs, UINT count, float* distances, MetaballStats* stats) const
+{
+    const float e = 0.5773f * 0.00001f;
+    UINT64 evaluations = stats ? stats->potentialEvaluations : 0;
+    Vec3 normal = Normalize(Vec3(
+        Potential(position + Vec3(-e, 0, 0), metaballs, count, distances, stats) - Potential(position + Vec3(e, 0, 0), metaballs, count, distances, stats),
+        Potential(position + Vec3(0, -e, 0), metaballs, count, distances, stats) - Potential(position + Vec3(0, e, 0), metaballs, count, distances, stats),
+        Potential(position + Vec3(0, 0, -e), metaballs, count, distances, stats) - Potential(position + Vec3(0, 0, e), metaballs, count, distances, stats)));
+    if (stats) stats->normalEvaluations += stats->potentialEvaluations - evaluations;
+    return normal;
+}
+
+// The ray walks the grid cells it crosses front to back. Within a cell, only the cell's metaballs
+// contribute to the field, so the ray is marched through the ones it crosses there, the part of the
+// ray inside their bounding spheres, as the intersection shader marches the whole field.
+// The first cell with a crossing has the closest one.
+bool MetaballField::Intersect(const Ray& ray, MetaballMarch::Enum march, MetaballNormals::Enum normals, float& thit, Vec3& normal, MetaballStats* stats) const
+{
+    if (stats) stats->rays++;
+
+    // Clip the ray to the grid.
+    float tEnter = ray.tMin;
+    float tExit = ray.tMax;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float invDirection = 1.0f / ray.direction[axis];
+        float t0 = (m_bounds.min[axis] - ray.origin[axis]) * invDirection;
+        float t1 = (m_bounds.max[axis] - ray.origin[axis]) * invDirection;
+        tEnter = (std::max)(tEnter, (std::min)(t0, t1));
+        tExit = (std::min)(tExit, (std::max)(t0, t1));
+    }
+    if (!(tEnter <= tExit))
+    {
+        return false;
+    }
+
+    // 3D DDA setup.
+    int cell[3], cellStep[3];
+    float tNext[3], tDelta[3];
+    Vec3 entry = ray.origin + ray.direction * tEnter;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        cell[axis] = (std::max)(0, (std::min)(static_cast<int>((entry[axis] - m_bounds.min[axis]) / m_cellSize[axis]), m_resolution[axis] - 1));
+        if (ray.direction[axis] != 0)
+        {
+            cellStep[axis] = ray.direction[axis] > 0 ? 1 : -1;
+            float boundary = m_bounds.min[axis] + (cell[axis] + (cellStep[axis] > 0 ? 1 : 0)) * m_cellSize[axis];
+            tNext[axis] = (boundary - ray.origin[axis]) / ray.direction[axis];
+            tDelta[axis] = m_cellSize[axis] / std::fabs(ray.direction[axis]);
+        }
+        else
+        {
+            cellStep[axis] = 0;
+            tNext[axis] = FLT_MAX;
+            tDelta[axis] = FLT_MAX;
+        }
+    }
+
+    // Per cell scratch: the cell's metaballs the ray crosses and the distances of their last evaluations.
+    UINT stackActive[c_stackMetaballs];
+    float stackDistances[2 * c_stackMetaballs];
+    std::vector<UINT> heapActive;
+    std::vector<float> heapDistances;
+    UINT* active = stackActive;
+    float* distances = stackDistances;
+    if (m_maxCellMetaballs > c_stackMetaballs)
+    {
+        heapActive.resize(m_maxCellMetaballs);
+        heapDistances.resize(2 * m_maxCellMetaballs);
+        active = heapActive.data();
+        distances = heapDistances.data();
+    }
+    float* midDistances = distances + (std::max)(m_maxCellMetaballs, c_stackMetaballs);
+
+    float tCellEnter = tEnter;
+    for (;;)
+    {
+        float tCellExit = (std::min)((std::min)((std::min)(tNext[0], tNext[1]), tNext[2]), tExit);
+        UINT cellIndex = CellIndex(cell);
+        if (stats) stats->cells++;
+
+        // The cell's metaballs the ray crosses within the cell, and the ray segment they span.
+        UINT activeCount = 0;
+        float tmin = FLT_MAX;
+        float tmax = -FLT_MAX;
+        float lipschitzBound = 0;
+        for (UINT i = m_cellStart[cellIndex]; i < m_cellStart[cellIndex + 1]; i++)
+        {
+            const Metaball& blob = m_blobs[m_cellMetaballs[i]];
+            float tSphereEnter, tSphereExit;
+            if (IntersectSolidSphere(ray, blob.center, blob.radius, tSphereEnter, tSphereExit))
+            {
+                tSphereEnter = (std::max)(tSphereEnter, tCellEnter);
+                tSphereExit = (std::min)(tSphereExit, tCellExit);
+                if (tSphereEnter <= tSphereExit)
+                {
+                    tmin = (std::min)(tmin, tSphereEnter);
+                    tmax = (std::max)(tmax, tSphereExit);
+                    lipschitzBound += METABALL_FIELD_LIPSCHITZ / blob.radius;
+                    active[activeCount++] = m_cellMetaballs[i];
+                }
+            }
+        }
+
+        if (activeCount > 0 && MarchSegment(ray, tmin, tmax, lipschitzBound, active, activeCount, march, normals, distances, midDistances, thit, normal, stats))
+        {
+            return true;
+        }
+
+        // Into the next cell.
+        if (tCellExit >= tExit)
+        {
+            return false;
+        }
+        int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        cell[axis] += cellStep[axis];
+        if (cell[axis] < 0 || cell[axis] >= m_resolution[axis])
+        {
+            return false;
+        }
+        tNext[axis] += tDelta[axis];
+        tCellEnter = tCellExit;
+    }
+}
+
+// See RayMetaballsIntersectionTest(), marches <tmin, tmax> of the ray through the metaballs of a cell.
+bool MetaballField::MarchSegment(const Ray& ray, float tmin, float tmax, float lipschitzBound, const UINT* metaballs, UINT count,
+    MetaballMarch::Enum march, MetaballNormals::Enum normals, float* distances, float* midDistances, float& thit, Vec3& normal, MetaballStats* stats) const
+{
+    lipschitzBound *= Length(ray.direction);
+
+    float minTStep = (tmax - tmin) / METABALL_MAX_STEPS;
+    float tPrevious = tmin;
+    float t = tmin;
+    for (UINT step = 0; step < METABALL_MAX_STEPS; step++)
+    {
+        if (stats) stats->steps++;
+        float sumFieldPotential = Potential(ray.origin + ray.direction * t, metaballs, count, distances, stats);
+
+        if (sumFieldPotential >= METABALL_THRESHOLD)
+        {
+            float tInside = t;
+            if (march == MetaballMarch::SphereTrace)
+            {
+                float tOutside = tPrevious;
+                for (UINT i = 0; i < METABALL_BISECTION_STEPS; i++)
+                {
+                    float tMid = 0.5f * (tOutside + tInside);
+                    if (Potential(ray.origin + ray.direction * tMid, metaballs, count, midDistances, stats) >= METABALL_THRESHOLD)
+                    {
+                        tInside = tMid;
+                        std::copy(midDistances, midDistances + count, distances);
+                    }
+                    else
+                    {
+                        tOutside = tMid;
+                    }
+                }
+            }
+
+            // Hits are in range by construction and the CPU backend doesn't cull.
+            thit = tInside;
+            Vec3 hitPosition = ray.origin + ray.direction * tInside;
+            normal = normals == MetaballNormals::Analytic
+                ? Normalize(-Gradient(hitPosition, metaballs, count, distances))
+                : FiniteDifferenceNormal(hitPosition, metaballs, count, midDistances, stats);
+            if (stats) stats->hits++;
+            return true;
+        }
+
+        if (march == MetaballMarch::Uniform)
+        {
+            t += minTStep;
+        }
+        else
+        {
+            if (t >= tmax)
+            {
+                break;
+            }
+            tPrevious = t;
+            t = (std::min)(t + (std::max)(std::fabs(METABALL_THRESHOLD - sumFieldPotential) / lipschitzBound, minTStep), tmax);
+        }
+    }
+    return false;
+}
@@ -0,0 +1,122 @@
+#ifndef CPU_METABALLS_H
+#define CPU_METABALLS_H
+
+#include "RayTracingHlslCompat.h"
+#include "CpuRay.h"
+
+namespace Cpu
+{
+    namespace MetaballMarch {
+        enum Enum {
+            Uniform = 0,    // METABALL_MAX_STEPS equal steps over the marched segment.
+            SphereTrace,    // Lipschitz bounded steps followed by bisection.
+            Count
+        };
+    }
+
+    namespace MetaballNormals {
+        enum Enum {
+            FiniteDifferences = 0,  // Central differences, six more field evaluations per hit.
+            Analytic,               // Field gradient from the per metaball distances of the march's last inside evaluation.
+            Count
+        };
+    }
+
+    namespace MetaballCulling {
+        enum Enum {
+            None = 0,   // A single cell, every ray tests every metaball.
+            Grid,       // Rays test the metaballs overlapping the uniform grid cells they cross.
+            Count
+        };
+    }
+
+    struct Metaball
+    {
+        Vec3 center;
+        float radius;
+    };
+
+    // Metaball moving between the centers of two key frames, see InitializeAnimatedMetaballs().
+    struct AnimatedMetaball
+    {
+        Vec3 center0;
+        Vec3 center1;
+        float radius;
+    };
+
+    struct MetaballStats
+    {
+        UINT64 rays = 0;
+        UINT64 hits = 0;
+        UINT64 steps = 0;
+        UINT64 cells = 0;                   // Grid cells the marches entered.
+        UINT64 potentialEvaluations = 0;    // Single metaball potentials, one per metaball crossed in the sample's cell.
+        UINT64 normalEvaluations = 0;       // The part of potentialEvaluations spent on normals.
+
+        void Merge(const MetaballStats& other)
+        {
+            rays += other.rays;
+            hits += other.hits;
+            steps += other.steps;
+            cells += other.cells;
+            potentialEvaluations += other.potentialEvaluations;
+            normalEvaluations += other.normalEvaluations;
+        }
+    };
+
+    // CPU port of the metaball field and its intersection test in VolumetricPrimitives.hlsli,
+    // for any number of metaballs. Works in the field's local space like the intersection shader.
+    // The field is bucketed into a uniform grid whose cells list the metaballs overlapping them.
+    // Only those contribute to the field within a cell, so a sample evaluates them alone and costs
+    // as much as the local metaball density, not the metaball count.
+    class MetaballField
+    {
+    public:
+        // The MetaballDemo field of MetaballKeyFrames.h.
+        MetaballField();
+        explicit MetaballField(std::vector<AnimatedMetaball> metaballs);
+
+        // Loads a text file with one metaball per line: "x0 y0 z0 x1 y1 z1 radius" for the centers at
+        // both key frames and the radius, or "x y z radius" for a static metaball. # starts a comment.
+        static MetaballField Load(const std::wstring& path);
+
+        // Moves the metaballs to their elapsedTime positions and rebuilds the grid, see InitializeAnimatedMetaballs().
+        void InitializeAnimated(float elapsedTime, float cycleDuration, MetaballCulling::Enum culling = MetaballCulling::Grid);
+
+        // Closest isosurface crossing within <ray.tMin, ray.tMax>.
+        bool Intersect(const Ray& ray, MetaballMarch::Enum march, MetaballNormals::Enum normals, float& thit, Vec3& normal, MetaballStats* stats = nullptr) const;
+
+        UINT Count() const { return static_cast<UINT>(m_keyFrames.size()); }
+        UINT CellCount() const { return static_cast<UINT>(m_resolution[0] * m_resolution[1] * m_resolution[2]); }
+        UINT MaxCellMetaballs() const { return m_maxCellMetaballs; }
+        const Aabb& Bounds() const { return m_bounds; }
+
+    private:
+        // Grid cells per metaball the resolution aims for, and the resolution limit per axis.
+        static const UINT c_cellsPerMetaball = 4;
+        static const UINT c_maxResolution = 128;
+
+        void BuildGrid(MetaballCulling::Enum culling);
+        UINT CellIndex(const int cell[3]) const { return static_cast<UINT>((cell[2] * m_resolution[1] + cell[1]) * m_resolution[0] + cell[0]); }
+
+        // distances: per metaball distance from position, -1 outside of the metaball.
+        float Potential(const Vec3& position, const UINT* metaballs, UINT count, float* distances, MetaballStats* stats) const;
+        Vec3 Gradient(const Vec3& position, const UINT* metaballs, UINT count, const float* distances) const;
+        bool MarchSegment(const Ray& ray, float tmin, float tmax, float lipschitzBound, const UINT* metaballs, UINT count,
+            MetaballMarch::Enum march, MetaballNormals::Enum normals, float* distances, float* midDistances, float& thit, Vec3& normal, MetaballStats* stats) const;
+        Vec3 FiniteDifferenceNormal(const Vec3& position, const UINT* metaballs, UINT count, float* distances, MetaballStats* stats) const;
+
+        std::vector<AnimatedMetaball> m_keyFrames;
+        std::vector<Metaball> m_blobs;
+
+        // Uniform grid over the bounding spheres of the metaballs.
+        Aabb m_bounds;
+        Vec3 m_cellSize;
+        int m_resolution[3];
+        std::vector<UINT> m_cellStart;          // First entry of each cell in m_cellMetaballs, followed by the end of the last cell.
+        std::vector<UINT> m_cellMetaballs;      // Metaballs overlapping each cell.
+        UINT m_maxCellMetaballs;
+    };
+}
+
+#endif // !CPU_METABALLS_H
@@ -0,0 +1,216 @@
+#include "stdafx.h"
+#include "CpuNoise.h"
+#include <emmintrin.h>
+
+using namespace Cpu;
+
+namespace
+{
+    inline float Fade(float t)
+    {
+        return t * t * t * (t * (t * 6 - 15) + 10);
+    }
+
+    inline UINT Permute(UINT i)
+    {
+        return c_perlinPermutation[i & 255];
+    }
+
+    inline float Gradient(UINT hash, float x, float y, float z)
+    {
+        const XMFLOAT3& g = c_perlinGradients[hash & 15];
+        return g.x * x + g.y * y + g.z * z;
+    }
+
+    // Hashes of the lattice corners of the cell <ix, iy, iz> (each in 0..255), indexed by x + 2y + 4z.
+    inline void CornerHashes(UINT ix, UINT iy, UINT iz, UINT hashes[8])
+    {
+        UINT a = Permute(ix) + iy;
+        UINT b = Permute(ix + 1) + iy;
+        UINT aa = Permute(a) + iz;
+        UINT ab = Permute(a + 1) + iz;
+        UINT ba = Permute(b) + iz;
+        UINT bb = Permute(b + 1) + iz;
+        hashes[0] = Permute(aa);
+        hashes[1] = Permute(ba);
+        hashes[2] = Permute(ab);
+        hashes[3] = Permute(bb);
+        hashes[4] = Permute(aa + 1);
+        hashes[5] = Permute(ba + 1);
+        hashes[6] = Permute(ab + 1);
+        hashes[7] = Permute(bb + 1);
+    }
+
+    inline __m128 Floor4(__m128 v)
+    {
+        // Truncate, then step down where truncation rounded towards zero from below.
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+        return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmplt_ps(v, truncated), _mm_set1_ps(1.0f)));
+    }
+
+    inline __m128 Fade4(__m128 t)
+    {
+        __m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+        return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+    }
+
+    inline __m128 Lerp4(__m128 a, __m128 b, __m128 t)
+    {
+        return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+    }
+
+    inline __m128 Select4(__m128i mask, __m128 a, __m128 b)
+    {
+        __m128 m = _mm_castsi128_ps(mask);
+        return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+    }
+
+    // Dot product with the gradient c_perlinGradients[hash & 15], selected arithmetically instead of
+    // gathered per lane: the low two bits flip the signs of the two nonzero components, the high two
+    // bits pick the axes they belong to.
+    inline __m128 Gradient4(__m128i hash, __m128 x, __m128 y, __m128 z)
+    {
+        __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+        __m128i lessThan8 = _mm_cmplt_epi32(h, _mm_set1_epi32(8));
+        __m128i lessThan4 = _mm_cmplt_epi32(h, _mm_set1_epi32(4));
+        __m128i is12or14 = _mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)), _mm_cmpeq_epi32(h, _mm_set1_epi32(14)));
+
+        __m128 u = Select4(lessThan8, x, y);
+        __m128 v = Select4(lessThan4, y, Select4(is12or14, x, z));
+        u = _mm_xor_ps(u, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31)));
+        v = _mm_xor_ps(v, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30)));
+        return _mm_add_ps(u, v);
+    }
+
+    // Noise of four points. Only the permutation table lookups of the lattice hashing run per lane,
+    // everything else runs on all lanes at once.
+    __m128 PerlinNoise4(__m128 px, __m128 py, __m128 pz)
+    {
+        __m128 fx = Floor4(px);
+        __m128 fy = Floor4(py);
+        __m128 fz = Floor4(pz);
+        __m128 x = _mm_sub_ps(px, fx);
+        __m128 y = _mm_sub_ps(py, fy);
+        __m128 z = _mm_sub_ps(pz, fz);
+
+        alignas(16) int ix[4], iy[4], iz[4];
+        __m128i mask = _mm_set1_epi32(255);
+        _mm_store_si128(reinterpret_cast<__m128i*>(ix), _mm_and_si128(_mm_cvttps_epi32(fx), mask));
+        _mm_store_si128(reinterpret_cast<__m128i*>(iy), _mm_and_si128(_mm_cvttps_epi32(fy), mask));
+        _mm_store_si128(reinterpret_cast<__m128i*>(iz), _mm_and_si128(_mm_cvttps_epi32(fz), mask));
+
+        // Corner hashes per corner and lane in structure of arrays layout.
+        alignas(16) UINT hashes[8][4];
+        for (UINT lane = 0; lane < 4; lane++)
+        {
+            UINT laneHashes[8];
+            CornerHashes(ix[lane], iy[lane], iz[lane], laneHashes);
+            for (UINT corner = 0; corner < 8; corner++)
+            {
+                hashes[corner][lane] = laneHashes[corner];
+            }
+        }
+
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 x1 = _mm_sub_ps(x, one);
+        __m128 y1 = _mm_sub_ps(y, one);
+        __m128 z1 = _mm_sub_ps(z, one);
+        __m128 n[8];
+        for (UINT corner = 0; corner < 8; corner++)
+        {
+            __m128 dx = corner & 1 ? x1 : x;
+            __m128 dy = corner & 2 ? y1 : y;
+            __m128 dz = corner & 4 ? z1 : z;
+            n[corner] = Gradient4(_mm_load_si128(reinterpret_cast<const __m128i*>(hashes[corner])), dx, dy, dz);
+        }
+
+        __m128 u = Fade4(x);
+        __m128 v = Fade4(y);
+        __m128 w = Fade4(z);
+        return Lerp4(
+            Lerp4(Lerp4(n[0], n[1], u), Lerp4(n[2], n[3], u), v),
+            Lerp4(Lerp4(n[4], n[5], u), Lerp4(n[6], n[7], u), v),
+            w);
+    }
+
+    __m128 Turbulence4(__m128 x, __m128 y, __m128 z, UINT octaves)
+    {
+        __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 accum = _mm_setzero_ps();
+        __m128 weight = _mm_set1_ps(1.0f);
+        __m128 two = _mm_set1_ps(2.0f);
+        __m128 half = _mm_set1_ps(0.5f);
+        for (UINT i = 0; i < octaves; i++)
+        {
+            accum = _mm_add_ps(accum, _mm_mul_ps(weight, _mm_and_ps(PerlinNoise4(x, y, z), absMask)));
+            weight = _mm_mul_ps(weight, half);
+            x = _mm_mul_ps(x, two);
+            y = _mm_mul_ps(y, two);
+            z = _mm_mul_ps(z, two);
+        }
+        return accum;
+    }
+}
+
+float Cpu::PerlinNoise(const Vec3& p)
+{
+    float fx = std::floor(p.x);
+    float fy = std::floor(p.y);
+    float fz = std::floor(p.z);
+    float x = p.x - fx;
+    float y = p.y - fy;
+    float z = p.z - fz;
+
+    UINT hashes[8];
+    CornerHashes(static_cast<int>(fx) & 255, static_cast<int>(fy) & 255, static_cast<int>(fz) & 255, hashes);
+
+    float u = Fade(x);
+    float v = Fade(y);
+    float w = Fade(z);
+    return Lerp(
+        Lerp(Lerp(Gradient(hashes[0], x, y, z), Gradient(hashes[1], x - 1, y, z), u),
+            Lerp(Gradient(hashes[2], x, y - 1, z), Gradient(hashes[3], x - 1, y - 1, z), u), v),
+        Lerp(Lerp(Gradient(hashes[4], x, y, z - 1), Gradient(hashes[5], x - 1, y, z - 1), u),
+            Lerp(Gradient(hashes[6], x, y - 1, z - 1), Gradient(hashes[7], x - 1, y - 1, z - 1), u), v),
+        w);
+}
+
+float Cpu::Turbulence(const Vec3& p, UINT octaves)
+{
+    float accum = 0;
+    float weight = 1;
+    Vec3 q = p;
+    for (UINT i = 0; i < octaves; i++)
+    {
+        accum += weight * std::fabs(PerlinNoise(q));
+        weight *= 0.5f;
+        q *= 2.0f;
+    }
+    return accum;
+}
+
+void Cpu::Turbulence(const float* x, const float* y, const float* z, float* result, UINT count, UINT octaves)
+{
+    UINT i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(result + i, Turbulence4(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i), _mm_loadu_ps(z + i), octaves));
+    }
+
+    // Pad the remainder to a full vector.
+    if (i < count)
+    {
+        alignas(16) float tail[4][4] = {};
+        for (UINT j = i; j < count; j++)
+        {
+            tail[0][j - i] = x[j];
+            tail[1][j - i] = y[j];
+            tail[2][j - i] = z[j];
+        }
+        _mm_store_ps(tail[3], Turbulence4(_mm_load_ps(tail[0]), _mm_load_ps(tail[1]), _mm_load_ps(tail[2]), octaves));
+        for (UINT j = i; j < count; j++)
+        {
+            result[j] = tail[3][j - i];
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef CPU_NOISE_H
+#define CPU_NOISE_H
+
+#include "CpuMath.h"
+#include "PerlinNoiseTables.h"
+
+namespace Cpu
+{
+    // Improved gradient noise in <-1, 1>, see PerlinNoise() in the shaders.
+    float PerlinNoise(const Vec3& p);
+
+    // Sum of |noise| over octaves of doubling frequency and halving weight, see Turbulence() in the shaders.
+    float Turbulence(const Vec3& p, UINT octaves = PERLIN_OCTAVES);
+
+    // Turbulence of count points in structure of arrays layout, evaluated four points at a time with SSE.
+    // Matches the scalar Turbulence() up to float rounding.
+    void Turbulence(const float* x, const float* y, const float* z, float* result, UINT count, UINT octaves = PERLIN_OCTAVES);
+}
+
+#endif // !CPU_NOISE_H
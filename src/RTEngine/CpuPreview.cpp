@@ -0,0 +1,206 @@
+#include "stdafx.h"
+#include "CpuPreview.h"
+
+using namespace Cpu;
+
+namespace
+{
+    // Position of (x, y) along the Hilbert curve over a size x size grid, size a power of 2.
+    UINT HilbertIndex(UINT size, UINT x, UINT y)
+    {
+        UINT index = 0;
+        for (UINT s = size / 2; s > 0; s /= 2)
+        {
+            UINT rx = (x & s) > 0 ? 1 : 0;
+            UINT ry = (y & s) > 0 ? 1 : 0;
+            index += s * s * ((3 * rx) ^ ry);
+
+            // Rotate the quadrant so the curve's sub-curves join up.
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = size - 1 - x;
+                    y = size - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return index;
+    }
+}
+
+PreviewRenderer::PreviewRenderer(ThreadPool& threadPool) :
+    m_renderer(threadPool),
+    m_threadPool(threadPool),
+    m_width(0),
+    m_height(0),
+    m_tileSize(0),
+    m_tilesX(0),
+    m_tilesY(0),
+    m_order(TileOrder::Count)
+{
+}
+
+void PreviewRenderer::Resize(UINT width, UINT height, const PreviewSettings& previewSettings)
+{
+    ThrowIfFalse(previewSettings.coarsestBlock > 0 && (previewSettings.coarsestBlock & (previewSettings.coarsestBlock - 1)) == 0 &&
+        previewSettings.tileSize % previewSettings.coarsestBlock == 0, L"The coarsest preview block must be a power of 2 that divides the tile size.");
+
+    m_image.resize(width * height);
+    if (width == m_width && height == m_height && previewSettings.tileSize == m_tileSize && previewSettings.order == m_order)
+    {
+        return;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_tileSize = previewSettings.tileSize;
+    m_order = previewSettings.order;
+    m_tilesX = (width + m_tileSize - 1) / m_tileSize;
+    m_tilesY = (height + m_tileSize - 1) / m_tileSize;
+
+    UINT tileCount = m_tilesX * m_tilesY;
+    m_tileOrder.resize(tileCount);
+    for (UINT i = 0; i < tileCount; i++)
+    {
+        m_tileOrder[i] = i;
+    }
+
+    if (m_order == TileOrder::Hilbert)
+    {
+        UINT size = 1;
+        while (size < (std::max)(m_tilesX, m_tilesY))
+        {
+            size *= 2;
+        }
+        std::vector<UINT> keys(tileCount);
+        for (UINT i = 0; i < tileCount; i++)
+        {
+            keys[i] = HilbertIndex(size, i % m_tilesX, i / m_tilesX);
+        }
+        std::sort(m_tileOrder.begin(), m_tileOrder.end(), [&keys](UINT a, UINT b) { return keys[a] < keys[b]; });
+    }
+    else if (m_order == TileOrder::Spiral)
+    {
+        // By distance of the tile center from the screen center, turning around it at equal distances.
+        std::vector<std::pair<float, float>> keys(tileCount);
+        for (UINT i = 0; i < tileCount; i++)
+        {
+            float dx = ((i % m_tilesX) + 0.5f) * m_tileSize - 0.5f * width;
+            float dy = ((i / m_tilesX) + 0.5f) * m_tileSize - 0.5f * height;
+            keys[i] = std::make_pair(dx * dx + dy * dy, std::atan2(dy, dx));
+        }
+        std::sort(m_tileOrder.begin(), m_tileOrder.end(), [&keys](UINT a, UINT b) { return keys[a] < keys[b]; });
+    }
+}
+
+bool PreviewRenderer::Render(const Scene& scene, const BVH& bvh, const Camera& camera, const PathSettings& settings,
+    const PreviewSettings& previewSettings, const std::atomic<bool>* cancel)
+{
+    m_timer.Start();
+    Resize(camera.width, camera.height, previewSettings);
+    m_stats = PreviewStats();
+    m_renderer.SetCancelFlag(cancel);
+
+    UINT centerTile = (camera.height / 2 / m_tileSize) * m_tilesX + camera.width / 2 / m_tileSize;
+    auto ElapsedMS = [&]()
+    {
+        m_timer.Stop();
+        return m_timer.GetElapsedMS();
+    };
+
+    for (UINT block = previewSettings.coarsestBlock; block > 0; block /= 2)
+    {
+        bool coarsest = block == previewSettings.coarsestBlock;
+        bool centerTileDone = false;
+        m_pixels.clear();
+        for (UINT i = 0; i < m_tileOrder.size(); i++)
+        {
+            CollectTilePixels(m_tileOrder[i], block, coarsest);
+            centerTileDone |= block == 1 && m_tileOrder[i] == centerTile;
+            if (m_pixels.size() < previewSettings.batchRays && i + 1 < m_tileOrder.size())
+            {
+                continue;
+            }
+
+            // Cancelled batches leave their pixels' blocks as the previous level filled them.
+            bool completed = m_renderer.Render(scene, bvh, camera, settings, nullptr, &m_pixels);
+            const RayStats& rays = m_renderer.Stats().rays;
+            m_stats.rays += rays.rays[RayType::Radiance] + rays.rays[RayType::Shadow];
+            m_stats.batches++;
+            if (!completed)
+            {
+                m_stats.cancelled = true;
+                m_stats.totalMS = ElapsedMS();
+                m_renderer.SetCancelFlag(nullptr);
+                return false;
+            }
+
+            FillBlocks(block);
+            m_pixels.clear();
+            if (centerTileDone && m_stats.centerTileMS == 0)
+            {
+                m_stats.centerTileMS = ElapsedMS();
+            }
+        }
+
+        m_stats.levels++;
+        if (coarsest)
+        {
+            m_stats.firstImageMS = ElapsedMS();
+        }
+        if (m_onLevel)
+        {
+            m_onLevel(m_image);
+        }
+    }
+
+    m_stats.totalMS = ElapsedMS();
+    m_renderer.SetCancelFlag(nullptr);
+    return true;
+}
+
+void PreviewRenderer::CollectTilePixels(UINT tile, UINT block, bool coarsest)
+{
+    // Pixels on the level's grid, minus those on the previous level's grid of twice the spacing.
+    UINT x0 = (tile % m_tilesX) * m_tileSize;
+    UINT y0 = (tile / m_tilesX) * m_tileSize;
+    UINT x1 = (std::min)(x0 + m_tileSize, m_width);
+    UINT y1 = (std::min)(y0 + m_tileSize, m_height);
+    UINT coarserMask = 2 * block - 1;
+    for (UINT y = y0; y < y1; y += block)
+    {
+        for (UINT x = x0; x < x1; x += block)
+        {
+            if (coarsest || (x & coarserMask) != 0 || (y & coarserMask) != 0)
+            {
+                m_pixels.push_back(y * m_width + x);
+            }
+        }
+    }
+}
+
+void PreviewRenderer::FillBlocks(UINT block)
+{
+    // A traced pixel's block holds no other pixel traced so far.
+    const std::vector<Vec3>& radiance = m_renderer.Radiance();
+    m_threadPool.ParallelFor(static_cast<UINT>(m_pixels.size()), WavefrontRenderer::BatchSize, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT i = begin; i < end; i++)
+        {
+            UINT pixel = m_pixels[i];
+            UINT x0 = pixel % m_width;
+            UINT y0 = pixel / m_width;
+            UINT x1 = (std::min)(x0 + block, m_width);
+            UINT y1 = (std::min)(y0 + block, m_height);
+            for (UINT y = y0; y < y1; y++)
+            {
+                for (UINT x = x0; x < x1; x++)
+                {
+                    m_image[y * m_width + x] = radiance[pixel];
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,83 @@
+#ifndef CPU_PREVIEW_H
+#define CPU_PREVIEW_H
+
+#include "CpuWavefront.h"
+
+namespace Cpu
+{
+    namespace TileOrder {
+        enum Enum {
+            Scanline = 0,   // Rows of tiles from the top left.
+            Hilbert,        // Along a Hilbert curve over the tile grid, consecutive tiles are always neighbours.
+            Spiral,         // Outwards from the screen center, where the viewer looks first.
+            Count
+        };
+    }
+
+    struct PreviewSettings
+    {
+        TileOrder::Enum order = TileOrder::Spiral;
+        UINT tileSize = 16;
+        UINT coarsestBlock = 8;     // The first level traces one pixel per block of this size, a power of 2 that divides tileSize.
+        UINT batchRays = 16384;     // Camera rays per render call, tiles are issued in batches of about this size.
+    };
+
+    struct PreviewStats
+    {
+        UINT levels = 0;            // Completed levels.
+        double firstImageMS = 0;    // Time until the coarsest level covered the screen.
+        double centerTileMS = 0;    // Time until the tile at the screen center was done at full resolution.
+        double totalMS = 0;
+        UINT batches = 0;
+        UINT64 rays = 0;            // Radiance and shadow rays.
+        bool cancelled = false;
+    };
+
+    // Coarse to fine progressive renderer for interactive preview.
+    // Every level traces the pixels on a grid of half the spacing of the previous level's and fills their
+    // blocks with them, so the first level gives a blocky image of the whole screen at a fraction of the
+    // cost of a frame, and the last level completes the frame with one sample per pixel, each pixel traced once.
+    // Each level issues its tiles in the tile order, in batches for the wavefront renderer.
+    // Raising the cancel flag, when the camera moves, stops the render within one bounce of the batch in flight.
+    class PreviewRenderer
+    {
+    public:
+        // Image of a completed level, handed over on the thread calling Render().
+        typedef std::function<void(const std::vector<Vec3>& image)> LevelCallback;
+
+        explicit PreviewRenderer(ThreadPool& threadPool);
+
+        // Returns false if cancelled. The image then holds the levels completed so far.
+        bool Render(const Scene& scene, const BVH& bvh, const Camera& camera, const PathSettings& settings,
+            const PreviewSettings& previewSettings = PreviewSettings(), const std::atomic<bool>* cancel = nullptr);
+
+        // Called after each level that completes, so a viewer can show the image as it refines.
+        void SetLevelCallback(const LevelCallback& onLevel) { m_onLevel = onLevel; }
+
+        const std::vector<Vec3>& Image() const { return m_image; }
+        const PreviewStats& Stats() const { return m_stats; }
+
+    private:
+        void Resize(UINT width, UINT height, const PreviewSettings& previewSettings);
+        void CollectTilePixels(UINT tile, UINT block, bool coarsest);
+        void FillBlocks(UINT block);
+
+        WavefrontRenderer m_renderer;
+        ThreadPool& m_threadPool;
+        DX::CPUTimer m_timer;
+        UINT m_width;
+        UINT m_height;
+        UINT m_tileSize;
+        UINT m_tilesX;
+        UINT m_tilesY;
+        TileOrder::Enum m_order;
+
+        std::vector<UINT> m_tileOrder;
+        std::vector<UINT> m_pixels;     // Pixels of the batch being rendered.
+        std::vector<Vec3> m_image;
+        PreviewStats m_stats;
+        LevelCallback m_onLevel;
+    };
+}
+
+#endif // !CPU_PREVIEW_H
@@ -0,0 +1,78 @@
+#ifndef CPU_RANDOM_H
+#define CPU_RANDOM_H
+
+#include <array>
+
+namespace Cpu
+{
+    typedef std::array<UINT, 4> Uint4;
+
+    // Philox4x32-10 counter based generator, Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3".
+    // Ten rounds of multiplications and key mixing turn a 128 bit counter and a 64 bit key into 128 random bits.
+    // There is no state to share or to advance: any number of any stream is computed directly.
+    inline Uint4 Philox4x32(Uint4 counter, UINT key0, UINT key1)
+    {
+        for (UINT round = 0; round < 10; round++)
+        {
+            UINT64 product0 = static_cast<UINT64>(0xD2511F53u) * counter[0];
+            UINT64 product1 = static_cast<UINT64>(0xCD9E8D57u) * counter[2];
+            UINT hi0 = static_cast<UINT>(product0 >> 32);
+            UINT hi1 = static_cast<UINT>(product1 >> 32);
+            counter = Uint4{ hi1 ^ counter[1] ^ key0, static_cast<UINT>(product1), hi0 ^ counter[3] ^ key1, static_cast<UINT>(product0) };
+            key0 += 0x9E3779B9u;
+            key1 += 0xBB67AE85u;
+        }
+        return counter;
+    }
+
+    // Sequence of random numbers named by a two word key and a subsequence, e.g. a path's pixel and sample index
+    // and its vertex, or a generated scene's seed and an object's index. The n-th number of a sequence doesn't
+    // depend on the thread that draws it or on any other sequence, so work split across any number of threads
+    // draws the same numbers.
+    class RandomStream
+    {
+    public:
+        RandomStream(UINT key0, UINT key1 = 0, UINT subsequence = 0) :
+            m_key0(key0),
+            m_key1(key1),
+            m_subsequence(subsequence),
+            m_counter(0),
+            m_used(4)
+        {
+        }
+
+        UINT NextUint()
+        {
+            // Four numbers per generator call.
+            if (m_used == 4)
+            {
+                m_block = Philox4x32(Uint4{ m_counter++, m_subsequence, 0, 0 }, m_key0, m_key1);
+                m_used = 0;
+            }
+            return m_block[m_used++];
+        }
+
+        // Uniform in <0, 1) with 24 bits.
+        float NextFloat() { return (NextUint() >> 8) * (1.0f / 16777216.0f); }
+
+        // Uniform in <0, 1) with 53 bits.
+        double NextDouble()
+        {
+            UINT64 high = NextUint() >> 5;
+            UINT64 low = NextUint() >> 6;
+            return ((high << 26) | low) * (1.0 / 9007199254740992.0);
+        }
+
+        double NextDouble(double min, double max) { return min + (max - min) * NextDouble(); }
+
+    private:
+        UINT m_key0;
+        UINT m_key1;
+        UINT m_subsequence;
+        UINT m_counter;
+        UINT m_used;
+        Uint4 m_block;
+    };
+}
+
+#endif // !CPU_RANDOM_H
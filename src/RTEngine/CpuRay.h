@@ -0,0 +1,60 @@
+#ifndef CPU_RAY_H
+#define CPU_RAY_H
+
+#include "RayTracingHlslCompat.h"
+#include "CpuMath.h"
+
+namespace Cpu
+{
+    static const UINT InvalidPrimitive = ~0u;
+
+    struct Ray
+    {
+        Vec3 origin;
+        Vec3 direction;
+        float tMin = 0.0f;
+        float tMax = FLT_MAX;
+        float time = 0.0f;      // Point of the shutter interval <0, 1> the ray samples moving primitives at.
+    };
+
+    // Closest hit record, the CPU counterpart of ProceduralPrimitiveAttributes + RayTCurrent().
+    struct Hit
+    {
+        float t = FLT_MAX;
+        Vec3 normal;
+        UINT primitive = InvalidPrimitive;   // Primitive reference, see PrimitiveRef.
+        UINT materialIndex = 0;
+        bool frontFace = true;
+    };
+
+    // Per-thread occlusion query state.
+    // Shadow rays from neighbouring pixels tend to be blocked by the same primitive,
+    // so the last occluder found is tested before the BVH is traversed.
+    struct OcclusionCache
+    {
+        UINT lastOccluder = InvalidPrimitive;
+    };
+
+    // Traversal counters, kept separately per ray type so radiance and shadow
+    // ray throughput can be reported independently.
+    struct RayStats
+    {
+        UINT64 rays[RayType::Count] = {};
+        UINT64 nodeVisits[RayType::Count] = {};
+        UINT64 primitiveTests[RayType::Count] = {};
+        UINT64 occlusionCacheHits = 0;
+
+        void Merge(const RayStats& other)
+        {
+            for (UINT i = 0; i < RayType::Count; i++)
+            {
+                rays[i] += other.rays[i];
+                nodeVisits[i] += other.nodeVisits[i];
+                primitiveTests[i] += other.primitiveTests[i];
+            }
+            occlusionCacheHits += other.occlusionCacheHits;
+        }
+    };
+}
+
+#endif // !CPU_RAY_H
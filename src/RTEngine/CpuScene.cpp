@@ -0,0 +1,361 @@
+#include "stdafx.h"
+#include "CpuScene.h"
+
+using namespace Cpu;
+
+UINT Scene::AddMaterial(const MaterialConstantBuffer& material)
+{
+    materials.push_back(material);
+    materialTextures.push_back(InvalidTexture);
+    materialEmission.push_back(Vec3(0.0f));
+    return static_cast<UINT>(materials.size() - 1);
+}
+
+UINT Scene::AddSphere(const Vec3& center, float radius, UINT materialIndex)
+{
+    return AddMovingSphere(center, center, radius, materialIndex);
+}
+
+UINT Scene::AddMovingSphere(const Vec3& center0, const Vec3& center1, float radius, UINT materialIndex)
+{
+    sphereCenterX.push_back(center0.x);
+    sphereCenterY.push_back(center0.y);
+    sphereCenterZ.push_back(center0.z);
+    sphereMotionX.push_back(center1.x - center0.x);
+    sphereMotionY.push_back(center1.y - center0.y);
+    sphereMotionZ.push_back(center1.z - center0.z);
+    sphereRadius.push_back(radius);
+    sphereMaterial.push_back(materialIndex);
+    return MakePrimitiveRef(PrimitiveKind::Sphere, SphereCount() - 1);
+}
+
+UINT Scene::AddTriangle(const Vec3& v0, const Vec3& v1, const Vec3& v2, UINT materialIndex)
+{
+    triangleV0.push_back(v0);
+    triangleE1.push_back(v1 - v0);
+    triangleE2.push_back(v2 - v0);
+    triangleMaterial.push_back(materialIndex);
+    return MakePrimitiveRef(PrimitiveKind::Triangle, TriangleCount() - 1);
+}
+
+UINT Scene::AddQuad(const Vec3& corner, const Vec3& edgeU, const Vec3& edgeV, UINT materialIndex)
+{
+    UINT first = AddTriangle(corner, corner + edgeU, corner + edgeU + edgeV, materialIndex);
+    AddTriangle(corner, corner + edgeU + edgeV, corner + edgeV, materialIndex);
+    return first;
+}
+
+void Scene::Clear()
+{
+    sphereCenterX.clear();
+    sphereCenterY.clear();
+    sphereCenterZ.clear();
+    sphereMotionX.clear();
+    sphereMotionY.clear();
+    sphereMotionZ.clear();
+    sphereRadius.clear();
+    sphereMaterial.clear();
+    triangleV0.clear();
+    triangleE1.clear();
+    triangleE2.clear();
+    triangleMaterial.clear();
+    materials.clear();
+    materialTextures.clear();
+    materialEmission.clear();
+    textures.clear();
+    lights.clear();
+    m_primitiveLights.clear();
+    m_texturePaths.clear();
+}
+
+UINT Scene::AddPointLight(const Vec3& position, const Vec3& intensity)
+{
+    Light light = {};
+    light.type = LightType::Point;
+    light.position = position;
+    light.emission = intensity;
+    light.primitive = ~0u;
+    lights.push_back(light);
+    return LightCount() - 1;
+}
+
+UINT Scene::AddSphereLight(const Vec3& center, float radius, const Vec3& radiance)
+{
+    Light light = {};
+    light.type = LightType::Sphere;
+    light.position = center;
+    light.radius = radius;
+    light.emission = radiance;
+    light.primitive = ~0u;
+    lights.push_back(light);
+    return LightCount() - 1;
+}
+
+void Scene::AddEmissivePrimitiveLights()
+{
+    auto AddLights = [&](PrimitiveKind::Enum kind, UINT count, const MappableArray<UINT>& primitiveMaterials)
+    {
+        for (UINT i = 0; i < count; i++)
+        {
+            const Vec3& emission = materialEmission[primitiveMaterials[i]];
+            if (MaxComponent(emission) > 0)
+            {
+                Light light = {};
+                light.type = LightType::Primitive;
+                light.emission = emission;
+                light.primitive = MakePrimitiveRef(kind, i);
+                m_primitiveLights[light.primitive] = LightCount();
+                lights.push_back(light);
+            }
+        }
+    };
+    AddLights(PrimitiveKind::Sphere, SphereCount(), sphereMaterial);
+    AddLights(PrimitiveKind::Triangle, TriangleCount(), triangleMaterial);
+}
+
+UINT Scene::AddLight(const Light& light)
+{
+    if (light.type == LightType::Primitive)
+    {
+        m_primitiveLights[light.primitive] = LightCount();
+    }
+    lights.push_back(light);
+    return LightCount() - 1;
+}
+
+Aabb Scene::GetLightBounds(UINT lightIndex) const
+{
+    const Light& light = lights[lightIndex];
+    if (light.type == LightType::Primitive)
+    {
+        return GetPrimitiveBounds(light.primitive);
+    }
+
+    Aabb bounds;
+    bounds.Grow(light.position - Vec3(light.radius));
+    bounds.Grow(light.position + Vec3(light.radius));
+    return bounds;
+}
+
+UINT Scene::AddTexture(Texture&& texture)
+{
+    textures.push_back(std::move(texture));
+    return static_cast<UINT>(textures.size() - 1);
+}
+
+UINT Scene::LoadTexture(const std::wstring& path)
+{
+    auto it = m_texturePaths.find(path);
+    if (it != m_texturePaths.end())
+    {
+        return it->second;
+    }
+
+    UINT index = AddTexture(Texture::LoadPPM(path));
+    m_texturePaths[path] = index;
+    return index;
+}
+
+void Scene::GetPrimitiveRefs(std::vector<UINT>& refs) const
+{
+    refs.clear();
+    refs.reserve(PrimitiveCount());
+    for (UINT i = 0; i < SphereCount(); i++)
+    {
+        refs.push_back(MakePrimitiveRef(PrimitiveKind::Sphere, i));
+    }
+    for (UINT i = 0; i < TriangleCount(); i++)
+    {
+        refs.push_back(MakePrimitiveRef(PrimitiveKind::Triangle, i));
+    }
+}
+
+// Primitives move linearly, so the bounds at both ends of the shutter interval enclose the swept volume.
+Aabb Scene::GetPrimitiveBounds(UINT ref) const
+{
+    Aabb bounds = GetPrimitiveBounds(ref, 0.0f);
+    if (GetPrimitiveKind(ref) == PrimitiveKind::Sphere)
+    {
+        bounds.Grow(GetPrimitiveBounds(ref, 1.0f));
+    }
+    return bounds;
+}
+
+Aabb Scene::GetPrimitiveBounds(UINT ref, float time) const
+{
+    UINT index = GetPrimitiveIndex(ref);
+    Aabb bounds;
+    switch (GetPrimitiveKind(ref))
+    {
+    case PrimitiveKind::Sphere:
+    {
+        Vec3 center = GetSphereCenter(index, time);
+        Vec3 radius(sphereRadius[index]);
+        bounds.Grow(center - radius);
+        bounds.Grow(center + radius);
+        break;
+    }
+    case PrimitiveKind::Triangle:
+        bounds.Grow(triangleV0[index]);
+        bounds.Grow(triangleV0[index] + triangleE1[index]);
+        bounds.Grow(triangleV0[index] + triangleE2[index]);
+        break;
+    default:
+        break;
+    }
+    return bounds;
+}
+
+Vec3 Scene::GetPrimitiveCentroid(UINT ref) const
+{
+    return GetPrimitiveBounds(ref).Centroid();
+}
+
+void Scene::GetTextureCoordinates(UINT ref, const Vec3& position, float time, float& u, float& v, float& uvPerWorldUnit) const
+{
+    static const float Pi = 3.14159265f;
+    static const float PlanarTextureScale = 0.1f;
+
+    UINT index = GetPrimitiveIndex(ref);
+    if (GetPrimitiveKind(ref) == PrimitiveKind::Sphere)
+    {
+        // Same mapping as get_sphere_uv(), about the sphere center.
+        Vec3 p = Normalize(position - GetSphereCenter(index, time));
+        u = (std::atan2(-p.z, p.x) + Pi) / (2 * Pi);
+        v = std::acos((std::max)(-1.0f, (std::min)(1.0f, -p.y))) / Pi;
+        uvPerWorldUnit = 1.0f / (Pi * sphereRadius[index]);
+    }
+    else
+    {
+        u = position.x * PlanarTextureScale;
+        v = position.z * PlanarTextureScale;
+        uvPerWorldUnit = PlanarTextureScale;
+    }
+}
+
+bool Scene::IntersectPrimitive(UINT ref, const Ray& ray, Hit& hit) const
+{
+    switch (GetPrimitiveKind(ref))
+    {
+    case PrimitiveKind::Sphere: return IntersectSphere(GetPrimitiveIndex(ref), ray, hit);
+    case PrimitiveKind::Triangle: return IntersectTriangle(GetPrimitiveIndex(ref), ray, hit);
+    default: return false;
+    }
+}
+
+bool Scene::OccludedByPrimitive(UINT ref, const Ray& ray) const
+{
+    switch (GetPrimitiveKind(ref))
+    {
+    case PrimitiveKind::Sphere: return OccludedBySphere(GetPrimitiveIndex(ref), ray);
+    case PrimitiveKind::Triangle: return OccludedByTriangle(GetPrimitiveIndex(ref), ray);
+    default: return false;
+    }
+}
+
+// Ray sphere intersection, same quadratic as SolveRaySphereIntersectionEquation() in AnalyticPrimitives.hlsli
+// using the half b form.
+bool Scene::IntersectSphere(UINT index, const Ray& ray, Hit& hit) const
+{
+    Vec3 center = GetSphereCenter(index, ray.time);
+    float radius = sphereRadius[index];
+
+    Vec3 L = ray.origin - center;
+    float a = Dot(ray.direction, ray.direction);
+    float halfB = Dot(ray.direction, L);
+    float c = Dot(L, L) - radius * radius;
+    float discr = halfB * halfB - a * c;
+    if (discr < 0) return false;
+
+    float sqrtDiscr = std::sqrt(discr);
+    float t = (-halfB - sqrtDiscr) / a;
+    if (t < ray.tMin || t > hit.t)
+    {
+        t = (-halfB + sqrtDiscr) / a;
+        if (t < ray.tMin || t > hit.t) return false;
+    }
+
+    Vec3 outwardNormal = (ray.origin + ray.direction * t - center) * (1.0f / radius);
+    hit.t = t;
+    hit.frontFace = Dot(ray.direction, outwardNormal) < 0;
+    hit.normal = hit.frontFace ? outwardNormal : -outwardNormal;
+    hit.primitive = MakePrimitiveRef(PrimitiveKind::Sphere, index);
+    hit.materialIndex = sphereMaterial[index];
+    return true;
+}
+
+// Moller-Trumbore ray triangle intersection.
+bool Scene::IntersectTriangle(UINT index, const Ray& ray, Hit& hit) const
+{
+    const Vec3& e1 = triangleE1[index];
+    const Vec3& e2 = triangleE2[index];
+    Vec3 p = Cross(ray.direction, e2);
+    float det = Dot(e1, p);
+    if (std::fabs(det) < 1e-8f) return false;
+
+    float invDet = 1.0f / det;
+    Vec3 s = ray.origin - triangleV0[index];
+    float u = Dot(s, p) * invDet;
+    if (u < 0 || u > 1) return false;
+    Vec3 q = Cross(s, e1);
+    float v = Dot(ray.direction, q) * invDet;
+    if (v < 0 || u + v > 1) return false;
+    float t = Dot(e2, q) * invDet;
+    if (t < ray.tMin || t > hit.t) return false;
+
+    Vec3 outwardNormal = Normalize(Cross(e1, e2));
+    hit.t = t;
+    hit.frontFace = Dot(ray.direction, outwardNormal) < 0;
+    hit.normal = hit.frontFace ? outwardNormal : -outwardNormal;
+    hit.primitive = MakePrimitiveRef(PrimitiveKind::Triangle, index);
+    hit.materialIndex = triangleMaterial[index];
+    return true;
+}
+
+// Boolean sphere test for shadow rays.
+// Instead of solving for the roots, check whether the ray segment crosses the sphere surface:
+// f(t) = a*t^2 + 2*halfB*t + c changes sign, or both ends are outside and the closest
+// approach of the segment is inside. No square root or division is needed.
+bool Scene::OccludedBySphere(UINT index, const Ray& ray) const
+{
+    Vec3 center = GetSphereCenter(index, ray.time);
+    float radius = sphereRadius[index];
+
+    Vec3 L = ray.origin - center;
+    float a = Dot(ray.direction, ray.direction);
+    float halfB = Dot(ray.direction, L);
+    float c = Dot(L, L) - radius * radius;
+
+    float f0 = (a * ray.tMin + 2 * halfB) * ray.tMin + c;
+    float f1 = (a * ray.tMax + 2 * halfB) * ray.tMax + c;
+
+    // Segment starts and ends on different sides of the surface.
+    if ((f0 <= 0) != (f1 <= 0)) return true;
+
+    // Segment entirely inside the (hollow) sphere doesn't cross its surface.
+    if (f0 < 0) return false;
+
+    // Both ends outside: the surface is crossed twice if the closest approach -halfB/a
+    // lies within the segment and is inside the sphere.
+    float tClosestScaled = -halfB;
+    return tClosestScaled > a * ray.tMin && tClosestScaled < a * ray.tMax && halfB * halfB - a * c >= 0;
+}
+
+bool Scene::OccludedByTriangle(UINT index, const Ray& ray) const
+{
+    const Vec3& e1 = triangleE1[index];
+    const Vec3& e2 = triangleE2[index];
+    Vec3 p = Cross(ray.direction, e2);
+    float det = Dot(e1, p);
+    if (std::fabs(det) < 1e-8f) return false;
+
+    float invDet = 1.0f / det;
+    Vec3 s = ray.origin - triangleV0[index];
+    float u = Dot(s, p) * invDet;
+    if (u < 0 || u > 1) return false;
+    Vec3 q = Cross(s, e1);
+    float v = Dot(ray.direction, q) * invDet;
+    if (v < 0 || u + v > 1) return false;
+    float t = Dot(e2, q) * invDet;
+    return t >= ray.tMin && t <= ray.tMax;
+}
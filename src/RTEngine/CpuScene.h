@@ -0,0 +1,164 @@
+#ifndef CPU_SCENE_H
+#define CPU_SCENE_H
+
+#include "RayTracingHlslCompat.h"
+#include "CpuArray.h"
+#include "CpuRay.h"
+#include "CpuTexture.h"
+
+namespace Cpu
+{
+    namespace PrimitiveKind {
+        enum Enum {
+            Sphere = 0,
+            Triangle,
+            Count
+        };
+    }
+
+    // A primitive reference packs the primitive kind into the top bits and the index
+    // into the kind's SoA arrays into the rest, so BVH leaves can mix primitive kinds.
+    static const UINT PrimitiveKindShift = 28;
+    static const UINT PrimitiveIndexMask = (1u << PrimitiveKindShift) - 1;
+
+    inline UINT MakePrimitiveRef(PrimitiveKind::Enum kind, UINT index) { return (static_cast<UINT>(kind) << PrimitiveKindShift) | index; }
+    inline PrimitiveKind::Enum GetPrimitiveKind(UINT ref) { return static_cast<PrimitiveKind::Enum>(ref >> PrimitiveKindShift); }
+    inline UINT GetPrimitiveIndex(UINT ref) { return ref & PrimitiveIndexMask; }
+
+    // Point light, mirrors the lighting part of SceneConstantBuffer.
+    struct SceneLight
+    {
+        Vec3 position = Vec3(0.0f, 18.0f, -20.0f);
+        Vec3 ambientColor = Vec3(0.25f);
+        Vec3 diffuseColor = Vec3(0.6f);
+    };
+
+    namespace LightType {
+        enum Enum {
+            Point = 0,      // Emits intensity from a point.
+            Sphere,         // Emits radiance from a sphere that is not part of the geometry.
+            Primitive,      // Emissive scene primitive, emits the radiance of its material.
+            Count
+        };
+    }
+
+    static const UINT InvalidLight = ~0u;
+
+    // Light of the many light list, see Scene::lights.
+    struct Light
+    {
+        LightType::Enum type;
+        Vec3 position;      // Point and sphere lights.
+        float radius;       // Sphere lights.
+        Vec3 emission;      // Intensity of point lights, radiance of sphere and primitive lights.
+        UINT primitive;     // Primitive reference of primitive lights.
+    };
+
+    // CPU side copy of the scene geometry.
+    // Primitives are stored as structure of arrays so intersection loops only touch the data they test.
+    // The primitive and material arrays may view the sections of a scene cache in place, see SceneCache::ReadScene().
+    class Scene
+    {
+    public:
+        UINT AddMaterial(const MaterialConstantBuffer& material);
+        UINT AddSphere(const Vec3& center, float radius, UINT materialIndex);
+        // Sphere moving linearly from center0 at shutter open (time 0) to center1 at shutter close (time 1).
+        UINT AddMovingSphere(const Vec3& center0, const Vec3& center1, float radius, UINT materialIndex);
+        UINT AddTriangle(const Vec3& v0, const Vec3& v1, const Vec3& v2, UINT materialIndex);
+        // Parallelogram spanned by two edges from a corner, as two triangles. Returns the first one.
+        UINT AddQuad(const Vec3& corner, const Vec3& edgeU, const Vec3& edgeV, UINT materialIndex);
+        void Clear();
+
+        // Many lights. Without any, the scene is lit by the point light alone.
+        // With lights, the point light only adds its ambient term and every hit samples one of the lights.
+        UINT AddPointLight(const Vec3& position, const Vec3& intensity);
+        UINT AddSphereLight(const Vec3& center, float radius, const Vec3& radiance);
+        // Adds a primitive light for every primitive with an emissive material. Triangles emit from their front face.
+        void AddEmissivePrimitiveLights();
+        // Adds a light of any type, primitive lights are found by GetPrimitiveLight() like the ones added above.
+        UINT AddLight(const Light& light);
+        void SetMaterialEmission(UINT materialIndex, const Vec3& radiance) { materialEmission[materialIndex] = radiance; }
+        UINT LightCount() const { return static_cast<UINT>(lights.size()); }
+        // Light of an emissive primitive, or InvalidLight.
+        UINT GetPrimitiveLight(UINT ref) const
+        {
+            auto it = m_primitiveLights.find(ref);
+            return it == m_primitiveLights.end() ? InvalidLight : it->second;
+        }
+        // Bounds of the space a light emits from over the shutter interval.
+        Aabb GetLightBounds(UINT lightIndex) const;
+
+        // Textures are shared: materials reference them by index and LoadTexture() loads each file once.
+        UINT AddTexture(Texture&& texture);
+        UINT LoadTexture(const std::wstring& path);
+        void SetMaterialTexture(UINT materialIndex, UINT textureIndex) { materialTextures[materialIndex] = textureIndex; }
+        const Texture* GetMaterialTexture(UINT materialIndex) const
+        {
+            UINT textureIndex = materialTextures[materialIndex];
+            return textureIndex == InvalidTexture ? nullptr : &textures[textureIndex];
+        }
+
+        UINT SphereCount() const { return static_cast<UINT>(sphereRadius.size()); }
+        UINT TriangleCount() const { return static_cast<UINT>(triangleV0.size()); }
+        UINT PrimitiveCount() const { return SphereCount() + TriangleCount(); }
+
+        // Enumerates primitive references of all primitives in the scene.
+        void GetPrimitiveRefs(std::vector<UINT>& refs) const;
+
+        // Bounds of the volume a primitive sweeps over the shutter interval, valid for rays of any time.
+        Aabb GetPrimitiveBounds(UINT ref) const;
+        // Bounds of a primitive at a single time of the shutter interval.
+        Aabb GetPrimitiveBounds(UINT ref, float time) const;
+        Vec3 GetPrimitiveCentroid(UINT ref) const;
+
+        Vec3 GetSphereCenter(UINT index, float time) const
+        {
+            return Vec3(sphereCenterX[index] + sphereMotionX[index] * time, sphereCenterY[index] + sphereMotionY[index] * time, sphereCenterZ[index] + sphereMotionZ[index] * time);
+        }
+
+        // Texture coordinates of a surface point at a time: spherical mapping on spheres, planar xz mapping on triangles.
+        // uvPerWorldUnit approximates how fast the coordinates change along the surface, for mip selection.
+        void GetTextureCoordinates(UINT ref, const Vec3& position, float time, float& u, float& v, float& uvPerWorldUnit) const;
+
+        // Closest hit test of a single primitive against <ray.tMin, hit.t>.
+        bool IntersectPrimitive(UINT ref, const Ray& ray, Hit& hit) const;
+
+        // Boolean any hit test of a single primitive against <ray.tMin, ray.tMax>.
+        // Does not compute a hit distance or normal.
+        bool OccludedByPrimitive(UINT ref, const Ray& ray) const;
+
+        // Spheres, centers at shutter open and their displacement over the shutter interval.
+        MappableArray<float> sphereCenterX;
+        MappableArray<float> sphereCenterY;
+        MappableArray<float> sphereCenterZ;
+        MappableArray<float> sphereMotionX;
+        MappableArray<float> sphereMotionY;
+        MappableArray<float> sphereMotionZ;
+        MappableArray<float> sphereRadius;
+        MappableArray<UINT> sphereMaterial;
+
+        // Triangles, stored as a vertex and two edges for the Moller-Trumbore test.
+        MappableArray<Vec3> triangleV0;
+        MappableArray<Vec3> triangleE1;
+        MappableArray<Vec3> triangleE2;
+        MappableArray<UINT> triangleMaterial;
+
+        MappableArray<MaterialConstantBuffer> materials;
+        std::vector<UINT> materialTextures;     // Texture index per material, or InvalidTexture.
+        MappableArray<Vec3> materialEmission;   // Emitted radiance per material, black for most.
+        std::vector<Texture> textures;
+        SceneLight light;
+        std::vector<Light> lights;
+
+    private:
+        bool IntersectSphere(UINT index, const Ray& ray, Hit& hit) const;
+        bool IntersectTriangle(UINT index, const Ray& ray, Hit& hit) const;
+        bool OccludedBySphere(UINT index, const Ray& ray) const;
+        bool OccludedByTriangle(UINT index, const Ray& ray) const;
+
+        std::unordered_map<std::wstring, UINT> m_texturePaths;
+        std::unordered_map<UINT, UINT> m_primitiveLights;
+    };
+}
+
+#endif // !CPU_SCENE_H
@@ -0,0 +1,388 @@
+#include "stdafx.h"
+#include "CpuSceneCache.h"
+
+using namespace Cpu;
+using namespace Microsoft::WRL;
+
+namespace
+{
+    static const UINT c_magic = 0x43535452;     // "RTSC"
+    static const UINT c_version = 1;
+
+    static const UINT c_sectionElementSizes[SceneCacheSection::Count] =
+    {
+        sizeof(float), sizeof(float), sizeof(float),
+        sizeof(float), sizeof(float), sizeof(float),
+        sizeof(float),
+        sizeof(UINT),
+        sizeof(Vec3), sizeof(Vec3), sizeof(Vec3),
+        sizeof(UINT),
+        sizeof(MaterialConstantBuffer),
+        sizeof(Vec3),
+        sizeof(Light),
+        sizeof(SceneLight),
+        sizeof(Aabb),
+        sizeof(BVHNode),
+        sizeof(UINT)
+    };
+
+    UINT ElementSizes()
+    {
+        UINT sum = 0;
+        for (UINT size : c_sectionElementSizes)
+        {
+            sum += size;
+        }
+        return sum;
+    }
+
+    UINT64 AlignSection(UINT64 offset)
+    {
+        return (offset + SceneCache::SectionAlignment - 1) / SceneCache::SectionAlignment * SceneCache::SectionAlignment;
+    }
+
+    struct SectionData
+    {
+        const void* data;
+        UINT64 size;
+    };
+
+    template <typename Array>
+    SectionData ArrayData(const Array& array)
+    {
+        SectionData section = { array.data(), array.size() * sizeof(array[0]) };
+        return section;
+    }
+
+    // WriteFile() takes 32 bit sizes.
+    void WriteBytes(HANDLE file, const void* data, UINT64 size)
+    {
+        const BYTE* bytes = static_cast<const BYTE*>(data);
+        while (size > 0)
+        {
+            DWORD chunk = static_cast<DWORD>((std::min)(size, static_cast<UINT64>(1) << 30));
+            DWORD written = 0;
+            ThrowIfFalse(WriteFile(file, bytes, chunk, &written, nullptr) && written == chunk, L"Failed to write the scene cache.");
+            bytes += chunk;
+            size -= chunk;
+        }
+    }
+
+    UINT64 SectionCount(const SceneCacheHeader& header, SceneCacheSection::Enum section)
+    {
+        return header.sections[section].size / c_sectionElementSizes[section];
+    }
+
+    // Checks the sections lie in the file and their element counts agree. The contents aren't checked here, that
+    // would touch every page of the mapping: ReadScene() and ReadBVH() check the indices of the sections they view.
+    bool IsValid(const SceneCacheHeader& header, UINT64 fileSize)
+    {
+        if (header.magic != c_magic || header.version != c_version || header.sectionCount != SceneCacheSection::Count || header.elementSizes != ElementSizes())
+        {
+            return false;
+        }
+        for (UINT section = 0; section < SceneCacheSection::Count; section++)
+        {
+            const SceneCacheSectionRange& range = header.sections[section];
+            if (range.offset % SceneCache::SectionAlignment != 0 || range.offset < sizeof(SceneCacheHeader) ||
+                range.size > fileSize || range.offset > fileSize - range.size || range.size % c_sectionElementSizes[section] != 0)
+            {
+                return false;
+            }
+        }
+
+        UINT64 spheres = SectionCount(header, SceneCacheSection::SphereRadius);
+        for (UINT section = SceneCacheSection::SphereCenterX; section <= SceneCacheSection::SphereMaterial; section++)
+        {
+            if (SectionCount(header, static_cast<SceneCacheSection::Enum>(section)) != spheres) return false;
+        }
+        UINT64 triangles = SectionCount(header, SceneCacheSection::TriangleV0);
+        for (UINT section = SceneCacheSection::TriangleV0; section <= SceneCacheSection::TriangleMaterial; section++)
+        {
+            if (SectionCount(header, static_cast<SceneCacheSection::Enum>(section)) != triangles) return false;
+        }
+        UINT64 bvhNodes = SectionCount(header, SceneCacheSection::BVHNodes);
+        UINT64 bvhPrimitiveRefs = SectionCount(header, SceneCacheSection::BVHPrimitiveRefs);
+        return SectionCount(header, SceneCacheSection::MaterialEmission) == SectionCount(header, SceneCacheSection::Materials) &&
+            SectionCount(header, SceneCacheSection::PhongLight) == 1 &&
+            SectionCount(header, SceneCacheSection::PrimitiveBounds) == spheres + triangles &&
+            (bvhNodes == 0 ? bvhPrimitiveRefs == 0 : bvhPrimitiveRefs == spheres + triangles);
+    }
+
+    bool IsValidPrimitiveRef(UINT ref, UINT64 spheres, UINT64 triangles)
+    {
+        UINT index = GetPrimitiveIndex(ref);
+        switch (GetPrimitiveKind(ref))
+        {
+        case PrimitiveKind::Sphere: return index < spheres;
+        case PrimitiveKind::Triangle: return index < triangles;
+        default: return false;
+        }
+    }
+
+    // Checks every index of the scene names an element of it, the cache may come from the network.
+    bool HasValidIndices(const Scene& scene)
+    {
+        size_t materials = scene.materials.size();
+        for (UINT material : scene.sphereMaterial)
+        {
+            if (material >= materials) return false;
+        }
+        for (UINT material : scene.triangleMaterial)
+        {
+            if (material >= materials) return false;
+        }
+        for (const Light& light : scene.lights)
+        {
+            if (light.type < LightType::Point || light.type >= LightType::Count ||
+                (light.type == LightType::Primitive && !IsValidPrimitiveRef(light.primitive, scene.SphereCount(), scene.TriangleCount())))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Checks a cached BVH is safe to traverse and refit: the primitive references name primitives of the cached scene,
+    // leaves reference entries of the list, the children of a node follow it in the node array, and no path is deeper
+    // than BVH::Build() makes them, which the traversal stacks are sized for.
+    bool IsValidBVH(const SceneCacheHeader& header, const BVHNode* nodes, size_t nodeCount, const UINT* primitiveRefs, size_t primitiveRefCount)
+    {
+        UINT64 spheres = SectionCount(header, SceneCacheSection::SphereRadius);
+        UINT64 triangles = SectionCount(header, SceneCacheSection::TriangleV0);
+        for (size_t i = 0; i < primitiveRefCount; i++)
+        {
+            if (!IsValidPrimitiveRef(primitiveRefs[i], spheres, triangles)) return false;
+        }
+
+        // Parents come first, so a node's depth is final when the sweep reaches it.
+        std::vector<UINT> depths(nodeCount, 0);
+        for (size_t i = 0; i < nodeCount; i++)
+        {
+            const BVHNode& node = nodes[i];
+            if (node.IsLeaf())
+            {
+                if (static_cast<UINT64>(node.leftFirst) + node.primitiveCount > primitiveRefCount) return false;
+            }
+            else
+            {
+                if (node.leftFirst <= i || static_cast<UINT64>(node.leftFirst) + 1 >= nodeCount || depths[i] + 2 >= BVH::MaxDepth) return false;
+                depths[node.leftFirst] = (std::max)(depths[node.leftFirst], depths[i] + 1);
+                depths[node.leftFirst + 1] = (std::max)(depths[node.leftFirst + 1], depths[i] + 1);
+            }
+        }
+        return true;
+    }
+
+    // The cache's header and sections, in file order.
+    struct CacheLayout
+    {
+        SceneCacheHeader header;
+        SectionData sections[SceneCacheSection::Count];
+        std::vector<Aabb> bounds;
+        UINT64 size;
+    };
+
+    void Layout(const Scene& scene, const BVH* bvh, CacheLayout& layout)
+    {
+        std::vector<UINT> refs;
+        scene.GetPrimitiveRefs(refs);
+        layout.bounds.resize(refs.size());
+        for (size_t i = 0; i < refs.size(); i++)
+        {
+            layout.bounds[i] = scene.GetPrimitiveBounds(refs[i]);
+        }
+
+        SectionData noData = { nullptr, 0 };
+        SectionData phongLight = { &scene.light, sizeof(SceneLight) };
+        const SectionData sections[SceneCacheSection::Count] =
+        {
+            ArrayData(scene.sphereCenterX), ArrayData(scene.sphereCenterY), ArrayData(scene.sphereCenterZ),
+            ArrayData(scene.sphereMotionX), ArrayData(scene.sphereMotionY), ArrayData(scene.sphereMotionZ),
+            ArrayData(scene.sphereRadius),
+            ArrayData(scene.sphereMaterial),
+            ArrayData(scene.triangleV0), ArrayData(scene.triangleE1), ArrayData(scene.triangleE2),
+            ArrayData(scene.triangleMaterial),
+            ArrayData(scene.materials),
+            ArrayData(scene.materialEmission),
+            ArrayData(scene.lights),
+            phongLight,
+            ArrayData(layout.bounds),
+            bvh ? ArrayData(bvh->Nodes()) : noData,
+            bvh ? ArrayData(bvh->PrimitiveRefs()) : noData
+        };
+
+        SceneCacheHeader& header = layout.header;
+        header = SceneCacheHeader();
+        header.magic = c_magic;
+        header.version = c_version;
+        header.sectionCount = SceneCacheSection::Count;
+        header.elementSizes = ElementSizes();
+        UINT64 offset = AlignSection(sizeof(SceneCacheHeader));
+        for (UINT section = 0; section < SceneCacheSection::Count; section++)
+        {
+            layout.sections[section] = sections[section];
+            header.sections[section].offset = offset;
+            header.sections[section].size = sections[section].size;
+            layout.size = offset + sections[section].size;
+            offset = AlignSection(layout.size);
+        }
+    }
+
+    template <typename T>
+    void ViewSection(const SceneCache& cache, SceneCacheSection::Enum section, MappableArray<T>& array)
+    {
+        size_t count = 0;
+        const T* data = cache.Section<T>(section, count);
+        array.View(data, count);
+    }
+}
+
+SceneCache::SceneCache() :
+    m_mapping(nullptr),
+    m_view(nullptr),
+    m_size(0)
+{
+}
+
+SceneCache::~SceneCache()
+{
+    Close();
+}
+
+void SceneCache::Write(const std::wstring& path, const Scene& scene, const BVH* bvh)
+{
+    CacheLayout layout;
+    Layout(scene, bvh, layout);
+    const SceneCacheHeader& header = layout.header;
+
+    Wrappers::FileHandle file(CreateFile2(path.c_str(), GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr));
+    ThrowIfFalse(file.Get() != INVALID_HANDLE_VALUE, L"Failed to create the scene cache.");
+
+    static const BYTE padding[SectionAlignment] = {};
+    WriteBytes(file.Get(), &header, sizeof(header));
+    UINT64 position = sizeof(header);
+    for (UINT section = 0; section < SceneCacheSection::Count; section++)
+    {
+        WriteBytes(file.Get(), padding, header.sections[section].offset - position);
+        WriteBytes(file.Get(), layout.sections[section].data, layout.sections[section].size);
+        position = header.sections[section].offset + layout.sections[section].size;
+    }
+}
+
+void SceneCache::Serialize(const Scene& scene, const BVH* bvh, std::vector<BYTE>& bytes)
+{
+    CacheLayout layout;
+    Layout(scene, bvh, layout);
+    bytes.assign(static_cast<size_t>(layout.size), 0);
+    memcpy(bytes.data(), &layout.header, sizeof(layout.header));
+    for (UINT section = 0; section < SceneCacheSection::Count; section++)
+    {
+        if (layout.sections[section].size > 0)
+        {
+            memcpy(bytes.data() + layout.header.sections[section].offset, layout.sections[section].data, static_cast<size_t>(layout.sections[section].size));
+        }
+    }
+}
+
+void SceneCache::Open(const std::wstring& path)
+{
+    Close();
+
+    // The mapping keeps the file open once its handle is closed.
+    Wrappers::FileHandle file(CreateFile2(path.c_str(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr));
+    ThrowIfFalse(file.Get() != INVALID_HANDLE_VALUE, L"Failed to open the scene cache.");
+    LARGE_INTEGER size = {};
+    ThrowIfFalse(GetFileSizeEx(file.Get(), &size) && size.QuadPart >= static_cast<LONGLONG>(sizeof(SceneCacheHeader)), L"Scene cache too small.");
+
+    m_mapping = CreateFileMapping(file.Get(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+    ThrowIfFalse(m_mapping != nullptr, L"Failed to map the scene cache.");
+    m_view = static_cast<const BYTE*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    ThrowIfFalse(m_view != nullptr, L"Failed to map the scene cache.");
+    m_size = static_cast<UINT64>(size.QuadPart);
+
+    if (!IsValid(Header(), m_size))
+    {
+        Close();
+        ThrowIfFalse(false, L"Invalid scene cache.");
+    }
+}
+
+void SceneCache::Open(const BYTE* data, UINT64 size)
+{
+    Close();
+    ThrowIfFalse(size >= sizeof(SceneCacheHeader) && reinterpret_cast<uintptr_t>(data) % SectionAlignment == 0 &&
+        IsValid(*reinterpret_cast<const SceneCacheHeader*>(data), size), L"Invalid scene cache.");
+    m_view = data;
+    m_size = size;
+}
+
+void SceneCache::Close()
+{
+    // Caches opened from memory have no mapping, the memory isn't theirs.
+    if (m_mapping)
+    {
+        if (m_view)
+        {
+            UnmapViewOfFile(m_view);
+        }
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    m_view = nullptr;
+    m_size = 0;
+}
+
+void SceneCache::ReadScene(Scene& scene) const
+{
+    scene.Clear();
+    ViewSection(*this, SceneCacheSection::SphereCenterX, scene.sphereCenterX);
+    ViewSection(*this, SceneCacheSection::SphereCenterY, scene.sphereCenterY);
+    ViewSection(*this, SceneCacheSection::SphereCenterZ, scene.sphereCenterZ);
+    ViewSection(*this, SceneCacheSection::SphereMotionX, scene.sphereMotionX);
+    ViewSection(*this, SceneCacheSection::SphereMotionY, scene.sphereMotionY);
+    ViewSection(*this, SceneCacheSection::SphereMotionZ, scene.sphereMotionZ);
+    ViewSection(*this, SceneCacheSection::SphereRadius, scene.sphereRadius);
+    ViewSection(*this, SceneCacheSection::SphereMaterial, scene.sphereMaterial);
+    ViewSection(*this, SceneCacheSection::TriangleV0, scene.triangleV0);
+    ViewSection(*this, SceneCacheSection::TriangleE1, scene.triangleE1);
+    ViewSection(*this, SceneCacheSection::TriangleE2, scene.triangleE2);
+    ViewSection(*this, SceneCacheSection::TriangleMaterial, scene.triangleMaterial);
+    ViewSection(*this, SceneCacheSection::Materials, scene.materials);
+    ViewSection(*this, SceneCacheSection::MaterialEmission, scene.materialEmission);
+    scene.materialTextures.assign(scene.materials.size(), InvalidTexture);
+
+    size_t count = 0;
+    scene.light = *Section<SceneLight>(SceneCacheSection::PhongLight, count);
+    const Light* lights = Section<Light>(SceneCacheSection::Lights, count);
+    scene.lights.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        scene.AddLight(lights[i]);
+    }
+
+    if (!HasValidIndices(scene))
+    {
+        scene.Clear();
+        ThrowIfFalse(false, L"Invalid scene cache.");
+    }
+}
+
+void SceneCache::ReadBVH(BVH& bvh) const
+{
+    ThrowIfFalse(HasBVH(), L"The scene cache holds no BVH.");
+    size_t nodeCount = 0;
+    size_t primitiveRefCount = 0;
+    const BVHNode* nodes = Section<BVHNode>(SceneCacheSection::BVHNodes, nodeCount);
+    const UINT* primitiveRefs = Section<UINT>(SceneCacheSection::BVHPrimitiveRefs, primitiveRefCount);
+    ThrowIfFalse(IsValidBVH(Header(), nodes, nodeCount, primitiveRefs, primitiveRefCount), L"Invalid scene cache.");
+    bvh.View(nodes, nodeCount, primitiveRefs, primitiveRefCount);
+}
+
+void SceneCache::BuildBVH(const Scene& scene, BVH& bvh) const
+{
+    size_t count = 0;
+    const Aabb* bounds = Section<Aabb>(SceneCacheSection::PrimitiveBounds, count);
+    ThrowIfFalse(count == scene.PrimitiveCount(), L"The scene doesn't match the scene cache.");
+    bvh.Build(scene, bounds);
+}
@@ -0,0 +1,110 @@
+#ifndef CPU_SCENE_CACHE_H
+#define CPU_SCENE_CACHE_H
+
+#include "CpuBVH.h"
+#include "CpuScene.h"
+
+namespace Cpu
+{
+    // Sections of a scene cache, each an array of one kind of element.
+    namespace SceneCacheSection {
+        enum Enum {
+            SphereCenterX = 0,      // Scene::sphereCenterX and the other sphere arrays, one element per sphere.
+            SphereCenterY,
+            SphereCenterZ,
+            SphereMotionX,
+            SphereMotionY,
+            SphereMotionZ,
+            SphereRadius,
+            SphereMaterial,
+            TriangleV0,             // Scene::triangleV0 and the other triangle arrays, one element per triangle.
+            TriangleE1,
+            TriangleE2,
+            TriangleMaterial,
+            Materials,              // Scene::materials and Scene::materialEmission.
+            MaterialEmission,
+            Lights,                 // Scene::lights.
+            PhongLight,             // Scene::light, a single SceneLight.
+            PrimitiveBounds,        // Swept bounds of every primitive, spheres then triangles as Scene::GetPrimitiveRefs() lists them.
+            BVHNodes,               // BVH::Nodes() and BVH::PrimitiveRefs(), empty if the cache was written without a BVH.
+            BVHPrimitiveRefs,
+            Count
+        };
+    }
+
+    struct SceneCacheSectionRange
+    {
+        UINT64 offset;              // From the start of the file, a multiple of SceneCache::SectionAlignment.
+        UINT64 size;                // In bytes.
+    };
+
+    struct SceneCacheHeader
+    {
+        UINT magic;
+        UINT version;
+        UINT sectionCount;
+        UINT elementSizes;          // Sum of the section element sizes, catches layout changes that keep the version.
+        SceneCacheSectionRange sections[SceneCacheSection::Count];
+    };
+
+    // Binary scene cache, memory mapped for loading.
+    // The file is a header followed by the sections of SceneCacheSection, each aligned to a cache line and laid out
+    // exactly like the arrays of Scene and BVH, so loading neither parses nor copies: ReadScene() and ReadBVH() point
+    // the arrays at the mapped sections, and the renderer and the traversal read the mapping. Only the lights are
+    // copied, they're few and the scene indexes the primitive ones. The indices of the sections are checked in a read
+    // only pass, since caches also arrive over the network. The primitive bounds are handed to BVH::Build() in place,
+    // and a cache written with a BVH skips the build altogether. Like scene files, caches don't hold textures:
+    // materials keep their hasTexture flag, but their Scene::materialTextures entries read back as InvalidTexture.
+    class SceneCache
+    {
+    public:
+        static const UINT SectionAlignment = 64;
+
+        SceneCache();
+        ~SceneCache();
+
+        static void Write(const std::wstring& path, const Scene& scene, const BVH* bvh = nullptr);
+        // The bytes Write() writes to the file, for scenes sent over the network.
+        static void Serialize(const Scene& scene, const BVH* bvh, std::vector<BYTE>& bytes);
+
+        // Maps the file and checks its header and sections, throws if it isn't a valid scene cache.
+        void Open(const std::wstring& path);
+        // Reads the cache from memory that holds the bytes of a file, aligned to SectionAlignment, and stays valid until Close().
+        void Open(const BYTE* data, UINT64 size);
+        void Close();
+        bool IsOpen() const { return m_view != nullptr; }
+        UINT64 SizeInBytes() const { return m_size; }
+
+        // Mapped section, valid until Close(). Count is the number of elements.
+        template <typename T>
+        const T* Section(SceneCacheSection::Enum section, size_t& count) const
+        {
+            const SceneCacheSectionRange& range = Header().sections[section];
+            count = static_cast<size_t>(range.size / sizeof(T));
+            return reinterpret_cast<const T*>(m_view + range.offset);
+        }
+
+        // Replaces the scene's contents with views of the cached scene, valid until Close(), throws if an index of it
+        // is out of range. Changing the scene copies the arrays it changes.
+        void ReadScene(Scene& scene) const;
+
+        bool HasBVH() const { return Header().sections[SceneCacheSection::BVHNodes].size > 0; }
+        // Replaces the BVH with a view of the cached one, valid until Close() and only for the scene the cache holds.
+        // Throws if a node or primitive reference is out of range or the hierarchy is deeper than the traversal stacks.
+        void ReadBVH(BVH& bvh) const;
+        // Builds a BVH over the cached scene from the mapped primitive bounds.
+        void BuildBVH(const Scene& scene, BVH& bvh) const;
+
+    private:
+        SceneCache(const SceneCache&) = delete;
+        SceneCache& operator=(const SceneCache&) = delete;
+
+        const SceneCacheHeader& Header() const { return *reinterpret_cast<const SceneCacheHeader*>(m_view); }
+
+        HANDLE m_mapping;
+        const BYTE* m_view;
+        UINT64 m_size;
+    };
+}
+
+#endif // !CPU_SCENE_CACHE_H
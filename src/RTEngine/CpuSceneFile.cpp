@@ -0,0 +1,564 @@
+#include "stdafx.h"
+#include "CpuSceneFile.h"
+#include <cstdarg>
+
+using namespace Cpu;
+
+namespace
+{
+    struct Keyword
+    {
+        const char* name;
+        SceneRecord::Enum record;
+    };
+
+    static const Keyword c_keywords[] =
+    {
+        { "camera", SceneRecord::Camera },
+        { "light", SceneRecord::Light },
+        { "material", SceneRecord::Material },
+        { "sphere", SceneRecord::Sphere },
+        { "vertex", SceneRecord::Vertex },
+        { "triangle", SceneRecord::Triangle },
+        { "pointlight", SceneRecord::ManyLight },
+        { "spherelight", SceneRecord::ManyLight },
+        { "metaball", SceneRecord::Metaball },
+        { "randomspheres", SceneRecord::RandomSpheres },
+    };
+
+    // Chunks per thread, so threads that finish early pick up more, and the smallest text worth splitting.
+    static const UINT c_chunksPerThread = 8;
+    static const size_t c_minChunkSize = 64 * 1024;
+
+    // Most numbers of a record, a material's.
+    static const UINT c_maxValues = 12;
+
+    // Reads the words and numbers of one line, up to its line break or comment.
+    class LineCursor
+    {
+    public:
+        LineCursor(const char* begin, const char* end) :
+            m_position(begin),
+            m_end(end)
+        {
+        }
+
+        bool AtEnd()
+        {
+            SkipSpaces();
+            return m_position == m_end;
+        }
+
+        // The record's keyword, or nullptr if the next word isn't one.
+        const Keyword* ReadKeyword()
+        {
+            for (const Keyword& keyword : c_keywords)
+            {
+                if (ReadWord(keyword.name))
+                {
+                    return &keyword;
+                }
+            }
+            return nullptr;
+        }
+
+        // Skips the word if it comes next, followed by a space or the end of the line.
+        bool ReadWord(const char* word)
+        {
+            SkipSpaces();
+            size_t length = strlen(word);
+            if (static_cast<size_t>(m_end - m_position) >= length && strncmp(m_position, word, length) == 0 &&
+                (m_position + length == m_end || IsSpace(m_position[length])))
+            {
+                m_position += length;
+                return true;
+            }
+            return false;
+        }
+
+        // Reads numbers up to maxCount and returns how many it read.
+        UINT ReadNumbers(double* values, UINT maxCount)
+        {
+            UINT count = 0;
+            while (count < maxCount)
+            {
+                SkipSpaces();
+                if (m_position == m_end)
+                {
+                    break;
+                }
+                // The text is null terminated, strtod stops at the line break or the comment at the latest.
+                char* next;
+                double value = strtod(m_position, &next);
+                if (next == m_position || (next < m_end && !IsSpace(*next)))
+                {
+                    break;
+                }
+                values[count++] = value;
+                m_position = next;
+            }
+            return count;
+        }
+
+    private:
+        static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+        void SkipSpaces()
+        {
+            while (m_position < m_end && IsSpace(*m_position))
+            {
+                m_position++;
+            }
+        }
+
+        const char* m_position;
+        const char* m_end;
+    };
+
+    // Calls lineFunction(cursor, lineIndex) for every line of <begin, end), the cursor ending at the comment.
+    template <typename LineFunction>
+    UINT ForEachLine(const std::string& text, size_t begin, size_t end, LineFunction lineFunction)
+    {
+        const char* data = text.data();
+        UINT line = 0;
+        while (begin < end)
+        {
+            const char* lineBegin = data + begin;
+            const char* lineEnd = static_cast<const char*>(memchr(lineBegin, '\n', end - begin));
+            lineEnd = lineEnd ? lineEnd : data + end;
+            const char* comment = static_cast<const char*>(memchr(lineBegin, '#', lineEnd - lineBegin));
+            LineCursor cursor(lineBegin, comment ? comment : lineEnd);
+            lineFunction(cursor, line++);
+            begin = lineEnd - data + 1;
+        }
+        return line;
+    }
+
+    bool IsIndex(double value, size_t count)
+    {
+        return value >= 0 && value < count && value == std::floor(value);
+    }
+
+    Vec3 ToVec3(const double* values)
+    {
+        return Vec3(static_cast<float>(values[0]), static_cast<float>(values[1]), static_cast<float>(values[2]));
+    }
+
+    void AppendLine(std::string& text, const char* format, ...)
+    {
+        char line[512];
+        va_list arguments;
+        va_start(arguments, format);
+        int length = vsnprintf(line, sizeof(line), format, arguments);
+        va_end(arguments);
+        text.append(line, (std::min)(static_cast<size_t>((std::max)(length, 0)), sizeof(line) - 1));
+    }
+}
+
+SceneFileLoader::SceneFileLoader(ThreadPool& threadPool) :
+    m_threadPool(threadPool)
+{
+}
+
+void SceneFileLoader::Load(const std::wstring& path, SceneDescription& description)
+{
+    byte* data = nullptr;
+    UINT size = 0;
+    ThrowIfFailed(ReadDataFromFile(path.c_str(), &data, &size));
+    std::string text(reinterpret_cast<const char*>(data), size);
+    free(data);
+
+    Parse(text, description);
+}
+
+void SceneFileLoader::Parse(const std::string& text, SceneDescription& description)
+{
+    // Chunks end after a line break, except for the last one.
+    UINT chunkCount = static_cast<UINT>((std::min)(static_cast<size_t>(m_threadPool.ThreadCount() * c_chunksPerThread), text.size() / c_minChunkSize + 1));
+    m_chunks.resize(chunkCount);
+    size_t chunkBegin = 0;
+    for (UINT i = 0; i < chunkCount; i++)
+    {
+        size_t chunkEnd = i + 1 < chunkCount ? text.size() * (i + 1) / chunkCount : text.size();
+        chunkEnd = chunkEnd < text.size() ? text.find('\n', (std::max)(chunkBegin, chunkEnd)) : std::string::npos;
+        chunkEnd = chunkEnd == std::string::npos ? text.size() : chunkEnd + 1;
+        m_chunks[i] = Chunk();
+        m_chunks[i].begin = chunkBegin;
+        m_chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+
+    m_threadPool.ParallelFor(chunkCount, 1, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT i = begin; i < end; i++)
+        {
+            CountRecords(text, m_chunks[i]);
+        }
+    });
+
+    UINT line = 1;
+    UINT totals[SceneRecord::Count] = {};
+    for (Chunk& chunk : m_chunks)
+    {
+        chunk.firstLine = line;
+        line += chunk.lines;
+        for (UINT record = 0; record < SceneRecord::Count; record++)
+        {
+            chunk.offsets[record] = totals[record];
+            totals[record] += chunk.counts[record];
+        }
+    }
+
+    description.cameras.resize(totals[SceneRecord::Camera]);
+    description.lights.resize(totals[SceneRecord::Light]);
+    description.materials.resize(totals[SceneRecord::Material]);
+    description.spheres.resize(totals[SceneRecord::Sphere]);
+    description.vertices.resize(totals[SceneRecord::Vertex]);
+    description.triangles.resize(totals[SceneRecord::Triangle]);
+    description.manyLights.resize(totals[SceneRecord::ManyLight]);
+    description.metaballs.resize(totals[SceneRecord::Metaball]);
+    description.randomSpheres.resize(totals[SceneRecord::RandomSpheres]);
+
+    m_threadPool.ParallelFor(chunkCount, 1, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT i = begin; i < end; i++)
+        {
+            ParseRecords(text, m_chunks[i], description);
+        }
+    });
+
+    for (const Chunk& chunk : m_chunks)
+    {
+        if (chunk.errorLine != 0)
+        {
+            std::wstring message = L"Scene file line " + std::to_wstring(chunk.errorLine) + L": " + chunk.error + L"\n";
+            ThrowIfFalse(false, message.c_str());
+        }
+    }
+}
+
+void SceneFileLoader::CountRecords(const std::string& text, Chunk& chunk) const
+{
+    chunk.lines = ForEachLine(text, chunk.begin, chunk.end, [&](LineCursor& cursor, UINT)
+    {
+        // Unknown keywords are reported by ParseRecords().
+        const Keyword* keyword = cursor.ReadKeyword();
+        if (keyword)
+        {
+            chunk.counts[keyword->record]++;
+        }
+    });
+}
+
+void SceneFileLoader::ParseRecords(const std::string& text, Chunk& chunk, SceneDescription& description) const
+{
+    UINT next[SceneRecord::Count];
+    memcpy(next, chunk.offsets, sizeof(next));
+    size_t materialCount = description.materials.size();
+    size_t vertexCount = description.vertices.size();
+
+    ForEachLine(text, chunk.begin, chunk.end, [&](LineCursor& cursor, UINT line)
+    {
+        if (chunk.errorLine != 0 || cursor.AtEnd())
+        {
+            return;
+        }
+
+        const wchar_t* error = nullptr;
+        const Keyword* keyword = cursor.ReadKeyword();
+        double v[c_maxValues];
+        UINT count = keyword ? cursor.ReadNumbers(v, c_maxValues) : 0;
+        switch (keyword ? keyword->record : SceneRecord::Count)
+        {
+        case SceneRecord::Camera:
+        {
+            if (count != 6 && count != 7)
+            {
+                error = L"expected \"camera eyeX eyeY eyeZ atX atY atZ [fieldOfView]\".";
+                break;
+            }
+            SceneFileCamera& camera = description.cameras[next[SceneRecord::Camera]++];
+            camera.eye = ToVec3(v);
+            camera.at = ToVec3(v + 3);
+            camera.fieldOfView = count == 7 ? static_cast<float>(v[6]) : 20.0f;
+            break;
+        }
+        case SceneRecord::Light:
+        {
+            if (count != 3 && count != 5)
+            {
+                error = L"expected \"light x y z [ambient diffuse]\".";
+                break;
+            }
+            SceneLight& light = description.lights[next[SceneRecord::Light]++];
+            light = SceneLight();
+            light.position = ToVec3(v);
+            if (count == 5)
+            {
+                light.ambientColor = Vec3(static_cast<float>(v[3]));
+                light.diffuseColor = Vec3(static_cast<float>(v[4]));
+            }
+            break;
+        }
+        case SceneRecord::Material:
+        {
+            if (count != 7 && count != 8 && count != 9 && count != 12)
+            {
+                error = L"expected \"material r g b reflectance diffuse specular specularPower [refractionIndex [fuzz [emissionR emissionG emissionB]]] [texture] [perlin]\".";
+                break;
+            }
+            SceneFileMaterial& material = description.materials[next[SceneRecord::Material]++];
+            MaterialConstantBuffer& constants = material.constants;
+            constants = MaterialConstantBuffer();
+            constants.albedo = XMFLOAT4(static_cast<float>(v[0]), static_cast<float>(v[1]), static_cast<float>(v[2]), 1.0f);
+            constants.reflectanceCoef = static_cast<float>(v[3]);
+            constants.diffuseCoef = static_cast<float>(v[4]);
+            constants.specularCoef = static_cast<float>(v[5]);
+            constants.specularPower = static_cast<float>(v[6]);
+            constants.refractionIndex = count > 7 ? static_cast<float>(v[7]) : 0.0f;
+            constants.fuzz = count > 8 ? static_cast<float>(v[8]) : 1.0f;
+            constants.hasTexture = cursor.ReadWord("texture");
+            constants.hasPerlin = cursor.ReadWord("perlin");
+            material.emission = count == 12 ? ToVec3(v + 9) : Vec3(0.0f);
+            break;
+        }
+        case SceneRecord::Sphere:
+        {
+            if ((count != 5 && count != 8) || !IsIndex(v[4], materialCount))
+            {
+                error = count == 5 || count == 8 ? L"material out of range." : L"expected \"sphere x y z radius material [x1 y1 z1]\".";
+                break;
+            }
+            SceneFileSphere& sphere = description.spheres[next[SceneRecord::Sphere]++];
+            sphere.center0 = ToVec3(v);
+            sphere.center1 = count == 8 ? ToVec3(v + 5) : sphere.center0;
+            sphere.radius = static_cast<float>(v[3]);
+            sphere.material = static_cast<UINT>(v[4]);
+            break;
+        }
+        case SceneRecord::Vertex:
+        {
+            if (count != 3)
+            {
+                error = L"expected \"vertex x y z\".";
+                break;
+            }
+            description.vertices[next[SceneRecord::Vertex]++] = ToVec3(v);
+            break;
+        }
+        case SceneRecord::Triangle:
+        {
+            if (count != 4)
+            {
+                error = L"expected \"triangle vertex0 vertex1 vertex2 material\".";
+                break;
+            }
+            if (!IsIndex(v[0], vertexCount) || !IsIndex(v[1], vertexCount) || !IsIndex(v[2], vertexCount) || !IsIndex(v[3], materialCount))
+            {
+                error = L"vertex or material out of range.";
+                break;
+            }
+            SceneFileTriangle& triangle = description.triangles[next[SceneRecord::Triangle]++];
+            for (UINT i = 0; i < 3; i++)
+            {
+                triangle.vertices[i] = static_cast<UINT>(v[i]);
+            }
+            triangle.material = static_cast<UINT>(v[3]);
+            break;
+        }
+        case SceneRecord::ManyLight:
+        {
+            bool sphere = strcmp(keyword->name, "spherelight") == 0;
+            if (count != (sphere ? 7u : 6u))
+            {
+                error = sphere ? L"expected \"spherelight x y z radius radianceR radianceG radianceB\"." : L"expected \"pointlight x y z intensityR intensityG intensityB\".";
+                break;
+            }
+            Light& light = description.manyLights[next[SceneRecord::ManyLight]++];
+            light = Light();
+            light.type = sphere ? LightType::Sphere : LightType::Point;
+            light.position = ToVec3(v);
+            light.radius = sphere ? static_cast<float>(v[3]) : 0.0f;
+            light.emission = ToVec3(v + (sphere ? 4 : 3));
+            light.primitive = ~0u;
+            break;
+        }
+        case SceneRecord::Metaball:
+        {
+            if (count != 4 && count != 7)
+            {
+                error = L"expected \"metaball x0 y0 z0 [x1 y1 z1] radius\".";
+                break;
+            }
+            AnimatedMetaball& metaball = description.metaballs[next[SceneRecord::Metaball]++];
+            metaball.center0 = ToVec3(v);
+            metaball.center1 = count == 7 ? ToVec3(v + 3) : metaball.center0;
+            metaball.radius = static_cast<float>(v[count - 1]);
+            break;
+        }
+        case SceneRecord::RandomSpheres:
+        {
+            if ((count != 1 && count != 2) || !IsIndex(v[0], ~0u) || (count == 2 && !IsIndex(v[1], ~0u)))
+            {
+                error = L"expected \"randomspheres count [seed]\".";
+                break;
+            }
+            RandomSceneSettings& settings = description.randomSpheres[next[SceneRecord::RandomSpheres]++];
+            settings = RandomSceneSettings();
+            settings.sphereCount = static_cast<UINT>(v[0]);
+            settings.seed = count == 2 ? static_cast<UINT>(v[1]) : settings.seed;
+            break;
+        }
+        default:
+            error = L"unknown record.";
+            break;
+        }
+
+        if (!error && !cursor.AtEnd())
+        {
+            error = L"unexpected value at the end of the record.";
+        }
+        if (error)
+        {
+            chunk.errorLine = chunk.firstLine + line;
+            chunk.error = error;
+        }
+    });
+}
+
+void SceneFileLoader::AddToScene(const SceneDescription& description, Scene& scene)
+{
+    UINT materialBase = static_cast<UINT>(scene.materials.size());
+    UINT sphereBase = scene.SphereCount();
+    UINT triangleBase = scene.TriangleCount();
+    size_t materialEnd = materialBase + description.materials.size();
+    size_t sphereEnd = sphereBase + description.spheres.size();
+    size_t triangleEnd = triangleBase + description.triangles.size();
+
+    scene.materials.resize(materialEnd);
+    scene.materialTextures.resize(materialEnd, InvalidTexture);
+    scene.materialEmission.resize(materialEnd);
+    for (size_t i = 0; i < description.materials.size(); i++)
+    {
+        scene.materials[materialBase + i] = description.materials[i].constants;
+        scene.materialEmission[materialBase + i] = description.materials[i].emission;
+    }
+
+    scene.sphereCenterX.resize(sphereEnd);
+    scene.sphereCenterY.resize(sphereEnd);
+    scene.sphereCenterZ.resize(sphereEnd);
+    scene.sphereMotionX.resize(sphereEnd);
+    scene.sphereMotionY.resize(sphereEnd);
+    scene.sphereMotionZ.resize(sphereEnd);
+    scene.sphereRadius.resize(sphereEnd);
+    scene.sphereMaterial.resize(sphereEnd);
+    m_threadPool.ParallelFor(static_cast<UINT>(description.spheres.size()), 4096, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT i = begin; i < end; i++)
+        {
+            const SceneFileSphere& sphere = description.spheres[i];
+            Vec3 motion = sphere.center1 - sphere.center0;
+            UINT index = sphereBase + i;
+            scene.sphereCenterX[index] = sphere.center0.x;
+            scene.sphereCenterY[index] = sphere.center0.y;
+            scene.sphereCenterZ[index] = sphere.center0.z;
+            scene.sphereMotionX[index] = motion.x;
+            scene.sphereMotionY[index] = motion.y;
+            scene.sphereMotionZ[index] = motion.z;
+            scene.sphereRadius[index] = sphere.radius;
+            scene.sphereMaterial[index] = materialBase + sphere.material;
+        }
+    });
+
+    scene.triangleV0.resize(triangleEnd);
+    scene.triangleE1.resize(triangleEnd);
+    scene.triangleE2.resize(triangleEnd);
+    scene.triangleMaterial.resize(triangleEnd);
+    m_threadPool.ParallelFor(static_cast<UINT>(description.triangles.size()), 4096, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT i = begin; i < end; i++)
+        {
+            const SceneFileTriangle& triangle = description.triangles[i];
+            const Vec3& v0 = description.vertices[triangle.vertices[0]];
+            UINT index = triangleBase + i;
+            scene.triangleV0[index] = v0;
+            scene.triangleE1[index] = description.vertices[triangle.vertices[1]] - v0;
+            scene.triangleE2[index] = description.vertices[triangle.vertices[2]] - v0;
+            scene.triangleMaterial[index] = materialBase + triangle.material;
+        }
+    });
+
+    scene.lights.insert(scene.lights.end(), description.manyLights.begin(), description.manyLights.end());
+
+    SceneGenerator generator(m_threadPool);
+    for (const RandomSceneSettings& settings : description.randomSpheres)
+    {
+        generator.Generate(scene, settings);
+    }
+}
+
+void SceneFileLoader::Write(const Scene& scene, std::string& text)
+{
+    const SceneLight& light = scene.light;
+    AppendLine(text, "light %.9g %.9g %.9g %.9g %.9g\n", light.position.x, light.position.y, light.position.z, light.ambientColor.x, light.diffuseColor.x);
+
+    for (size_t i = 0; i < scene.materials.size(); i++)
+    {
+        const MaterialConstantBuffer& m = scene.materials[i];
+        const Vec3& e = scene.materialEmission[i];
+        AppendLine(text, "material %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g%s%s\n",
+            m.albedo.x, m.albedo.y, m.albedo.z, m.reflectanceCoef, m.diffuseCoef, m.specularCoef, m.specularPower,
+            m.refractionIndex, m.fuzz, e.x, e.y, e.z, m.hasTexture ? " texture" : "", m.hasPerlin ? " perlin" : "");
+    }
+
+    for (UINT i = 0; i < scene.SphereCount(); i++)
+    {
+        Vec3 center0 = scene.GetSphereCenter(i, 0.0f);
+        Vec3 center1 = scene.GetSphereCenter(i, 1.0f);
+        if (scene.sphereMotionX[i] == 0 && scene.sphereMotionY[i] == 0 && scene.sphereMotionZ[i] == 0)
+        {
+            AppendLine(text, "sphere %.9g %.9g %.9g %.9g %u\n", center0.x, center0.y, center0.z, scene.sphereRadius[i], scene.sphereMaterial[i]);
+        }
+        else
+        {
+            AppendLine(text, "sphere %.9g %.9g %.9g %.9g %u %.9g %.9g %.9g\n", center0.x, center0.y, center0.z, scene.sphereRadius[i],
+                scene.sphereMaterial[i], center1.x, center1.y, center1.z);
+        }
+    }
+
+    for (UINT i = 0; i < scene.TriangleCount(); i++)
+    {
+        Vec3 v[3] = { scene.triangleV0[i], scene.triangleV0[i] + scene.triangleE1[i], scene.triangleV0[i] + scene.triangleE2[i] };
+        for (const Vec3& vertex : v)
+        {
+            AppendLine(text, "vertex %.9g %.9g %.9g\n", vertex.x, vertex.y, vertex.z);
+        }
+        AppendLine(text, "triangle %u %u %u %u\n", 3 * i, 3 * i + 1, 3 * i + 2, scene.triangleMaterial[i]);
+    }
+
+    for (const Light& l : scene.lights)
+    {
+        if (l.type == LightType::Point)
+        {
+            AppendLine(text, "pointlight %.9g %.9g %.9g %.9g %.9g %.9g\n", l.position.x, l.position.y, l.position.z, l.emission.x, l.emission.y, l.emission.z);
+        }
+        else if (l.type == LightType::Sphere)
+        {
+            AppendLine(text, "spherelight %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", l.position.x, l.position.y, l.position.z, l.radius, l.emission.x, l.emission.y, l.emission.z);
+        }
+    }
+}
+
+size_t SceneFileLoader::Save(const std::wstring& path, const Scene& scene)
+{
+    std::string text;
+    Write(scene, text);
+
+    Microsoft::WRL::Wrappers::FileHandle file(CreateFile2(path.c_str(), GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr));
+    ThrowIfFalse(file.Get() != INVALID_HANDLE_VALUE, L"Failed to create the scene file.");
+    ThrowIfFalse(text.size() < (static_cast<UINT64>(1) << 32), L"Scene file too large.");
+    DWORD written = 0;
+    ThrowIfFalse(WriteFile(file.Get(), text.data(), static_cast<DWORD>(text.size()), &written, nullptr) && written == text.size(),
+        L"Failed to write the scene file.");
+    return text.size();
+}
@@ -0,0 +1,125 @@
+#ifndef CPU_SCENE_FILE_H
+#define CPU_SCENE_FILE_H
+
+#include "CpuMetaballs.h"
+#include "CpuScene.h"
+#include "CpuSceneGenerator.h"
+#include "CpuThreadPool.h"
+
+namespace Cpu
+{
+    // Scene file records, one per line, keyword first. # starts a comment. Materials and vertices are numbered
+    // from 0 in file order, across the whole file, and referenced by those numbers.
+    //   camera eyeX eyeY eyeZ atX atY atZ [fieldOfView]       Vertical field of view in degrees, 20 by default.
+    //   light x y z [ambient diffuse]                          Point light of the Phong shading, gray levels.
+    //   material r g b reflectance diffuse specular specularPower [refractionIndex [fuzz [emissionR emissionG emissionB]]] [texture] [perlin]
+    //   sphere x y z radius material [x1 y1 z1]                Moving to the second center over the shutter interval.
+    //   vertex x y z
+    //   triangle vertex0 vertex1 vertex2 material
+    //   pointlight x y z intensityR intensityG intensityB      Lights of the many light list, see Scene::lights.
+    //   spherelight x y z radius radianceR radianceG radianceB
+    //   metaball x0 y0 z0 [x1 y1 z1] radius                   Centers at both key frames, see MetaballField.
+    //   randomspheres count [seed]                             Random sphere field of SceneGenerator.
+    // Later camera and light records replace earlier ones.
+    namespace SceneRecord {
+        enum Enum {
+            Camera = 0,
+            Light,
+            Material,
+            Sphere,
+            Vertex,
+            Triangle,
+            ManyLight,      // pointlight and spherelight.
+            Metaball,
+            RandomSpheres,
+            Count
+        };
+    }
+
+    struct SceneFileCamera
+    {
+        Vec3 eye;
+        Vec3 at;
+        float fieldOfView;
+    };
+
+    struct SceneFileMaterial
+    {
+        MaterialConstantBuffer constants;
+        Vec3 emission;
+    };
+
+    struct SceneFileSphere
+    {
+        Vec3 center0;
+        Vec3 center1;
+        float radius;
+        UINT material;
+    };
+
+    struct SceneFileTriangle
+    {
+        UINT vertices[3];
+        UINT material;
+    };
+
+    // Contents of a scene file, records of each kind in file order.
+    struct SceneDescription
+    {
+        std::vector<SceneFileCamera> cameras;
+        std::vector<SceneLight> lights;
+        std::vector<SceneFileMaterial> materials;
+        std::vector<SceneFileSphere> spheres;
+        std::vector<Vec3> vertices;
+        std::vector<SceneFileTriangle> triangles;
+        std::vector<Light> manyLights;
+        std::vector<AnimatedMetaball> metaballs;
+        std::vector<RandomSceneSettings> randomSpheres;
+    };
+
+    // Parallel scene file parser.
+    // The text is split into chunks at line breaks, one pass over all chunks in parallel counts each chunk's records,
+    // and a second one parses them straight into their place in the description's arrays, which are sized once
+    // from the counts. Numbers are read in place from the text, nothing is allocated per record.
+    class SceneFileLoader
+    {
+    public:
+        explicit SceneFileLoader(ThreadPool& threadPool);
+
+        // Throws on a malformed record, after writing the line number and the reason to the debug output.
+        void Load(const std::wstring& path, SceneDescription& description);
+        void Parse(const std::string& text, SceneDescription& description);
+
+        // Appends the description's materials, spheres, triangles, lights and random sphere fields to the scene.
+        // Material numbers of the file are offset by the scene's materials. The camera, the Phong light and the
+        // metaballs are left to the caller, and so are the lights of emissive primitives, see Scene::AddEmissivePrimitiveLights().
+        void AddToScene(const SceneDescription& description, Scene& scene);
+
+        // Writes the scene's materials, primitives and lights in the scene file format. Triangles are written as
+        // three vertices each.
+        static void Write(const Scene& scene, std::string& text);
+        // Writes the scene to a scene file and returns its size in bytes.
+        static size_t Save(const std::wstring& path, const Scene& scene);
+
+    private:
+        struct Chunk
+        {
+            size_t begin;
+            size_t end;
+            UINT firstLine;
+            UINT lines;
+            UINT counts[SceneRecord::Count];
+            UINT offsets[SceneRecord::Count];
+            UINT errorLine;             // First malformed line, 0 if none.
+            const wchar_t* error;
+        };
+
+        void CountRecords(const std::string& text, Chunk& chunk) const;
+        void ParseRecords(const std::string& text, Chunk& chunk, SceneDescription& description) const;
+
+        ThreadPool& m_threadPool;
+        std::vector<Chunk> m_chunks;
+    };
+}
+
+#endif // !CPU_SCENE_FILE_H
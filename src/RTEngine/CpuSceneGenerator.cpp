@@ -0,0 +1,297 @@
+#include "stdafx.h"
+#include "CpuSceneGenerator.h"
+#include "CpuRandom.h"
+
+using namespace Cpu;
+
+namespace
+{
+    // Materials of RTIAWRandomScene.
+    MaterialConstantBuffer GroundMaterial()
+    {
+        MaterialConstantBuffer material = {};
+        material.albedo = XMFLOAT4(0.5f, 0.5f, 0.6f, 1.0f);
+        material.reflectanceCoef = 0.1f;
+        material.diffuseCoef = 2.0f;
+        material.specularCoef = 0.1f;
+        material.specularPower = 50.0f;
+        material.refractionIndex = 1.0f;
+        return material;
+    }
+
+    // The random sphere materials are quantized to a palette, so spheres share their materials and the material
+    // table stays bounded however many spheres there are: 8 levels per albedo channel of the diffuse spheres,
+    // 4 levels per albedo channel and of fuzz of the metal ones, and a single glass.
+    static const UINT c_diffuseLevels = 8;
+    static const UINT c_metalLevels = 4;
+    static const UINT c_diffuseMaterials = c_diffuseLevels * c_diffuseLevels * c_diffuseLevels;
+    static const UINT c_metalMaterials = c_metalLevels * c_metalLevels * c_metalLevels * c_metalLevels;
+    static const UINT c_glassMaterial = c_diffuseMaterials + c_metalMaterials;
+    static const UINT c_paletteSize = c_glassMaterial + 1;
+
+    UINT Quantize(float value, UINT levels)
+    {
+        return (std::min)(levels - 1, static_cast<UINT>(value * levels));
+    }
+
+    float Dequantize(UINT level, UINT levels)
+    {
+        return (level + 0.5f) / levels;
+    }
+
+    // Palette entry of a sphere, drawn with the odds of RTIAWRandomScene.
+    UINT RandomPaletteEntry(RandomStream& random)
+    {
+        float chooseMaterial = random.NextFloat();
+        if (chooseMaterial < 0.7f)
+        {
+            UINT r = Quantize(random.NextFloat() * random.NextFloat(), c_diffuseLevels);
+            UINT g = Quantize(random.NextFloat() * random.NextFloat(), c_diffuseLevels);
+            UINT b = Quantize(random.NextFloat() * random.NextFloat(), c_diffuseLevels);
+            return (r * c_diffuseLevels + g) * c_diffuseLevels + b;
+        }
+        else if (chooseMaterial < 0.95f)
+        {
+            UINT r = Quantize(random.NextFloat(), c_metalLevels);
+            UINT g = Quantize(random.NextFloat(), c_metalLevels);
+            UINT b = Quantize(random.NextFloat(), c_metalLevels);
+            UINT fuzz = Quantize(random.NextFloat(), c_metalLevels);
+            return c_diffuseMaterials + ((r * c_metalLevels + g) * c_metalLevels + b) * c_metalLevels + fuzz;
+        }
+        return c_glassMaterial;
+    }
+
+    MaterialConstantBuffer PaletteMaterial(UINT entry)
+    {
+        MaterialConstantBuffer material = {};
+        material.specularPower = 50.0f;
+        material.fuzz = 1.0f;
+
+        if (entry < c_diffuseMaterials)
+        {
+            float r = Dequantize(entry / (c_diffuseLevels * c_diffuseLevels), c_diffuseLevels);
+            float g = Dequantize(entry / c_diffuseLevels % c_diffuseLevels, c_diffuseLevels);
+            float b = Dequantize(entry % c_diffuseLevels, c_diffuseLevels);
+            material.albedo = XMFLOAT4(r, g, b, 1.0f);
+            material.diffuseCoef = 2.0f;
+            material.specularCoef = 0.1f;
+        }
+        else if (entry < c_glassMaterial)
+        {
+            UINT metal = entry - c_diffuseMaterials;
+            float r = 0.4f + 0.6f * Dequantize(metal / (c_metalLevels * c_metalLevels * c_metalLevels), c_metalLevels);
+            float g = 0.4f + 0.6f * Dequantize(metal / (c_metalLevels * c_metalLevels) % c_metalLevels, c_metalLevels);
+            float b = 0.4f + 0.6f * Dequantize(metal / c_metalLevels % c_metalLevels, c_metalLevels);
+            material.albedo = XMFLOAT4(r, g, b, 1.0f);
+            material.reflectanceCoef = 0.9f;
+            material.specularCoef = 0.7f;
+            material.fuzz = 0.01f + 0.09f * Dequantize(metal % c_metalLevels, c_metalLevels);
+        }
+        else
+        {
+            material.albedo = XMFLOAT4(0.7f, 0.7f, 0.7f, 1.0f);
+            material.reflectanceCoef = 1.0f;
+            material.specularCoef = 0.7f;
+            material.specularPower = 150.0f;
+            material.refractionIndex = 1.7f;
+        }
+        return material;
+    }
+
+    // Subsequences of the random streams: a cell's placement, keyed by the cell, and a sphere's material, keyed by the sphere.
+    static const UINT c_placementSubsequence = 0;
+    static const UINT c_materialSubsequence = 1;
+}
+
+SceneGenerator::SceneGenerator(ThreadPool& threadPool) :
+    m_threadPool(threadPool),
+    m_gridSize(0),
+    m_capacity(0),
+    m_quota(0),
+    m_extraQuotaCells(0),
+    m_cellSize(0),
+    m_origin(0)
+{
+}
+
+void SceneGenerator::Resize(const RandomSceneSettings& settings)
+{
+    ThrowIfFalse(settings.minRadius > 0 && settings.minRadius <= settings.maxRadius && settings.coverage > 0 && settings.spheresPerCell > 0,
+        L"Invalid random scene settings.");
+
+    // Cells hold spheresPerCell spheres at the requested coverage, but are never narrower than a sphere's
+    // diameter, so spheres of cells that aren't neighbours can't overlap.
+    float a = settings.minRadius;
+    float b = settings.maxRadius;
+    float meanFootprint = 3.14159265f * (a * a + a * b + b * b) / 3.0f;
+    m_cellSize = (std::max)(2.0f * settings.maxRadius, std::sqrt(settings.spheresPerCell * meanFootprint / settings.coverage));
+    m_gridSize = (std::max)(1u, static_cast<UINT>(std::ceil(std::sqrt(static_cast<double>(settings.sphereCount) / settings.spheresPerCell))));
+    m_origin = -0.5f * m_gridSize * m_cellSize;
+
+    UINT cellCount = m_gridSize * m_gridSize;
+    m_quota = settings.sphereCount / cellCount;
+    m_extraQuotaCells = settings.sphereCount % cellCount;
+    m_capacity = m_quota + (m_extraQuotaCells > 0 ? 1 : 0);
+
+    size_t slots = static_cast<size_t>(cellCount) * m_capacity;
+    m_x.resize(slots);
+    m_z.resize(slots);
+    m_radius.resize(slots);
+    m_cellCounts.assign(cellCount, 0);
+    m_cellOffsets.resize(cellCount);
+    m_threadCandidates.assign(m_threadPool.ThreadCount(), 0);
+    m_threadOverlapTests.assign(m_threadPool.ThreadCount(), 0);
+}
+
+void SceneGenerator::Generate(Scene& scene, const RandomSceneSettings& settings)
+{
+    Resize(settings);
+
+    // The cells of a phase are two cells apart, their 3x3 neighbourhoods only share cells of other phases,
+    // which no cell writes to during this one.
+    for (UINT phase = 0; phase < 4; phase++)
+    {
+        UINT phaseX = phase & 1;
+        UINT phaseZ = phase >> 1;
+        UINT cellsX = (m_gridSize - phaseX + 1) / 2;
+        UINT cellsZ = (m_gridSize - phaseZ + 1) / 2;
+        m_threadPool.ParallelFor(cellsX * cellsZ, 64, [&](UINT begin, UINT end, UINT threadIndex)
+        {
+            for (UINT i = begin; i < end; i++)
+            {
+                PlaceSpheres(2 * (i % cellsX) + phaseX, 2 * (i / cellsX) + phaseZ, settings, threadIndex);
+            }
+        });
+    }
+
+    UINT sphereCount = 0;
+    for (size_t cell = 0; cell < m_cellCounts.size(); cell++)
+    {
+        m_cellOffsets[cell] = sphereCount;
+        sphereCount += m_cellCounts[cell];
+    }
+
+    float extent = m_gridSize * m_cellSize;
+    UINT groundMaterial = scene.AddMaterial(GroundMaterial());
+    scene.AddQuad(Vec3(m_origin, 0, m_origin), Vec3(0, 0, extent), Vec3(extent, 0, 0), groundMaterial);
+
+    UINT sphereBase = scene.SphereCount();
+    size_t sphereEnd = static_cast<size_t>(sphereBase) + sphereCount;
+    scene.sphereCenterX.resize(sphereEnd);
+    scene.sphereCenterY.resize(sphereEnd);
+    scene.sphereCenterZ.resize(sphereEnd);
+    scene.sphereMotionX.resize(sphereEnd, 0.0f);
+    scene.sphereMotionY.resize(sphereEnd, 0.0f);
+    scene.sphereMotionZ.resize(sphereEnd, 0.0f);
+    scene.sphereRadius.resize(sphereEnd);
+    scene.sphereMaterial.resize(sphereEnd);
+    WriteSpheres(scene, sphereBase, settings);
+
+    // The spheres hold their palette entries, the materials of the entries in use are added in sphere order,
+    // which keeps the scene independent of the thread count.
+    std::vector<UINT> paletteMaterials(c_paletteSize, UINT_MAX);
+    for (size_t index = sphereBase; index < sphereEnd; index++)
+    {
+        UINT& material = paletteMaterials[scene.sphereMaterial[index]];
+        if (material == UINT_MAX)
+        {
+            material = scene.AddMaterial(PaletteMaterial(scene.sphereMaterial[index]));
+        }
+        scene.sphereMaterial[index] = material;
+    }
+
+    m_stats = RandomSceneStats();
+    m_stats.spheres = sphereCount;
+    m_stats.materials = static_cast<UINT>(c_paletteSize - std::count(paletteMaterials.begin(), paletteMaterials.end(), UINT_MAX));
+    for (UINT thread = 0; thread < m_threadPool.ThreadCount(); thread++)
+    {
+        m_stats.candidates += m_threadCandidates[thread];
+        m_stats.overlapTests += m_threadOverlapTests[thread];
+    }
+    m_stats.gridSize = m_gridSize;
+    m_stats.cellSize = m_cellSize;
+    m_stats.extent = extent;
+}
+
+void SceneGenerator::PlaceSpheres(UINT cellX, UINT cellZ, const RandomSceneSettings& settings, UINT threadIndex)
+{
+    UINT cell = cellZ * m_gridSize + cellX;
+    UINT quota = CellQuota(cell);
+    UINT attempts = quota * settings.attemptsPerSphere;
+    UINT x0 = cellX > 0 ? cellX - 1 : 0;
+    UINT z0 = cellZ > 0 ? cellZ - 1 : 0;
+    UINT x1 = (std::min)(cellX + 1, m_gridSize - 1);
+    UINT z1 = (std::min)(cellZ + 1, m_gridSize - 1);
+    float cellMinX = m_origin + cellX * m_cellSize;
+    float cellMinZ = m_origin + cellZ * m_cellSize;
+    UINT64 overlapTests = 0;
+
+    RandomStream random(settings.seed, cell, c_placementSubsequence);
+    UINT& count = m_cellCounts[cell];
+    UINT attempt = 0;
+    for (; attempt < attempts && count < quota; attempt++)
+    {
+        float x = cellMinX + random.NextFloat() * m_cellSize;
+        float z = cellMinZ + random.NextFloat() * m_cellSize;
+        float radius = settings.minRadius + random.NextFloat() * (settings.maxRadius - settings.minRadius);
+
+        // Two spheres resting on the ground overlap if the distance of their centers over the ground is
+        // below 2 sqrt(r0 r1), as (r0 + r1)^2 - (r0 - r1)^2 = 4 r0 r1.
+        bool overlaps = false;
+        for (UINT neighbourZ = z0; neighbourZ <= z1 && !overlaps; neighbourZ++)
+        {
+            for (UINT neighbourX = x0; neighbourX <= x1 && !overlaps; neighbourX++)
+            {
+                UINT neighbour = neighbourZ * m_gridSize + neighbourX;
+                size_t slot = static_cast<size_t>(neighbour) * m_capacity;
+                size_t slotEnd = slot + m_cellCounts[neighbour];
+                overlapTests += slotEnd - slot;
+                for (; slot < slotEnd; slot++)
+                {
+                    float dx = m_x[slot] - x;
+                    float dz = m_z[slot] - z;
+                    if (dx * dx + dz * dz < 4.0f * m_radius[slot] * radius)
+                    {
+                        overlaps = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (!overlaps)
+        {
+            size_t slot = static_cast<size_t>(cell) * m_capacity + count;
+            m_x[slot] = x;
+            m_z[slot] = z;
+            m_radius[slot] = radius;
+            count++;
+        }
+    }
+
+    m_threadCandidates[threadIndex] += attempt;
+    m_threadOverlapTests[threadIndex] += overlapTests;
+}
+
+void SceneGenerator::WriteSpheres(Scene& scene, UINT sphereBase, const RandomSceneSettings& settings)
+{
+    m_threadPool.ParallelFor(static_cast<UINT>(m_cellCounts.size()), 64, [&](UINT begin, UINT end, UINT)
+    {
+        for (UINT cell = begin; cell < end; cell++)
+        {
+            for (UINT i = 0; i < m_cellCounts[cell]; i++)
+            {
+                size_t slot = static_cast<size_t>(cell) * m_capacity + i;
+                UINT sphere = m_cellOffsets[cell] + i;
+                UINT index = sphereBase + sphere;
+                scene.sphereCenterX[index] = m_x[slot];
+                scene.sphereCenterY[index] = m_radius[slot];
+                scene.sphereCenterZ[index] = m_z[slot];
+                scene.sphereRadius[index] = m_radius[slot];
+
+                RandomStream random(settings.seed, sphere, c_materialSubsequence);
+                scene.sphereMaterial[index] = RandomPaletteEntry(random);
+            }
+        }
+    });
+}
@@ -0,0 +1,77 @@
+#ifndef CPU_SCENE_GENERATOR_H
+#define CPU_SCENE_GENERATOR_H
+
+#include "CpuScene.h"
+#include "CpuThreadPool.h"
+
+namespace Cpu
+{
+    // Random sphere field of the RTIAWRandomScene demo, scaled up: small spheres of random size resting on a ground
+    // quad, none overlapping another, 70% diffuse with a random albedo, 25% fuzzy metal and 5% glass.
+    // The random albedos and fuzz are quantized, so the spheres share at most 769 materials.
+    struct RandomSceneSettings
+    {
+        UINT sphereCount = 1 << 20;
+        float minRadius = 0.05f;
+        float maxRadius = 0.2f;
+        float coverage = 0.3f;          // Share of the ground under the spheres, random placement jams at about half.
+        UINT spheresPerCell = 4;        // Mean spheres per rejection grid cell.
+        UINT attemptsPerSphere = 16;    // Candidate positions drawn per sphere before its cell gives up on it.
+        UINT seed = 1;
+    };
+
+    struct RandomSceneStats
+    {
+        UINT spheres = 0;               // Placed, short of sphereCount when cells ran out of attempts.
+        UINT materials = 0;             // Distinct sphere materials added to the scene.
+        UINT64 candidates = 0;          // Candidate spheres drawn, each tested against the spheres of its 3x3 cells.
+        UINT64 overlapTests = 0;
+        UINT gridSize = 0;              // Cells along each side of the square grid.
+        float cellSize = 0;
+        float extent = 0;               // Side of the square the spheres cover, centered at the origin.
+    };
+
+    // Parallel generator of non-overlapping random sphere fields with millions of spheres.
+    // A uniform grid over the ground, of cells at least a sphere's diameter wide, holds the spheres placed so far,
+    // so a candidate is tested for overlap against the spheres of its own and the 8 neighbouring cells only.
+    // Every cell places its share of the spheres inside itself. Cells are processed in 4 phases by the parity of
+    // their coordinates, so the cells of a phase run in parallel without sharing a neighbour they write to,
+    // and draw from a random stream of their own: the scene only depends on the seed, not on the thread count.
+    // The placed spheres are written straight into the scene's arrays, the materials they use are added once each.
+    class SceneGenerator
+    {
+    public:
+        explicit SceneGenerator(ThreadPool& threadPool);
+
+        // Appends the ground, the spheres and their materials to the scene.
+        void Generate(Scene& scene, const RandomSceneSettings& settings = RandomSceneSettings());
+
+        const RandomSceneStats& Stats() const { return m_stats; }
+
+    private:
+        void Resize(const RandomSceneSettings& settings);
+        void PlaceSpheres(UINT cellX, UINT cellZ, const RandomSceneSettings& settings, UINT threadIndex);
+        void WriteSpheres(Scene& scene, UINT sphereBase, const RandomSceneSettings& settings);
+        UINT CellQuota(UINT cell) const { return m_quota + (cell < m_extraQuotaCells ? 1 : 0); }
+
+        ThreadPool& m_threadPool;
+        UINT m_gridSize;
+        UINT m_capacity;                // Sphere slots per cell.
+        UINT m_quota;                   // Spheres per cell, and one more for the first m_extraQuotaCells cells.
+        UINT m_extraQuotaCells;
+        float m_cellSize;
+        float m_origin;                 // Corner of the grid on both axes.
+
+        // Sphere slots of the cells, structure of arrays. A sphere's center is at the height of its radius.
+        std::vector<float> m_x;
+        std::vector<float> m_z;
+        std::vector<float> m_radius;
+        std::vector<UINT> m_cellCounts;
+        std::vector<UINT> m_cellOffsets;    // First sphere of each cell in the output.
+        std::vector<UINT64> m_threadCandidates;
+        std::vector<UINT64> m_threadOverlapTests;
+        RandomSceneStats m_stats;
+    };
+}
+
+#endif // !CPU_SCENE_GENERATOR_H
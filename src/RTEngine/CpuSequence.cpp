@@ -0,0 +1,139 @@
+#include "stdafx.h"
+#include "CpuSequence.h"
+
+using namespace Cpu;
+
+SequenceRenderer::SequenceRenderer(ThreadPool& threadPool) :
+    m_renderer(threadPool),
+    m_totalMS(0)
+{
+}
+
+void SequenceRenderer::Render(const Scene& scene, const Camera& camera, const SequenceUpdate& update, const std::wstring& path,
+    const SequenceSettings& settings)
+{
+    ImageFormat::Enum format = ImageFormatFromPath(path);
+    std::vector<ImageLayer> layers = RenderImageLayers(format == ImageFormat::EXR);
+    m_frameStats.assign(settings.frameCount, SequenceFrameStats());
+    m_totalMS = 0;
+    if (settings.frameCount == 0)
+    {
+        return;
+    }
+    for (Frame& frame : m_frames)
+    {
+        frame.scene = scene;
+        frame.camera = camera;
+        frame.hasBVH = false;
+    }
+
+    DX::CPUTimer frameTimer;
+    DX::CPUTimer renderTimer;
+    frameTimer.Start();
+    Update(update, settings, 0, m_frames[0], m_frameStats[0]);
+    if (settings.refit)
+    {
+        // The other copy of the scene starts from the first frame's BVH, a refit is all it needs.
+        m_frames[1].bvh = m_frames[0].bvh;
+        m_frames[1].hasBVH = true;
+    }
+    for (UINT i = 0; i < settings.frameCount; i++)
+    {
+        // The next frame goes to the other copy of the scene, which no render reads from until this frame is done.
+        bool hasNext = i + 1 < settings.frameCount;
+        std::exception_ptr updateError;
+        auto UpdateNext = [&]()
+        {
+            try
+            {
+                Update(update, settings, i + 1, m_frames[(i + 1) % 2], m_frameStats[i + 1]);
+            }
+            catch (...)
+            {
+                updateError = std::current_exception();
+            }
+        };
+        std::thread updateThread;
+        if (hasNext && settings.pipelined)
+        {
+            updateThread = std::thread(UpdateNext);
+        }
+
+        // The update thread has to be joined before an error leaves the function.
+        std::exception_ptr renderError;
+        try
+        {
+            const Frame& frame = m_frames[i % 2];
+            PathSettings pathSettings = settings.pathSettings;
+            pathSettings.sampleIndex += i;
+            renderTimer.Start();
+            ImageWriter writer;
+            writer.Open(FramePath(path, i), format, frame.camera.width, frame.camera.height, layers, settings.writerSettings);
+            RenderImage(m_renderer, frame.scene, frame.bvh, frame.camera, pathSettings, writer);
+            writer.Close();
+            renderTimer.Stop();
+            m_frameStats[i].renderMS = renderTimer.GetElapsedMS();
+        }
+        catch (...)
+        {
+            renderError = std::current_exception();
+        }
+
+        if (updateThread.joinable())
+        {
+            updateThread.join();
+        }
+        else if (hasNext && !renderError)
+        {
+            UpdateNext();
+        }
+        if (renderError)
+        {
+            std::rethrow_exception(renderError);
+        }
+        if (updateError)
+        {
+            std::rethrow_exception(updateError);
+        }
+
+        frameTimer.Stop();
+        m_frameStats[i].frameMS = frameTimer.GetElapsedMS();
+        m_totalMS += m_frameStats[i].frameMS;
+        frameTimer.Start();
+    }
+}
+
+void SequenceRenderer::Update(const SequenceUpdate& update, const SequenceSettings& settings, UINT frameIndex, Frame& frame, SequenceFrameStats& stats)
+{
+    DX::CPUTimer timer;
+    timer.Start();
+    update(settings.startTime + frameIndex * settings.frameTime, frame.scene, frame.camera);
+    timer.Stop();
+    stats.updateMS = timer.GetElapsedMS();
+
+    timer.Start();
+    if (settings.refit && frame.hasBVH)
+    {
+        frame.bvh.Refit(frame.scene);
+    }
+    else
+    {
+        frame.bvh.Build(frame.scene);
+    }
+    frame.hasBVH = true;
+    timer.Stop();
+    stats.bvhMS = timer.GetElapsedMS();
+}
+
+std::wstring SequenceRenderer::FramePath(const std::wstring& path, UINT frame)
+{
+    size_t extension = path.find_last_of(L'.');
+    size_t separator = path.find_last_of(L"\\/");
+    if (extension == std::wstring::npos || (separator != std::wstring::npos && extension < separator))
+    {
+        extension = path.size();
+    }
+    std::wstringstream number;
+    number << std::setw(4) << std::setfill(L'0') << frame;
+    return path.substr(0, extension) + number.str() + path.substr(extension);
+}
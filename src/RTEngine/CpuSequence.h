@@ -0,0 +1,72 @@
+#ifndef CPU_SEQUENCE_H
+#define CPU_SEQUENCE_H
+
+#include "CpuImageWriter.h"
+
+namespace Cpu
+{
+    // Sets the scene and camera to their state at a simulation time. Called with copies of the scene and camera
+    // that hold an earlier frame's state, so it has to set everything that animates, not advance it.
+    // Runs concurrently with the rendering of the previous frame.
+    typedef std::function<void(float time, Scene& scene, Camera& camera)> SequenceUpdate;
+
+    struct SequenceSettings
+    {
+        UINT frameCount = 1;
+        float startTime = 0.0f;
+        float frameTime = 1.0f / 30;    // Simulation time step between frames.
+        bool refit = true;              // Refits the BVH of the frame before, otherwise builds a new one every frame.
+        bool pipelined = true;          // Updates the next frame while the current one renders, otherwise after it.
+        PathSettings pathSettings;      // The sample index is offset by the frame index.
+        ImageWriterSettings writerSettings;
+    };
+
+    struct SequenceFrameStats
+    {
+        double updateMS = 0;            // The update function.
+        double bvhMS = 0;               // BVH refit or build.
+        double renderMS = 0;            // Rendering and writing the image, until the file is complete.
+        double frameMS = 0;             // The frame's step of the sequence: its render and the next frame's update, overlapped
+                                        // or not. The first frame's includes its own update.
+    };
+
+    // Headless renderer of animation sequences.
+    // Every frame is rendered at a fixed simulation time, startTime + frame * frameTime, and streamed to its own image
+    // file, so a sequence renders the same no matter how long its frames take. Frames alternate between two copies of
+    // the scene, each with its own BVH: while one frame renders on the thread pool, a separate thread updates the other
+    // copy to the next frame and refits its BVH. The BVH is only built once, for the first frame, and copied to the
+    // other scene. The frames don't depend on the pipelining.
+    class SequenceRenderer
+    {
+    public:
+        explicit SequenceRenderer(ThreadPool& threadPool);
+
+        // Renders the frames to FramePath(path, frame) in the image format of the path's extension, see ImageFormatFromPath().
+        void Render(const Scene& scene, const Camera& camera, const SequenceUpdate& update, const std::wstring& path,
+            const SequenceSettings& settings = SequenceSettings());
+
+        const std::vector<SequenceFrameStats>& FrameStats() const { return m_frameStats; }
+        double TotalMS() const { return m_totalMS; }
+
+        // The path with a four digit frame number before its extension, "frame.exr" becomes "frame0007.exr".
+        static std::wstring FramePath(const std::wstring& path, UINT frame);
+
+    private:
+        struct Frame
+        {
+            Scene scene;
+            Camera camera;
+            BVH bvh;
+            bool hasBVH = false;
+        };
+
+        void Update(const SequenceUpdate& update, const SequenceSettings& settings, UINT frameIndex, Frame& frame, SequenceFrameStats& stats);
+
+        WavefrontRenderer m_renderer;
+        Frame m_frames[2];
+        std::vector<SequenceFrameStats> m_frameStats;
+        double m_totalMS;
+    };
+}
+
+#endif // !CPU_SEQUENCE_H
@@ -0,0 +1,389 @@
+#include "stdafx.h"
+#include "CpuService.h"
+#include "CpuSceneFile.h"
+
+using namespace Cpu;
+
+namespace
+{
+    namespace ServiceMessage {
+        enum Enum {
+            Job = 1,        // Client to service, JobMessage followed by the scene id's characters.
+            Stop,           // Client to service.
+            Tile,           // TileHeader followed by the tile's pixels in rows.
+            Done,           // RenderJobStats, after the job's last tile.
+            Error           // The reason the job failed, in place of Done.
+        };
+    }
+
+    // Largest messages accepted, guards against allocating whatever a corrupt header asks for.
+    static const UINT64 c_maxRequestBytes = 1 << 16;
+    static const UINT64 c_maxResponseBytes = 1ull << 32;
+
+    struct JobMessage
+    {
+        RenderJob job;
+        UINT idLength;
+    };
+
+    struct TileHeader
+    {
+        UINT x, y, width, height;
+    };
+
+    // Scene ids ending in .cache are scene caches, anything else is a scene file.
+    bool IsSceneCachePath(const std::wstring& path)
+    {
+        static const wchar_t c_extension[] = L".cache";
+        size_t length = wcslen(c_extension);
+        return path.size() >= length && _wcsicmp(path.c_str() + path.size() - length, c_extension) == 0;
+    }
+}
+
+RenderService::RenderService(ThreadPool& threadPool, const RenderServiceSettings& settings) :
+    m_threadPool(threadPool),
+    m_settings(settings),
+    m_renderer(threadPool),
+    m_port(0),
+    m_exit(false)
+{
+}
+
+void RenderService::Listen(UINT16 port)
+{
+    ThrowIfFalse(!m_listener.IsValid(), L"The render service is listening already.");
+    m_listener = Socket::Listen(port, true);
+    m_port = m_listener.Port();
+}
+
+void RenderService::Run()
+{
+    ThrowIfFalse(m_listener.IsValid(), L"The render service isn't listening.");
+    for (;;)
+    {
+        Socket socket = m_listener.Accept();
+        std::lock_guard<std::mutex> lock(m_connectionMutex);
+        if (m_exit || !socket.IsValid())
+        {
+            break;
+        }
+
+        // The service runs for long, connections that closed are cleaned up as new ones come in.
+        for (auto connection = m_connections.begin(); connection != m_connections.end();)
+        {
+            if ((*connection)->done)
+            {
+                (*connection)->thread.join();
+                connection = m_connections.erase(connection);
+            }
+            else
+            {
+                ++connection;
+            }
+        }
+
+        m_connections.emplace_back(new Connection());
+        Connection* connection = m_connections.back().get();
+        connection->socket = std::move(socket);
+        connection->done = false;
+        connection->thread = std::thread(&RenderService::ConnectionThreadMain, this, connection);
+    }
+
+    // Connections are closed once their current job is done.
+    std::vector<std::unique_ptr<Connection>> connections;
+    {
+        std::lock_guard<std::mutex> lock(m_connectionMutex);
+        connections.swap(m_connections);
+    }
+    for (auto& connection : connections)
+    {
+        connection->socket.Shutdown();
+        connection->thread.join();
+    }
+}
+
+void RenderService::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_connectionMutex);
+        if (m_exit)
+        {
+            return;
+        }
+        m_exit = true;
+    }
+
+    // Run() is woken with a connection of its own, it sees the exit flag and returns.
+    try
+    {
+        Socket::Connect("127.0.0.1", m_port);
+    }
+    catch (...)
+    {
+        m_listener.Shutdown();
+    }
+}
+
+std::shared_ptr<const ServiceScene> RenderService::FindScene(const std::wstring& id, RenderJobStats& stats)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return Acquire(id, stats);
+}
+
+UINT RenderService::CachedSceneCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return static_cast<UINT>(m_cache.size());
+}
+
+bool RenderService::Render(const RenderJob& job, const std::wstring& sceneId, const RenderTileCallback& onTile, RenderJobStats& stats)
+{
+    const Camera& camera = job.camera;
+    ThrowIfFalse(camera.width > 0 && camera.height > 0 && job.samplesPerPixel > 0, L"Invalid render job.");
+
+    DX::CPUTimer jobTimer;
+    DX::CPUTimer renderTimer;
+    jobTimer.Start();
+    stats = RenderJobStats();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::shared_ptr<const ServiceScene> scene = Acquire(sceneId, stats);
+    lock.unlock();
+
+    renderTimer.Start();
+    PathSettings settings;
+    settings.maxBounces = job.maxBounces;
+    UINT tileSize = job.tileSize > 0 ? job.tileSize : (std::max)(camera.width, camera.height);
+    bool completed = true;
+    std::vector<UINT> pixels;
+    std::vector<Vec3> tilePixels;
+    for (UINT y0 = 0; y0 < camera.height && completed; y0 += tileSize)
+    {
+        for (UINT x0 = 0; x0 < camera.width && completed; x0 += tileSize)
+        {
+            // The whole image renders without a pixel list.
+            UINT width = (std::min)(tileSize, camera.width - x0);
+            UINT height = (std::min)(tileSize, camera.height - y0);
+            bool wholeImage = width == camera.width && height == camera.height;
+            pixels.resize(static_cast<size_t>(width) * height);
+            for (UINT y = 0; y < height; y++)
+            {
+                for (UINT x = 0; x < width; x++)
+                {
+                    pixels[static_cast<size_t>(y) * width + x] = (y0 + y) * camera.width + x0 + x;
+                }
+            }
+
+            tilePixels.assign(pixels.size(), Vec3());
+            lock.lock();
+            for (UINT sample = 0; sample < job.samplesPerPixel; sample++)
+            {
+                settings.sampleIndex = sample;
+                m_renderer.Render(scene->scene, scene->bvh, camera, settings, nullptr, wholeImage ? nullptr : &pixels);
+                const std::vector<Vec3>& radiance = m_renderer.Radiance();
+                m_threadPool.ParallelFor(static_cast<UINT>(pixels.size()), WavefrontRenderer::BatchSize, [&](UINT begin, UINT end, UINT)
+                {
+                    for (UINT i = begin; i < end; i++)
+                    {
+                        tilePixels[i] += radiance[pixels[i]];
+                    }
+                });
+            }
+            lock.unlock();
+            if (job.samplesPerPixel > 1)
+            {
+                float scale = 1.0f / job.samplesPerPixel;
+                for (Vec3& pixel : tilePixels)
+                {
+                    pixel *= scale;
+                }
+            }
+
+            // Sent without the lock, a slow client doesn't hold up the other connections' jobs.
+            completed = onTile(x0, y0, width, height, tilePixels.data());
+        }
+    }
+    renderTimer.Stop();
+    jobTimer.Stop();
+    stats.renderMS = renderTimer.GetElapsedMS();
+    stats.jobMS = jobTimer.GetElapsedMS();
+    return completed;
+}
+
+std::shared_ptr<const ServiceScene> RenderService::Acquire(const std::wstring& id, RenderJobStats& stats)
+{
+    for (auto entry = m_cache.begin(); entry != m_cache.end(); ++entry)
+    {
+        if (entry->id == id)
+        {
+            m_cache.splice(m_cache.begin(), m_cache, entry);
+            stats.cached = true;
+            return m_cache.front().scene;
+        }
+    }
+
+    std::shared_ptr<ServiceScene> scene = std::make_shared<ServiceScene>();
+    Load(id, *scene, stats);
+    CacheEntry entry = { id, scene };
+    m_cache.push_front(entry);
+    while (m_cache.size() > (std::max)(1u, m_settings.maxScenes))
+    {
+        m_cache.pop_back();
+    }
+    return scene;
+}
+
+void RenderService::Load(const std::wstring& id, ServiceScene& scene, RenderJobStats& stats)
+{
+    DX::CPUTimer timer;
+    timer.Start();
+    if (IsSceneCachePath(id))
+    {
+        SceneCache& cache = scene.sceneCache;
+        cache.Open(id);
+        cache.ReadScene(scene.scene);
+        timer.Stop();
+        stats.loadMS = timer.GetElapsedMS();
+
+        timer.Start();
+        if (cache.HasBVH())
+        {
+            cache.ReadBVH(scene.bvh);
+        }
+        else
+        {
+            scene.bvh.Build(scene.scene);
+        }
+    }
+    else
+    {
+        // As RTEngine loads a -scene file, without the demo scene's materials in front.
+        SceneFileLoader loader(m_threadPool);
+        SceneDescription description;
+        loader.Load(id, description);
+        loader.AddToScene(description, scene.scene);
+        if (!description.lights.empty())
+        {
+            scene.scene.light = description.lights.back();
+        }
+        scene.scene.AddEmissivePrimitiveLights();
+        timer.Stop();
+        stats.loadMS = timer.GetElapsedMS();
+
+        timer.Start();
+        scene.bvh.Build(scene.scene);
+    }
+    timer.Stop();
+    stats.bvhMS = timer.GetElapsedMS();
+}
+
+void RenderService::ConnectionThreadMain(Connection* connection)
+{
+    const Socket& socket = connection->socket;
+    UINT type = 0;
+    std::vector<BYTE> payload;
+    while (ReadMessage(socket, type, payload, c_maxRequestBytes))
+    {
+        if (type == ServiceMessage::Stop)
+        {
+            Stop();
+            break;
+        }
+
+        JobMessage message;
+        if (type != ServiceMessage::Job || payload.size() < sizeof(message))
+        {
+            break;
+        }
+        memcpy(&message, payload.data(), sizeof(message));
+        if (payload.size() != sizeof(message) + static_cast<size_t>(message.idLength) * sizeof(wchar_t))
+        {
+            break;
+        }
+        std::wstring id(message.idLength, L'\0');
+        memcpy(&id[0], payload.data() + sizeof(message), message.idLength * sizeof(wchar_t));
+
+        // A failed job is reported to the client, the connection stays open for the next one.
+        RenderJobStats stats;
+        bool sent = true;
+        try
+        {
+            Render(message.job, id, [&](UINT x, UINT y, UINT width, UINT height, const Vec3* pixels)
+            {
+                TileHeader tile = { x, y, width, height };
+                sent = WriteMessage(socket, ServiceMessage::Tile, &tile, sizeof(tile), pixels, static_cast<size_t>(width) * height * sizeof(Vec3));
+                return sent;
+            }, stats);
+            sent = sent && WriteMessage(socket, ServiceMessage::Done, &stats, sizeof(stats));
+        }
+        catch (const std::exception& e)
+        {
+            // HrException carries the ThrowIfFalse() message.
+            sent = sent && WriteMessage(socket, ServiceMessage::Error, e.what(), strlen(e.what()));
+        }
+        if (!sent)
+        {
+            break;
+        }
+    }
+    connection->done = true;
+}
+
+void RenderClient::Connect(UINT16 port)
+{
+    m_socket = Socket::Connect("127.0.0.1", port);
+}
+
+void RenderClient::Render(const RenderJob& job, const std::wstring& sceneId, std::vector<Vec3>& image, RenderJobStats& stats,
+    const RenderTileCallback& onTile)
+{
+    JobMessage message = {};
+    message.job = job;
+    message.idLength = static_cast<UINT>(sceneId.size());
+    ThrowIfFalse(WriteMessage(m_socket, ServiceMessage::Job, &message, sizeof(message), sceneId.data(), sceneId.size() * sizeof(wchar_t)),
+        L"Lost the connection to the render service.");
+
+    const Camera& camera = job.camera;
+    image.assign(static_cast<size_t>(camera.width) * camera.height, Vec3());
+    UINT type = 0;
+    for (;;)
+    {
+        ThrowIfFalse(ReadMessage(m_socket, type, m_payload, c_maxResponseBytes), L"Lost the connection to the render service.");
+        if (type == ServiceMessage::Tile)
+        {
+            TileHeader tile;
+            ThrowIfFalse(m_payload.size() >= sizeof(tile), L"Invalid render service tile.");
+            memcpy(&tile, m_payload.data(), sizeof(tile));
+            ThrowIfFalse(tile.x + tile.width <= camera.width && tile.y + tile.height <= camera.height &&
+                m_payload.size() == sizeof(tile) + static_cast<size_t>(tile.width) * tile.height * sizeof(Vec3), L"Invalid render service tile.");
+            const BYTE* pixels = m_payload.data() + sizeof(tile);
+            for (UINT y = 0; y < tile.height; y++)
+            {
+                memcpy(&image[static_cast<size_t>(tile.y + y) * camera.width + tile.x], pixels + static_cast<size_t>(y) * tile.width * sizeof(Vec3), tile.width * sizeof(Vec3));
+            }
+            if (onTile)
+            {
+                onTile(tile.x, tile.y, tile.width, tile.height, &image[static_cast<size_t>(tile.y) * camera.width + tile.x]);
+            }
+        }
+        else if (type == ServiceMessage::Done)
+        {
+            ThrowIfFalse(m_payload.size() == sizeof(stats), L"Invalid render service message.");
+            memcpy(&stats, m_payload.data(), sizeof(stats));
+            return;
+        }
+        else
+        {
+            // The reason is written to the debug output, like ThrowIfFalse() messages.
+            ThrowIfFalse(type == ServiceMessage::Error, L"Invalid render service message.");
+            std::string reason = "Render service job failed: " + std::string(m_payload.begin(), m_payload.end()) + "\n";
+            OutputDebugStringA(reason.c_str());
+            ThrowIfFalse(false, L"The render service failed the job.");
+        }
+    }
+}
+
+void RenderClient::StopService()
+{
+    WriteMessage(m_socket, ServiceMessage::Stop, nullptr, 0);
+    m_socket.Close();
+}
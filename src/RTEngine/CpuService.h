@@ -0,0 +1,131 @@
+#ifndef CPU_SERVICE_H
+#define CPU_SERVICE_H
+
+#include <list>
+#include "CpuSceneCache.h"
+#include "CpuSocket.h"
+#include "CpuWavefront.h"
+
+namespace Cpu
+{
+    struct RenderJob
+    {
+        Camera camera;              // The image is camera.width by camera.height pixels.
+        UINT samplesPerPixel = 1;
+        UINT maxBounces = MAX_PATH_BOUNCES;
+        UINT tileSize = 0;          // 0 returns the whole image at once, otherwise square tiles as they finish.
+    };
+
+    struct RenderJobStats
+    {
+        bool cached = false;        // The scene and its BVH were in the cache.
+        double loadMS = 0;          // Loading the scene, 0 when cached.
+        double bvhMS = 0;           // Reading or building the BVH, 0 when cached.
+        double renderMS = 0;        // Tracing, including handing over the tiles.
+        double jobMS = 0;           // The whole job on the service.
+    };
+
+    struct RenderServiceSettings
+    {
+        UINT maxScenes = 4;         // Scenes kept loaded, the least recently used is evicted beyond this many.
+    };
+
+    // A loaded scene and its BVH, shared by the cache and the jobs rendering it, so evicting it never pulls it from
+    // under a render. Scenes loaded from a scene cache view its mapped sections, which stay mapped as long as they do.
+    struct ServiceScene
+    {
+        SceneCache sceneCache;
+        Scene scene;
+        BVH bvh;
+    };
+
+    // Tile of a job: its top left pixel, its size and its pixels in rows. Returning false cancels the job.
+    typedef std::function<bool(UINT x, UINT y, UINT width, UINT height, const Vec3* pixels)> RenderTileCallback;
+
+    // Long lived render service.
+    // Clients on this machine connect over a loopback socket, see RenderClient, and send render jobs: a camera, the
+    // samples per pixel and a scene id, the path of a scene file or of a scene cache ending in .cache. Loaded scenes
+    // and their BVHs stay cached between jobs, up to maxScenes of them in least recently used order, so a job on a
+    // cached scene costs its tracing and nothing else. The image comes back whole or tile by tile as tiles finish,
+    // with the same pixels either way. Each connection has a thread of its own, their jobs take turns on the thread
+    // pool a scene load or a tile at a time, loading scenes and rendering use all of it.
+    class RenderService
+    {
+    public:
+        RenderService(ThreadPool& threadPool, const RenderServiceSettings& settings = RenderServiceSettings());
+
+        RenderService(const RenderService&) = delete;
+        RenderService& operator=(const RenderService&) = delete;
+
+        // Listens for connections from this machine, on a free port if port is 0, see Port().
+        void Listen(UINT16 port);
+        UINT16 Port() const { return m_port; }
+        // Serves clients until Stop() is called or a client stops the service, then closes their connections.
+        void Run();
+        // Makes Run() return, from any thread.
+        void Stop();
+
+        // The scene of the id from the cache, or loaded into it. Throws if it can't be loaded.
+        std::shared_ptr<const ServiceScene> FindScene(const std::wstring& id, RenderJobStats& stats);
+        // Scenes in the cache.
+        UINT CachedSceneCount();
+        // Renders a job in this process, handing over the tiles, or the whole image as one tile, as they finish.
+        // Returns false if the callback cancelled the job.
+        bool Render(const RenderJob& job, const std::wstring& sceneId, const RenderTileCallback& onTile, RenderJobStats& stats);
+
+    private:
+        struct CacheEntry
+        {
+            std::wstring id;
+            std::shared_ptr<const ServiceScene> scene;
+        };
+
+        struct Connection
+        {
+            Socket socket;
+            std::thread thread;
+            std::atomic<bool> done;
+        };
+
+        // These are called with m_mutex held.
+        std::shared_ptr<const ServiceScene> Acquire(const std::wstring& id, RenderJobStats& stats);
+        void Load(const std::wstring& id, ServiceScene& scene, RenderJobStats& stats);
+
+        void ConnectionThreadMain(Connection* connection);
+
+        ThreadPool& m_threadPool;
+        RenderServiceSettings m_settings;
+
+        // Held by a job while it loads its scene and while it renders a tile, not while the tile is handed over,
+        // guards the cache and the renderer.
+        std::mutex m_mutex;
+        std::list<CacheEntry> m_cache;      // Most recently used first.
+        WavefrontRenderer m_renderer;
+
+        Socket m_listener;
+        UINT16 m_port;
+        std::mutex m_connectionMutex;
+        std::vector<std::unique_ptr<Connection>> m_connections;
+        bool m_exit;
+    };
+
+    // Connection to a RenderService.
+    class RenderClient
+    {
+    public:
+        void Connect(UINT16 port);
+
+        // Renders the job on the service into image, camera.width by camera.height pixels, tiles are copied in as they
+        // arrive and handed to the callback if there is one, whose result is ignored. Throws if the service fails the job.
+        void Render(const RenderJob& job, const std::wstring& sceneId, std::vector<Vec3>& image, RenderJobStats& stats,
+            const RenderTileCallback& onTile = RenderTileCallback());
+        // Asks the service to stop, its Run() returns.
+        void StopService();
+
+    private:
+        Socket m_socket;
+        std::vector<BYTE> m_payload;
+    };
+}
+
+#endif // !CPU_SERVICE_H
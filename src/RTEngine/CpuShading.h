@@ -0,0 +1,123 @@
+#ifndef CPU_SHADING_H
+#define CPU_SHADING_H
+
+#include "RayTracingHlslCompat.h"
+#include "CpuMath.h"
+#include "CpuRandom.h"
+
+// CPU ports of the shading helpers in Raytracing.hlsl and RaytracingShaderHelper.hlsli.
+namespace Cpu
+{
+    inline Vec3 ToVec3(const XMFLOAT4& v) { return Vec3(v.x, v.y, v.z); }
+
+    static const Vec3 c_backgroundColor = ToVec3(BackgroundColor);
+
+    // Shading paths of the closest hit shaders, used to bin hits so each batch runs a single material kernel.
+    namespace MaterialClass {
+        enum Enum {
+            Miss = 0,
+            Opaque,         // Phong only.
+            Reflective,     // Phong + fresnel weighted (fuzzy) reflection.
+            Refractive,     // Phong + fresnel weighted refraction.
+            Count
+        };
+    }
+
+    inline MaterialClass::Enum GetMaterialClass(const MaterialConstantBuffer& material)
+    {
+        if (material.refractionIndex != 0)
+        {
+            return MaterialClass::Refractive;
+        }
+        return material.reflectanceCoef > 0.001f ? MaterialClass::Reflective : MaterialClass::Opaque;
+    }
+
+    // Fresnel reflectance - schlick approximation.
+    inline Vec3 FresnelReflectanceSchlick(const Vec3& I, const Vec3& N, const Vec3& f0)
+    {
+        float cosi = Saturate(Dot(-I, N));
+        float k = std::pow(1 - cosi, 5.0f);
+        return f0 + (Vec3(1.0f) - f0) * k;
+    }
+
+    // Refraction eq from scratchapixel, see refractSH().
+    // Falls back to a reflection on total internal reflection.
+    inline Vec3 Refract(const Vec3& incident, const Vec3& normal, float ior)
+    {
+        float cosi = (std::max)(-1.0f, (std::min)(1.0f, Dot(incident, normal)));
+        float etai = 1, etat = ior;
+        Vec3 n = normal;
+        if (cosi < 0) { cosi = -cosi; } else { std::swap(etai, etat); n = -normal; }
+        float eta = etai / etat;
+        float k = 1 - eta * eta * (1 - cosi * cosi);
+        if (k < 0)
+        {
+            return Reflect(incident, n);
+        }
+        return incident * eta + n * (eta * cosi - std::sqrt(k));
+    }
+
+    // Procedurally generated checker texture, see getCheckerColor().
+    inline float CheckerColor(const Vec3& p)
+    {
+        float sines = std::sin(10 * p.x) * std::sin(10 * p.y) * std::sin(10 * p.z);
+        return sines < 0 ? 0.0f : 1.0f;
+    }
+
+    // Integer hash used to decorrelate per path random numbers.
+    inline UINT HashUint(UINT x)
+    {
+        x = (x ^ 61) ^ (x >> 16);
+        x *= 9;
+        x = x ^ (x >> 4);
+        x *= 0x27d4eb2d;
+        x = x ^ (x >> 15);
+        return x;
+    }
+
+    inline float HashToFloat(UINT x)
+    {
+        return (HashUint(x) >> 8) * (1.0f / 16777216.0f);
+    }
+
+    inline Vec3 RandomInUnitSphere(RandomStream& random)
+    {
+        for (;;)
+        {
+            float x = 2 * random.NextFloat() - 1;
+            float y = 2 * random.NextFloat() - 1;
+            float z = 2 * random.NextFloat() - 1;
+            Vec3 p(x, y, z);
+            if (LengthSquared(p) < 1.0f)
+            {
+                return p;
+            }
+        }
+    }
+
+    // Cosine weighted direction about the normal, its density is Dot(direction, normal) / pi.
+    inline Vec3 SampleCosineHemisphere(const Vec3& normal, float u1, float u2)
+    {
+        float r = std::sqrt(u1);
+        float phi = 2.0f * 3.14159265f * u2;
+        Vec3 t = Normalize(Cross(std::fabs(normal.x) > 0.9f ? Vec3(0, 1, 0) : Vec3(1, 0, 0), normal));
+        Vec3 b = Cross(normal, t);
+        return Normalize(t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + normal * std::sqrt((std::max)(0.0f, 1.0f - u1)));
+    }
+
+    // Multiple importance sampling weight of a sample drawn with density pdf against another strategy's otherPdf.
+    inline float PowerHeuristic(float pdf, float otherPdf)
+    {
+        float a = pdf * pdf;
+        float b = otherPdf * otherPdf;
+        return a + b > 0 ? a / (a + b) : 0.0f;
+    }
+
+    // Visibility falloff applied by the closest hit shaders, returns the background blend weight.
+    inline float VisibilityFalloff(float t)
+    {
+        return 1.0f - std::exp(-0.000002f * t * t * t);
+    }
+}
+
+#endif // !CPU_SHADING_H
@@ -0,0 +1,182 @@
+#include "stdafx.h"
+#include "CpuSocket.h"
+#include <ws2tcpip.h>
+
+using namespace Cpu;
+
+namespace
+{
+    // Winsock is started once per process and left running until it exits.
+    void StartWinsock()
+    {
+        static const int result = []()
+        {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data);
+        }();
+        ThrowIfFalse(result == 0, L"Failed to start Winsock.");
+    }
+
+    // Sends and receives are at most this large at once, their sizes are ints.
+    static const size_t c_maxTransfer = 1 << 30;
+}
+
+Socket::Socket() :
+    m_socket(INVALID_SOCKET)
+{
+}
+
+Socket::~Socket()
+{
+    Close();
+}
+
+Socket::Socket(Socket&& other) :
+    m_socket(other.m_socket)
+{
+    other.m_socket = INVALID_SOCKET;
+}
+
+Socket& Socket::operator=(Socket&& other)
+{
+    if (this != &other)
+    {
+        Close();
+        m_socket = other.m_socket;
+        other.m_socket = INVALID_SOCKET;
+    }
+    return *this;
+}
+
+Socket Socket::Listen(UINT16 port, bool loopbackOnly)
+{
+    StartWinsock();
+    Socket listener(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    ThrowIfFalse(listener.IsValid(), L"Failed to create a socket.");
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+    address.sin_port = htons(port);
+    ThrowIfFalse(bind(listener.m_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != SOCKET_ERROR &&
+        listen(listener.m_socket, SOMAXCONN) != SOCKET_ERROR, L"Failed to listen on the port.");
+    return listener;
+}
+
+Socket Socket::Connect(const std::string& host, UINT16 port)
+{
+    StartWinsock();
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    addrinfo* addresses = nullptr;
+    ThrowIfFalse(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) == 0, L"Failed to resolve the host.");
+
+    Socket connection;
+    for (addrinfo* address = addresses; address && !connection.IsValid(); address = address->ai_next)
+    {
+        Socket candidate(socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+        if (candidate.IsValid() && connect(candidate.m_socket, address->ai_addr, static_cast<int>(address->ai_addrlen)) != SOCKET_ERROR)
+        {
+            connection = std::move(candidate);
+        }
+    }
+    freeaddrinfo(addresses);
+    ThrowIfFalse(connection.IsValid(), L"Failed to connect to the host.");
+
+    // Messages are sent whole and answered, waiting to coalesce them only adds latency.
+    int noDelay = 1;
+    setsockopt(connection.m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    return connection;
+}
+
+Socket Socket::Accept() const
+{
+    Socket connection(accept(m_socket, nullptr, nullptr));
+    if (connection.IsValid())
+    {
+        int noDelay = 1;
+        setsockopt(connection.m_socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+    }
+    return connection;
+}
+
+UINT16 Socket::Port() const
+{
+    sockaddr_in address = {};
+    socklen_t size = sizeof(address);
+    ThrowIfFalse(getsockname(m_socket, reinterpret_cast<sockaddr*>(&address), &size) != SOCKET_ERROR, L"Failed to get the socket's port.");
+    return ntohs(address.sin_port);
+}
+
+bool Socket::Send(const void* data, size_t size) const
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        int sent = send(m_socket, bytes, static_cast<int>((std::min)(size, c_maxTransfer)), 0);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool Socket::Receive(void* data, size_t size) const
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        int received = recv(m_socket, bytes, static_cast<int>((std::min)(size, c_maxTransfer)), 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+void Socket::Shutdown() const
+{
+    if (IsValid())
+    {
+        shutdown(m_socket, SD_BOTH);
+    }
+}
+
+void Socket::Close()
+{
+    if (IsValid())
+    {
+        closesocket(m_socket);
+        m_socket = INVALID_SOCKET;
+    }
+}
+
+bool Cpu::WriteMessage(const Socket& socket, UINT type, const void* payload, size_t size, const void* payload2, size_t size2)
+{
+    MessageHeader header = {};
+    header.type = type;
+    header.size = size + size2;
+    return socket.Send(&header, sizeof(header)) &&
+        (size == 0 || socket.Send(payload, size)) &&
+        (size2 == 0 || socket.Send(payload2, size2));
+}
+
+bool Cpu::ReadMessage(const Socket& socket, UINT& type, std::vector<BYTE>& payload, UINT64 maxSize)
+{
+    MessageHeader header;
+    if (!socket.Receive(&header, sizeof(header)) || header.size > maxSize)
+    {
+        return false;
+    }
+    type = header.type;
+    payload.resize(static_cast<size_t>(header.size));
+    return header.size == 0 || socket.Receive(payload.data(), payload.size());
+}
@@ -0,0 +1,58 @@
+#ifndef CPU_SOCKET_H
+#define CPU_SOCKET_H
+
+#include <winsock2.h>
+
+namespace Cpu
+{
+    // Blocking TCP socket. Winsock is started by the first socket that listens or connects.
+    class Socket
+    {
+    public:
+        Socket();
+        ~Socket();
+
+        Socket(Socket&& other);
+        Socket& operator=(Socket&& other);
+        Socket(const Socket&) = delete;
+        Socket& operator=(const Socket&) = delete;
+
+        // Listens on all interfaces, or only for connections from this machine, on a free port if port is 0, see Port().
+        static Socket Listen(UINT16 port, bool loopbackOnly = false);
+        // Throws if no connection could be made.
+        static Socket Connect(const std::string& host, UINT16 port);
+
+        // Waits for a connection, returns an invalid socket once the socket is shut down.
+        Socket Accept() const;
+        bool IsValid() const { return m_socket != INVALID_SOCKET; }
+        UINT16 Port() const;
+
+        // Send all or receive exactly size bytes, false if the connection is closed or failed.
+        bool Send(const void* data, size_t size) const;
+        bool Receive(void* data, size_t size) const;
+
+        // Ends the connection, unblocking the threads waiting in Accept() or Receive(), but keeps the socket until Close().
+        void Shutdown() const;
+        void Close();
+
+    private:
+        explicit Socket(SOCKET socket) : m_socket(socket) {}
+
+        SOCKET m_socket;
+    };
+
+    // Messages are a header followed by its size of payload bytes.
+    struct MessageHeader
+    {
+        UINT type;
+        UINT reserved;
+        UINT64 size;
+    };
+
+    // Sends a header and its payload, given in two parts so a structure and the data that follows it need no copy.
+    bool WriteMessage(const Socket& socket, UINT type, const void* payload, size_t size, const void* payload2 = nullptr, size_t size2 = 0);
+    // Receives the next message, false if the connection closed or the payload is larger than maxSize.
+    bool ReadMessage(const Socket& socket, UINT& type, std::vector<BYTE>& payload, UINT64 maxSize);
+}
+
+#endif // !CPU_SOCKET_H
@@ -0,0 +1,238 @@
+#include "stdafx.h"
+#include "CpuTexture.h"
+
+using namespace Cpu;
+
+namespace
+{
+    static const size_t c_cacheLineTexels = 64 / sizeof(UINT);
+
+    inline UINT Channel(UINT texel, UINT channel)
+    {
+        return (texel >> (channel * 8)) & 0xff;
+    }
+
+    inline Vec3 Decode(UINT texel)
+    {
+        return Vec3(static_cast<float>(Channel(texel, 0)), static_cast<float>(Channel(texel, 1)), static_cast<float>(Channel(texel, 2))) * (1.0f / 255.0f);
+    }
+
+    // 2x2 box filter of a row major image, odd edges reuse the last row or column.
+    void Downsample(const std::vector<UINT>& source, UINT width, UINT height, std::vector<UINT>& destination)
+    {
+        UINT dstWidth = (std::max)(1u, width / 2);
+        UINT dstHeight = (std::max)(1u, height / 2);
+        destination.resize(dstWidth * dstHeight);
+        for (UINT y = 0; y < dstHeight; y++)
+        {
+            UINT y0 = 2 * y;
+            UINT y1 = (std::min)(y0 + 1, height - 1);
+            for (UINT x = 0; x < dstWidth; x++)
+            {
+                UINT x0 = 2 * x;
+                UINT x1 = (std::min)(x0 + 1, width - 1);
+                UINT corners[4] = { source[y0 * width + x0], source[y0 * width + x1], source[y1 * width + x0], source[y1 * width + x1] };
+                UINT texel = 0;
+                for (UINT channel = 0; channel < 4; channel++)
+                {
+                    UINT sum = 2;
+                    for (UINT c : corners)
+                    {
+                        sum += Channel(c, channel);
+                    }
+                    texel |= (sum / 4) << (channel * 8);
+                }
+                destination[y * dstWidth + x] = texel;
+            }
+        }
+    }
+
+    // Skips whitespace and # comments of a PPM header and parses the next number.
+    UINT ReadHeaderValue(const byte* data, UINT size, UINT& position)
+    {
+        while (position < size && (isspace(data[position]) || data[position] == '#'))
+        {
+            if (data[position] == '#')
+            {
+                while (position < size && data[position] != '\n') position++;
+            }
+            else
+            {
+                position++;
+            }
+        }
+        ThrowIfFalse(position < size && isdigit(data[position]) != 0, L"Invalid PPM header.");
+
+        UINT value = 0;
+        while (position < size && isdigit(data[position]))
+        {
+            value = value * 10 + (data[position++] - '0');
+        }
+        return value;
+    }
+}
+
+Texture::Texture(UINT width, UINT height, const UINT* texels, TextureLayout::Enum layout) :
+    m_layout(layout),
+    m_alignOffset(0),
+    m_texelCount(0)
+{
+    ThrowIfFalse(width > 0 && height > 0, L"Empty texture.");
+
+    // Level dimensions and offsets. Tiled levels are padded to whole tiles,
+    // which keeps every level tile aligned.
+    for (UINT w = width, h = height;; w = (std::max)(1u, w / 2), h = (std::max)(1u, h / 2))
+    {
+        MipLevel level;
+        level.width = w;
+        level.height = h;
+        level.tilesX = (w + TileSize - 1) / TileSize;
+        level.offset = static_cast<UINT>(m_texelCount);
+        m_levels.push_back(level);
+
+        if (layout == TextureLayout::Tiled)
+        {
+            m_texelCount += level.tilesX * ((h + TileSize - 1) / TileSize) * TileTexels;
+        }
+        else
+        {
+            m_texelCount += w * h;
+        }
+
+        if (w == 1 && h == 1)
+        {
+            break;
+        }
+    }
+    Allocate(m_texelCount);
+
+    // Build the chain row major, then swizzle each level into the storage.
+    std::vector<UINT> image(texels, texels + width * height);
+    std::vector<UINT> nextImage;
+    UINT* storage = Texels();
+    for (UINT i = 0; i < MipCount(); i++)
+    {
+        const MipLevel& level = m_levels[i];
+        for (UINT y = 0; y < level.height; y++)
+        {
+            for (UINT x = 0; x < level.width; x++)
+            {
+                storage[Address(level, x, y)] = image[y * level.width + x];
+            }
+        }
+
+        if (i + 1 < MipCount())
+        {
+            Downsample(image, level.width, level.height, nextImage);
+            image.swap(nextImage);
+        }
+    }
+}
+
+Texture::Texture(const Texture& other) :
+    m_layout(other.m_layout),
+    m_levels(other.m_levels),
+    m_alignOffset(0),
+    m_texelCount(other.m_texelCount)
+{
+    Allocate(m_texelCount);
+    std::copy(other.Texels(), other.Texels() + m_texelCount, Texels());
+}
+
+Texture& Texture::operator=(const Texture& other)
+{
+    if (this != &other)
+    {
+        Texture copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+// The storage is over-allocated by a cache line and the texels start at the first line boundary.
+// The offset is recomputed on copies, moves keep the allocation.
+void Texture::Allocate(size_t texelCount)
+{
+    m_storage.assign(texelCount + c_cacheLineTexels - 1, 0);
+    size_t misalignment = (reinterpret_cast<uintptr_t>(m_storage.data()) / sizeof(UINT)) % c_cacheLineTexels;
+    m_alignOffset = misalignment ? c_cacheLineTexels - misalignment : 0;
+}
+
+Texture Texture::LoadPPM(const std::wstring& path, TextureLayout::Enum layout)
+{
+    byte* data = nullptr;
+    UINT size = 0;
+    ThrowIfFailed(ReadDataFromFile(path.c_str(), &data, &size));
+
+    std::vector<UINT> texels;
+    UINT width = 0;
+    UINT height = 0;
+    try
+    {
+        ThrowIfFalse(size > 2 && data[0] == 'P' && data[1] == '6', L"Only binary PPM (P6) textures are supported.");
+        UINT position = 2;
+        width = ReadHeaderValue(data, size, position);
+        height = ReadHeaderValue(data, size, position);
+        UINT maxValue = ReadHeaderValue(data, size, position);
+        ThrowIfFalse(maxValue == 255, L"Only 8 bit PPM textures are supported.");
+
+        // A single whitespace character separates the header from the texels.
+        position++;
+        ThrowIfFalse(width > 0 && height > 0 && position <= size && (size - position) / 3 / width >= height, L"Truncated PPM texture.");
+
+        texels.resize(width * height);
+        const byte* rgb = data + position;
+        for (UINT i = 0; i < width * height; i++, rgb += 3)
+        {
+            texels[i] = rgb[0] | (rgb[1] << 8) | (rgb[2] << 16) | 0xff000000;
+        }
+    }
+    catch (...)
+    {
+        free(data);
+        throw;
+    }
+    free(data);
+
+    return Texture(width, height, texels.data(), layout);
+}
+
+Vec3 Texture::SampleBilinear(UINT level, float u, float v) const
+{
+    const MipLevel& mip = m_levels[level];
+    const UINT* texels = Texels();
+
+    // Wrap to <0, 1) and offset to texel centers.
+    float x = (u - std::floor(u)) * mip.width - 0.5f;
+    float y = (v - std::floor(v)) * mip.height - 0.5f;
+    float fx = std::floor(x);
+    float fy = std::floor(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    UINT x0 = fx < 0 ? mip.width - 1 : (std::min)(static_cast<UINT>(fx), mip.width - 1);
+    UINT y0 = fy < 0 ? mip.height - 1 : (std::min)(static_cast<UINT>(fy), mip.height - 1);
+    UINT x1 = x0 + 1 == mip.width ? 0 : x0 + 1;
+    UINT y1 = y0 + 1 == mip.height ? 0 : y0 + 1;
+
+    Vec3 top = Lerp(Decode(texels[Address(mip, x0, y0)]), Decode(texels[Address(mip, x1, y0)]), tx);
+    Vec3 bottom = Lerp(Decode(texels[Address(mip, x0, y1)]), Decode(texels[Address(mip, x1, y1)]), tx);
+    return Lerp(top, bottom, ty);
+}
+
+Vec3 Texture::Sample(float u, float v, float footprint) const
+{
+    // The level whose texels are about as wide as the footprint.
+    float texels = footprint * (std::max)(Width(), Height());
+    float lod = texels > 1.0f ? std::log2(texels) : 0.0f;
+    lod = (std::min)(lod, static_cast<float>(MipCount() - 1));
+
+    UINT level = static_cast<UINT>(lod);
+    float t = lod - level;
+    Vec3 color = SampleBilinear(level, u, v);
+    if (t > 0 && level + 1 < MipCount())
+    {
+        color = Lerp(color, SampleBilinear(level + 1, u, v), t);
+    }
+    return color;
+}
@@ -0,0 +1,87 @@
+#ifndef CPU_TEXTURE_H
+#define CPU_TEXTURE_H
+
+#include "CpuMath.h"
+
+namespace Cpu
+{
+    namespace TextureLayout {
+        enum Enum {
+            Linear = 0,     // Row major texels per mip level.
+            Tiled,          // Row major 4x4 texel tiles per mip level, each tile one cache line.
+            Count
+        };
+    }
+
+    static const UINT InvalidTexture = ~0u;
+
+    // RGBA8 image texture with a full mip chain.
+    // In the tiled layout the 2x2 texels of a bilinear footprint mostly share a cache line, whatever the
+    // direction rays sweep across the texture, while in the linear layout every step down a column
+    // is a new cache line, and at high resolutions a new page.
+    class Texture
+    {
+    public:
+        static const UINT TileSize = 4;
+        static const UINT TileTexels = TileSize * TileSize;
+
+        // texels: width * height RGBA8 texels, row major, R in the low byte.
+        Texture(UINT width, UINT height, const UINT* texels, TextureLayout::Enum layout = TextureLayout::Tiled);
+        Texture(const Texture& other);
+        Texture(Texture&& other) = default;
+        Texture& operator=(const Texture& other);
+        Texture& operator=(Texture&& other) = default;
+
+        // Loads a binary PPM (P6) image.
+        static Texture LoadPPM(const std::wstring& path, TextureLayout::Enum layout = TextureLayout::Tiled);
+
+        UINT Width() const { return m_levels[0].width; }
+        UINT Height() const { return m_levels[0].height; }
+        UINT MipCount() const { return static_cast<UINT>(m_levels.size()); }
+        TextureLayout::Enum Layout() const { return m_layout; }
+        size_t SizeInBytes() const { return m_texelCount * sizeof(UINT); }
+
+        // Raw RGBA8 texel of a mip level, coordinates must be in range.
+        UINT Fetch(UINT level, UINT x, UINT y) const { return Texels()[Address(m_levels[level], x, y)]; }
+
+        // Bilinearly filtered texel of a mip level, with wrapped texture coordinates.
+        Vec3 SampleBilinear(UINT level, float u, float v) const;
+
+        // Trilinearly filtered texel. footprint is the width of the filtered area in texture
+        // coordinate units and selects the mip levels.
+        Vec3 Sample(float u, float v, float footprint) const;
+
+    private:
+        struct MipLevel
+        {
+            UINT width;
+            UINT height;
+            UINT tilesX;
+            UINT offset;    // First texel of the level in the storage.
+        };
+
+        UINT Address(const MipLevel& level, UINT x, UINT y) const
+        {
+            if (m_layout == TextureLayout::Tiled)
+            {
+                UINT tile = (y / TileSize) * level.tilesX + x / TileSize;
+                return level.offset + tile * TileTexels + (y % TileSize) * TileSize + x % TileSize;
+            }
+            return level.offset + y * level.width + x;
+        }
+
+        void Allocate(size_t texelCount);
+        UINT* Texels() { return m_storage.data() + m_alignOffset; }
+        const UINT* Texels() const { return m_storage.data() + m_alignOffset; }
+
+        TextureLayout::Enum m_layout;
+        std::vector<MipLevel> m_levels;
+
+        // Texel storage of all levels, the texels start at a cache line boundary so tiles don't straddle lines.
+        std::vector<UINT> m_storage;
+        size_t m_alignOffset;
+        size_t m_texelCount;
+    };
+}
+
+#endif // !CPU_TEXTURE_H
@@ -0,0 +1,110 @@
+#include "stdafx.h"
+#include "CpuThreadPool.h"
+
+using namespace Cpu;
+
+ThreadPool::ThreadPool(UINT threadCount) :
+    m_kernel(nullptr),
+    m_count(0),
+    m_batchSize(1),
+    m_nextBatch(0),
+    m_pendingWorkers(0),
+    m_generation(0),
+    m_exit(false)
+{
+    if (threadCount == 0)
+    {
+        threadCount = (std::max)(1u, std::thread::hardware_concurrency());
+    }
+
+    for (UINT i = 1; i < threadCount; i++)
+    {
+        m_workers.emplace_back(&ThreadPool::WorkerMain, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_wakeCondition.notify_all();
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(UINT count, UINT batchSize, const Kernel& kernel)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    batchSize = (std::max)(1u, batchSize);
+
+    // Not worth waking the workers for a single batch.
+    if (m_workers.empty() || count <= batchSize)
+    {
+        for (UINT begin = 0; begin < count; begin += batchSize)
+        {
+            kernel(begin, (std::min)(count, begin + batchSize), 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_kernel = &kernel;
+        m_count = count;
+        m_batchSize = batchSize;
+        m_nextBatch = 0;
+        m_pendingWorkers = static_cast<UINT>(m_workers.size());
+        m_generation++;
+    }
+    m_wakeCondition.notify_all();
+
+    RunBatches(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCondition.wait(lock, [this] { return m_pendingWorkers == 0; });
+    m_kernel = nullptr;
+}
+
+void ThreadPool::WorkerMain(UINT threadIndex)
+{
+    UINT64 generation = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [&] { return m_exit || m_generation != generation; });
+            if (m_exit)
+            {
+                return;
+            }
+            generation = m_generation;
+        }
+
+        RunBatches(threadIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pendingWorkers--;
+        }
+        m_doneCondition.notify_one();
+    }
+}
+
+void ThreadPool::RunBatches(UINT threadIndex)
+{
+    UINT batchCount = (m_count + m_batchSize - 1) / m_batchSize;
+    for (UINT batch = m_nextBatch++; batch < batchCount; batch = m_nextBatch++)
+    {
+        UINT begin = batch * m_batchSize;
+        UINT end = (std::min)(m_count, begin + m_batchSize);
+        (*m_kernel)(begin, end, threadIndex);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef CPU_THREAD_POOL_H
+#define CPU_THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace Cpu
+{
+    // Persistent worker threads running data parallel batches.
+    // The calling thread takes part in the work, so a pool of N threads has N - 1 workers.
+    class ThreadPool
+    {
+    public:
+        // Kernel processing the items <begin, end) on thread threadIndex < ThreadCount().
+        typedef std::function<void(UINT begin, UINT end, UINT threadIndex)> Kernel;
+
+        // threadCount of 0 uses one thread per hardware thread.
+        explicit ThreadPool(UINT threadCount = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        UINT ThreadCount() const { return static_cast<UINT>(m_workers.size()) + 1; }
+
+        // Splits <0, count) into batches of batchSize items and blocks until all of them are processed.
+        void ParallelFor(UINT count, UINT batchSize, const Kernel& kernel);
+
+    private:
+        void WorkerMain(UINT threadIndex);
+        void RunBatches(UINT threadIndex);
+
+        std::vector<std::thread> m_workers;
+        std::mutex m_mutex;
+        std::condition_variable m_wakeCondition;
+        std::condition_variable m_doneCondition;
+
+        // Current job, guarded by m_mutex apart from the batch counter.
+        const Kernel* m_kernel;
+        UINT m_count;
+        UINT m_batchSize;
+        std::atomic<UINT> m_nextBatch;
+        UINT m_pendingWorkers;
+        UINT64 m_generation;
+        bool m_exit;
+    };
+}
+
+#endif // !CPU_THREAD_POOL_H
@@ -0,0 +1,189 @@
+#include "stdafx.h"
+#include "CpuTonemap.h"
+#include <emmintrin.h>
+
+using namespace Cpu;
+
+namespace
+{
+    // Radiance is clamped below the largest half before the curves, which keeps infinities from turning into NaNs.
+    static const float c_maxRadiance = 65504.0f;
+
+    // sRGB encoding: linear below the threshold, 1.055 x^(1/2.4) - 0.055 above.
+    static const float c_sRGBThreshold = 0.0031308f;
+    static const float c_sRGBLinearScale = 12.92f;
+
+    // Least squares fit of the power segment on [c_sRGBThreshold, 1] to x^(1/2), x^(1/4), x^(1/8), x and 1,
+    // weighted towards the largest errors.
+    static const float c_sRGBFit[5] = { 0.653968607f, 0.688752409f, -0.318508114f, -0.020185153f, -0.004059037f };
+
+    // Ordered dither matrix, every threshold of 0 to 63 once in each 8x8 block, spread as far apart as possible.
+    static const BYTE c_bayer[8][8] =
+    {
+        { 0, 32, 8, 40, 2, 34, 10, 42 },
+        { 48, 16, 56, 24, 50, 18, 58, 26 },
+        { 12, 44, 4, 36, 14, 46, 6, 38 },
+        { 60, 28, 52, 20, 62, 30, 54, 22 },
+        { 3, 35, 11, 43, 1, 33, 9, 41 },
+        { 51, 19, 59, 27, 49, 17, 57, 25 },
+        { 15, 47, 7, 39, 13, 45, 5, 37 },
+        { 63, 31, 55, 23, 61, 29, 53, 21 }
+    };
+
+    // Quantization offsets of row y in (0, 1), added before truncation. The row's 8 thresholds repeat for 4 more
+    // columns, so the ones of any 4 consecutive pixels can be loaded at once. Without dither all round to nearest.
+    void DitherThresholds(UINT y, bool dither, float thresholds[12])
+    {
+        for (UINT i = 0; i < 12; i++)
+        {
+            thresholds[i] = dither ? (c_bayer[y % 8][i % 8] + 0.5f) / 64 : 0.5f;
+        }
+    }
+
+    // Exposed, clamped radiance through the tone curve, in [0, 1]. NaNs go to 0.
+    float ToneMap(float value, float scale, ToneCurve::Enum curve)
+    {
+        float x = value * scale;
+        x = x > 0 ? (x < c_maxRadiance ? x : c_maxRadiance) : 0;
+        switch (curve)
+        {
+        case ToneCurve::Reinhard:
+            x = 1 - 1 / (1 + x);
+            break;
+        case ToneCurve::ACES:
+            x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+            break;
+        default:
+            break;
+        }
+        return (std::min)(x, 1.0f);
+    }
+
+    float EncodeSRGB(float x)
+    {
+        return x <= c_sRGBThreshold ? c_sRGBLinearScale * x : 1.055f * std::pow(x, 1 / 2.4f) - 0.055f;
+    }
+
+    BYTE Quantize(float x, float threshold)
+    {
+        return static_cast<BYTE>(x * 255 + threshold);
+    }
+
+    // SSE counterparts of the above, four values at a time. The maximum with zero comes first, it returns zero for NaNs.
+    inline __m128 ToneMap4(__m128 value, __m128 scale, ToneCurve::Enum curve)
+    {
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(value, scale), _mm_setzero_ps()), _mm_set1_ps(c_maxRadiance));
+        switch (curve)
+        {
+        case ToneCurve::Reinhard:
+            x = _mm_sub_ps(one, _mm_div_ps(one, _mm_add_ps(one, x)));
+            break;
+        case ToneCurve::ACES:
+        {
+            __m128 numerator = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+            __m128 denominator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+            x = _mm_div_ps(numerator, denominator);
+            break;
+        }
+        default:
+            break;
+        }
+        return _mm_min_ps(x, one);
+    }
+
+    inline __m128 EncodeSRGB4(__m128 x)
+    {
+        __m128 s1 = _mm_sqrt_ps(x);
+        __m128 s2 = _mm_sqrt_ps(s1);
+        __m128 s3 = _mm_sqrt_ps(s2);
+        __m128 curve = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(c_sRGBFit[0]), s1), _mm_mul_ps(_mm_set1_ps(c_sRGBFit[1]), s2)),
+            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(c_sRGBFit[2]), s3), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(c_sRGBFit[3]), x), _mm_set1_ps(c_sRGBFit[4]))));
+        curve = _mm_min_ps(curve, _mm_set1_ps(1.0f));
+        __m128 linear = _mm_mul_ps(x, _mm_set1_ps(c_sRGBLinearScale));
+        __m128 isLinear = _mm_cmple_ps(x, _mm_set1_ps(c_sRGBThreshold));
+        return _mm_or_ps(_mm_and_ps(isLinear, linear), _mm_andnot_ps(isLinear, curve));
+    }
+
+    inline __m128i Quantize4(__m128 x, __m128 threshold)
+    {
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(255.0f)), threshold));
+    }
+
+    // Four interleaved RGB pixels to 12 bytes.
+    inline void Tonemap4(const float* radiance, __m128 threshold, __m128 scale, const OutputTransform& transform, BYTE* rgb)
+    {
+        // r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3 to planes of r, g and b.
+        __m128 a = _mm_loadu_ps(radiance);
+        __m128 b = _mm_loadu_ps(radiance + 4);
+        __m128 c = _mm_loadu_ps(radiance + 8);
+        __m128 channels[3] =
+        {
+            _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0)),
+            _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)),
+            _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), c, _MM_SHUFFLE(3, 0, 2, 0))
+        };
+
+        __m128i packed = _mm_setzero_si128();
+        for (UINT channel = 0; channel < 3; channel++)
+        {
+            __m128 x = ToneMap4(channels[channel], scale, transform.toneCurve);
+            if (transform.sRGB)
+            {
+                x = EncodeSRGB4(x);
+            }
+            packed = _mm_or_si128(packed, _mm_slli_epi32(Quantize4(x, threshold), 8 * channel));
+        }
+
+        UINT pixels[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels), packed);
+        for (UINT i = 0; i < 4; i++)
+        {
+            memcpy(rgb + 3 * i, &pixels[i], 3);
+        }
+    }
+}
+
+void Cpu::TonemapRow(const float* radiance, UINT count, UINT x, UINT y, const OutputTransform& transform, BYTE* rgb)
+{
+    float thresholds[12];
+    DitherThresholds(y, transform.dither, thresholds);
+    __m128 scale = _mm_set1_ps(std::exp2(transform.exposure));
+
+    UINT i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        Tonemap4(radiance + 3 * i, _mm_loadu_ps(&thresholds[(x + i) % 8]), scale, transform, rgb + 3 * i);
+    }
+
+    // The last pixels go through the same code, padded with black, so every pixel gets the same result wherever the row is split.
+    if (i < count)
+    {
+        float padded[12] = {};
+        BYTE bytes[12];
+        memcpy(padded, radiance + 3 * i, (count - i) * 3 * sizeof(float));
+        Tonemap4(padded, _mm_loadu_ps(&thresholds[(x + i) % 8]), scale, transform, bytes);
+        memcpy(rgb + 3 * i, bytes, (count - i) * 3);
+    }
+}
+
+void Cpu::TonemapRowReference(const float* radiance, UINT count, UINT x, UINT y, const OutputTransform& transform, BYTE* rgb)
+{
+    float thresholds[12];
+    DitherThresholds(y, transform.dither, thresholds);
+    float scale = std::exp2(transform.exposure);
+
+    for (UINT i = 0; i < count; i++)
+    {
+        float threshold = thresholds[(x + i) % 8];
+        for (UINT channel = 0; channel < 3; channel++)
+        {
+            float value = ToneMap(radiance[3 * i + channel], scale, transform.toneCurve);
+            if (transform.sRGB)
+            {
+                value = EncodeSRGB(value);
+            }
+            rgb[3 * i + channel] = Quantize(value, threshold);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef CPU_TONEMAP_H
+#define CPU_TONEMAP_H
+
+#include "CpuMath.h"
+
+namespace Cpu
+{
+    namespace ToneCurve {
+        enum Enum {
+            Clamp = 0,      // Radiance above 1 clips.
+            Reinhard,       // x / (1 + x).
+            ACES,           // Narkowicz's fit of the ACES filmic curve.
+            Count
+        };
+    }
+
+    // Turns linear radiance into 8 bit display values: exposure, tone curve, sRGB encoding and quantization with an
+    // ordered 8x8 Bayer dither, which hides the banding of smooth gradients at 8 bits.
+    struct OutputTransform
+    {
+        float exposure = 0.0f;      // In stops, the radiance is scaled by 2^exposure.
+        ToneCurve::Enum toneCurve = ToneCurve::ACES;
+        bool sRGB = true;           // Otherwise the values are stored linear.
+        bool dither = true;         // Otherwise the values are rounded to nearest.
+    };
+
+    // Transforms count RGB pixels of row y, starting at column x, into count RGB byte triplets.
+    // The pixels are processed four at a time with SSE. The sRGB curve is a polynomial in square roots of the value,
+    // within 0.01 of a quantization step of the exact one, and the dither pattern follows the pixels' image
+    // coordinates, so the result doesn't depend on how the image is split into rows or tiles.
+    void TonemapRow(const float* radiance, UINT count, UINT x, UINT y, const OutputTransform& transform, BYTE* rgb);
+
+    // Scalar TonemapRow() with the exact sRGB curve, the reference the SSE version is checked against.
+    void TonemapRowReference(const float* radiance, UINT count, UINT x, UINT y, const OutputTransform& transform, BYTE* rgb);
+}
+
+#endif // !CPU_TONEMAP_H
@@ -0,0 +1,680 @@
+#include "stdafx.h"
+#include "CpuWavefront.h"
+#include "CpuNoise.h"
+#include "CpuTexture.h"
+
+using namespace Cpu;
+
+namespace
+{
+    // Offset to avoid self-intersection of rays leaving a surface.
+    static const float c_rayOffset = 1e-3f;
+
+    static const float c_pi = 3.14159265f;
+
+    // Random numbers of a path vertex, a sequence per pixel, sample and depth.
+    inline RandomStream PathRandom(UINT pixel, UINT depth, UINT sampleIndex)
+    {
+        return RandomStream(pixel, sampleIndex, depth);
+    }
+
+    struct PendingRay
+    {
+        Ray ray;
+        Vec3 throughput;
+        UINT pixel;
+        UINT depth;
+        float coneWidth;
+        float coneSpread;
+        Vec3 scatterNormal;
+        float scatterPdf;
+    };
+
+    struct PendingShadowRay
+    {
+        Ray ray;
+        Vec3 lit;
+        Vec3 shadowed;
+        UINT pixel;
+    };
+}
+
+void RayQueue::Resize(UINT capacity)
+{
+    for (auto* v : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ, &throughputR, &throughputG, &throughputB, &coneWidth, &coneSpread, &time, &scatterNormalX, &scatterNormalY, &scatterNormalZ, &scatterPdf })
+    {
+        v->resize(capacity);
+    }
+    pixel.resize(capacity);
+    depth.resize(capacity);
+    size = 0;
+}
+
+Ray RayQueue::GetRay(UINT i) const
+{
+    Ray ray;
+    ray.origin = Vec3(originX[i], originY[i], originZ[i]);
+    ray.direction = Vec3(directionX[i], directionY[i], directionZ[i]);
+    ray.time = time[i];
+    return ray;
+}
+
+void RayQueue::Set(UINT i, const Ray& ray, const Vec3& throughput, UINT pixelIndex, UINT pathDepth, float width, float spread,
+    const Vec3& scatterNormal, float bsdfPdf)
+{
+    originX[i] = ray.origin.x;
+    originY[i] = ray.origin.y;
+    originZ[i] = ray.origin.z;
+    directionX[i] = ray.direction.x;
+    directionY[i] = ray.direction.y;
+    directionZ[i] = ray.direction.z;
+    time[i] = ray.time;
+    throughputR[i] = throughput.x;
+    throughputG[i] = throughput.y;
+    throughputB[i] = throughput.z;
+    pixel[i] = pixelIndex;
+    depth[i] = pathDepth;
+    coneWidth[i] = width;
+    coneSpread[i] = spread;
+    scatterNormalX[i] = scatterNormal.x;
+    scatterNormalY[i] = scatterNormal.y;
+    scatterNormalZ[i] = scatterNormal.z;
+    scatterPdf[i] = bsdfPdf;
+}
+
+void RayQueue::SetCameraRays(UINT first, UINT count, const Vec3& origin, const float* directionsX, const float* directionsY,
+    const float* directionsZ, const float* times, const UINT* pixels, float spread)
+{
+    // One array at a time, the loops vectorize.
+    std::fill_n(&originX[first], count, origin.x);
+    std::fill_n(&originY[first], count, origin.y);
+    std::fill_n(&originZ[first], count, origin.z);
+    std::copy_n(directionsX, count, &directionX[first]);
+    std::copy_n(directionsY, count, &directionY[first]);
+    std::copy_n(directionsZ, count, &directionZ[first]);
+    std::copy_n(times, count, &time[first]);
+    std::fill_n(&throughputR[first], count, 1.0f);
+    std::fill_n(&throughputG[first], count, 1.0f);
+    std::fill_n(&throughputB[first], count, 1.0f);
+    std::copy_n(pixels, count, &pixel[first]);
+    std::fill_n(&depth[first], count, 1u);
+    std::fill_n(&coneWidth[first], count, 0.0f);
+    std::fill_n(&coneSpread[first], count, spread);
+    std::fill_n(&scatterNormalX[first], count, 0.0f);
+    std::fill_n(&scatterNormalY[first], count, 0.0f);
+    std::fill_n(&scatterNormalZ[first], count, 0.0f);
+    std::fill_n(&scatterPdf[first], count, 0.0f);
+}
+
+void ShadowRayQueue::Resize(UINT capacity)
+{
+    for (auto* v : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ, &tMax, &litR, &litG, &litB, &shadowedR, &shadowedG, &shadowedB, &time })
+    {
+        v->resize(capacity);
+    }
+    pixel.resize(capacity);
+    size = 0;
+}
+
+Ray ShadowRayQueue::GetRay(UINT i) const
+{
+    Ray ray;
+    ray.origin = Vec3(originX[i], originY[i], originZ[i]);
+    ray.direction = Vec3(directionX[i], directionY[i], directionZ[i]);
+    ray.tMax = tMax[i];
+    ray.time = time[i];
+    return ray;
+}
+
+void HitQueue::Resize(UINT capacity)
+{
+    t.resize(capacity);
+    normalX.resize(capacity);
+    normalY.resize(capacity);
+    normalZ.resize(capacity);
+    primitive.resize(capacity);
+    materialIndex.resize(capacity);
+    materialClass.resize(capacity);
+    frontFace.resize(capacity);
+}
+
+WavefrontRenderer::WavefrontRenderer(ThreadPool& threadPool) :
+    m_threadPool(threadPool),
+    m_width(0),
+    m_height(0),
+    m_lightTree(nullptr),
+    m_cancel(nullptr),
+    m_currentQueue(0)
+{
+}
+
+void WavefrontRenderer::Resize(UINT width, UINT height)
+{
+    if (width == m_width && height == m_height)
+    {
+        return;
+    }
+
+    // Every path has at most one active segment and one shadow ray at a time,
+    // so all queues are bounded by the pixel count.
+    m_width = width;
+    m_height = height;
+    UINT capacity = width * height;
+    m_rayQueues[0].Resize(capacity);
+    m_rayQueues[1].Resize(capacity);
+    m_hits.Resize(capacity);
+    m_shadowQueue.Resize(capacity);
+    m_sortedRays.resize(capacity);
+    m_radiance.resize(capacity);
+    m_albedo.resize(capacity);
+    m_normals.resize(capacity);
+    m_depths.resize(capacity);
+}
+
+bool WavefrontRenderer::Render(const Scene& scene, const BVH& bvh, const Camera& camera, const PathSettings& settings, const LightTree* lightTree,
+    const std::vector<UINT>* pixels)
+{
+    Resize(camera.width, camera.height);
+    m_lightTree = lightTree;
+    m_stats = WavefrontStats();
+    m_threadStats.assign(m_threadPool.ThreadCount(), RayStats());
+    m_threadOcclusionCaches.assign(m_threadPool.ThreadCount(), OcclusionCache());
+
+    Generate(camera, settings, pixels);
+
+    bool cancelled = false;
+    while (m_rayQueues[m_currentQueue].size > 0)
+    {
+        if (m_cancel && m_cancel->load(std::memory_order_relaxed))
+        {
+            cancelled = true;
+            m_rayQueues[m_currentQueue].size = 0;
+            break;
+        }
+
+        m_stats.activeRays.push_back(m_rayQueues[m_currentQueue].size);
+
+        Extend(scene, bvh);
+        SortByMaterial();
+        Shade(scene, settings);
+
+        m_stats.shadowRays.push_back(m_shadowQueue.size);
+        TraceShadowRays(scene, bvh);
+
+        m_currentQueue = 1 - m_currentQueue;
+    }
+
+    for (auto& threadStats : m_threadStats)
+    {
+        m_stats.rays.Merge(threadStats);
+    }
+    return !cancelled;
+}
+
+void WavefrontRenderer::Generate(const Camera& camera, const PathSettings& settings, const std::vector<UINT>* pixels)
+{
+    StartStage(WavefrontStage::Generate);
+
+    RayQueue& queue = m_rayQueues[m_currentQueue];
+    UINT count = pixels ? static_cast<UINT>(pixels->size()) : m_width * m_height;
+    queue.size = count;
+    float spread = camera.PixelSpreadAngle();
+    CameraRayBasis basis(camera);
+    bool jitter = settings.jitterStrata > 0;
+    m_threadPool.ParallelFor(count, BatchSize, [&](UINT begin, UINT end, UINT)
+    {
+        UINT batchPixels[BatchSize];
+        float times[BatchSize];
+        float offsetsX[BatchSize];
+        float offsetsY[BatchSize];
+        UINT batchCount = end - begin;
+        for (UINT i = 0; i < batchCount; i++)
+        {
+            // Each path samples the shutter at one time, every segment of it sees the scene at that time.
+            // Path vertices start at depth 1, so the depth 0 stream is free for the time sample and the subpixel offset.
+            UINT pixel = pixels ? (*pixels)[begin + i] : begin + i;
+            m_radiance[pixel] = Vec3(0.0f);
+            float time = 0.0f;
+            if (settings.motionBlur || jitter)
+            {
+                RandomStream random = PathRandom(pixel, 0, settings.sampleIndex);
+                time = random.NextFloat();
+                if (jitter)
+                {
+                    float u = random.NextFloat();
+                    float v = random.NextFloat();
+                    StratifiedOffset(settings.sampleIndex, settings.jitterStrata, u, v, offsetsX[i], offsetsY[i]);
+                }
+            }
+            batchPixels[i] = pixel;
+            times[i] = settings.motionBlur ? time : 0.0f;
+        }
+
+        // Directions of runs of consecutive pixels in a row at once.
+        float directionsX[BatchSize];
+        float directionsY[BatchSize];
+        float directionsZ[BatchSize];
+        for (UINT i = 0; i < batchCount;)
+        {
+            UINT pixel = batchPixels[i];
+            UINT x = pixel % m_width;
+            UINT run = 1;
+            while (i + run < batchCount && x + run < m_width && batchPixels[i + run] == pixel + run)
+            {
+                run++;
+            }
+            basis.GenerateDirections(x, pixel / m_width, run, jitter ? offsetsX + i : nullptr, jitter ? offsetsY + i : nullptr,
+                directionsX + i, directionsY + i, directionsZ + i);
+            i += run;
+        }
+
+        queue.SetCameraRays(begin, batchCount, basis.origin, directionsX, directionsY, directionsZ, times, batchPixels, spread);
+    });
+
+    StopStage(WavefrontStage::Generate);
+}
+
+void WavefrontRenderer::Extend(const Scene& scene, const BVH& bvh)
+{
+    StartStage(WavefrontStage::Extend);
+
+    const RayQueue& queue = m_rayQueues[m_currentQueue];
+    m_threadPool.ParallelFor(queue.size, BatchSize, [&](UINT begin, UINT end, UINT threadIndex)
+    {
+        RayStats& stats = m_threadStats[threadIndex];
+        for (UINT i = begin; i < end; i++)
+        {
+            Hit hit;
+            if (bvh.Intersect(scene, queue.GetRay(i), hit, &stats))
+            {
+                m_hits.t[i] = hit.t;
+                m_hits.normalX[i] = hit.normal.x;
+                m_hits.normalY[i] = hit.normal.y;
+                m_hits.normalZ[i] = hit.normal.z;
+                m_hits.primitive[i] = hit.primitive;
+                m_hits.materialIndex[i] = hit.materialIndex;
+                m_hits.materialClass[i] = static_cast<UINT8>(GetMaterialClass(scene.materials[hit.materialIndex]));
+                m_hits.frontFace[i] = hit.frontFace;
+            }
+            else
+            {
+                m_hits.t[i] = FLT_MAX;
+                m_hits.materialClass[i] = MaterialClass::Miss;
+            }
+        }
+    });
+
+    StopStage(WavefrontStage::Extend);
+}
+
+// Counting sort of the ray queue indices by material class.
+void WavefrontRenderer::SortByMaterial()
+{
+    StartStage(WavefrontStage::Sort);
+
+    UINT count = m_rayQueues[m_currentQueue].size;
+    UINT classCounts[MaterialClass::Count] = {};
+    for (UINT i = 0; i < count; i++)
+    {
+        classCounts[m_hits.materialClass[i]]++;
+    }
+
+    UINT offsets[MaterialClass::Count];
+    m_classOffsets[0] = 0;
+    for (UINT c = 0; c < MaterialClass::Count; c++)
+    {
+        offsets[c] = m_classOffsets[c];
+        m_classOffsets[c + 1] = m_classOffsets[c] + classCounts[c];
+    }
+
+    for (UINT i = 0; i < count; i++)
+    {
+        m_sortedRays[offsets[m_hits.materialClass[i]]++] = i;
+    }
+
+    StopStage(WavefrontStage::Sort);
+}
+
+void WavefrontRenderer::Shade(const Scene& scene, const PathSettings& settings)
+{
+    StartStage(WavefrontStage::Shade);
+
+    m_rayQueues[1 - m_currentQueue].size = 0;
+    m_shadowQueue.size = 0;
+
+    auto ShadeClass = [&](MaterialClass::Enum materialClass, void (WavefrontRenderer::*kernel)(const Scene&, const PathSettings&, UINT, UINT))
+    {
+        UINT first = m_classOffsets[materialClass];
+        UINT count = m_classOffsets[materialClass + 1] - first;
+        m_threadPool.ParallelFor(count, BatchSize, [&](UINT begin, UINT end, UINT)
+        {
+            (this->*kernel)(scene, settings, first + begin, first + end);
+        });
+    };
+    ShadeClass(MaterialClass::Miss, &WavefrontRenderer::ShadeBatch<MaterialClass::Miss>);
+    ShadeClass(MaterialClass::Opaque, &WavefrontRenderer::ShadeBatch<MaterialClass::Opaque>);
+    ShadeClass(MaterialClass::Reflective, &WavefrontRenderer::ShadeBatch<MaterialClass::Reflective>);
+    ShadeClass(MaterialClass::Refractive, &WavefrontRenderer::ShadeBatch<MaterialClass::Refractive>);
+
+    StopStage(WavefrontStage::Shade);
+}
+
+// Shades the sorted ray queue entries <begin, end), all of the given material class.
+// Mirrors MyClosestHitShader_Triangle/AABB: ambient + phong + fresnel weighted secondary ray, with
+// the secondary contribution carried as path throughput instead of a recursive TraceRay.
+template <MaterialClass::Enum Class>
+void WavefrontRenderer::ShadeBatch(const Scene& scene, const PathSettings& settings, UINT begin, UINT end)
+{
+    const RayQueue& queue = m_rayQueues[m_currentQueue];
+    const SceneLight& light = scene.light;
+
+    PendingRay pendingRays[BatchSize];
+    PendingShadowRay pendingShadowRays[BatchSize];
+    UINT pendingRayCount = 0;
+    UINT pendingShadowRayCount = 0;
+
+    // Turbulence of the PERLIN material hits, evaluated for the whole batch at once.
+    float noisePositionX[BatchSize], noisePositionY[BatchSize], noisePositionZ[BatchSize];
+    float noise[BatchSize];
+    UINT noiseCount = 0;
+    if (Class != MaterialClass::Miss)
+    {
+        for (UINT s = begin; s < end; s++)
+        {
+            UINT i = m_sortedRays[s];
+            if (scene.materials[m_hits.materialIndex[i]].hasPerlin)
+            {
+                Ray ray = queue.GetRay(i);
+                Vec3 hitPosition = (ray.origin + ray.direction * m_hits.t[i]) * PERLIN_SCALE;
+                noisePositionX[noiseCount] = hitPosition.x;
+                noisePositionY[noiseCount] = hitPosition.y;
+                noisePositionZ[noiseCount] = hitPosition.z;
+                noiseCount++;
+            }
+        }
+        if (noiseCount > 0)
+        {
+            Turbulence(noisePositionX, noisePositionY, noisePositionZ, noise, noiseCount);
+            noiseCount = 0;
+        }
+    }
+
+    for (UINT s = begin; s < end; s++)
+    {
+        UINT i = m_sortedRays[s];
+        UINT pixel = queue.pixel[i];
+        Vec3 throughput(queue.throughputR[i], queue.throughputG[i], queue.throughputB[i]);
+
+        if (Class == MaterialClass::Miss)
+        {
+            m_radiance[pixel] += throughput * c_backgroundColor;
+            if (queue.depth[i] == 1)
+            {
+                m_albedo[pixel] = c_backgroundColor;
+                m_normals[pixel] = Vec3(0.0f);
+                m_depths[pixel] = FLT_MAX;
+            }
+            continue;
+        }
+
+        const MaterialConstantBuffer& material = scene.materials[m_hits.materialIndex[i]];
+        Vec3 albedo = ToVec3(material.albedo);
+        Ray ray = queue.GetRay(i);
+        float t = m_hits.t[i];
+        Vec3 normal(m_hits.normalX[i], m_hits.normalY[i], m_hits.normalZ[i]);
+        Vec3 hitPosition = ray.origin + ray.direction * t;
+
+        // Image texture, filtered over the ray cone footprint projected onto the surface.
+        float coneWidth = queue.coneWidth[i] + queue.coneSpread[i] * t;
+        if (const Texture* texture = scene.GetMaterialTexture(m_hits.materialIndex[i]))
+        {
+            float u, v, uvPerWorldUnit;
+            scene.GetTextureCoordinates(m_hits.primitive[i], hitPosition, ray.time, u, v, uvPerWorldUnit);
+            float footprint = coneWidth * uvPerWorldUnit / (std::max)(std::fabs(Dot(ray.direction, normal)), 0.1f);
+            albedo *= texture->Sample(u, v, footprint);
+        }
+
+        // Apply visibility falloff.
+        float falloff = VisibilityFalloff(t);
+        m_radiance[pixel] += throughput * c_backgroundColor * falloff;
+        throughput *= 1.0f - falloff;
+
+        // Emission, from the front faces only. Where light sampling could have found the emitter too,
+        // the two strategies share it by MIS.
+        const Vec3& emission = scene.materialEmission[m_hits.materialIndex[i]];
+        if (m_hits.frontFace[i] && MaxComponent(emission) > 0)
+        {
+            float weight = 1.0f;
+            UINT lightIndex = settings.integrator == Integrator::NextEvent && queue.scatterPdf[i] > 0
+                ? scene.GetPrimitiveLight(m_hits.primitive[i]) : InvalidLight;
+            if (lightIndex != InvalidLight)
+            {
+                Vec3 scatterNormal(queue.scatterNormalX[i], queue.scatterNormalY[i], queue.scatterNormalZ[i]);
+                float lightPdf = LightSelectionPdf(scene, ray.origin, scatterNormal, lightIndex) *
+                    LightPdf(scene, scene.lights[lightIndex], ray.origin, ray.time, hitPosition);
+                weight = PowerHeuristic(queue.scatterPdf[i], lightPdf);
+            }
+            m_radiance[pixel] += throughput * emission * weight;
+        }
+
+        // Checker texture modulates the phong color and the Lambertian albedo.
+        float phongScale = material.hasTexture ? CheckerColor(hitPosition) : 1.0f;
+        float perlin = material.hasPerlin ? noise[noiseCount++] : 0.0f;
+
+        UINT depth = queue.depth[i];
+        if (depth == 1)
+        {
+            m_albedo[pixel] = albedo * phongScale;
+            m_normals[pixel] = normal;
+            m_depths[pixel] = t;
+        }
+
+        // Diffuse and specular components, resolved by the shadow stage.
+        RandomStream random = PathRandom(pixel, depth, settings.sampleIndex);
+        Vec3 lightPosition = light.position;
+        Vec3 litColor(0.0f);
+        Vec3 shadowedColor(0.0f);
+        float shadowRayLength = 1.0f;
+        Vec3 diffuseAlbedo = albedo * (material.diffuseCoef * phongScale);
+        if (settings.integrator == Integrator::Phong)
+        {
+            // Ambient component.
+            // Fake AO: Darken faces with normal facing downwards/away from the sky a little bit.
+            float a = 1 - Saturate(-normal.y);
+            Vec3 ambientColor = albedo * Lerp(light.ambientColor - Vec3(0.1f), light.ambientColor, a);
+            m_radiance[pixel] += throughput * (ambientColor * phongScale + Vec3(perlin));
+
+            if (scene.lights.empty())
+            {
+                Vec3 incidentLightRay = Normalize(hitPosition - light.position);
+                float Kd = Saturate(Dot(-incidentLightRay, normal));
+                Vec3 diffuseColor = light.diffuseColor * albedo * (material.diffuseCoef * Kd);
+                float Ks = std::pow(Saturate(Dot(Normalize(Reflect(incidentLightRay, normal)), -ray.direction)), material.specularPower);
+                litColor = (diffuseColor * 0.75f + Vec3(material.specularCoef * Ks)) * phongScale;
+                shadowedColor = diffuseColor * (InShadowRadiance * phongScale);
+            }
+            else
+            {
+                // One light sample, weighted by the inverse of its selection probability. The shadow ray stops
+                // just short of the sampled point, which may lie on an emissive primitive.
+                float selectionPdf = 0;
+                UINT lightIndex = SelectLight(scene, hitPosition, normal, random.NextFloat(), selectionPdf);
+                float u1 = random.NextFloat();
+                float u2 = random.NextFloat();
+                LightSample sample;
+                if (lightIndex != InvalidLight && SampleLight(scene, scene.lights[lightIndex], hitPosition, ray.time, u1, u2, sample))
+                {
+                    Vec3 toLight = Normalize(sample.position - hitPosition);
+                    float Kd = Dot(toLight, normal);
+                    if (Kd > 0)
+                    {
+                        float Ks = std::pow(Saturate(Dot(Reflect(-toLight, normal), -ray.direction)), material.specularPower);
+                        litColor = (albedo * (material.diffuseCoef * Kd) + Vec3(material.specularCoef * Ks)) * sample.irradiance * (phongScale / selectionPdf);
+                        lightPosition = sample.position;
+                        shadowRayLength = 0.999f;
+                    }
+                }
+            }
+        }
+        else if (Class == MaterialClass::Opaque && settings.integrator == Integrator::NextEvent)
+        {
+            // Next event estimation of the Lambertian BSDF. Emissive primitives can also be found by the
+            // scattered path, point and sphere lights only by light sampling.
+            float selectionPdf = 0;
+            UINT lightIndex = SelectLight(scene, hitPosition, normal, random.NextFloat(), selectionPdf);
+            float u1 = random.NextFloat();
+            float u2 = random.NextFloat();
+            LightSample sample;
+            if (lightIndex != InvalidLight && SampleLight(scene, scene.lights[lightIndex], hitPosition, ray.time, u1, u2, sample))
+            {
+                Vec3 toLight = Normalize(sample.position - hitPosition);
+                float cosine = Dot(toLight, normal);
+                if (cosine > 0)
+                {
+                    float weight = sample.pdf > 0 ? PowerHeuristic(selectionPdf * sample.pdf, cosine / c_pi) : 1.0f;
+                    litColor = diffuseAlbedo * sample.irradiance * (cosine / c_pi * weight / selectionPdf);
+                    lightPosition = sample.position;
+                    shadowRayLength = 0.999f;
+                }
+            }
+        }
+
+        Vec3 lit = throughput * litColor;
+        Vec3 shadowed = throughput * shadowedColor;
+        if (MaxComponent(lit - shadowed) > 0)
+        {
+            PendingShadowRay& shadowRay = pendingShadowRays[pendingShadowRayCount++];
+            shadowRay.ray.origin = hitPosition + normal * c_rayOffset;
+            shadowRay.ray.tMax = Length(lightPosition - shadowRay.ray.origin);
+            shadowRay.ray.direction = (lightPosition - shadowRay.ray.origin) * (1.0f / shadowRay.ray.tMax);
+            shadowRay.ray.tMax *= shadowRayLength;
+            shadowRay.ray.time = ray.time;
+            shadowRay.lit = lit;
+            shadowRay.shadowed = shadowed;
+            shadowRay.pixel = pixel;
+        }
+        else
+        {
+            m_radiance[pixel] += shadowed;
+        }
+
+        if ((Class == MaterialClass::Opaque && settings.integrator == Integrator::Phong) || depth >= settings.maxBounces)
+        {
+            continue;
+        }
+
+        // Lambertian scattering samples the cosine, so the throughput only picks up the albedo.
+        bool diffuse = Class == MaterialClass::Opaque;
+        Vec3 secondaryThroughput = diffuse
+            ? throughput * diffuseAlbedo
+            : throughput * FresnelReflectanceSchlick(ray.direction, normal, albedo) * material.reflectanceCoef;
+
+        // Russian roulette: low contribution paths survive with a probability proportional
+        // to their throughput, survivors are reweighted to keep the estimate unbiased.
+        float survivalProbability = Saturate(MaxComponent(secondaryThroughput));
+        if (settings.russianRoulette && depth >= settings.russianRouletteMinBounces)
+        {
+            if (random.NextFloat() >= survivalProbability)
+            {
+                continue;
+            }
+            secondaryThroughput *= 1.0f / survivalProbability;
+        }
+        else if (survivalProbability == 0)
+        {
+            continue;
+        }
+
+        PendingRay& secondary = pendingRays[pendingRayCount++];
+        secondary.scatterNormal = normal;
+        secondary.scatterPdf = 0;
+        if (diffuse)
+        {
+            float u1 = random.NextFloat();
+            float u2 = random.NextFloat();
+            secondary.ray.direction = SampleCosineHemisphere(normal, u1, u2);
+            secondary.ray.origin = hitPosition + normal * c_rayOffset;
+            secondary.scatterPdf = Dot(secondary.ray.direction, normal) / c_pi;
+        }
+        else if (Class == MaterialClass::Reflective)
+        {
+            Vec3 direction = Reflect(ray.direction, normal);
+            if (material.fuzz > 0)
+            {
+                direction += RandomInUnitSphere(random) * material.fuzz;
+            }
+            secondary.ray.direction = Normalize(direction);
+            secondary.ray.origin = hitPosition + normal * c_rayOffset;
+        }
+        else
+        {
+            // Refraction needs the geometric outward normal to tell entering from exiting rays.
+            Vec3 outwardNormal = m_hits.frontFace[i] ? normal : -normal;
+            secondary.ray.direction = Normalize(Refract(ray.direction, outwardNormal, material.refractionIndex));
+            secondary.ray.origin = hitPosition + normal * (Dot(secondary.ray.direction, normal) < 0 ? -c_rayOffset : c_rayOffset);
+        }
+        secondary.ray.time = ray.time;
+        secondary.throughput = secondaryThroughput;
+        secondary.pixel = pixel;
+        secondary.depth = depth + 1;
+        secondary.coneWidth = coneWidth;
+        secondary.coneSpread = queue.coneSpread[i];
+    }
+
+    // One atomic reservation per batch and output queue.
+    if (pendingRayCount)
+    {
+        RayQueue& nextQueue = m_rayQueues[1 - m_currentQueue];
+        UINT first = nextQueue.Reserve(pendingRayCount);
+        for (UINT j = 0; j < pendingRayCount; j++)
+        {
+            const PendingRay& p = pendingRays[j];
+            nextQueue.Set(first + j, p.ray, p.throughput, p.pixel, p.depth, p.coneWidth, p.coneSpread, p.scatterNormal, p.scatterPdf);
+        }
+    }
+
+    if (pendingShadowRayCount)
+    {
+        UINT first = m_shadowQueue.Reserve(pendingShadowRayCount);
+        for (UINT j = 0; j < pendingShadowRayCount; j++)
+        {
+            const PendingShadowRay& p = pendingShadowRays[j];
+            UINT k = first + j;
+            m_shadowQueue.originX[k] = p.ray.origin.x;
+            m_shadowQueue.originY[k] = p.ray.origin.y;
+            m_shadowQueue.originZ[k] = p.ray.origin.z;
+            m_shadowQueue.directionX[k] = p.ray.direction.x;
+            m_shadowQueue.directionY[k] = p.ray.direction.y;
+            m_shadowQueue.directionZ[k] = p.ray.direction.z;
+            m_shadowQueue.tMax[k] = p.ray.tMax;
+            m_shadowQueue.time[k] = p.ray.time;
+            m_shadowQueue.litR[k] = p.lit.x;
+            m_shadowQueue.litG[k] = p.lit.y;
+            m_shadowQueue.litB[k] = p.lit.z;
+            m_shadowQueue.shadowedR[k] = p.shadowed.x;
+            m_shadowQueue.shadowedG[k] = p.shadowed.y;
+            m_shadowQueue.shadowedB[k] = p.shadowed.z;
+            m_shadowQueue.pixel[k] = p.pixel;
+        }
+    }
+}
+
+void WavefrontRenderer::TraceShadowRays(const Scene& scene, const BVH& bvh)
+{
+    StartStage(WavefrontStage::Shadow);
+
+    m_threadPool.ParallelFor(m_shadowQueue.size, BatchSize, [&](UINT begin, UINT end, UINT threadIndex)
+    {
+        RayStats& stats = m_threadStats[threadIndex];
+        OcclusionCache& cache = m_threadOcclusionCaches[threadIndex];
+        for (UINT i = begin; i < end; i++)
+        {
+            bool occluded = bvh.Occluded(scene, m_shadowQueue.GetRay(i), &cache, &stats);
+            m_radiance[m_shadowQueue.pixel[i]] += occluded
+                ? Vec3(m_shadowQueue.shadowedR[i], m_shadowQueue.shadowedG[i], m_shadowQueue.shadowedB[i])
+                : Vec3(m_shadowQueue.litR[i], m_shadowQueue.litG[i], m_shadowQueue.litB[i]);
+        }
+    });
+
+    StopStage(WavefrontStage::Shadow);
+}
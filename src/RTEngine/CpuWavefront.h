@@ -0,0 +1,205 @@
+#ifndef CPU_WAVEFRONT_H
+#define CPU_WAVEFRONT_H
+
+#include "CpuBVH.h"
+#include "CpuCamera.h"
+#include "CpuLights.h"
+#include "CpuShading.h"
+#include "CpuThreadPool.h"
+#include "PerformanceTimers.h"
+
+namespace Cpu
+{
+    namespace WavefrontStage {
+        enum Enum {
+            Generate = 0,   // Camera rays for every pixel.
+            Extend,         // Closest hit traversal of the active rays.
+            Sort,           // Bin hits by material class.
+            Shade,          // Per material class shading, emits extension and shadow rays.
+            Shadow,         // Occlusion tests, resolves the deferred direct lighting.
+            Count
+        };
+    }
+
+    namespace Integrator {
+        enum Enum {
+            Phong = 0,      // Mirrors the closest hit shaders: Phong lighting, paths continue off reflective and refractive hits only.
+            BSDFSampling,   // Opaque hits are Lambertian and scatter paths too, emitters contribute when a path hits them.
+            NextEvent,      // BSDFSampling plus a light sample per opaque hit, both weighted by multiple importance sampling.
+            Count
+        };
+    }
+
+    // Path termination, see MAX_PATH_BOUNCES and RUSSIAN_ROULETTE_MIN_BOUNCES.
+    // The physically based integrators treat reflective and refractive hits as specular and need the scene's light list.
+    struct PathSettings
+    {
+        Integrator::Enum integrator = Integrator::Phong;
+        UINT maxBounces = MAX_PATH_BOUNCES;
+        UINT russianRouletteMinBounces = RUSSIAN_ROULETTE_MIN_BOUNCES;
+        bool russianRoulette = true;
+        UINT sampleIndex = 0;       // Decorrelates the random numbers of successive passes.
+        bool motionBlur = true;     // Samples a shutter time per path, otherwise every path sees the scene at shutter open.
+        UINT jitterStrata = 0;      // 0 traces the pixel centers, n jitters camera rays in an n x n grid of strata, see StratifiedOffset().
+    };
+
+    // Radiance ray queue in structure of arrays layout.
+    // Each entry is a path segment: the ray, the path throughput and the pixel it contributes to.
+    // Each entry also keeps the shutter time its path samples moving primitives at, and the normal and BSDF density
+    // of the vertex it scattered from for multiple importance sampling, the density is 0 after camera and specular vertices.
+    // The ray carries a cone, its width at the origin and its spread angle, that approximates
+    // the ray differentials for texture filtering.
+    struct RayQueue
+    {
+        std::vector<float> originX, originY, originZ;
+        std::vector<float> directionX, directionY, directionZ;
+        std::vector<float> throughputR, throughputG, throughputB;
+        std::vector<float> coneWidth, coneSpread;
+        std::vector<float> time;
+        std::vector<float> scatterNormalX, scatterNormalY, scatterNormalZ;
+        std::vector<float> scatterPdf;
+        std::vector<UINT> pixel;
+        std::vector<UINT> depth;
+        std::atomic<UINT> size;
+
+        RayQueue() : size(0) {}
+
+        void Resize(UINT capacity);
+        UINT Capacity() const { return static_cast<UINT>(pixel.size()); }
+
+        // Reserves count consecutive entries and returns the first one.
+        UINT Reserve(UINT count) { return size.fetch_add(count); }
+
+        Ray GetRay(UINT i) const;
+        void Set(UINT i, const Ray& ray, const Vec3& throughput, UINT pixelIndex, UINT pathDepth, float width, float spread,
+            const Vec3& scatterNormal = Vec3(0.0f), float bsdfPdf = 0.0f);
+        // Sets count camera rays from the entry first on, the batched Set() of the generate stage: full throughput,
+        // the first path vertex, and the rays' directions, times and pixels taken from the arrays.
+        void SetCameraRays(UINT first, UINT count, const Vec3& origin, const float* directionsX, const float* directionsY,
+            const float* directionsZ, const float* times, const UINT* pixels, float spread);
+    };
+
+    // Shadow ray queue. Shading computes the direct lighting for both outcomes of the
+    // occlusion test, the shadow stage adds the one that applies.
+    struct ShadowRayQueue
+    {
+        std::vector<float> originX, originY, originZ;
+        std::vector<float> directionX, directionY, directionZ;
+        std::vector<float> tMax;
+        std::vector<float> time;
+        std::vector<float> litR, litG, litB;
+        std::vector<float> shadowedR, shadowedG, shadowedB;
+        std::vector<UINT> pixel;
+        std::atomic<UINT> size;
+
+        ShadowRayQueue() : size(0) {}
+
+        void Resize(UINT capacity);
+        UINT Reserve(UINT count) { return size.fetch_add(count); }
+
+        Ray GetRay(UINT i) const;
+    };
+
+    // Closest hits of the extend stage, indexed like the ray queue.
+    struct HitQueue
+    {
+        std::vector<float> t;
+        std::vector<float> normalX, normalY, normalZ;
+        std::vector<UINT> primitive;
+        std::vector<UINT> materialIndex;
+        std::vector<UINT8> materialClass;
+        std::vector<UINT8> frontFace;
+
+        void Resize(UINT capacity);
+    };
+
+    struct WavefrontStats
+    {
+        double stageMS[WavefrontStage::Count] = {};
+        std::vector<UINT> activeRays;       // Extend queue size per bounce.
+        std::vector<UINT> shadowRays;       // Shadow queue size per bounce.
+        RayStats rays;
+    };
+
+    // Queue based path tracer.
+    // Instead of following each path to the end, every stage processes all active paths as a parallel batch,
+    // so each kernel and the data it touches stay hot in cache.
+    // Paths are integrated iteratively: each queue entry carries its path throughput, and low
+    // throughput paths are ended by Russian roulette.
+    class WavefrontRenderer
+    {
+    public:
+        static const UINT BatchSize = 256;
+
+        explicit WavefrontRenderer(ThreadPool& threadPool);
+
+        // Scenes with many lights sample one light per hit, picked by the light tree if given and uniformly otherwise.
+        // With a pixel list, only those pixels are traced and cleared, the radiance of the others is left as it was.
+        // Returns false if the cancel flag was raised, the radiance of the traced pixels is incomplete then.
+        bool Render(const Scene& scene, const BVH& bvh, const Camera& camera, const PathSettings& settings = PathSettings(), const LightTree* lightTree = nullptr,
+            const std::vector<UINT>* pixels = nullptr);
+
+        // Flag that Render() polls between bounces, so a render stops within one bounce of being cancelled.
+        void SetCancelFlag(const std::atomic<bool>* cancel) { m_cancel = cancel; }
+
+        UINT Width() const { return m_width; }
+        UINT Height() const { return m_height; }
+        const std::vector<Vec3>& Radiance() const { return m_radiance; }
+
+        // Denoiser guides of the traced pixels' first hits: textured albedo, normal and distance.
+        // Pixels that see the background have its color, a zero normal and a distance of FLT_MAX.
+        const std::vector<Vec3>& Albedo() const { return m_albedo; }
+        const std::vector<Vec3>& Normals() const { return m_normals; }
+        const std::vector<float>& Depths() const { return m_depths; }
+        const WavefrontStats& Stats() const { return m_stats; }
+
+    private:
+        void Resize(UINT width, UINT height);
+        void Generate(const Camera& camera, const PathSettings& settings, const std::vector<UINT>* pixels);
+        void Extend(const Scene& scene, const BVH& bvh);
+        void SortByMaterial();
+        void Shade(const Scene& scene, const PathSettings& settings);
+        void TraceShadowRays(const Scene& scene, const BVH& bvh);
+
+        UINT SelectLight(const Scene& scene, const Vec3& position, const Vec3& normal, float u, float& pdf) const
+        {
+            return m_lightTree ? m_lightTree->Select(position, normal, u, pdf) : SelectLightUniform(scene.LightCount(), u, pdf);
+        }
+        float LightSelectionPdf(const Scene& scene, const Vec3& position, const Vec3& normal, UINT lightIndex) const
+        {
+            return m_lightTree ? m_lightTree->Pdf(position, normal, lightIndex) : 1.0f / scene.LightCount();
+        }
+
+        template <MaterialClass::Enum Class>
+        void ShadeBatch(const Scene& scene, const PathSettings& settings, UINT begin, UINT end);
+
+        void StartStage(WavefrontStage::Enum stage) { m_timer.Start(stage); }
+        void StopStage(WavefrontStage::Enum stage) { m_timer.Stop(stage); m_stats.stageMS[stage] += m_timer.GetElapsedMS(stage); }
+
+        ThreadPool& m_threadPool;
+        DX::CPUTimer m_timer;
+        UINT m_width;
+        UINT m_height;
+        const LightTree* m_lightTree;
+        const std::atomic<bool>* m_cancel;
+
+        RayQueue m_rayQueues[2];
+        UINT m_currentQueue;
+        HitQueue m_hits;
+        ShadowRayQueue m_shadowQueue;
+
+        // Ray queue indices sorted by material class, m_classOffsets[c] is the first entry of class c.
+        std::vector<UINT> m_sortedRays;
+        UINT m_classOffsets[MaterialClass::Count + 1];
+
+        std::vector<Vec3> m_radiance;
+        std::vector<Vec3> m_albedo;
+        std::vector<Vec3> m_normals;
+        std::vector<float> m_depths;
+        std::vector<RayStats> m_threadStats;
+        std::vector<OcclusionCache> m_threadOcclusionCaches;
+        WavefrontStats m_stats;
+    };
+}
+
+#endif // !CPU_WAVEFRONT_H
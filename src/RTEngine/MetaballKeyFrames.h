@@ -0,0 +1,38 @@
+#ifndef METABALLKEYFRAMES_H
+#define METABALLKEYFRAMES_H
+
+//**********************************************************************************************
+//
+// MetaballKeyFrames.h
+//
+// Metaball animation key frames shared by the shaders and the CPU backend,
+// see InitializeAnimatedMetaballs().
+//
+//**********************************************************************************************
+
+#include "RayTracingHlslCompat.h"
+
+// Metaball centers at t0 and t1 key frames and field radii of max influence.
+#if N_METABALLS == 5
+static const XMFLOAT3 c_metaballKeyFrame0[N_METABALLS] =
+{
+    XMFLOAT3(-0.7f, 0, 0), XMFLOAT3(0.7f, 0, 0), XMFLOAT3(0, -0.7f, 0), XMFLOAT3(0, 0.7f, 0), XMFLOAT3(0, 0, 0)
+};
+static const XMFLOAT3 c_metaballKeyFrame1[N_METABALLS] =
+{
+    XMFLOAT3(0.7f, 0, 0), XMFLOAT3(-0.7f, 0, 0), XMFLOAT3(0, 0.7f, 0), XMFLOAT3(0, -0.7f, 0), XMFLOAT3(0, 0, 0)
+};
+static const float c_metaballRadii[N_METABALLS] = { 0.35f, 0.35f, 0.35f, 0.35f, 0.25f };
+#else
+static const XMFLOAT3 c_metaballKeyFrame0[N_METABALLS] =
+{
+    XMFLOAT3(-0.3f, -0.2f, -0.2f), XMFLOAT3(0.0f, -0.2f, 0.5f), XMFLOAT3(0.4f, 0.4f, 0.4f)
+};
+static const XMFLOAT3 c_metaballKeyFrame1[N_METABALLS] =
+{
+    XMFLOAT3(0.4f, 0.4f, 0.0f), XMFLOAT3(0.0f, 0.4f, 0.5f), XMFLOAT3(-0.4f, 0.2f, -0.4f)
+};
+static const float c_metaballRadii[N_METABALLS] = { 0.45f, 0.65f, 0.45f };
+#endif
+
+#endif // METABALLKEYFRAMES_H
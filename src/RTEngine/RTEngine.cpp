@@ -12,6 +12,13 @@
 #include "stdafx.h"
 #include "RTEngine.h"
 #include "UtilityFunctions.h"
+#include "CpuBenchmark.h"
+#include "CpuDistributed.h"
+#include "CpuImageWriter.h"
+#include "CpuSequence.h"
+#include "CpuService.h"
+#include "CpuTonemap.h"
+#include "CpuSceneFile.h"
 #include "CompiledShaders\Raytracing.hlsl.h"
 #include <iostream>
 
@@ -67,6 +74,21 @@ RTEngine::RTEngine(UINT width, UINT height, std::wstring name) :
 
 void RTEngine::OnInit()
 {
+	// Worker processes of a distributed render only render the tiles they're sent, they need no device or scene of their own.
+	if (m_cpuWorkerPort != 0)
+	{
+		RunCpuWorker();
+		PostQuitMessage(0);
+		return;
+	}
+	// The render service loads the scenes of its jobs, it needs no device either.
+	if (m_cpuServicePort != 0)
+	{
+		RunCpuService();
+		PostQuitMessage(0);
+		return;
+	}
+
 	m_deviceResources = std::make_unique<DeviceResources>(
 		DXGI_FORMAT_R8G8B8A8_UNORM,
 		DXGI_FORMAT_UNKNOWN,
@@ -91,14 +113,28 @@ void RTEngine::OnInit()
 
 	CreateDeviceDependentResources();
 	CreateWindowSizeDependentResources();
+
+	if (m_cpuPreview)
+	{
+		StartCpuPreview();
+	}
 }
 
 // Initialize scene rendering parameters.
 void RTEngine::InitializeScene()
 {
+	m_cpuScene.Clear();
+	m_cpuMovingSphere = UINT_MAX;
+	m_materials.clear();
+	memset(m_aabbInstanceCB, 0, sizeof(m_aabbInstanceCB));
+
 	SetupCamera();
 	SetupLights();
 
+	// Path termination.
+	m_sceneCB->maxPathBounces = m_maxPathBounces;
+	m_sceneCB->russianRouletteMinBounces = GPU_RUSSIAN_ROULETTE_MIN_BOUNCES;
+
 	BuildPlaneGeometry();
 
 	// Draw scene
@@ -106,7 +142,11 @@ void RTEngine::InitializeScene()
 	DemoType demo2 = DemoType::RTTNW;
 	DemoType demo3 = DemoType::METABALLS;
 
-	switch (demo2) {
+	if (!m_sceneFile.empty())
+	{
+		LoadSceneFile();
+	}
+	else switch (demo2) {
 	case DemoType::RTIAW:
 		RTIAWRandomScene();
 		break;
@@ -120,6 +160,7 @@ void RTEngine::InitializeScene()
 		assert(false);
 	}
 
+	CreateMaterialBuffer();
 }
 
 // Update camera matrices passed into the shader.
@@ -128,11 +169,16 @@ void RTEngine::UpdateCameraMatrices()
 	auto frameIndex = m_deviceResources->GetCurrentFrameIndex();
 
 	m_sceneCB->cameraPosition = m_eye;
-	float fovAngleY = 20.0f;
-	XMMATRIX view = XMMatrixLookAtLH(m_eye, m_at, m_up);
+	m_sceneCB->projectionToWorld = ProjectionToWorld(m_eye, m_at, m_up);
+}
+
+XMMATRIX RTEngine::ProjectionToWorld(const XMVECTOR& eye, const XMVECTOR& at, const XMVECTOR& up) const
+{
+	float fovAngleY = m_fieldOfView;
+	XMMATRIX view = XMMatrixLookAtLH(eye, at, up);
 	XMMATRIX proj = XMMatrixPerspectiveFovLH(XMConvertToRadians(fovAngleY), m_aspectRatio, 0.01f, 125.0f);
 	XMMATRIX viewProj = view * proj;
-	m_sceneCB->projectionToWorld = XMMatrixInverse(nullptr, viewProj);
+	return XMMatrixInverse(nullptr, viewProj);
 }
 
 // Update AABB primite attributes buffers passed into the shader.
@@ -223,6 +269,10 @@ void RTEngine::SetupLights()
 	float d = 0.6f;
 	lightDiffuseColor = XMFLOAT4(d, d, d, 1.0f);
 	m_sceneCB->lightDiffuseColor = XMLoadFloat4(&lightDiffuseColor);
+
+	m_cpuScene.light.position = Cpu::Vec3(lightPosition.x, lightPosition.y, lightPosition.z);
+	m_cpuScene.light.ambientColor = Cpu::Vec3(lightAmbientColor.x, lightAmbientColor.y, lightAmbientColor.z);
+	m_cpuScene.light.diffuseColor = Cpu::Vec3(d);
 }
 
 void RTEngine::SetupCamera()
@@ -258,7 +308,7 @@ void RTEngine::MetaballDemo()
 		float stepScale = 1.0f
 		)
 	{
-		auto& attributes = m_aabbMaterialCB[primitiveIndex];
+		MaterialConstantBuffer attributes = {};
 		attributes.albedo = albedo;
 		attributes.reflectanceCoef = reflectanceCoef;
 		attributes.diffuseCoef = diffuseCoef;
@@ -266,6 +316,7 @@ void RTEngine::MetaballDemo()
 		attributes.specularPower = specularPower;
 		attributes.fuzz = fuzz;
 		attributes.hasTexture = true;
+		m_aabbInstanceCB[primitiveIndex].materialIndex = AddMaterial(attributes);
 	};
 
 	// Volumetric primitives.
@@ -356,25 +407,29 @@ void RTEngine::RTIAWRandomScene()
 	{
 		for (int b = -numLoops; b < numLoops; b++)
 		{
-			XMFLOAT3 center = XMFLOAT3(a*offsetX  + 0.9 * random_double(), .8, b*offsetY  + 0.9 * random_double());
+			// Each sphere draws from a stream of its own, keyed by its grid cell.
+			Cpu::RandomStream rng(c_sceneSeed, (a + numLoops) * 2 * numLoops + (b + numLoops));
+			float offsetA = static_cast<float>(0.9 * random_double(rng));
+			float offsetB = static_cast<float>(0.9 * random_double(rng));
+			XMFLOAT3 center = XMFLOAT3(a*offsetX  + offsetA, .8, b*offsetY  + offsetB);
 			XMFLOAT3 cutoff = XMFLOAT3(3, .8, 0);
 			float distance = getDistance(center, cutoff);
 			sphereIndex++;
 			if (distance > 0.9) {
-				double chooseMat = random_double();
+				double chooseMat = random_double(rng);
 			
-				XMFLOAT3 box = XMFLOAT3(3, 3, 3);
+				XMFLOAT3 box = XMFLOAT3(c_sphereAABBSize, c_sphereAABBSize, c_sphereAABBSize);
 				Sphere* miniSphere = nullptr;
 				float radius = .2f;
-				float fuzz = random_double(0.01, 0.1);
+				float fuzz = random_double(rng, 0.01, 0.1);
 				if (chooseMat < 0.7) {
-					XMFLOAT4 randA = random();
-					XMFLOAT4 randB = random();
+					XMFLOAT4 randA = random(rng);
+					XMFLOAT4 randB = random(rng);
 					XMFLOAT4 randomAlbedo = XMFLOAT4(randA.x * randB.x, randA.y * randB.y, randA.z * randB.z, 1);
 					miniSphere = new Sphere(sphereIndex, &diffuseMat, randomAlbedo, center, radius);
 				}
 				else if (chooseMat < 0.95) {
-					XMFLOAT4 randomAlbedo = random(.4, 1);
+					XMFLOAT4 randomAlbedo = random(rng, .4, 1);
 					metalMat.fuzz = fuzz;
 					miniSphere = new Sphere(sphereIndex, &metalMat, randomAlbedo, center, radius);
 				}
@@ -388,6 +443,66 @@ void RTEngine::RTIAWRandomScene()
 	}
 }
 
+// Load the -scene file in place of the demo scenes.
+// The GPU path has a fixed set of sphere AABBs, 3 units wide: the first spheres of the file fill them and the
+// rest, the triangles, the metaballs and the many lights only go to the CPU backend.
+void RTEngine::LoadSceneFile()
+{
+	Cpu::ThreadPool threadPool;
+	Cpu::SceneFileLoader loader(threadPool);
+	Cpu::SceneDescription description;
+	loader.Load(m_sceneFile, description);
+
+	if (!description.cameras.empty())
+	{
+		const Cpu::SceneFileCamera& camera = description.cameras.back();
+		m_eye = XMVectorSet(camera.eye.x, camera.eye.y, camera.eye.z, 1);
+		m_at = XMVectorSet(camera.at.x, camera.at.y, camera.at.z, 1);
+		m_up = XMVectorSet(0, 1, 0, 0);
+		m_fieldOfView = camera.fieldOfView;
+		UpdateCameraMatrices();
+	}
+
+	if (!description.lights.empty())
+	{
+		const Cpu::SceneLight& light = description.lights.back();
+		m_sceneCB->lightPosition = XMVectorSet(light.position.x, light.position.y, light.position.z, 0);
+		m_sceneCB->lightAmbientColor = XMVectorSet(light.ambientColor.x, light.ambientColor.y, light.ambientColor.z, 1);
+		m_sceneCB->lightDiffuseColor = XMVectorSet(light.diffuseColor.x, light.diffuseColor.y, light.diffuseColor.z, 1);
+		m_cpuScene.light = light;
+	}
+
+	// The file's materials are appended to both tables without sharing entries, so they keep the same indices.
+	assert(m_materials.size() == m_cpuScene.materials.size());
+	UINT materialBase = static_cast<UINT>(m_materials.size());
+	for (const Cpu::SceneFileMaterial& material : description.materials)
+	{
+		m_materials.push_back(material.constants);
+	}
+	loader.AddToScene(description, m_cpuScene);
+	m_cpuScene.AddEmissivePrimitiveLights();
+	m_sceneMetaballs = description.metaballs;
+
+	// The AABB instance is moved up by half an AABB width, see SetSphereGPU().
+	this->numSpheres = AnalyticPrimitive::Count;
+	m_aabbs.resize(IntersectionShaderType::TotalPrimitiveCount);
+	UINT gpuSphereCount = (std::min)(static_cast<UINT>(description.spheres.size()), static_cast<UINT>(AnalyticPrimitive::Count));
+	for (UINT i = 0; i < gpuSphereCount; i++)
+	{
+		const Cpu::SceneFileSphere& sphere = description.spheres[i];
+		XMFLOAT3 center(sphere.center0.x, sphere.center0.y - c_aabbWidth / 2, sphere.center0.z);
+		float halfSize = c_sphereAABBSize / 2;
+		m_aabbs[i] = D3D12_RAYTRACING_AABB{
+			center.x - halfSize, center.y - halfSize, center.z - halfSize,
+			center.x + halfSize, center.y + halfSize, center.z + halfSize };
+		m_aabbInstanceCB[i].materialIndex = materialBase + sphere.material;
+		m_aabbInstanceCB[i].radius = sphere.radius;
+	}
+
+	auto device = m_deviceResources->GetD3DDevice();
+	AllocateUploadBuffer(device, m_aabbs.data(), m_aabbs.size() * sizeof(m_aabbs[0]), &m_aabbBuffer.resource);
+}
+
 void RTEngine::RTTNWDemo()
 {
 	// Goal: world.add(sphere(location, size, sphereMaterial))
@@ -426,7 +541,11 @@ void RTEngine::RTTNWDemo()
 
 	//Cube of mini spheres
 	for (int j = 0; j < ns; j++) {
-		XMFLOAT3 center = XMFLOAT3(random_double(.3, .6), random_double(1.2,1.5), random_double(1.5,1.2));
+		Cpu::RandomStream rng(c_sceneSeed, j);
+		float x = static_cast<float>(random_double(rng, .3, .6));
+		float y = static_cast<float>(random_double(rng, 1.2, 1.5));
+		float z = static_cast<float>(random_double(rng, 1.5, 1.2));
+		XMFLOAT3 center = XMFLOAT3(x, y, z);
 		sphereIndex++;
 		float radius = .08f;
 		Sphere* miniSphere = new Sphere(sphereIndex, &diffuseMat, white, center, radius);
@@ -481,17 +600,18 @@ void RTEngine::SetSphereGPU(Sphere* pSphere)
 		Material& mat
 		)
 	{
-		MaterialConstantBuffer& attributes = m_aabbMaterialCB[primitiveIndex];
+		MaterialConstantBuffer attributes = {};
 		attributes.albedo = sphere->albedo;
 		attributes.reflectanceCoef = mat.reflectanceCoef;
 		attributes.diffuseCoef = mat.diffuseCoef;
 		attributes.specularCoef = mat.specularCoef;
 		attributes.specularPower = mat.specularPower;
 		attributes.refractionIndex = mat.refractionIndex;
-		attributes.radius = sphere->radius;
 		attributes.fuzz = mat.fuzz;
 		attributes.hasTexture = mat.hasTexture;
 		attributes.hasPerlin = mat.hasPerlin;
+		m_aabbInstanceCB[primitiveIndex].materialIndex = AddMaterial(attributes);
+		m_aabbInstanceCB[primitiveIndex].radius = sphere->radius;
 	};
 
 	// grid for the spheres
@@ -516,15 +636,58 @@ void RTEngine::SetSphereGPU(Sphere* pSphere)
 		};
 	};
 
-	XMFLOAT3 boxSize = XMFLOAT3(3, 3, 3);
+	XMFLOAT3 boxSize = XMFLOAT3(c_sphereAABBSize, c_sphereAABBSize, c_sphereAABBSize);
 	SetAttributes(pSphere->ID, pSphere, *pSphere->material);
 	m_aabbs[pSphere->ID] = InitializeAABB(pSphere->center, boxSize);
 
+	// Mirror the sphere for the CPU backend. The sphere sits in the middle of its AABB
+	// and the AABB instance is moved up by half an AABB width.
+	const D3D12_RAYTRACING_AABB& aabb = m_aabbs[pSphere->ID];
+	Cpu::Vec3 center(
+		0.5f * (aabb.MinX + aabb.MaxX),
+		0.5f * (aabb.MinY + aabb.MaxY) + c_aabbWidth / 2,
+		0.5f * (aabb.MinZ + aabb.MaxZ));
+	// The GPU path teleports the MOVING sphere along z every frame, the CPU backend blurs it over the shutter instead.
+	if (pSphere->ID == AnalyticPrimitive::MOVING)
+	{
+		Cpu::Vec3 center1 = center + Cpu::Vec3(0, 0, c_movingSphereShutterTravel);
+		m_cpuMovingSphere = Cpu::GetPrimitiveIndex(m_cpuScene.AddMovingSphere(center, center1, pSphere->radius, m_aabbInstanceCB[pSphere->ID].materialIndex));
+	}
+	else
+	{
+		m_cpuScene.AddSphere(center, pSphere->radius, m_aabbInstanceCB[pSphere->ID].materialIndex);
+	}
+
 	auto device = m_deviceResources->GetD3DDevice();
 	AllocateUploadBuffer(device, m_aabbs.data(), m_aabbs.size() * sizeof(m_aabbs[0]), &m_aabbBuffer.resource);
 }
 
 
+// Add a material to the material table and return its index.
+// Scenes use a handful of materials for many primitives, so identical materials share one entry.
+UINT RTEngine::AddMaterial(const MaterialConstantBuffer& material)
+{
+	for (UINT i = 0; i < m_materials.size(); i++)
+	{
+		if (memcmp(&m_materials[i], &material, sizeof(material)) == 0)
+		{
+			return i;
+		}
+	}
+
+	// Mirror the table for the CPU backend so both use the same indices.
+	m_materials.push_back(material);
+	m_cpuScene.AddMaterial(material);
+	return static_cast<UINT>(m_materials.size() - 1);
+}
+
+// Upload the material table, it is bound as a structured buffer and indexed by the hit groups.
+void RTEngine::CreateMaterialBuffer()
+{
+	auto device = m_deviceResources->GetD3DDevice();
+	AllocateUploadBuffer(device, m_materials.data(), m_materials.size() * sizeof(m_materials[0]), &m_materialBuffer.resource, L"Material table");
+}
+
 // Create constant buffers.
 void RTEngine::CreateConstantBuffers()
 {
@@ -563,6 +726,32 @@ void RTEngine::CreateDeviceDependentResources()
 
 	InitializeScene();
 
+	if (m_runCpuBenchmark)
+	{
+		RunCpuBenchmark();
+	}
+
+	if (!m_cpuImageFile.empty())
+	{
+		RenderCpuImage();
+	}
+
+	// Batch mode: quit once the sequence is on disk.
+	if (m_cpuSequenceFrames > 0)
+	{
+		RenderCpuSequence();
+		PostQuitMessage(0);
+		return;
+	}
+
+	// Batch mode: quit once the workers have rendered the image.
+	if (!m_cpuDistributedFile.empty())
+	{
+		RenderCpuDistributed();
+		PostQuitMessage(0);
+		return;
+	}
+
 	// Build raytracing acceleration structures from the generated geometry.
 	BuildAccelerationStructures();
 
@@ -605,6 +794,7 @@ void RTEngine::CreateRootSignatures()
 		rootParameters[GlobalRootSignature::Slot::AccelerationStructure].InitAsShaderResourceView(0);
 		rootParameters[GlobalRootSignature::Slot::SceneConstant].InitAsConstantBufferView(0);
 		rootParameters[GlobalRootSignature::Slot::AABBattributeBuffer].InitAsShaderResourceView(3);
+		rootParameters[GlobalRootSignature::Slot::MaterialBuffer].InitAsShaderResourceView(4);
 		rootParameters[GlobalRootSignature::Slot::VertexBuffers].InitAsDescriptorTable(1, &ranges[1]);
 		CD3DX12_ROOT_SIGNATURE_DESC globalRootSignatureDesc(ARRAYSIZE(rootParameters), rootParameters);
 		SerializeAndCreateRaytracingRootSignature(globalRootSignatureDesc, &m_raytracingGlobalRootSignature);
@@ -617,7 +807,7 @@ void RTEngine::CreateRootSignatures()
 		{
 			namespace RootSignatureSlots = LocalRootSignature::Triangle::Slot;
 			CD3DX12_ROOT_PARAMETER rootParameters[RootSignatureSlots::Count];
-			rootParameters[RootSignatureSlots::MaterialConstant].InitAsConstants(SizeOfInUint32(MaterialConstantBuffer), 1);
+			rootParameters[RootSignatureSlots::PrimitiveConstant].InitAsConstants(SizeOfInUint32(PrimitiveInstanceConstantBuffer), 1);
 
 			CD3DX12_ROOT_SIGNATURE_DESC localRootSignatureDesc(ARRAYSIZE(rootParameters), rootParameters);
 			localRootSignatureDesc.Flags = D3D12_ROOT_SIGNATURE_FLAG_LOCAL_ROOT_SIGNATURE;
@@ -628,8 +818,7 @@ void RTEngine::CreateRootSignatures()
 		{
 			namespace RootSignatureSlots = LocalRootSignature::AABB::Slot;
 			CD3DX12_ROOT_PARAMETER rootParameters[RootSignatureSlots::Count];
-			rootParameters[RootSignatureSlots::MaterialConstant].InitAsConstants(SizeOfInUint32(MaterialConstantBuffer), 1);
-			rootParameters[RootSignatureSlots::GeometryIndex].InitAsConstants(SizeOfInUint32(PrimitiveInstanceConstantBuffer), 2);
+			rootParameters[RootSignatureSlots::PrimitiveConstant].InitAsConstants(SizeOfInUint32(PrimitiveInstanceConstantBuffer), 1);
 
 			CD3DX12_ROOT_SIGNATURE_DESC localRootSignatureDesc(ARRAYSIZE(rootParameters), rootParameters);
 			localRootSignatureDesc.Flags = D3D12_ROOT_SIGNATURE_FLAG_LOCAL_ROOT_SIGNATURE;
@@ -802,6 +991,20 @@ void RTEngine::CreateRaytracingOutputResource()
 	UAVDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
 	device->CreateUnorderedAccessView(m_raytracingOutput.Get(), nullptr, &UAVDesc, uavDescriptorHandle);
 	m_raytracingOutputResourceUAVGpuDescriptor = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_descriptorHeap->GetGPUDescriptorHandleForHeapStart(), m_raytracingOutputResourceUAVDescriptorHeapIndex, m_descriptorSize);
+
+	// Upload buffers the CPU preview is copied to the output from, one per frame in flight.
+	if (m_cpuPreview)
+	{
+		UINT64 uploadSize;
+		device->GetCopyableFootprints(&uavDesc, 0, 1, 0, &m_cpuPreviewFootprint, nullptr, nullptr, &uploadSize);
+		auto uploadHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+		auto uploadDesc = CD3DX12_RESOURCE_DESC::Buffer(uploadSize);
+		for (auto& upload : m_cpuPreviewUpload)
+		{
+			ThrowIfFailed(device->CreateCommittedResource(
+				&uploadHeapProperties, D3D12_HEAP_FLAG_NONE, &uploadDesc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&upload)));
+		}
+	}
 }
 
 void RTEngine::CreateAuxilaryDeviceResources()
@@ -835,7 +1038,8 @@ void RTEngine::CreateDescriptorHeap()
 
 void RTEngine::BuildPlaneGeometry()
 {
-	m_planeMaterialCB = { XMFLOAT4(0.5f, 0.5f, 0.6f, 1.0f), 0.1f, 2, 0.1f, 50, 1 };
+	MaterialConstantBuffer planeMaterial = { XMFLOAT4(0.5f, 0.5f, 0.6f, 1.0f), 0.1f, 2, 0.1f, 50, 1 };
+	m_planeMaterialIndex = AddMaterial(planeMaterial);
 
 	auto device = m_deviceResources->GetD3DDevice();
 	// Plane indices.
@@ -861,6 +1065,39 @@ void RTEngine::BuildPlaneGeometry()
 	UINT descriptorIndexIB = CreateBufferSRV(&m_PlaneIndexBuffer, sizeof(indices) / 4, 0);
 	UINT descriptorIndexVB = CreateBufferSRV(&m_PlaneVertexBuffer, ARRAYSIZE(vertices), sizeof(vertices[0]));
 	ThrowIfFalse(descriptorIndexVB == descriptorIndexIB + 1, L"Vertex Buffer descriptor index must follow that of Index Buffer descriptor index");
+
+	// Mirror the plane in world space for the CPU backend.
+	XMMATRIX mTransform = GetPlaneInstanceTransform();
+	for (UINT i = 0; i < ARRAYSIZE(indices); i += 3)
+	{
+		XMFLOAT3 v[3];
+		for (UINT j = 0; j < 3; j++)
+		{
+			XMStoreFloat3(&v[j], XMVector3Transform(XMLoadFloat3(&vertices[indices[i + j]].position), mTransform));
+		}
+		m_cpuScene.AddTriangle(v[0], v[1], v[2], m_planeMaterialIndex);
+	}
+}
+
+// Transform of the plane bottom-level AS instance.
+XMMATRIX RTEngine::GetPlaneInstanceTransform()
+{
+	// Width of a bottom-level AS geometry.
+	// Make the plane a little larger than the actual number of primitives in each dimension.
+	const XMUINT3 NUM_AABB = XMUINT3(70, 1, 70);
+	const XMFLOAT3 fWidth = XMFLOAT3(
+		NUM_AABB.x * c_aabbWidth + (NUM_AABB.x - 1) * c_aabbDistance,
+		NUM_AABB.y * c_aabbWidth + (NUM_AABB.y - 1) * c_aabbDistance,
+		NUM_AABB.z * c_aabbWidth + (NUM_AABB.z - 1) * c_aabbDistance);
+	const XMVECTOR vWidth = XMLoadFloat3(&fWidth);
+
+	// Calculate transformation matrix.
+	const XMVECTOR vBasePosition = vWidth * XMLoadFloat3(&XMFLOAT3(-0.35f, 0.25f, -0.35f));
+
+	// Scale in XZ dimensions.
+	XMMATRIX mScale = XMMatrixScaling(fWidth.x, fWidth.y, fWidth.z);
+	XMMATRIX mTranslation = XMMatrixTranslationFromVector(vBasePosition);
+	return mScale * mTranslation;
 }
 
 void RTEngine::BuildTetrahedronGeometry()
@@ -1009,16 +1246,6 @@ void RTEngine::BuildBotomLevelASInstanceDescs(BLASPtrType* bottomLevelASaddresse
 	vector<InstanceDescType> instanceDescs;
 	instanceDescs.resize(NUM_BLAS);
 
-	// Width of a bottom-level AS geometry.
-	// Make the plane a little larger than the actual number of primitives in each dimension.
-	const XMUINT3 NUM_AABB = XMUINT3(70, 1, 70);
-	const XMFLOAT3 fWidth = XMFLOAT3(
-		NUM_AABB.x * c_aabbWidth + (NUM_AABB.x - 1) * c_aabbDistance,
-		NUM_AABB.y * c_aabbWidth + (NUM_AABB.y - 1) * c_aabbDistance,
-		NUM_AABB.z * c_aabbWidth + (NUM_AABB.z - 1) * c_aabbDistance);
-	const XMVECTOR vWidth = XMLoadFloat3(&fWidth);
-
-
 	// Bottom-level AS with a single plane.
 	{
 		auto& instanceDesc = instanceDescs[BottomLevelASType::Triangle];
@@ -1027,13 +1254,7 @@ void RTEngine::BuildBotomLevelASInstanceDescs(BLASPtrType* bottomLevelASaddresse
 		instanceDesc.InstanceContributionToHitGroupIndex = 0;
 		instanceDesc.AccelerationStructure = bottomLevelASaddresses[BottomLevelASType::Triangle];
 
-		// Calculate transformation matrix.
-		const XMVECTOR vBasePosition = vWidth * XMLoadFloat3(&XMFLOAT3(-0.35f, 0.25f, -0.35f));
-
-		// Scale in XZ dimensions.
-		XMMATRIX mScale = XMMatrixScaling(fWidth.x, fWidth.y, fWidth.z);
-		XMMATRIX mTranslation = XMMatrixTranslationFromVector(vBasePosition);
-		XMMATRIX mTransform = mScale * mTranslation;
+		XMMATRIX mTransform = GetPlaneInstanceTransform();
 		XMStoreFloat3x4(reinterpret_cast<XMFLOAT3X4*>(instanceDesc.Transform), mTransform);
 	}
 
@@ -1266,8 +1487,8 @@ void RTEngine::BuildShaderTables()
 
 		// Triangle geometry hit groups.
 		{
-			LocalRootSignature::Triangle::RootArguments rootArgs;
-			rootArgs.materialCb = m_planeMaterialCB;
+			LocalRootSignature::Triangle::RootArguments rootArgs = {};
+			rootArgs.primitiveCB.materialIndex = m_planeMaterialIndex;
 
 			for (auto& hitGroupShaderID : hitGroupShaderIDs_TriangleGeometry)
 			{
@@ -1288,9 +1509,9 @@ void RTEngine::BuildShaderTables()
 				// Primitives for each intersection shader.
 				for (UINT primitiveIndex = 0; primitiveIndex < numPrimitiveTypes; primitiveIndex++, instanceIndex++)
 				{
-					rootArgs.materialCb = m_aabbMaterialCB[instanceIndex];
-					rootArgs.aabbCB.instanceIndex = instanceIndex;
-					rootArgs.aabbCB.primitiveType = primitiveIndex;
+					rootArgs.primitiveCB = m_aabbInstanceCB[instanceIndex];
+					rootArgs.primitiveCB.instanceIndex = instanceIndex;
+					rootArgs.primitiveCB.primitiveType = primitiveIndex;
 
 					// Ray types.
 					for (UINT r = 0; r < RayType::Count; r++)
@@ -1303,6 +1524,14 @@ void RTEngine::BuildShaderTables()
 		}
 		hitGroupShaderTable.DebugPrint(shaderIdToStringMap);
 		m_hitGroupShaderTableStrideInBytes = hitGroupShaderTable.GetShaderRecordSize();
+
+		wstringstream text;
+		text << setprecision(2) << fixed
+			<< L"Hit group shader table: " << numShaderRecords << L" records x " << m_hitGroupShaderTableStrideInBytes << L" bytes = "
+			<< numShaderRecords * m_hitGroupShaderTableStrideInBytes / 1024.0 << L"KB"
+			<< L"    material table: " << m_materials.size() << L" materials x " << sizeof(MaterialConstantBuffer) << L" bytes = "
+			<< m_materials.size() * sizeof(MaterialConstantBuffer) / 1024.0 << L"KB\n";
+		OutputDebugStringW(text.str().c_str());
 		m_hitGroupShaderTable = hitGroupShaderTable.GetResource();
 	}
 }
@@ -1329,12 +1558,14 @@ void RTEngine::OnKeyDown(UINT8 key)
 		m_up = XMVector3Transform(m_up, rotate);
 		m_at = XMVector3Transform(m_at, rotate);
 		UpdateCameraMatrices();
+		UpdateCpuPreviewCamera();
 		break;
 	case 'A':
 		m_eye = XMVector3Transform(m_eye, rotate);
 		m_up = XMVector3Transform(m_up, rotate);
 		m_at = XMVector3Transform(m_at, rotate);
 		UpdateCameraMatrices();
+		UpdateCpuPreviewCamera();
 		break;
 	}
 }
@@ -1343,6 +1574,12 @@ void RTEngine::OnKeyDown(UINT8 key)
 bool flip = true;
 void RTEngine::OnUpdate()
 {
+	// Worker processes have no device, see OnInit().
+	if (!m_deviceResources)
+	{
+		return;
+	}
+
 	m_timer.Tick();
 	CalculateFrameStats();
 	float elapsedTime = static_cast<float>(m_timer.GetElapsedSeconds());
@@ -1359,6 +1596,7 @@ void RTEngine::OnUpdate()
 		m_up = XMVector3Transform(m_up, rotate);
 		m_at = XMVector3Transform(m_at, rotate);
 		UpdateCameraMatrices();
+		UpdateCpuPreviewCamera();
 	}
 
 	// Rotate the second light around Y axis.
@@ -1437,6 +1675,9 @@ void RTEngine::DoRaytracing()
 		commandList->SetComputeRootShaderResourceView(GlobalRootSignature::Slot::AABBattributeBuffer, m_aabbPrimitiveAttributeBuffer.GpuVirtualAddress(frameIndex));
 	}
 
+	// Static material table.
+	commandList->SetComputeRootShaderResourceView(GlobalRootSignature::Slot::MaterialBuffer, m_materialBuffer.resource->GetGPUVirtualAddress());
+
 	// Bind the heaps, acceleration structure and dispatch rays.  
 	D3D12_DISPATCH_RAYS_DESC dispatchDesc = {};
 	SetCommonPipelineState(commandList);
@@ -1475,12 +1716,17 @@ void RTEngine::CreateWindowSizeDependentResources()
 {
 	CreateRaytracingOutputResource();
 	UpdateCameraMatrices();
+	UpdateCpuPreviewCamera();
 }
 
 // Release resources that are dependent on the size of the main window.
 void RTEngine::ReleaseWindowSizeDependentResources()
 {
 	m_raytracingOutput.Reset();
+	for (auto& upload : m_cpuPreviewUpload)
+	{
+		upload.Reset();
+	}
 }
 
 // Release all resources that depend on the device.
@@ -1510,6 +1756,7 @@ void RTEngine::ReleaseDeviceDependentResources()
 	/*  m_TetraIndexBuffer.resource.Reset();
 	  m_TetraVertexBuffer.resource.Reset();*/
 	m_aabbBuffer.resource.Reset();
+	m_materialBuffer.resource.Reset();
 
 	ResetComPtrArray(&m_bottomLevelAS);
 	m_topLevelAS.Reset();
@@ -1538,7 +1785,7 @@ void RTEngine::RecreateD3D()
 // Render the scene.
 void RTEngine::OnRender()
 {
-	if (!m_deviceResources->IsWindowVisible())
+	if (!m_deviceResources || !m_deviceResources->IsWindowVisible())
 	{
 		return;
 	}
@@ -1553,7 +1800,14 @@ void RTEngine::OnRender()
 		gpuTimer.BeginFrame(commandList);
 	}
 
-	DoRaytracing();
+	if (m_cpuPreview)
+	{
+		CopyCpuPreviewToOutput();
+	}
+	else
+	{
+		DoRaytracing();
+	}
 	CopyRaytracingOutputToBackbuffer();
 
 	// End frame.
@@ -1567,6 +1821,13 @@ void RTEngine::OnRender()
 
 void RTEngine::OnDestroy()
 {
+	if (!m_deviceResources)
+	{
+		return;
+	}
+
+	StopCpuPreview();
+
 	// Let GPU finish before releasing D3D resources.
 	m_deviceResources->WaitForGpu();
 	OnDeviceLost();
@@ -1586,6 +1847,429 @@ void RTEngine::OnDeviceRestored()
 	CreateWindowSizeDependentResources();
 }
 
+void RTEngine::ParseCommandLineArgs(WCHAR* argv[], int argc)
+{
+	DXSample::ParseCommandLineArgs(argv, argc);
+
+	for (int i = 1; i < argc; ++i)
+	{
+		// -cpuBenchmark
+		if (_wcsnicmp(argv[i], L"-cpuBenchmark", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/cpuBenchmark", wcslen(argv[i])) == 0)
+		{
+			m_runCpuBenchmark = true;
+		}
+		// -cpuPreview
+		else if (_wcsnicmp(argv[i], L"-cpuPreview", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/cpuPreview", wcslen(argv[i])) == 0)
+		{
+			m_cpuPreview = true;
+		}
+		// -maxBounces [n]
+		else if (_wcsnicmp(argv[i], L"-maxBounces", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/maxBounces", wcslen(argv[i])) == 0)
+		{
+			ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+			m_maxPathBounces = (std::max)(1, _wtoi(argv[i + 1]));
+			i++;
+		}
+		// -metaballs [file]
+		else if (_wcsnicmp(argv[i], L"-metaballs", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/metaballs", wcslen(argv[i])) == 0)
+		{
+			ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+			m_metaballFile = argv[i + 1];
+			i++;
+		}
+		// -scene [file]
+		else if (_wcsnicmp(argv[i], L"-scene", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/scene", wcslen(argv[i])) == 0)
+		{
+			ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+			m_sceneFile = argv[i + 1];
+			i++;
+		}
+		// -cpuImage [file]
+		else if (_wcsnicmp(argv[i], L"-cpuImage", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/cpuImage", wcslen(argv[i])) == 0)
+		{
+			ThrowIfFalse(i + 1 < argc, L"Incorrect argument format passed in.");
+
+			m_cpuImageFile = argv[i + 1];
+			i++;
+		}
+		// -cpuSequence [frames] [file]
+		else if (_wcsnicmp(argv[i], L"-cpuSequence", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/cpuSequence", wcslen(argv[i])) == 0)
+		{
+			ThrowIfFalse(i + 2 < argc, L"Incorrect argument format passed in.");
+
+			m_cpuSequenceFrames = static_cast<UINT>(_wtoi(argv[i + 1]));
+			m_cpuSequenceFile = argv[i + 2];
+			i += 2;
+		}
+		// -cpuDistributed [port] [workers] [file]
+		else if (_wcsnicmp(argv[i], L"-cpuDistributed", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/cpuDistributed", wcslen(argv[i])) == 0)
+		{
+			ThrowIfFalse(i + 3 < argc, L"Incorrect argument format passed in.");
+
+			m_cpuDistributedPort = static_cast<UINT>(_wtoi(argv[i + 1]));
+			m_cpuDistributedWorkers = static_cast<UINT>(_wtoi(argv[i + 2]));
+			m_cpuDistributedFile = argv[i + 3];
+			i += 3;
+		}
+		// -cpuWorker [host] [port] [threads]
+		else if (_wcsnicmp(argv[i], L"-cpuWorker", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/cpuWorker", wcslen(argv[i])) == 0)
+		{
+			ThrowIfFalse(i + 3 < argc, L"Incorrect argument format passed in.");
+
+			// Host names are ASCII.
+			m_cpuWorkerHost.clear();
+			for (const wchar_t* c = argv[i + 1]; *c; c++)
+			{
+				m_cpuWorkerHost += static_cast<char>(*c);
+			}
+			m_cpuWorkerPort = static_cast<UINT>(_wtoi(argv[i + 2]));
+			m_cpuWorkerThreads = static_cast<UINT>(_wtoi(argv[i + 3]));
+			ThrowIfFalse(m_cpuWorkerPort != 0, L"Incorrect argument format passed in.");
+			i += 3;
+		}
+		// -cpuService [port] [scenes]
+		else if (_wcsnicmp(argv[i], L"-cpuService", wcslen(argv[i])) == 0 ||
+			_wcsnicmp(argv[i], L"/cpuService", wcslen(argv[i])) == 0)
+		{
+			ThrowIfFalse(i + 2 < argc, L"Incorrect argument format passed in.");
+
+			m_cpuServicePort = static_cast<UINT>(_wtoi(argv[i + 1]));
+			m_cpuServiceScenes = static_cast<UINT>(_wtoi(argv[i + 2]));
+			ThrowIfFalse(m_cpuServicePort != 0 && m_cpuServiceScenes != 0, L"Incorrect argument format passed in.");
+			i += 2;
+		}
+	}
+}
+
+// Run the CPU backend benchmarks on the current scene, results are written to the debug output.
+void RTEngine::RunCpuBenchmark()
+{
+	Cpu::Camera camera;
+	camera.Set(m_sceneCB->projectionToWorld, m_eye, m_width, m_height);
+
+	Cpu::Benchmark benchmark(m_cpuScene, camera, m_maxPathBounces);
+	benchmark.SetMetaballFile(m_metaballFile);
+	benchmark.SetSceneMetaballs(m_sceneMetaballs);
+	benchmark.Run();
+}
+
+// Render the frame with the CPU backend and write it to an image, see Cpu::ImageFormatFromPath().
+void RTEngine::RenderCpuImage()
+{
+	Cpu::Camera camera;
+	camera.Set(m_sceneCB->projectionToWorld, m_eye, m_width, m_height);
+
+	Cpu::ThreadPool threadPool;
+	Cpu::BVH bvh;
+	bvh.Build(m_cpuScene);
+	Cpu::WavefrontRenderer renderer(threadPool);
+	Cpu::PathSettings settings;
+	settings.maxBounces = m_maxPathBounces;
+
+	Cpu::ImageFormat::Enum format = Cpu::ImageFormatFromPath(m_cpuImageFile);
+	Cpu::ImageWriter writer;
+	writer.Open(m_cpuImageFile, format, m_width, m_height, Cpu::RenderImageLayers(format == Cpu::ImageFormat::EXR));
+	Cpu::RenderImage(renderer, m_cpuScene, bvh, camera, settings, writer);
+	writer.Close();
+}
+
+// Render the animation OnUpdate() plays in real time with the CPU backend, a fixed 1/30s of animation time per frame,
+// and write the frames to numbered images. Results are written to the debug output.
+void RTEngine::RenderCpuSequence()
+{
+	// Camera and light orbits and the MOVING sphere's bounce as OnUpdate() advances them, as functions of the time.
+	// The GPU path teleports the sphere along z between -1 and 1 at a unit per second.
+	XMVECTOR eye = m_eye;
+	XMVECTOR at = m_at;
+	XMVECTOR up = m_up;
+	Cpu::Vec3 lightPosition = m_cpuScene.light.position;
+	float movingSphereZ = m_cpuMovingSphere != UINT_MAX ? m_cpuScene.sphereCenterZ[m_cpuMovingSphere] : 0.0f;
+	auto update = [&](float time, Cpu::Scene& scene, Cpu::Camera& camera)
+	{
+		if (m_animateCamera)
+		{
+			XMMATRIX rotate = XMMatrixRotationY(XMConvertToRadians(360.0f * time / 48.0f));
+			XMVECTOR frameEye = XMVector3Transform(eye, rotate);
+			camera.Set(ProjectionToWorld(frameEye, XMVector3Transform(at, rotate), XMVector3Transform(up, rotate)), frameEye, m_width, m_height);
+		}
+		if (m_animateLight)
+		{
+			XMMATRIX rotate = XMMatrixRotationY(XMConvertToRadians(-360.0f * time / 8.0f));
+			XMFLOAT3 position;
+			XMStoreFloat3(&position, XMVector3Transform(XMVectorSet(lightPosition.x, lightPosition.y, lightPosition.z, 1.0f), rotate));
+			scene.light.position = Cpu::Vec3(position);
+		}
+		if (m_animateGeometry && m_cpuMovingSphere != UINT_MAX)
+		{
+			scene.sphereCenterZ[m_cpuMovingSphere] = movingSphereZ + 1.0f - std::fabs(std::fmod(time + 1.0f, 4.0f) - 2.0f);
+		}
+	};
+
+	Cpu::Camera camera;
+	camera.Set(m_sceneCB->projectionToWorld, m_eye, m_width, m_height);
+	Cpu::SequenceSettings settings;
+	settings.frameCount = m_cpuSequenceFrames;
+	settings.pathSettings.maxBounces = m_maxPathBounces;
+
+	Cpu::ThreadPool threadPool;
+	Cpu::SequenceRenderer renderer(threadPool);
+	renderer.Render(m_cpuScene, camera, update, m_cpuSequenceFile, settings);
+
+	wstringstream text;
+	text << setprecision(2) << fixed
+		<< L"CPU sequence: " << m_cpuSequenceFrames << L" frames    total: " << renderer.TotalMS() << L"ms    "
+		<< m_cpuSequenceFrames * 1000.0 / renderer.TotalMS() << L" frames/s\n";
+	for (UINT i = 0; i < m_cpuSequenceFrames; i++)
+	{
+		const Cpu::SequenceFrameStats& stats = renderer.FrameStats()[i];
+		text << L"    frame " << i << L": " << stats.frameMS << L"ms    update: " << stats.updateMS << L"ms    BVH: " << stats.bvhMS
+			<< L"ms    render: " << stats.renderMS << L"ms\n";
+	}
+	OutputDebugStringW(text.str().c_str());
+}
+
+// Render the frame with the CPU backend on worker processes started on this machine, and on any started elsewhere
+// with -cpuWorker that connect to the port, then write it to an image like -cpuImage, radiance only.
+// Results are written to the debug output.
+void RTEngine::RenderCpuDistributed()
+{
+	Cpu::Camera camera;
+	camera.Set(m_sceneCB->projectionToWorld, m_eye, m_width, m_height);
+	Cpu::BVH bvh;
+	bvh.Build(m_cpuScene);
+	Cpu::PathSettings settings;
+	settings.maxBounces = m_maxPathBounces;
+
+	// Local workers run this executable hidden, in worker mode, and split the hardware threads between them.
+	WCHAR executable[MAX_PATH];
+	ThrowIfFalse(GetModuleFileNameW(nullptr, executable, MAX_PATH) > 0, L"Failed to get the executable's path.");
+	UINT threadsPerWorker = (std::max)(1u, std::thread::hardware_concurrency() / (std::max)(1u, m_cpuDistributedWorkers));
+
+	vector<HANDLE> workerProcesses;
+	vector<Cpu::Vec3> image;
+	Cpu::DistributedStats stats;
+	{
+		Cpu::TileCoordinator coordinator;
+		coordinator.Listen(static_cast<UINT16>(m_cpuDistributedPort));
+		coordinator.SetScene(m_cpuScene, bvh);
+		for (UINT i = 0; i < m_cpuDistributedWorkers; i++)
+		{
+			wstring commandLine = L"\"" + wstring(executable) + L"\" -cpuWorker localhost " + to_wstring(coordinator.Port()) + L" " + to_wstring(threadsPerWorker);
+			STARTUPINFOW startupInfo = {};
+			startupInfo.cb = sizeof(startupInfo);
+			startupInfo.dwFlags = STARTF_USESHOWWINDOW;
+			startupInfo.wShowWindow = SW_HIDE;
+			PROCESS_INFORMATION processInfo = {};
+			ThrowIfFalse(CreateProcessW(executable, &commandLine[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startupInfo, &processInfo) != FALSE,
+				L"Failed to start a worker process.");
+			CloseHandle(processInfo.hThread);
+			workerProcesses.push_back(processInfo.hProcess);
+		}
+		ThrowIfFalse(coordinator.WaitForWorkers(m_cpuDistributedWorkers, 30000), L"The worker processes failed to connect.");
+
+		// Workers that connect later still get tiles.
+		coordinator.Render(camera, settings, image);
+		stats = coordinator.Stats();
+	}
+
+	// The coordinator told the workers to exit when it went out of scope.
+	for (HANDLE process : workerProcesses)
+	{
+		WaitForSingleObject(process, 10000);
+		CloseHandle(process);
+	}
+
+	Cpu::ImageWriter writer;
+	writer.Open(m_cpuDistributedFile, Cpu::ImageFormatFromPath(m_cpuDistributedFile), m_width, m_height, Cpu::RenderImageLayers(false));
+	for (UINT tileY = 0; tileY < writer.TilesY(); tileY++)
+	{
+		for (UINT tileX = 0; tileX < writer.TilesX(); tileX++)
+		{
+			const float* pixels = &image[static_cast<size_t>(tileY) * writer.TileHeight() * m_width + tileX * writer.TileWidth()].x;
+			writer.WriteTile(tileX, tileY, &pixels, m_width);
+		}
+	}
+	writer.Close();
+
+	wstringstream text;
+	text << setprecision(2) << fixed
+		<< L"CPU distributed render: " << stats.renderMS << L"ms    workers: " << stats.workers << L"    tiles: " << stats.tiles
+		<< L"    lost workers: " << stats.lostWorkers << L"    reissued: " << stats.reissuedTiles << L"    stolen: " << stats.stolenTiles
+		<< L"    scene sent: " << stats.sceneBytes / (1024.0 * 1024.0) << L"MB\n";
+	OutputDebugStringW(text.str().c_str());
+}
+
+// Render tiles for the coordinator of a distributed render until it's done, see RenderCpuDistributed().
+void RTEngine::RunCpuWorker()
+{
+	Cpu::ThreadPool threadPool(m_cpuWorkerThreads);
+	Cpu::TileWorker worker(threadPool);
+	UINT tiles = worker.Run(m_cpuWorkerHost, static_cast<UINT16>(m_cpuWorkerPort));
+
+	wstringstream text;
+	text << L"CPU worker: " << tiles << L" tiles rendered\n";
+	OutputDebugStringW(text.str().c_str());
+}
+
+// Serve render jobs from clients on this machine until one of them stops the service.
+void RTEngine::RunCpuService()
+{
+	Cpu::ThreadPool threadPool;
+	Cpu::RenderServiceSettings settings;
+	settings.maxScenes = m_cpuServiceScenes;
+	Cpu::RenderService service(threadPool, settings);
+	service.Listen(static_cast<UINT16>(m_cpuServicePort));
+
+	wstringstream text;
+	text << L"CPU render service: listening on port " << service.Port() << L", up to " << settings.maxScenes << L" scenes cached\n";
+	OutputDebugStringW(text.str().c_str());
+	service.Run();
+}
+
+// Start the thread that renders the CPU preview shown in the window, on a copy of the scene.
+void RTEngine::StartCpuPreview()
+{
+	m_cpuPreviewThread = thread(&RTEngine::CpuPreviewThreadMain, this, m_cpuScene);
+}
+
+void RTEngine::StopCpuPreview()
+{
+	if (!m_cpuPreviewThread.joinable())
+	{
+		return;
+	}
+	{
+		lock_guard<mutex> lock(m_cpuPreviewMutex);
+		m_cpuPreviewExit = true;
+		m_cpuPreviewCancel = true;
+	}
+	m_cpuPreviewCondition.notify_one();
+	m_cpuPreviewThread.join();
+}
+
+// Cancel the preview in flight and have the preview thread start over on the current camera.
+void RTEngine::UpdateCpuPreviewCamera()
+{
+	if (!m_cpuPreview)
+	{
+		return;
+	}
+	{
+		lock_guard<mutex> lock(m_cpuPreviewMutex);
+		m_cpuPreviewCamera.Set(m_sceneCB->projectionToWorld, m_eye, m_width, m_height);
+		m_cpuPreviewCameraVersion++;
+		m_cpuPreviewCancel = true;
+	}
+	m_cpuPreviewCondition.notify_one();
+}
+
+// Render coarse to fine previews of the latest camera until the engine exits, handing each completed level to OnRender().
+void RTEngine::CpuPreviewThreadMain(Cpu::Scene scene)
+{
+	Cpu::ThreadPool threadPool;
+	Cpu::BVH bvh;
+	bvh.Build(scene);
+	Cpu::PreviewRenderer preview(threadPool);
+	Cpu::PathSettings settings;
+	settings.maxBounces = m_maxPathBounces;
+	Cpu::OutputTransform transform;
+	Cpu::Camera camera;
+
+	// Levels are tone mapped on this thread, OnRender() only copies them.
+	vector<BYTE> rgb;
+	vector<UINT> pixels;
+	UINT renderedVersion = 0;
+	preview.SetLevelCallback([&](const vector<Cpu::Vec3>& image)
+	{
+		rgb.resize(3 * camera.width);
+		pixels.resize(camera.width * camera.height);
+		for (UINT y = 0; y < camera.height; y++)
+		{
+			Cpu::TonemapRow(&image[y * camera.width].x, camera.width, 0, y, transform, rgb.data());
+			for (UINT x = 0; x < camera.width; x++)
+			{
+				pixels[y * camera.width + x] = rgb[3 * x] | (rgb[3 * x + 1] << 8) | (rgb[3 * x + 2] << 16) | 0xFF000000u;
+			}
+		}
+
+		// A level of a camera that has moved since would overwrite the newer camera's last level.
+		lock_guard<mutex> lock(m_cpuPreviewMutex);
+		if (renderedVersion != m_cpuPreviewCameraVersion)
+		{
+			return;
+		}
+		m_cpuPreviewPixels.swap(pixels);
+		m_cpuPreviewWidth = camera.width;
+		m_cpuPreviewHeight = camera.height;
+		m_cpuPreviewUpdated = true;
+	});
+
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(m_cpuPreviewMutex);
+			m_cpuPreviewCondition.wait(lock, [&] { return m_cpuPreviewExit || m_cpuPreviewCameraVersion != renderedVersion; });
+			if (m_cpuPreviewExit)
+			{
+				return;
+			}
+			camera = m_cpuPreviewCamera;
+			renderedVersion = m_cpuPreviewCameraVersion;
+
+			// Camera changes from here on cancel this preview.
+			m_cpuPreviewCancel = false;
+		}
+		preview.Render(scene, bvh, camera, settings, Cpu::PreviewSettings(), &m_cpuPreviewCancel);
+	}
+}
+
+// Upload the latest completed preview level to the raytracing output, which is then presented like a GPU frame.
+void RTEngine::CopyCpuPreviewToOutput()
+{
+	auto commandList = m_deviceResources->GetCommandList();
+	ID3D12Resource* upload = m_cpuPreviewUpload[m_deviceResources->GetCurrentFrameIndex()].Get();
+	{
+		lock_guard<mutex> lock(m_cpuPreviewMutex);
+		if (!m_cpuPreviewUpdated || m_cpuPreviewWidth != m_width || m_cpuPreviewHeight != m_height)
+		{
+			return;
+		}
+		m_cpuPreviewUpdated = false;
+
+		// The upload buffer's rows are padded to the texture data pitch.
+		BYTE* mapped;
+		CD3DX12_RANGE readRange(0, 0);
+		ThrowIfFailed(upload->Map(0, &readRange, reinterpret_cast<void**>(&mapped)));
+		for (UINT y = 0; y < m_height; y++)
+		{
+			memcpy(mapped + m_cpuPreviewFootprint.Offset + y * m_cpuPreviewFootprint.Footprint.RowPitch, &m_cpuPreviewPixels[y * m_width], m_width * sizeof(UINT));
+		}
+		upload->Unmap(0, nullptr);
+	}
+
+	auto preCopyBarrier = CD3DX12_RESOURCE_BARRIER::Transition(m_raytracingOutput.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST);
+	commandList->ResourceBarrier(1, &preCopyBarrier);
+
+	CD3DX12_TEXTURE_COPY_LOCATION destination(m_raytracingOutput.Get(), 0);
+	CD3DX12_TEXTURE_COPY_LOCATION source(upload, m_cpuPreviewFootprint);
+	commandList->CopyTextureRegion(&destination, 0, 0, 0, &source, nullptr);
+
+	auto postCopyBarrier = CD3DX12_RESOURCE_BARRIER::Transition(m_raytracingOutput.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	commandList->ResourceBarrier(1, &postCopyBarrier);
+}
+
 // Compute the average frames per second and million rays per second.
 void RTEngine::CalculateFrameStats()
 {
@@ -1619,7 +2303,7 @@ void RTEngine::CalculateFrameStats()
 // Handle OnSizeChanged message event.
 void RTEngine::OnSizeChanged(UINT width, UINT height, bool minimized)
 {
-	if (!m_deviceResources->WindowSizeChanged(width, height, minimized))
+	if (!m_deviceResources || !m_deviceResources->WindowSizeChanged(width, height, minimized))
 	{
 		return;
 	}
@@ -21,6 +21,9 @@
 #include "PerformanceTimers.h"
 #include "Material.h"
 #include "Sphere.h"
+#include "CpuMetaballs.h"
+#include "CpuPreview.h"
+#include "CpuScene.h"
 
 
 
@@ -42,6 +45,7 @@ public:
     virtual void OnSizeChanged(UINT width, UINT height, bool minimized);
     virtual void OnDestroy();
     virtual IDXGISwapChain* GetSwapchain() { return m_deviceResources->GetSwapChain(); }
+    virtual void ParseCommandLineArgs(WCHAR* argv[], int argc) override;
 
 private:
     enum class DemoType {
@@ -56,6 +60,9 @@ private:
     const UINT NUM_BLAS = 2;          // Triangle + AABB bottom-level AS.
     const float c_aabbWidth = 2;      // AABB width.
     const float c_aabbDistance = 2;   // Distance between AABBs.
+    const float c_sphereAABBSize = 3; // Edge of the cubic AABB around an analytic sphere.
+    const float c_movingSphereShutterTravel = 0.5f;  // Distance the MOVING sphere travels along z over the CPU shutter interval.
+    const UINT c_sceneSeed = 1;       // Seed of the random sphere placement, see Cpu::RandomStream.
     
     // DirectX Raytracing (DXR) attributes
     ComPtr<ID3D12Device5> m_dxrDevice;
@@ -78,8 +85,12 @@ private:
 
     // Root constants
     Material myMaterials[IntersectionShaderType::TotalPrimitiveCount];
-    MaterialConstantBuffer m_planeMaterialCB;
-    MaterialConstantBuffer m_aabbMaterialCB[IntersectionShaderType::TotalPrimitiveCount];
+    UINT m_planeMaterialIndex;
+    PrimitiveInstanceConstantBuffer m_aabbInstanceCB[IntersectionShaderType::TotalPrimitiveCount];
+
+    // Material table, deduplicated: primitives sharing a material share one entry.
+    std::vector<MaterialConstantBuffer> m_materials;
+    D3DBuffer m_materialBuffer;
 
     // Geometry
     D3DBuffer m_PlaneIndexBuffer;
@@ -122,9 +133,51 @@ private:
     XMVECTOR m_eye;
     XMVECTOR m_at;
     XMVECTOR m_up;
+    float m_fieldOfView = 20.0f;      // Vertical, in degrees.
     int numSpheres = 0;
 
+    // CPU backend
+    Cpu::Scene m_cpuScene;
+    bool m_runCpuBenchmark = false;
+    std::wstring m_metaballFile;
+    std::wstring m_sceneFile;         // -scene file, replaces the demo scenes.
+    std::wstring m_cpuImageFile;      // -cpuImage file the CPU backend renders the frame to.
+    UINT m_cpuSequenceFrames = 0;     // -cpuSequence frames the CPU backend renders the animation to, then exits.
+    std::wstring m_cpuSequenceFile;
+    std::wstring m_cpuDistributedFile;    // -cpuDistributed file worker processes render the frame to, then exits.
+    UINT m_cpuDistributedPort = 0;
+    UINT m_cpuDistributedWorkers = 0;     // Started on this machine, others can connect to the port.
+    std::string m_cpuWorkerHost;      // -cpuWorker coordinator this process renders tiles for, without a device, then exits.
+    UINT m_cpuWorkerPort = 0;
+    UINT m_cpuWorkerThreads = 0;      // 0 for all hardware threads.
+    UINT m_cpuServicePort = 0;        // -cpuService port this process serves render jobs on, without a device, until stopped.
+    UINT m_cpuServiceScenes = 0;      // Scenes the service keeps loaded.
+
+    // -cpuPreview: the window shows the CPU backend's coarse to fine preview instead of the GPU render.
+    // A thread of its own renders it whenever the camera changes, camera moves raise the cancel flag, so the
+    // preview in flight stops within a bounce and the next one starts on the new camera.
+    bool m_cpuPreview = false;
+    std::thread m_cpuPreviewThread;
+    std::atomic<bool> m_cpuPreviewCancel{ false };
+    std::mutex m_cpuPreviewMutex;                 // Guards the camera and the finished level.
+    std::condition_variable m_cpuPreviewCondition;
+    Cpu::Camera m_cpuPreviewCamera;
+    UINT m_cpuPreviewCameraVersion = 0;           // Incremented by each camera change.
+    bool m_cpuPreviewExit = false;
+    std::vector<UINT> m_cpuPreviewPixels;         // Latest completed level, RGBA8.
+    UINT m_cpuPreviewWidth = 0;
+    UINT m_cpuPreviewHeight = 0;
+    bool m_cpuPreviewUpdated = false;             // A level completed since OnRender() last uploaded one.
+    ComPtr<ID3D12Resource> m_cpuPreviewUpload[FrameCount];
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT m_cpuPreviewFootprint;
+    UINT m_cpuMovingSphere = UINT_MAX;    // Sphere index of the MOVING sphere in m_cpuScene, if the demo scene has it.
+    std::vector<Cpu::AnimatedMetaball> m_sceneMetaballs;
+
+    // Path tracing
+    UINT m_maxPathBounces = MAX_PATH_BOUNCES;
+
     void UpdateCameraMatrices();
+    XMMATRIX ProjectionToWorld(const XMVECTOR& eye, const XMVECTOR& at, const XMVECTOR& up) const;
     void UpdateMovingSphere(float animationTime);
     void UpdateAABBPrimitiveTransform(float animationTime);
     void InitializeScene();
@@ -132,6 +185,7 @@ private:
     void SetupLights();
     void SetupCamera();
     void RTTNWDemo();
+    void LoadSceneFile();
     void RTIAWRandomScene();
     void RecreateD3D();
     void DoRaytracing();
@@ -168,6 +222,20 @@ private:
     UINT AllocateDescriptor(D3D12_CPU_DESCRIPTOR_HANDLE* cpuDescriptor, UINT descriptorIndexToUse = UINT_MAX);
     UINT CreateBufferSRV(D3DBuffer* buffer, UINT numElements, UINT elementSize);
     void SetSphereGPU(Sphere* pSphere);
+    UINT AddMaterial(const MaterialConstantBuffer& material);
+    void CreateMaterialBuffer();
+    XMMATRIX GetPlaneInstanceTransform();
+    void RunCpuBenchmark();
+    void RenderCpuImage();
+    void RenderCpuSequence();
+    void RenderCpuDistributed();
+    void RunCpuWorker();
+    void RunCpuService();
+    void StartCpuPreview();
+    void StopCpuPreview();
+    void UpdateCpuPreviewCamera();
+    void CpuPreviewThreadMain(Cpu::Scene scene);
+    void CopyCpuPreviewToOutput();
 
 
     // Defined Albedos for testing
@@ -45,11 +45,35 @@ typedef UINT16 Index;
 #define LIMIT_TO_ACTIVE_METABALLS 0
 #endif
 
+// Field potential threshold defining the metaball isosurface.
+// Valid range is (0, 1>, the larger the threshold the smaller the blob.
+#define METABALL_THRESHOLD 0.25f
+
+// Step limit of the metaball isosurface search. Sphere tracing steps are at least
+// 1 / METABALL_MAX_STEPS of the marched segment, the crossing is then refined by bisection.
+#define METABALL_MAX_STEPS 128
+#define METABALL_BISECTION_STEPS 6
+
+// Largest slope of the quintic field function over distance, times the metaball radius:
+// d/dx (6x^5 - 15x^4 + 10x^3) = 30x^2 (1 - x)^2 peaks at x = 1/2.
+#define METABALL_FIELD_LIPSCHITZ 1.875f
+
 #define N_FRACTAL_ITERATIONS 4      // = <1,...>
 
 // PERFORMANCE TIP: Set max recursion depth as low as needed
 // as drivers may apply optimization strategies for low recursion depths.
-#define MAX_RAY_RECURSION_DEPTH 6    // ~ primary rays + reflections + shadow rays from reflected geometry.
+// Paths are traced iteratively by the raygen shader, only shadow rays are traced from closest hit shaders.
+#define MAX_RAY_RECURSION_DEPTH 2    // ~ primary and path continuation rays + shadow rays.
+
+// Default maximum number of path segments traced per pixel.
+#define MAX_PATH_BOUNCES 6
+
+// Paths may be terminated by Russian roulette after this many bounces.
+#define RUSSIAN_ROULETTE_MIN_BOUNCES 2
+
+// The GPU renders one sample per pixel per frame and doesn't accumulate frames, so the noise Russian roulette adds
+// is never averaged away. Its paths are only terminated by roulette beyond the default path length.
+#define GPU_RUSSIAN_ROULETTE_MIN_BOUNCES MAX_PATH_BOUNCES
 
 
 struct ProceduralPrimitiveAttributes
@@ -59,8 +83,12 @@ struct ProceduralPrimitiveAttributes
 
 struct RayPayload
 {
-    XMFLOAT4 color;
-    UINT   recursionDepth;
+    XMFLOAT4 color;             // Radiance of this path segment, excluding the continuation ray.
+    XMFLOAT3 nextOrigin;        // Continuation ray, traced by the raygen shader.
+    float    nextTMin;
+    XMFLOAT3 nextDirection;
+    UINT     recursionDepth;    // Path bounce index.
+    XMFLOAT3 nextThroughput;    // Weight of the continuation ray, zero ends the path.
 };
 
 struct ShadowRayPayload
@@ -77,9 +105,11 @@ struct SceneConstantBuffer
     XMVECTOR lightDiffuseColor;
     float    reflectance;
     float    elapsedTime;                 // Elapsed application time.
+    UINT     maxPathBounces;
+    UINT     russianRouletteMinBounces;
 };
 
-// Attributes per primitive type.
+// Material table entry, shared by all primitives using the material.
 struct MaterialConstantBuffer
 {
     XMFLOAT4 albedo;
@@ -88,11 +118,9 @@ struct MaterialConstantBuffer
     float specularCoef;
     float specularPower;
     float refractionIndex;
-    float radius; 
     float fuzz;
     int hasTexture;
     int hasPerlin;
-    XMFLOAT3 padding;
 };
 
 // Attributes per primitive instance.
@@ -100,6 +128,8 @@ struct PrimitiveInstanceConstantBuffer
 {
     UINT instanceIndex;  
     UINT primitiveType; // Procedural primitive type
+    UINT materialIndex; // Index into the material table.
+    float radius;       // Sphere radius in local space.
 };
 
 // Dynamic attributes per primitive instance.
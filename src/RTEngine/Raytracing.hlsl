@@ -35,8 +35,10 @@ StructuredBuffer<Vertex> g_vertices : register(t2, space0);
 
 // Procedural geometry resources
 StructuredBuffer<PrimitiveInstancePerFrameBuffer> g_AABBPrimitiveAttributes : register(t3, space0);
-ConstantBuffer<MaterialConstantBuffer> l_materialCB : register(b1);
-ConstantBuffer<PrimitiveInstanceConstantBuffer> l_aabbCB: register(b2);
+
+// Material table, indexed by l_primitiveCB.materialIndex.
+StructuredBuffer<MaterialConstantBuffer> g_materials : register(t4, space0);
+ConstantBuffer<PrimitiveInstanceConstantBuffer> l_primitiveCB : register(b1);
 
 
 //***************************************************************************
@@ -108,22 +110,17 @@ float4 CalculatePhongLighting(in float4 albedo, in float3 normal, in bool isInSh
 //***************************************************************************
 //*****------ TraceRay wrappers for radiance and shadow rays. -------********
 //***************************************************************************
-float4 TraceRadianceRay(in Ray ray, in UINT currentRayRecursionDepth)
+RayPayload TraceRadianceRay(in Ray ray, in float tMin, in UINT bounce)
 {
-    if (currentRayRecursionDepth >= MAX_RAY_RECURSION_DEPTH)
-    {
-        return float4(0, 0, 0, 1);
-    }
-
     // Set the ray's extents.
     RayDesc rayDesc;
     rayDesc.Origin = ray.origin;
     rayDesc.Direction = ray.direction;
     // Set TMin to a zero value to avoid aliasing artifacts along contact areas.
     // Note: make sure to enable face culling so as to avoid surface face fighting.
-    rayDesc.TMin = 0;
+    rayDesc.TMin = tMin;
     rayDesc.TMax = 10000;
-    RayPayload rayPayload = { float4(0, 0, 0, 0), currentRayRecursionDepth + 1 };
+    RayPayload rayPayload = { float4(0, 0, 0, 0), float3(0, 0, 0), 0, float3(0, 0, 0), bounce, float3(0, 0, 0) };
     TraceRay(g_scene,
         RAY_FLAG_CULL_BACK_FACING_TRIANGLES,
         TraceRayParameters::InstanceMask,
@@ -132,44 +129,12 @@ float4 TraceRadianceRay(in Ray ray, in UINT currentRayRecursionDepth)
         TraceRayParameters::MissShader::Offset[RayType::Radiance],
         rayDesc, rayPayload);
 
-    return rayPayload.color;
+    return rayPayload;
 }
 
-
-float4 TraceRadianceRayGlass(in Ray ray, in UINT currentRayRecursionDepth)
-{
-    if (currentRayRecursionDepth >= MAX_RAY_RECURSION_DEPTH)
-    {
-        return float4(0, 0, 0, 1);
-    }
-
-    // Set the ray's extents.
-    RayDesc rayDesc;
-    rayDesc.Origin = ray.origin;
-    rayDesc.Direction = ray.direction;
-    // Set TMin to a zero value to avoid aliasing artifacts along contact areas.
-    // Note: make sure to enable face culling so as to avoid surface face fighting.
-    rayDesc.TMin = 1;
-    rayDesc.TMax = 10000;
-    RayPayload rayPayload = { float4(0, 0, 0, 0), currentRayRecursionDepth + 1 };
-    TraceRay(g_scene,
-        RAY_FLAG_CULL_BACK_FACING_TRIANGLES,
-        TraceRayParameters::InstanceMask,
-        TraceRayParameters::HitGroup::Offset[RayType::Radiance],
-        TraceRayParameters::HitGroup::GeometryStride,
-        TraceRayParameters::MissShader::Offset[RayType::Radiance],
-        rayDesc, rayPayload);
-
-    return rayPayload.color;
-}
 // Trace a shadow ray and return true if it hits any geometry.
-bool TraceShadowRayAndReportIfHit(in Ray ray, in UINT currentRayRecursionDepth)
+bool TraceShadowRayAndReportIfHit(in Ray ray)
 {
-    if (currentRayRecursionDepth >= MAX_RAY_RECURSION_DEPTH)
-    {
-        return false;
-    }
-
     // Set the ray's extents.
     RayDesc rayDesc;
     rayDesc.Origin = ray.origin;
@@ -197,6 +162,15 @@ bool TraceShadowRayAndReportIfHit(in Ray ray, in UINT currentRayRecursionDepth)
     return shadowPayload.hit;
 }
 
+// Hand the reflected or refracted ray back to the raygen shader instead of tracing it recursively.
+void SetContinuationRay(inout RayPayload rayPayload, in float3 origin, in float3 direction, in float tMin, in float3 throughput)
+{
+    rayPayload.nextOrigin = origin;
+    rayPayload.nextDirection = direction;
+    rayPayload.nextTMin = tMin;
+    rayPayload.nextThroughput = throughput;
+}
+
 //***************************************************************************
 //********************------ Ray gen shader.. -------************************
 //***************************************************************************
@@ -206,13 +180,42 @@ void MyRaygenShader()
 {
     // Generate a ray for a camera pixel corresponding to an index from the dispatched 2D grid.
     Ray ray = GenerateCameraRay(DispatchRaysIndex().xy, g_sceneCB.cameraPosition.xyz, g_sceneCB.projectionToWorld);
- 
-    // Cast a ray into the scene and retrieve a shaded color.
-    UINT currentRecursionDepth = 0;
-    float4 color = TraceRadianceRay(ray, currentRecursionDepth);
+    float tMin = 0;
+
+    // Trace the path iteratively. Each closest hit shader returns the shaded segment and the
+    // continuation ray, the path throughput is carried here.
+    uint rngState = HashUint(DispatchRaysIndex().y * DispatchRaysDimensions().x + DispatchRaysIndex().x) ^ asuint(g_sceneCB.elapsedTime);
+    float3 throughput = float3(1, 1, 1);
+    float3 color = float3(0, 0, 0);
+    for (UINT bounce = 0; bounce < g_sceneCB.maxPathBounces; bounce++)
+    {
+        RayPayload rayPayload = TraceRadianceRay(ray, tMin, bounce);
+        color += throughput * rayPayload.color.rgb;
+        throughput *= rayPayload.nextThroughput;
+
+        // Russian roulette: low contribution paths survive with a probability proportional
+        // to their throughput, survivors are reweighted to keep the estimate unbiased.
+        float survivalProbability = saturate(max(throughput.x, max(throughput.y, throughput.z)));
+        if (bounce + 1 >= g_sceneCB.russianRouletteMinBounces)
+        {
+            if (RandomFloat01(rngState) >= survivalProbability)
+            {
+                break;
+            }
+            throughput /= survivalProbability;
+        }
+        else if (survivalProbability == 0)
+        {
+            break;
+        }
+
+        ray.origin = rayPayload.nextOrigin;
+        ray.direction = rayPayload.nextDirection;
+        tMin = rayPayload.nextTMin;
+    }
 
     // Write the raytraced color to the output texture.
-    g_renderTarget[DispatchRaysIndex().xy] = color;
+    g_renderTarget[DispatchRaysIndex().xy] = float4(color, 1);
 }
 
 //***************************************************************************
@@ -233,6 +236,7 @@ void MyClosestHitShader_Triangle(inout RayPayload rayPayload, in BuiltInTriangle
 
     // Retrieve corresponding vertex normals for the triangle vertices.
     float3 triangleNormal = g_vertices[indices[0]].normal;
+    MaterialConstantBuffer material = g_materials[l_primitiveCB.materialIndex];
 
     // PERFORMANCE TIP: it is recommended to avoid values carry over across TraceRay() calls. 
     // Therefore, in cases like retrieving HitWorldPosition(), it is recomputed every time.
@@ -241,32 +245,27 @@ void MyClosestHitShader_Triangle(inout RayPayload rayPayload, in BuiltInTriangle
     // Trace a shadow ray.
     float3 hitPosition = HitWorldPosition();
     Ray shadowRay = { hitPosition, normalize(g_sceneCB.lightPosition.xyz - hitPosition) };
-    bool shadowRayHit = TraceShadowRayAndReportIfHit(shadowRay, rayPayload.recursionDepth);
+    bool shadowRayHit = TraceShadowRayAndReportIfHit(shadowRay);
 
 //    float checkers = AnalyticalCheckersTexture(HitWorldPosition(), triangleNormal, g_sceneCB.cameraPosition.xyz, g_sceneCB.projectionToWorld);
 
-    // Reflected component.
-    float4 reflectedColor = float4(0, 0, 0, 0);
-    if (l_materialCB.reflectanceCoef > 0.001 )
+    // Reflected component, the reflection ray is traced by the raygen shader.
+    float3 reflectedWeight = float3(0, 0, 0);
+    if (material.reflectanceCoef > 0.001 )
     {
-        // Trace a reflection ray.
-        Ray reflectionRay = { HitWorldPosition(), reflect(WorldRayDirection(), triangleNormal) };
-        float4 reflectionColor = TraceRadianceRay(reflectionRay, rayPayload.recursionDepth);
-
-        float3 fresnelR = FresnelReflectanceSchlick(WorldRayDirection(), triangleNormal, l_materialCB.albedo.xyz);
-        reflectedColor = l_materialCB.reflectanceCoef * float4(fresnelR, 1) * reflectionColor;
+        float3 fresnelR = FresnelReflectanceSchlick(WorldRayDirection(), triangleNormal, material.albedo.xyz);
+        reflectedWeight = material.reflectanceCoef * fresnelR;
     }
 
     // Calculate final color.
-    float4 phongColor = CalculatePhongLighting(l_materialCB.albedo, triangleNormal, shadowRayHit, l_materialCB.diffuseCoef, l_materialCB.specularCoef, l_materialCB.specularPower);
-   // float4 color = checkers * (phongColor + reflectedColor);
-    float4 color = (phongColor + reflectedColor);
+    float4 phongColor = CalculatePhongLighting(material.albedo, triangleNormal, shadowRayHit, material.diffuseCoef, material.specularCoef, material.specularPower);
 
     // Apply visibility falloff.
     float t = RayTCurrent();
-    color = lerp(color, BackgroundColor, 1.0 - exp(-0.000002*t*t*t));
+    float falloff = 1.0 - exp(-0.000002*t*t*t);
 
-    rayPayload.color = color;
+    rayPayload.color = lerp(phongColor, BackgroundColor, falloff);
+    SetContinuationRay(rayPayload, hitPosition, reflect(WorldRayDirection(), triangleNormal), 0, reflectedWeight * (1 - falloff));
 }
 
 
@@ -275,65 +274,60 @@ void MyClosestHitShader_AABB(inout RayPayload rayPayload, in ProceduralPrimitive
 {
     // PERFORMANCE TIP: it is recommended to minimize values carry over across TraceRay() calls. 
     // Therefore, in cases like retrieving HitWorldPosition(), it is recomputed every time.
-    float4 color = float4 (1,1,1,1);
-    float4 reflectedColor = float4(0, 0, 0, 1);
     float3 hitPosition = HitWorldPosition();
+    MaterialConstantBuffer material = g_materials[l_primitiveCB.materialIndex];
 
     // Shadow component.
     // Trace a shadow ray.
     Ray shadowRay = { hitPosition, normalize(g_sceneCB.lightPosition.xyz - hitPosition) };
-    bool shadowRayHit = TraceShadowRayAndReportIfHit(shadowRay, rayPayload.recursionDepth);
-    float4 phongColor = CalculatePhongLighting(l_materialCB.albedo, attr.normal, shadowRayHit, l_materialCB.diffuseCoef, l_materialCB.specularCoef, l_materialCB.specularPower);
-
-    if(l_materialCB.refractionIndex == 0)
+    bool shadowRayHit = TraceShadowRayAndReportIfHit(shadowRay);
+    float4 phongColor = CalculatePhongLighting(material.albedo, attr.normal, shadowRayHit, material.diffuseCoef, material.specularCoef, material.specularPower);
+
+    // Reflected or refracted component, the secondary ray is traced by the raygen shader.
+    Ray secondaryRay = { hitPosition, float3(0, 0, 0) };
+    float secondaryTMin = 0;
+    float3 secondaryWeight = float3(0, 0, 0);
+    float3 fresnelR = FresnelReflectanceSchlick(WorldRayDirection(), attr.normal, material.albedo.xyz);
+    if(material.refractionIndex == 0)
     {
         float2 uv = float2(0, 1);
         float ranSeed = rnd(uv);
 
-        if (l_materialCB.reflectanceCoef > 0.001)
+        if (material.reflectanceCoef > 0.001)
         {        
              // Reflection calculations for metals        
-	         Ray reflectionRay = { HitWorldPosition(), reflect(WorldRayDirection(), attr.normal) };
-             Ray scattered = {HitWorldPosition(), reflect(WorldRayDirection(), attr.normal) * l_materialCB.fuzz*randomInUnitSphere(ranSeed)};
-             float4 reflectionColor = TraceRadianceRay(scattered, rayPayload.recursionDepth);
-	         float3 fresnelR = FresnelReflectanceSchlick(WorldRayDirection(), attr.normal, l_materialCB.albedo.xyz);
-             reflectedColor = l_materialCB.reflectanceCoef * float4(fresnelR, 1) * reflectionColor;
+             secondaryRay.direction = reflect(WorldRayDirection(), attr.normal) * material.fuzz*randomInUnitSphere(ranSeed);
+             secondaryWeight = material.reflectanceCoef * fresnelR;
         }
-
-        color = phongColor + reflectedColor; 
     }
     else
     {
         // glass shading
-	    Ray reflectionRay = { hitPosition, refractSH(WorldRayDirection(), attr.normal, l_materialCB.refractionIndex) };
-	    float4 reflectionColor = TraceRadianceRayGlass(reflectionRay, rayPayload.recursionDepth);
-	    float3 fresnelR = FresnelReflectanceSchlick(WorldRayDirection(), attr.normal, l_materialCB.albedo.xyz);
-	    reflectedColor = l_materialCB.reflectanceCoef * float4(fresnelR, 1) * reflectionColor;
-        color = phongColor + reflectedColor;
+        secondaryRay.direction = refractSH(WorldRayDirection(), attr.normal, material.refractionIndex);
+        secondaryTMin = 1;
+        secondaryWeight = material.reflectanceCoef * fresnelR;
     }
 
-    if(l_materialCB.hasTexture)
+    float4 color = phongColor;
+    if(material.hasTexture)
     {
         // Add on checker pattern 
         float2 uv = get_sphere_uv(HitWorldPosition());
         float4 checkers = getCheckerColor(uv.x, uv.y, HitWorldPosition());
-        color = checkers* phongColor + reflectedColor;
+        color = checkers* phongColor;
     }
 
-    if(l_materialCB.hasPerlin)
+    if(material.hasPerlin)
     {
-        // TODO add on perlin noise 
-        float2 uv = get_sphere_uv(HitWorldPosition());
-        float scale = 3;
-        float3 perlin = noise(HitWorldPosition(), scale);
-        float4 perlin4 = float4(perlin.x, perlin.y, perlin.z, 1);
-        color = perlin4 + phongColor + reflectedColor;
+        float perlin = Turbulence(HitWorldPosition() * PERLIN_SCALE, PERLIN_OCTAVES);
+        color = float4(perlin, perlin, perlin, 1) + phongColor;
     }
     
     // Apply visibility falloff.
     float t = RayTCurrent();
-    color = lerp(color, BackgroundColor, 1.0 - exp(-0.000002*t*t*t));
-    rayPayload.color = color;
+    float falloff = 1.0 - exp(-0.000002*t*t*t);
+    rayPayload.color = lerp(color, BackgroundColor, falloff);
+    SetContinuationRay(rayPayload, secondaryRay.origin, secondaryRay.direction, secondaryTMin, secondaryWeight * (1 - falloff));
 }
 
 
@@ -346,6 +340,7 @@ void MyMissShader(inout RayPayload rayPayload)
 {
     float4 backgroundColor = float4(BackgroundColor);
     rayPayload.color = backgroundColor;
+    rayPayload.nextThroughput = float3(0, 0, 0);
 }
 
 [shader("miss")]
@@ -361,7 +356,7 @@ void MyMissShader_ShadowRay(inout ShadowRayPayload rayPayload)
 // Get ray in AABB's local space.
 Ray GetRayInAABBPrimitiveLocalSpace()
 {
-    PrimitiveInstancePerFrameBuffer attr = g_AABBPrimitiveAttributes[l_aabbCB.instanceIndex];
+    PrimitiveInstancePerFrameBuffer attr = g_AABBPrimitiveAttributes[l_primitiveCB.instanceIndex];
 
     // Retrieve a ray origin position and direction in bottom level AS space 
     // and transform them into the AABB primitive's local space.
@@ -376,14 +371,14 @@ Ray GetRayInAABBPrimitiveLocalSpace()
 //void MyIntersectionShader_AnalyticPrimitive()
 //{
 //    Ray localRay = GetRayInAABBPrimitiveLocalSpace();
-//    AnalyticPrimitive::Enum primitiveType = (AnalyticPrimitive::Enum) l_aabbCB.primitiveType;
+//    AnalyticPrimitive::Enum primitiveType = (AnalyticPrimitive::Enum) l_primitiveCB.primitiveType;
 
 //    float thit;
 //    ProceduralPrimitiveAttributes attr;
 //    if (RayAnalyticGeometryIntersectionTest(localRay, primitiveType, thit, attr))
 //  //  if (RaySphereGeometryIntersectionTest(localRay, thit, attr))
 //    {
-//        PrimitiveInstancePerFrameBuffer aabbAttribute = g_AABBPrimitiveAttributes[l_aabbCB.instanceIndex];
+//        PrimitiveInstancePerFrameBuffer aabbAttribute = g_AABBPrimitiveAttributes[l_primitiveCB.instanceIndex];
 //        attr.normal = mul(attr.normal, (float3x3) aabbAttribute.localSpaceToBottomLevelAS);
 //        attr.normal = normalize(mul((float3x3) ObjectToWorld3x4(), attr.normal));
 
@@ -399,9 +394,9 @@ void MyIntersectionShader_AnalyticPrimitiveSphere()
     float thit;
     ProceduralPrimitiveAttributes attr;   
 
-    if (RaySphereGeometryIntersectionTest(localRay, thit, attr, l_materialCB.radius))
+    if (RaySphereGeometryIntersectionTest(localRay, thit, attr, l_primitiveCB.radius))
     {
-        PrimitiveInstancePerFrameBuffer aabbAttribute = g_AABBPrimitiveAttributes[l_aabbCB.instanceIndex];
+        PrimitiveInstancePerFrameBuffer aabbAttribute = g_AABBPrimitiveAttributes[l_primitiveCB.instanceIndex];
         attr.normal = mul(attr.normal, (float3x3) aabbAttribute.localSpaceToBottomLevelAS);
         attr.normal = normalize(mul((float3x3) ObjectToWorld3x4(), attr.normal));
         ReportHit(thit, /*hitKind*/ 0, attr);
@@ -412,13 +407,13 @@ void MyIntersectionShader_AnalyticPrimitiveSphere()
 void MyIntersectionShader_VolumetricPrimitive()
 {
     Ray localRay = GetRayInAABBPrimitiveLocalSpace();
-    VolumetricPrimitive::Enum primitiveType = (VolumetricPrimitive::Enum) l_aabbCB.primitiveType;
+    VolumetricPrimitive::Enum primitiveType = (VolumetricPrimitive::Enum) l_primitiveCB.primitiveType;
     
     float thit;
     ProceduralPrimitiveAttributes attr;
     if (RayVolumetricGeometryIntersectionTest(localRay, primitiveType, thit, attr, g_sceneCB.elapsedTime))
     {
-        PrimitiveInstancePerFrameBuffer aabbAttribute = g_AABBPrimitiveAttributes[l_aabbCB.instanceIndex];
+        PrimitiveInstancePerFrameBuffer aabbAttribute = g_AABBPrimitiveAttributes[l_primitiveCB.instanceIndex];
         attr.normal = mul(attr.normal, (float3x3) aabbAttribute.localSpaceToBottomLevelAS);
         attr.normal = normalize(mul((float3x3) ObjectToWorld3x4(), attr.normal));
 
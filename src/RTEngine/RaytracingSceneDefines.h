@@ -22,6 +22,7 @@ namespace GlobalRootSignature {
             AccelerationStructure,
             SceneConstant,
             AABBattributeBuffer,
+            MaterialBuffer,
             VertexBuffers,
             Count
         };
@@ -42,12 +43,12 @@ namespace LocalRootSignature {
     namespace Triangle {
         namespace Slot {
             enum Enum {
-                MaterialConstant = 0,
+                PrimitiveConstant = 0,
                 Count
             };
         }
         struct RootArguments {
-            MaterialConstantBuffer materialCb;
+            PrimitiveInstanceConstantBuffer primitiveCB;
         };
     }
 }
@@ -56,14 +57,12 @@ namespace LocalRootSignature {
     namespace AABB {
         namespace Slot {
             enum Enum {
-                MaterialConstant = 0,
-                GeometryIndex,
+                PrimitiveConstant = 0,
                 Count
             };
         }
         struct RootArguments {
-            MaterialConstantBuffer materialCb;
-            PrimitiveInstanceConstantBuffer aabbCB;
+            PrimitiveInstanceConstantBuffer primitiveCB;
         };
     }
 }
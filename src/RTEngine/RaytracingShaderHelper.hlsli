@@ -13,6 +13,7 @@
 #define RAYTRACINGSHADERHELPER_H
 
 #include "RayTracingHlslCompat.h"
+#include "PerlinNoiseTables.h"
 
 #define INFINITY (1.0/0.0)
 
@@ -45,6 +46,24 @@ float rnd2(float2 uv)
     return frac(sin(dot(uv.xy, float2(12.9898, 78.233))) * 43758.5453);
 }
 
+// Integer hash, used to seed per pixel random number streams.
+uint HashUint(uint x)
+{
+    x = (x ^ 61) ^ (x >> 16);
+    x *= 9;
+    x = x ^ (x >> 4);
+    x *= 0x27d4eb2d;
+    x = x ^ (x >> 15);
+    return x;
+}
+
+// Returns a random number in <0, 1) and advances the state.
+float RandomFloat01(inout uint state)
+{
+    state = state * 1664525u + 1013904223u;
+    return (HashUint(state) >> 8) * (1.0 / 16777216.0);
+}
+
 float3 randomFloat3(float seed) 
 {
   float2 seed0 = float2(0,seed);
@@ -53,53 +72,59 @@ float3 randomFloat3(float seed)
   return float3(rnd2(seed0), rnd2(seed1), rnd2(seed2));
 }
 
-float trilinearInterp(double c[2][2][2], double u, double v, double w) {
-    float accum = 0.0;
-    for (int i = 0; i < 2; i++)
-    {
-        for (int j = 0; j < 2; j++) {
-            for (int k = 0; k < 2; k++)
-            {
-                accum += (i * u + (1 - i) * (1 - u)) *
-                    (j * v + (1 - j) * (1 - v)) *
-                    (k * w + (1 - k) * (1 - w)) * c[i][j][k];
-            }
-        }
-    }
+// Hashes of the lattice corners of the cell i (each component in 0..255), indexed by x + 2y + 4z.
+void PerlinCornerHashes(uint3 i, out uint hashes[8])
+{
+    uint a = c_perlinPermutation[i.x] + i.y;
+    uint b = c_perlinPermutation[(i.x + 1) & 255] + i.y;
+    uint aa = c_perlinPermutation[a & 255] + i.z;
+    uint ab = c_perlinPermutation[(a + 1) & 255] + i.z;
+    uint ba = c_perlinPermutation[b & 255] + i.z;
+    uint bb = c_perlinPermutation[(b + 1) & 255] + i.z;
+    hashes[0] = c_perlinPermutation[aa & 255];
+    hashes[1] = c_perlinPermutation[ba & 255];
+    hashes[2] = c_perlinPermutation[ab & 255];
+    hashes[3] = c_perlinPermutation[bb & 255];
+    hashes[4] = c_perlinPermutation[(aa + 1) & 255];
+    hashes[5] = c_perlinPermutation[(ba + 1) & 255];
+    hashes[6] = c_perlinPermutation[(ab + 1) & 255];
+    hashes[7] = c_perlinPermutation[(bb + 1) & 255];
+}
 
-    return accum;
+float PerlinGradient(uint hash, float3 d)
+{
+    return dot(c_perlinGradients[hash & 15], d);
 }
 
-float noise(float3 p, float scale)  
+// Improved gradient noise in <-1, 1>, with precomputed permutation and gradient tables.
+float PerlinNoise(float3 p)
 {
-   p *= scale;
-   float u = p.x - floor(p.x);
-   float v = p.y - floor(p.y);
-   float w = p.z - floor(p.z);
-
-   //Hermitian smoothing
-   u = u * u * (3 - 2 * u);
-   v = v * v * (3 - 2 * v);
-   w = w * w * (3 - 2 * w);
-
-   int i = floor(p.x);
-   int j = floor(p.y);
-   int k = floor(p.z);
-
-   double c[2][2][2];
-
-   for (int di = 0; di < 2; di++) {
-       for (int dj = 0; dj < 2; dj++) {
-           for (int dk = 0; dk < 2; dk++) {
-               float perm_x = rnd2(float2(0, i+di));
-               float perm_y = rnd2(float2(0, j+dj));
-               float perm_z = rnd2(float2(0, k+dk));
-               float3 rand = randomFloat3(perm_x * perm_y * perm_z);
-               c[di][dj][dk] = rand.x;
-           }
-       }
-   }
-   return trilinearInterp(c,u,v,w);
+    float3 cell = floor(p);
+    float3 d = p - cell;
+    uint hashes[8];
+    PerlinCornerHashes(uint3(int3(cell) & 255), hashes);
+
+    float3 f = d * d * d * (d * (d * 6 - 15) + 10);
+    return lerp(
+        lerp(lerp(PerlinGradient(hashes[0], d), PerlinGradient(hashes[1], d - float3(1, 0, 0)), f.x),
+             lerp(PerlinGradient(hashes[2], d - float3(0, 1, 0)), PerlinGradient(hashes[3], d - float3(1, 1, 0)), f.x), f.y),
+        lerp(lerp(PerlinGradient(hashes[4], d - float3(0, 0, 1)), PerlinGradient(hashes[5], d - float3(1, 0, 1)), f.x),
+             lerp(PerlinGradient(hashes[6], d - float3(0, 1, 1)), PerlinGradient(hashes[7], d - float3(1, 1, 1)), f.x), f.y),
+        f.z);
+}
+
+// Sum of |noise| over octaves of doubling frequency and halving weight.
+float Turbulence(float3 p, uint octaves)
+{
+    float accum = 0;
+    float weight = 1;
+    for (uint i = 0; i < octaves; i++)
+    {
+        accum += weight * abs(PerlinNoise(p));
+        weight *= 0.5;
+        p *= 2;
+    }
+    return accum;
 }
 
 float lengthSquared(float3 myVec){
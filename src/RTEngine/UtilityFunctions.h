@@ -6,31 +6,41 @@
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include "CpuRandom.h"
 
 
-inline double random_double() {
+// Random numbers for scene generation. They come from a caller's stream rather than rand(), which shares
+// one locked state across threads, so every object can draw from a stream of its own and objects can be
+// generated in any order, or in parallel, with the same result.
+inline double random_double(Cpu::RandomStream& rng) {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    return rng.NextDouble();
 }
 
-inline static double random_double(double min, double max) {
+inline static double random_double(Cpu::RandomStream& rng, double min, double max) {
     // Returns a random real in [min,max).
-    return min + (max - min) * random_double();
+    return rng.NextDouble(min, max);
 }
 
 
-inline static XMFLOAT4 random() {
-    return XMFLOAT4(random_double(), random_double(), random_double(), 1);
+inline static XMFLOAT4 random(Cpu::RandomStream& rng) {
+    float x = static_cast<float>(random_double(rng));
+    float y = static_cast<float>(random_double(rng));
+    float z = static_cast<float>(random_double(rng));
+    return XMFLOAT4(x, y, z, 1);
 }
 
-inline static XMFLOAT4 random(double min, double max) {
+inline static XMFLOAT4 random(Cpu::RandomStream& rng, double min, double max) {
     // Returns a random real in [min,max).
-    return XMFLOAT4(random_double(min, max), random_double(min, max), random_double(min, max), 1);
+    float x = static_cast<float>(random_double(rng, min, max));
+    float y = static_cast<float>(random_double(rng, min, max));
+    float z = static_cast<float>(random_double(rng, min, max));
+    return XMFLOAT4(x, y, z, 1);
 }
 
-inline int random_int(int min, int max) {
+inline int random_int(Cpu::RandomStream& rng, int min, int max) {
     // Returns a random integer in [min,max].
-    return static_cast<int>(random_double(min, max + 1));
+    return static_cast<int>(random_double(rng, min, max + 1));
 }
 
 double length_squared(XMFLOAT3 myVec) {
@@ -23,6 +23,7 @@
 
 
 #include "RaytracingShaderHelper.hlsli"
+#include "MetaballKeyFrames.h"
 
 struct Metaball
 {
@@ -30,93 +31,78 @@ struct Metaball
     float  radius;
 };
 
-// Calculate a magnitude of an influence from a Metaball charge.
+// Calculate a magnitude of an influence from a Metaball charge, and its gradient.
 // Return metaball potential range: <0,1>
 // mbRadius - largest possible area of metaball contribution - AKA its bounding sphere.
-float CalculateMetaballPotential(in float3 position, in Metaball blob, out float distance)
+float CalculateMetaballPotential(in float3 position, in Metaball blob, out float3 gradient)
 {
-    distance = length(position - blob.center);
+    float3 offset = position - blob.center;
+    float distance = length(offset);
+    gradient = float3(0, 0, 0);
     
     if (distance <= blob.radius)
     {
-        float d = distance;
-
         // Quintic polynomial field function.
         // The advantage of this polynomial is having smooth second derivative. Not having a smooth
         // second derivative may result in a sharp and visually unpleasant normal vector jump.
         // The field function should return 1 at distance 0 from a center, and 1 at radius distance,
         // but this one gives f(0) = 0, f(radius) = 1, so we use the distance to radius instead.
-        d = blob.radius - d;
+        float x = (blob.radius - distance) / blob.radius;
 
-        float r = blob.radius;
-        return 6 * (d*d*d*d*d) / (r*r*r*r*r)
-            - 15 * (d*d*d*d) / (r*r*r*r)
-            + 10 * (d*d*d) / (r*r*r);
+        // d/d(distance) of the field function is -30x^2 (1 - x)^2 / radius, pointing away from the center.
+        // It vanishes at the center, where the direction is undefined.
+        if (distance > 0)
+        {
+            float xx = x * (1 - x);
+            gradient = (-30 * xx * xx / (blob.radius * distance)) * offset;
+        }
+        return x * x * x * (x * (x * 6 - 15) + 10);
     }
     return 0;
 }
 
-// Calculate field potential from all active metaballs.
-float CalculateMetaballsPotential(in float3 position, in Metaball blobs[N_METABALLS], in UINT nActiveMetaballs)
+// Calculate field potential and its gradient from all active metaballs.
+float CalculateMetaballsPotential(in float3 position, in Metaball blobs[N_METABALLS], in UINT nActiveMetaballs, out float3 gradient)
 {
     float sumFieldPotential = 0;
+    gradient = float3(0, 0, 0);
 #if USE_DYNAMIC_LOOPS 
     for (UINT j = 0; j < nActiveMetaballs; j++)
 #else
     for (UINT j = 0; j < N_METABALLS; j++)
 #endif
     {
-        float dummy;
-        sumFieldPotential += CalculateMetaballPotential(position, blobs[j], dummy);
+        float3 blobGradient;
+        sumFieldPotential += CalculateMetaballPotential(position, blobs[j], blobGradient);
+        gradient += blobGradient;
     }
     return sumFieldPotential;
 }
 
-// Calculate a normal via central differences.
-float3 CalculateMetaballsNormal(in float3 position, in Metaball blobs[N_METABALLS], in UINT nActiveMetaballs)
+// Upper bound of the field potential slope along the ray, per unit of t.
+// Metaballs the ray doesn't intersect contribute nothing along it, so only the active ones count.
+float CalculateMetaballsLipschitzBound(in Ray ray, in Metaball blobs[N_METABALLS], in UINT nActiveMetaballs)
 {
-    float e = 0.5773 * 0.00001;
-    return normalize(float3(
-        CalculateMetaballsPotential(position + float3(-e, 0, 0), blobs, nActiveMetaballs) -
-        CalculateMetaballsPotential(position + float3(e, 0, 0), blobs, nActiveMetaballs),
-        CalculateMetaballsPotential(position + float3(0, -e, 0), blobs, nActiveMetaballs) -
-        CalculateMetaballsPotential(position + float3(0, e, 0), blobs, nActiveMetaballs),
-        CalculateMetaballsPotential(position + float3(0, 0, -e), blobs, nActiveMetaballs) -
-        CalculateMetaballsPotential(position + float3(0, 0, e), blobs, nActiveMetaballs)));
+    float bound = 0;
+#if USE_DYNAMIC_LOOPS 
+    for (UINT j = 0; j < nActiveMetaballs; j++)
+#else
+    for (UINT j = 0; j < N_METABALLS; j++)
+#endif
+    {
+        bound += METABALL_FIELD_LIPSCHITZ / blobs[j].radius;
+    }
+    return bound * length(ray.direction);
 }
 
 void InitializeAnimatedMetaballs(out Metaball blobs[N_METABALLS], in float elapsedTime, in float cycleDuration)
 {
-    // Metaball centers at t0 and t1 key frames.
-#if N_METABALLS == 5
-    float3 keyFrameCenters[N_METABALLS][2] =
-    {
-        { float3(-0.7, 0, 0),float3(0.7,0, 0) },
-        { float3(0.7 , 0, 0), float3(-0.7, 0, 0) },
-        { float3(0, -0.7, 0),float3(0, 0.7, 0) },
-        { float3(0, 0.7, 0), float3(0, -0.7, 0) },
-        { float3(0, 0, 0),   float3(0, 0, 0) }
-    };
-    // Metaball field radii of max influence
-    float radii[N_METABALLS] = { 0.35, 0.35, 0.35, 0.35, 0.25 };
-#else
-    float3 keyFrameCenters[N_METABALLS][2] =
-    {
-        //{ float3(-0.3, -0.3, -0.4),float3(0.3,-0.3,-0.0) },
-       { float3(-0.3, -0.2, -0.2), float3(0.4, 0.4, 0.0) },
-        { float3(0.0, -0.2, 0.5), float3(0.0, 0.4, 0.5) },
-        { float3(0.4,0.4, 0.4), float3(-0.4, 0.2, -0.4) }
-    };
-    // Metaball field radii of max influence
-    float radii[N_METABALLS] = { 0.45, 0.65, 0.45 };
-#endif
-
     // Calculate animated metaball center positions.
     float  tAnimate = CalculateAnimationInterpolant(elapsedTime, cycleDuration);
     for (UINT j = 0; j < N_METABALLS; j++)
     {
-        blobs[j].center = lerp(keyFrameCenters[j][0], keyFrameCenters[j][1], tAnimate);
-        blobs[j].radius = radii[j];
+        blobs[j].center = lerp(c_metaballKeyFrame0[j], c_metaballKeyFrame1[j], tAnimate);
+        blobs[j].radius = c_metaballRadii[j];
     }
 }
 
@@ -148,7 +134,10 @@ void FindIntersectingMetaballs(in Ray ray, out float tmin, out float tmax, inout
 }
 
 // Test if a ray with RayFlags and segment <RayTMin(), RayTCurrent()> intersects metaball field.
-// The test sphere traces through the metaball field until it hits a threshold isosurface. 
+// The test sphere traces through the metaball field until it hits a threshold isosurface:
+// the field can't reach the threshold closer than the potential gap over the field's slope bound,
+// so each step skips that far. The crossing is then refined by bisection.
+// The normal is the field gradient, accumulated by the same potential evaluations.
 bool RayMetaballsIntersectionTest(in Ray ray, out float thit, out ProceduralPrimitiveAttributes attr, in float elapsedTime)
 {
     Metaball blobs[N_METABALLS];
@@ -157,46 +146,58 @@ bool RayMetaballsIntersectionTest(in Ray ray, out float thit, out ProceduralPrim
     float tmin, tmax;   // Ray extents to first and last metaball intersections.
     UINT nActiveMetaballs = 0;  // Number of metaballs's that the ray intersects.
     FindIntersectingMetaballs(ray, tmin, tmax, blobs, nActiveMetaballs);
+    if (tmin > tmax)
+    {
+        return false;
+    }
 
-    UINT MAX_STEPS = 128;
+    float lipschitzBound = CalculateMetaballsLipschitzBound(ray, blobs, nActiveMetaballs);
+    float minTStep = (tmax - tmin) / METABALL_MAX_STEPS;
+    float tPrevious = tmin;
     float t = tmin;
-    float minTStep = (tmax - tmin) / (MAX_STEPS / 1);
-    UINT iStep = 0;
 
-    while (iStep++ < MAX_STEPS)
+    for (UINT iStep = 0; iStep < METABALL_MAX_STEPS; iStep++)
     {
-        float3 position = ray.origin + t * ray.direction;
-        float fieldPotentials[N_METABALLS];    // Field potentials for each metaball.
-        float sumFieldPotential = 0;           // Sum of all metaball field potentials.
-            
-        // Calculate field potentials from all metaballs.
-#if USE_DYNAMIC_LOOPS
-        for (UINT j = 0; j < nActiveMetaballs; j++)
-#else
-        for (UINT j = 0; j < N_METABALLS; j++)
-#endif
-        {
-            float distance;
-            fieldPotentials[j] = CalculateMetaballPotential(position, blobs[j], distance);
-            sumFieldPotential += fieldPotentials[j];
-         }
-
-        // Field potential threshold defining the isosurface.
-        // Threshold - valid range is (0, 1>, the larger the threshold the smaller the blob.
-        const float Threshold = 0.25f;
+        float3 gradient;
+        float sumFieldPotential = CalculateMetaballsPotential(ray.origin + t * ray.direction, blobs, nActiveMetaballs, gradient);
 
         // Have we crossed the isosurface?
-        if (sumFieldPotential >= Threshold)
+        if (sumFieldPotential >= METABALL_THRESHOLD)
         {
-            float3 normal = CalculateMetaballsNormal(position, blobs, nActiveMetaballs);
-            if (IsAValidHit(ray, t, normal))
+            // Bisect the last step down to the crossing.
+            float tOutside = tPrevious;
+            float tInside = t;
+            for (UINT i = 0; i < METABALL_BISECTION_STEPS; i++)
             {
-                thit = t;
+                float tMid = 0.5f * (tOutside + tInside);
+                float3 midGradient;
+                if (CalculateMetaballsPotential(ray.origin + tMid * ray.direction, blobs, nActiveMetaballs, midGradient) >= METABALL_THRESHOLD)
+                {
+                    tInside = tMid;
+                    gradient = midGradient;
+                }
+                else
+                {
+                    tOutside = tMid;
+                }
+            }
+
+            // The field decreases outwards, so the normal is the negated gradient at the hit.
+            float3 normal = normalize(-gradient);
+            if (IsAValidHit(ray, tInside, normal))
+            {
+                thit = tInside;
                 attr.normal = normal;
                 return true;
             }
         }
-        t += minTStep;
+
+        if (t >= tmax)
+        {
+            break;
+        }
+        tPrevious = t;
+        t = min(t + max(abs(METABALL_THRESHOLD - sumFieldPotential) / lipschitzBound, minTStep), tmax);
     }
 
     return false;
@@ -28,8 +28,19 @@ class HrException : public std::runtime_error
         sprintf_s(s_str, "HRESULT of 0x%08X", static_cast<UINT>(hr));
         return std::string(s_str);
     }
+    // The messages are ASCII.
+    inline std::string HrToString(HRESULT hr, const wchar_t* msg)
+    {
+        std::string text;
+        for (; *msg; msg++)
+        {
+            text += *msg < 0x80 ? static_cast<char>(*msg) : '?';
+        }
+        return text + " (" + HrToString(hr) + ")";
+    }
 public:
     HrException(HRESULT hr) : std::runtime_error(HrToString(hr)), m_hr(hr) {}
+    HrException(HRESULT hr, const wchar_t* msg) : std::runtime_error(HrToString(hr, msg)), m_hr(hr) {}
     HRESULT Error() const { return m_hr; }
 private:
     const HRESULT m_hr;
@@ -50,7 +61,7 @@ inline void ThrowIfFailed(HRESULT hr, const wchar_t* msg)
     if (FAILED(hr))
     {
         OutputDebugString(msg);
-        throw HrException(hr);
+        throw HrException(hr, msg);
     }
 }
 